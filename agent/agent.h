@@ -104,6 +104,10 @@ struct
   unsigned long max_cache_ttl;     /* Default. */
   unsigned long max_cache_ttl_ssh; /* for SSH. */
 
+  /* The number of seconds unprotected private keys are cached or 0
+     to disable that cache.  */
+  unsigned long unprotected_key_cache_ttl;
+
   /* Flag disallowing bypassing of the warning.  */
   int enforce_passphrase_constraints;
 
@@ -315,6 +319,17 @@ cache_mode_t;
 typedef int (*lookup_ttl_t)(const char *hexgrip);
 
 
+/* Information about a key file used to detect changes of that
+   file.  */
+typedef struct
+{
+  unsigned long long dev;
+  unsigned long long ino;
+  unsigned long long size;
+  time_t mtime;
+} key_file_stamp_t;
+
+
 /* This is a special version of the usual _() gettext macro.  It
    assumes a server connection control variable with the name "ctrl"
    and uses that to translate a string according to the locale set for
@@ -348,6 +363,7 @@ gpg_error_t agent_copy_startup_env (ctrl_t ctrl);
 const char *get_agent_socket_name (void);
 const char *get_agent_ssh_socket_name (void);
 int get_agent_active_connection_count (void);
+char *get_agent_worker_stats (void);
 #ifdef HAVE_W32_SYSTEM
 void *get_agent_scd_notify_event (void);
 #endif
@@ -447,6 +463,41 @@ int agent_put_cache (const char *key, cache_mode_t cache_mode,
                      const char *data, int ttl);
 char *agent_get_cache (const char *key, cache_mode_t cache_mode);
 void agent_store_cache_hit (const char *key);
+void agent_put_key_cache (const unsigned char *grip,
+                          const key_file_stamp_t *stamp, int is_protected,
+                          const unsigned char *key, size_t keylen);
+gpg_error_t agent_get_key_cache (const unsigned char *grip,
+                                 const key_file_stamp_t *stamp,
+                                 int *r_is_protected,
+                                 unsigned char **r_key, size_t *r_keylen);
+void agent_flush_key_cache (const unsigned char *grip);
+
+/*-- stats.c --*/
+/* Counters kept by stats.c.  */
+typedef enum
+  {
+    STATS_CACHE_HIT,        /* Passphrase found in the cache.  */
+    STATS_CACHE_MISS,       /* Passphrase not in the cache.  */
+    STATS_KEY_CACHE_HIT,    /* Unprotected key found in the cache.  */
+    STATS_KEY_CACHE_MISS,   /* Unprotected key not in the cache.  */
+    STATS_N_COUNTERS
+  } stats_counter_t;
+
+/* Timed operations kept by stats.c.  */
+typedef enum
+  {
+    STATS_KEYFILE_LOAD,     /* Reading and parsing a key file.  */
+    STATS_KEY_UNPROTECT,    /* Unprotecting a key.  */
+    STATS_SCD_OP,           /* An operation of the SCdaemon.  */
+    STATS_N_TIMERS
+  } stats_timer_t;
+
+void agent_stats_count (stats_counter_t counter);
+void agent_stats_begin (struct timespec *r_start);
+void agent_stats_end (stats_timer_t timer, const struct timespec *start);
+void agent_stats_end_command (const char *name, const struct timespec *start);
+void agent_stats_reset (void);
+char *agent_stats_string (void);
 
 
 /*-- pksign.c --*/
@@ -458,6 +509,11 @@ int agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
 int agent_pksign (ctrl_t ctrl, const char *cache_nonce,
                   const char *desc_text,
                   membuf_t *outbuf, cache_mode_t cache_mode);
+gpg_error_t agent_pksign_batch (ctrl_t ctrl, const char *cache_nonce,
+                                const char *desc_text,
+                                const unsigned char *hashes, size_t hashlen,
+                                unsigned int nhashes,
+                                membuf_t *outbuf, cache_mode_t cache_mode);
 
 /*-- pkdecrypt.c --*/
 int agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
@@ -52,22 +52,64 @@ struct secret_data_s {
 
 typedef struct cache_item_s *ITEM;
 struct cache_item_s {
-  ITEM next;
+  ITEM next;         /* Next item in the same hash bucket.  */
   time_t created;
   time_t accessed;
+  time_t deadline;   /* Next time housekeeping needs to look at it.  */
+  int heapidx;       /* Index into EXPIRY_HEAP or -1 if not in the heap. */
   int ttl;  /* max. lifetime given in seconds, -1 one means infinite */
   struct secret_data_s *pw;
   cache_mode_t cache_mode;
   char key[1];
 };
 
-/* The cache himself.  */
-static ITEM thecache;
+/* The initial number of buckets of the cache.  */
+#define CACHE_INITIAL_BUCKETS 64
+
+/* The cache himself.  This is a hash table indexed by the key; items
+ * with the same key are kept in the order they have been inserted,
+ * most recent first.  THECACHE_SIZE is a power of 2.  */
+static ITEM *thecache;
+static unsigned int thecache_size;
+static unsigned int thecache_count;
+
+/* A min-heap of all items with a deadline, ordered by the deadline.
+ * This allows housekeeping to find the items which need to be
+ * expired without looking at all items.  */
+static ITEM *expiry_heap;
+static unsigned int expiry_heap_count;
+static unsigned int expiry_heap_size;
+
+/* The values of the max-cache-ttl options used to compute the
+ * deadlines.  */
+static unsigned long deadline_max_cache_ttl;
+static unsigned long deadline_max_cache_ttl_ssh;
 
 /* NULL or the last cache key stored by agent_store_cache_hit.  */
 static char *last_stored_cache_key;
 
 
+/* The cache of unprotected private keys.  */
+#define KEY_CACHE_BUCKETS 256
+
+typedef struct key_cache_item_s *KEY_ITEM;
+struct key_cache_item_s {
+  KEY_ITEM next;         /* Next item in the same hash bucket.  */
+  KEY_ITEM older;        /* Doubly linked list sorted by age.  */
+  KEY_ITEM newer;
+  time_t created;
+  key_file_stamp_t stamp;
+  int is_protected;      /* The key file is passphrase protected.  */
+  unsigned char grip[20];
+  size_t keylen;
+  unsigned char *key;    /* The canonical S-expression in secure memory.  */
+};
+
+static KEY_ITEM key_cache[KEY_CACHE_BUCKETS];
+static KEY_ITEM key_cache_oldest;
+static KEY_ITEM key_cache_newest;
+
+
 /* This function must be called once to initialize this module. It
    has to be done before a second thread is spawned.  */
 void
@@ -189,71 +231,376 @@ new_data (const char *string, struct secret_data_s **r_data)
 
 
 
+/* Return the bucket for KEY.  */
+static ITEM *
+cache_bucket (const char *key)
+{
+  unsigned int hash = 0;
+
+  for (; *key; key++)
+    hash = hash * 33 + *(const unsigned char *)key;
+  return thecache + (hash & (thecache_size - 1));
+}
+
+
+/* Grow the hash table if needed.  Errors are ignored because the
+ * table still works if it is too small.  */
+static void
+maybe_grow_cache (void)
+{
+  ITEM *old, *bucket, r, rnext, rev;
+  unsigned int i, oldsize;
+  unsigned int newsize;
+
+  if (thecache && thecache_count < 2 * thecache_size)
+    return;
+
+  newsize = thecache? 2 * thecache_size : CACHE_INITIAL_BUCKETS;
+  old = thecache;
+  oldsize = thecache_size;
+  thecache = xtrycalloc (newsize, sizeof *thecache);
+  if (!thecache)
+    {
+      thecache = old;
+      return;
+    }
+  thecache_size = newsize;
+
+  for (i = 0; i < oldsize; i++)
+    {
+      /* Reverse the chain so that pushing the items to the new
+       * buckets keeps their order.  */
+      for (rev = NULL, r = old[i]; r; r = rnext)
+        {
+          rnext = r->next;
+          r->next = rev;
+          rev = r;
+        }
+      for (r = rev; r; r = rnext)
+        {
+          rnext = r->next;
+          bucket = cache_bucket (r->key);
+          r->next = *bucket;
+          *bucket = r;
+        }
+    }
+  xfree (old);
+}
+
+
+/* Return the max-cache-ttl for an item with CACHE_MODE.  */
+static unsigned long
+max_cache_ttl (cache_mode_t cache_mode)
+{
+  switch (cache_mode)
+    {
+    case CACHE_MODE_SSH: return opt.max_cache_ttl_ssh;
+    default: return opt.max_cache_ttl;
+    }
+}
+
+
+/* Compute the time when housekeeping needs to look at R again and
+ * store it at R_DEADLINE.  Returns false if housekeeping never needs
+ * to look at R.  */
+static int
+compute_deadline (ITEM r, time_t *r_deadline)
+{
+  time_t deadline, t;
+
+  if (r->pw)
+    {
+      deadline = r->created + max_cache_ttl (r->cache_mode) + 1;
+      if (r->ttl >= 0)
+        {
+          t = r->accessed + r->ttl + 1;
+          if (t < deadline)
+            deadline = t;
+        }
+    }
+  else if (r->ttl >= 0)
+    deadline = r->accessed + 60*30 + 1;
+  else
+    return 0;
+
+  *r_deadline = deadline;
+  return 1;
+}
+
+
+/* Helpers to maintain the expiry heap.  */
+static void
+heap_set (unsigned int idx, ITEM r)
+{
+  expiry_heap[idx] = r;
+  r->heapidx = idx;
+}
+
+static void
+heap_sift_up (unsigned int idx)
+{
+  ITEM r = expiry_heap[idx];
+  unsigned int parent;
+
+  while (idx)
+    {
+      parent = (idx - 1) / 2;
+      if (expiry_heap[parent]->deadline <= r->deadline)
+        break;
+      heap_set (idx, expiry_heap[parent]);
+      idx = parent;
+    }
+  heap_set (idx, r);
+}
+
+static void
+heap_sift_down (unsigned int idx)
+{
+  ITEM r = expiry_heap[idx];
+  unsigned int child;
+
+  for (;;)
+    {
+      child = 2 * idx + 1;
+      if (child >= expiry_heap_count)
+        break;
+      if (child + 1 < expiry_heap_count
+          && expiry_heap[child + 1]->deadline < expiry_heap[child]->deadline)
+        child++;
+      if (r->deadline <= expiry_heap[child]->deadline)
+        break;
+      heap_set (idx, expiry_heap[child]);
+      idx = child;
+    }
+  heap_set (idx, r);
+}
+
+static void
+heap_remove (ITEM r)
+{
+  unsigned int idx = r->heapidx;
+  ITEM last;
+
+  if (r->heapidx < 0)
+    return;
+  r->heapidx = -1;
+
+  last = expiry_heap[--expiry_heap_count];
+  if (last == r)
+    return;
+  heap_set (idx, last);
+  heap_sift_up (idx);
+  heap_sift_down (last->heapidx);
+}
+
+
+/* Make sure that there is space in the heap for one more item.  */
+static gpg_error_t
+heap_reserve (void)
+{
+  ITEM *tmp;
+  unsigned int newsize;
+
+  if (expiry_heap_count < expiry_heap_size)
+    return 0;
+
+  newsize = expiry_heap_size? 2 * expiry_heap_size : CACHE_INITIAL_BUCKETS;
+  tmp = xtryrealloc (expiry_heap, newsize * sizeof *expiry_heap);
+  if (!tmp)
+    return gpg_error_from_syserror ();
+  expiry_heap = tmp;
+  expiry_heap_size = newsize;
+  return 0;
+}
+
+
+/* Recompute the deadline of R after it has been changed and update
+ * its position in the heap.  The caller must have made sure that
+ * there is space in the heap using heap_reserve.  */
+static void
+update_deadline (ITEM r)
+{
+  time_t deadline;
+
+  if (!compute_deadline (r, &deadline))
+    heap_remove (r);
+  else if (r->heapidx < 0)
+    {
+      log_assert (expiry_heap_count < expiry_heap_size);
+      r->deadline = deadline;
+      heap_set (expiry_heap_count++, r);
+      heap_sift_up (r->heapidx);
+    }
+  else if (deadline != r->deadline)
+    {
+      r->deadline = deadline;
+      heap_sift_up (r->heapidx);
+      heap_sift_down (r->heapidx);
+    }
+}
+
+
+/* Remove R from the cache and release it.  */
+static void
+remove_item (ITEM r)
+{
+  ITEM *rp;
+
+  for (rp = cache_bucket (r->key); *rp; rp = &(*rp)->next)
+    if (*rp == r)
+      {
+        *rp = r->next;
+        break;
+      }
+  thecache_count--;
+  heap_remove (r);
+  if (r->pw)
+    release_data (r->pw);
+  xfree (r);
+}
+
+
+/* The deadlines depend on the max-cache-ttl options.  If they have
+ * been changed, recompute all deadlines.  */
+static void
+check_deadline_options (void)
+{
+  unsigned int i;
+
+  if (deadline_max_cache_ttl == opt.max_cache_ttl
+      && deadline_max_cache_ttl_ssh == opt.max_cache_ttl_ssh)
+    return;
+  deadline_max_cache_ttl = opt.max_cache_ttl;
+  deadline_max_cache_ttl_ssh = opt.max_cache_ttl_ssh;
+
+  /* All items are in the heap except those which don't expire;
+   * those do not depend on the options.  */
+  for (i = 0; i < expiry_heap_count; i++)
+    compute_deadline (expiry_heap[i], &expiry_heap[i]->deadline);
+  for (i = expiry_heap_count / 2; i-- > 0; )
+    heap_sift_down (i);
+}
+
+
+/* Remove R from the key cache and release it.  */
+static void
+drop_key_item (KEY_ITEM r)
+{
+  KEY_ITEM *rp;
+
+  for (rp = &key_cache[r->grip[0]]; *rp; rp = &(*rp)->next)
+    if (*rp == r)
+      {
+        *rp = r->next;
+        break;
+      }
+  if (r->older)
+    r->older->newer = r->newer;
+  else
+    key_cache_oldest = r->newer;
+  if (r->newer)
+    r->newer->older = r->older;
+  else
+    key_cache_newest = r->older;
+
+  wipememory (r->key, r->keylen);
+  xfree (r->key);
+  xfree (r);
+}
+
+
+/* Return the key cache item for GRIP or NULL.  */
+static KEY_ITEM
+find_key_item (const unsigned char *grip)
+{
+  KEY_ITEM r;
+
+  for (r = key_cache[grip[0]]; r; r = r->next)
+    if (!memcmp (r->grip, grip, 20))
+      return r;
+  return NULL;
+}
+
+
+/* Remove the unprotected key for the passphrase cache item R.  This
+ * is called when the passphrase for R is removed so that an
+ * unprotected key does not stay in memory longer than needed.  */
+static void
+drop_key_item_for (ITEM r)
+{
+  unsigned char grip[20];
+  KEY_ITEM k;
+
+  if (!key_cache_oldest)
+    return;
+  if (strlen (r->key) != 40 || hex2bin (r->key, grip, 20) < 0)
+    return;  /* Not a keygrip.  */
+  k = find_key_item (grip);
+  if (k)
+    drop_key_item (k);
+}
+
+
 /* Check whether there are items to expire.  */
 static void
 housekeeping (void)
 {
-  ITEM r, rprev;
+  ITEM r;
   time_t current = gnupg_get_time ();
 
-  /* First expire the actual data */
-  for (r=thecache; r; r = r->next)
+  check_deadline_options ();
+
+  /* All cached keys have the same TTL; thus the oldest expire first.  */
+  while (key_cache_oldest
+         && (key_cache_oldest->created + (time_t)opt.unprotected_key_cache_ttl
+             < current))
     {
+      if (DBG_CACHE)
+        log_debug ("  expired cached key\n");
+      drop_key_item (key_cache_oldest);
+    }
+
+  while (expiry_heap_count && expiry_heap[0]->deadline <= current)
+    {
+      r = expiry_heap[0];
+
+      /* First expire the actual data */
       if (r->pw && r->ttl >= 0 && r->accessed + r->ttl < current)
         {
           if (DBG_CACHE)
             log_debug ("  expired '%s' (%ds after last access)\n",
                        r->key, r->ttl);
+          drop_key_item_for (r);
           release_data (r->pw);
           r->pw = NULL;
           r->accessed = current;
         }
-    }
 
-  /* Second, make sure that we also remove them based on the created stamp so
-     that the user has to enter it from time to time. */
-  for (r=thecache; r; r = r->next)
-    {
-      unsigned long maxttl;
-
-      switch (r->cache_mode)
-        {
-        case CACHE_MODE_SSH: maxttl = opt.max_cache_ttl_ssh; break;
-        default: maxttl = opt.max_cache_ttl; break;
-        }
-      if (r->pw && r->created + maxttl < current)
+      /* Second, make sure that we also remove them based on the
+         created stamp so that the user has to enter it from time to
+         time. */
+      if (r->pw && r->created + max_cache_ttl (r->cache_mode) < current)
         {
           if (DBG_CACHE)
             log_debug ("  expired '%s' (%lus after creation)\n",
                        r->key, opt.max_cache_ttl);
+          drop_key_item_for (r);
           release_data (r->pw);
           r->pw = NULL;
           r->accessed = current;
         }
-    }
 
-  /* Third, make sure that we don't have too many items in the list.
-     Expire old and unused entries after 30 minutes */
-  for (rprev=NULL, r=thecache; r; )
-    {
+      /* Third, make sure that we don't have too many items in the
+         list.  Expire old and unused entries after 30 minutes */
       if (!r->pw && r->ttl >= 0 && r->accessed + 60*30 < current)
         {
-          ITEM r2 = r->next;
           if (DBG_CACHE)
             log_debug ("  removed '%s' (mode %d) (slot not used for 30m)\n",
                        r->key, r->cache_mode);
-          xfree (r);
-          if (!rprev)
-            thecache = r2;
-          else
-            rprev->next = r2;
-          r = r2;
+          remove_item (r);
         }
       else
-        {
-          rprev = r;
-          r = r->next;
-        }
+        update_deadline (r);  /* Always later than CURRENT.  */
     }
 }
 
@@ -262,6 +609,7 @@ void
 agent_flush_cache (void)
 {
   ITEM r;
+  unsigned int i;
   int res;
 
   if (DBG_CACHE)
@@ -271,17 +619,21 @@ agent_flush_cache (void)
   if (res)
     log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
 
-  for (r=thecache; r; r = r->next)
-    {
-      if (r->pw)
-        {
-          if (DBG_CACHE)
-            log_debug ("  flushing '%s'\n", r->key);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = 0;
-        }
-    }
+  for (i=0; i < thecache_size; i++)
+    for (r=thecache[i]; r; r = r->next)
+      {
+        if (r->pw)
+          {
+            if (DBG_CACHE)
+              log_debug ("  flushing '%s'\n", r->key);
+            release_data (r->pw);
+            r->pw = NULL;
+            r->accessed = 0;
+            update_deadline (r);
+          }
+      }
+  while (key_cache_oldest)
+    drop_key_item (key_cache_oldest);
 
   res = npth_mutex_unlock (&cache_lock);
   if (res)
@@ -333,7 +685,15 @@ agent_put_cache (const char *key, cache_mode_t cache_mode,
   if ((!ttl && data) || cache_mode == CACHE_MODE_IGNORE)
     goto out;
 
-  for (r=thecache; r; r = r->next)
+  /* Make sure that the item can be put into the expiry heap.  */
+  if (data && (err = heap_reserve ()))
+    {
+      log_error ("error inserting cache item: %s\n", gpg_strerror (err));
+      goto out;
+    }
+
+  r = thecache? *cache_bucket (key) : NULL;
+  for (; r; r = r->next)
     {
       if (((cache_mode != CACHE_MODE_USER
             && cache_mode != CACHE_MODE_NONCE)
@@ -345,6 +705,7 @@ agent_put_cache (const char *key, cache_mode_t cache_mode,
     {
       if (r->pw)
         {
+          drop_key_item_for (r);
           release_data (r->pw);
           r->pw = NULL;
         }
@@ -357,16 +718,19 @@ agent_put_cache (const char *key, cache_mode_t cache_mode,
           if (err)
             log_error ("error replacing cache item: %s\n", gpg_strerror (err));
         }
+      update_deadline (r);
     }
   else if (data) /* Insert.  */
     {
-      r = xtrycalloc (1, sizeof *r + strlen (key));
+      maybe_grow_cache ();
+      r = thecache? xtrycalloc (1, sizeof *r + strlen (key)) : NULL;
       if (!r)
         err = gpg_error_from_syserror ();
       else
         {
           strcpy (r->key, key);
           r->created = r->accessed = gnupg_get_time ();
+          r->heapidx = -1;
           r->ttl = ttl;
           r->cache_mode = cache_mode;
           err = new_data (data, &r->pw);
@@ -374,8 +738,12 @@ agent_put_cache (const char *key, cache_mode_t cache_mode,
             xfree (r);
           else
             {
-              r->next = thecache;
-              thecache = r;
+              ITEM *bucket = cache_bucket (key);
+
+              r->next = *bucket;
+              *bucket = r;
+              thecache_count++;
+              update_deadline (r);
             }
         }
       if (err)
@@ -424,7 +792,8 @@ agent_get_cache (const char *key, cache_mode_t cache_mode)
                last_stored? " (stored cache key)":"");
   housekeeping ();
 
-  for (r=thecache; r; r = r->next)
+  r = thecache? *cache_bucket (key) : NULL;
+  for (; r; r = r->next)
     {
       if (r->pw
           && ((cache_mode != CACHE_MODE_USER
@@ -434,6 +803,7 @@ agent_get_cache (const char *key, cache_mode_t cache_mode)
         {
           /* Note: To avoid races KEY may not be accessed anymore below.  */
           r->accessed = gnupg_get_time ();
+          update_deadline (r);
           if (DBG_CACHE)
             log_debug ("... hit\n");
           if (r->pw->totallen < 32)
@@ -460,6 +830,7 @@ agent_get_cache (const char *key, cache_mode_t cache_mode)
     }
   if (DBG_CACHE && value == NULL)
     log_debug ("... miss\n");
+  agent_stats_count (value? STATS_CACHE_HIT : STATS_CACHE_MISS);
 
  out:
   res = npth_mutex_unlock (&cache_lock);
@@ -502,3 +873,140 @@ agent_store_cache_hit (const char *key)
 
   xfree (old);
 }
+
+
+/* Store the unprotected private key KEY of length KEYLEN with the
+ * keygrip GRIP in the cache of unprotected keys.  STAMP describes
+ * the key file the key was read from.  IS_PROTECTED tells whether
+ * that file is protected by a passphrase.  Does nothing if that
+ * cache is disabled.  */
+void
+agent_put_key_cache (const unsigned char *grip, const key_file_stamp_t *stamp,
+                     int is_protected,
+                     const unsigned char *key, size_t keylen)
+{
+  KEY_ITEM r;
+  int res;
+
+  if (!opt.unprotected_key_cache_ttl)
+    return;
+
+  res = npth_mutex_lock (&cache_lock);
+  if (res)
+    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+
+  r = find_key_item (grip);
+  if (r)
+    drop_key_item (r);
+
+  r = xtrycalloc (1, sizeof *r);
+  if (r)
+    r->key = xtrymalloc_secure (keylen);
+  if (!r || !r->key)
+    {
+      log_error ("error inserting key cache item: %s\n",
+                 gpg_strerror (gpg_error_from_syserror ()));
+      xfree (r);
+      goto out;
+    }
+  memcpy (r->grip, grip, 20);
+  r->stamp = *stamp;
+  r->is_protected = is_protected;
+  r->created = gnupg_get_time ();
+  memcpy (r->key, key, keylen);
+  r->keylen = keylen;
+
+  r->next = key_cache[grip[0]];
+  key_cache[grip[0]] = r;
+  r->older = key_cache_newest;
+  if (key_cache_newest)
+    key_cache_newest->newer = r;
+  else
+    key_cache_oldest = r;
+  key_cache_newest = r;
+
+ out:
+  res = npth_mutex_unlock (&cache_lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+}
+
+
+/* Look up the unprotected key with the keygrip GRIP in the cache.
+ * STAMP describes the current key file; if it does not match the
+ * cached item, the item is removed.  On success a copy of the key in
+ * secure memory is stored at R_KEY and its length at R_KEYLEN, and
+ * R_IS_PROTECTED is set as given to agent_put_key_cache.  Returns
+ * GPG_ERR_NOT_FOUND if the key is not cached.  */
+gpg_error_t
+agent_get_key_cache (const unsigned char *grip, const key_file_stamp_t *stamp,
+                     int *r_is_protected,
+                     unsigned char **r_key, size_t *r_keylen)
+{
+  gpg_error_t err;
+  KEY_ITEM r;
+  int res;
+
+  *r_key = NULL;
+  *r_keylen = 0;
+
+  if (!opt.unprotected_key_cache_ttl)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+
+  res = npth_mutex_lock (&cache_lock);
+  if (res)
+    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+
+  housekeeping ();
+
+  r = find_key_item (grip);
+  if (r && (r->stamp.dev != stamp->dev
+            || r->stamp.ino != stamp->ino
+            || r->stamp.size != stamp->size
+            || r->stamp.mtime != stamp->mtime))
+    {
+      if (DBG_CACHE)
+        log_debug ("agent_get_key_cache: key file changed\n");
+      drop_key_item (r);
+      r = NULL;
+    }
+  if (!r)
+    err = gpg_error (GPG_ERR_NOT_FOUND);
+  else if (!(*r_key = xtrymalloc_secure (r->keylen)))
+    err = gpg_error_from_syserror ();
+  else
+    {
+      memcpy (*r_key, r->key, r->keylen);
+      *r_keylen = r->keylen;
+      *r_is_protected = r->is_protected;
+      err = 0;
+    }
+
+  res = npth_mutex_unlock (&cache_lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+
+  return err;
+}
+
+
+/* Remove the key with the keygrip GRIP from the cache of unprotected
+ * keys.  */
+void
+agent_flush_key_cache (const unsigned char *grip)
+{
+  KEY_ITEM r;
+  int res;
+
+  res = npth_mutex_lock (&cache_lock);
+  if (res)
+    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+
+  r = find_key_item (grip);
+  if (r)
+    drop_key_item (r);
+
+  res = npth_mutex_unlock (&cache_lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+}
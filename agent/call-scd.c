@@ -64,6 +64,7 @@ struct scd_local_s
                            used with this connection. */
   int locked;           /* This flag is used to assert proper use of
                            start_scd and unlock_scd. */
+  struct timespec op_start; /* Time start_scd was called.  */
 
 };
 
@@ -176,6 +177,8 @@ unlock_scd (ctrl_t ctrl, int rc)
       if (!rc)
         rc = gpg_error (GPG_ERR_INTERNAL);
     }
+  else
+    agent_stats_end (STATS_SCD_OP, &ctrl->scd_local->op_start);
   ctrl->scd_local->locked = 0;
   return rc;
 }
@@ -233,6 +236,7 @@ start_scd (ctrl_t ctrl)
       return gpg_error (GPG_ERR_INTERNAL);
     }
   ctrl->scd_local->locked++;
+  agent_stats_begin (&ctrl->scd_local->op_start);
 
   if (ctrl->scd_local->ctx)
     return 0; /* Okay, the context is fine.  We used to test for an
@@ -46,6 +46,8 @@
 
 /* Maximum allowed size of the inquired ciphertext.  */
 #define MAXLEN_CIPHERTEXT 4096
+/* Maximum allowed size of the inquired list of hash values.  */
+#define MAXLEN_HASHVALS 65536
 /* Maximum allowed size of the key parameters.  */
 #define MAXLEN_KEYPARAM 1024
 /* Maximum allowed size of key data as used in inquiries (bytes). */
@@ -106,6 +108,9 @@ struct server_local_s
   /* Client is aware of the error code GPG_ERR_FULLY_CANCELED.  */
   int allow_fully_canceled;
 
+  /* The time the current command was started.  */
+  struct timespec cmd_start;
+
   /* Last CACHE_NONCE sent as status (malloced).  */
   char *last_cache_nonce;
 
@@ -693,6 +698,34 @@ cmd_setkeydesc (assuan_context_t ctx, char *line)
 }
 
 
+/* Parse the --hash=<name> option in LINE.  Returns the algorithm
+   number, 0 if the option was not given, or -1 if the name is not
+   known.  */
+static int
+parse_hash_option (const char *line)
+{
+  if (!has_option_name (line, "--hash"))
+    return 0;
+  if (has_option (line, "--hash=sha1"))
+    return GCRY_MD_SHA1;
+  if (has_option (line, "--hash=sha224"))
+    return GCRY_MD_SHA224;
+  if (has_option (line, "--hash=sha256"))
+    return GCRY_MD_SHA256;
+  if (has_option (line, "--hash=sha384"))
+    return GCRY_MD_SHA384;
+  if (has_option (line, "--hash=sha512"))
+    return GCRY_MD_SHA512;
+  if (has_option (line, "--hash=rmd160"))
+    return GCRY_MD_RMD160;
+  if (has_option (line, "--hash=md5"))
+    return GCRY_MD_MD5;
+  if (has_option (line, "--hash=tls-md5sha1"))
+    return MD_USER_TLS_MD5SHA1;
+  return -1;
+}
+
+
 static const char hlp_sethash[] =
   "SETHASH (--hash=<name>)|(<algonumber>) <hexstring>\n"
   "\n"
@@ -711,29 +744,9 @@ cmd_sethash (assuan_context_t ctx, char *line)
 
   /* Parse the alternative hash options which may be used instead of
      the algo number.  */
-  if (has_option_name (line, "--hash"))
-    {
-      if (has_option (line, "--hash=sha1"))
-        algo = GCRY_MD_SHA1;
-      else if (has_option (line, "--hash=sha224"))
-        algo = GCRY_MD_SHA224;
-      else if (has_option (line, "--hash=sha256"))
-        algo = GCRY_MD_SHA256;
-      else if (has_option (line, "--hash=sha384"))
-        algo = GCRY_MD_SHA384;
-      else if (has_option (line, "--hash=sha512"))
-        algo = GCRY_MD_SHA512;
-      else if (has_option (line, "--hash=rmd160"))
-        algo = GCRY_MD_RMD160;
-      else if (has_option (line, "--hash=md5"))
-        algo = GCRY_MD_MD5;
-      else if (has_option (line, "--hash=tls-md5sha1"))
-        algo = MD_USER_TLS_MD5SHA1;
-      else
-        return set_error (GPG_ERR_ASS_PARAMETER, "invalid hash algorithm");
-    }
-  else
-    algo = 0;
+  algo = parse_hash_option (line);
+  if (algo < 0)
+    return set_error (GPG_ERR_ASS_PARAMETER, "invalid hash algorithm");
 
   line = skip_options (line);
 
@@ -818,6 +831,101 @@ cmd_pksign (assuan_context_t ctx, char *line)
 }
 
 
+static const char hlp_pksign_batch[] =
+  "PKSIGN_BATCH --hash=<name> [<cache_nonce>]\n"
+  "\n"
+  "Sign a list of hash values with the key set by SIGKEY.  The\n"
+  "hash values are requested by the inquiry HASHVALS and are sent\n"
+  "back to back in binary form; all must have the length of the\n"
+  "algorithm given with --hash.  The secret key is read and unprotected\n"
+  "only once.  The concatenated signatures are returned as canonical\n"
+  "S-expressions in the same order as the hash values.";
+static gpg_error_t
+cmd_pksign_batch (assuan_context_t ctx, char *line)
+{
+  gpg_error_t err;
+  cache_mode_t cache_mode = CACHE_MODE_NORMAL;
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  membuf_t outbuf;
+  char *cache_nonce = NULL;
+  unsigned char *value = NULL;
+  size_t valuelen;
+  size_t hashlen;
+  int algo;
+  char *p;
+
+  algo = parse_hash_option (line);
+  if (algo < 0)
+    {
+      err = set_error (GPG_ERR_ASS_PARAMETER, "invalid hash algorithm");
+      goto leave;
+    }
+  if (!algo)
+    {
+      err = set_error (GPG_ERR_ASS_PARAMETER, "option --hash is required");
+      goto leave;
+    }
+  hashlen = (algo == MD_USER_TLS_MD5SHA1)? 36 : gcry_md_get_algo_dlen (algo);
+  if (!hashlen)
+    {
+      err = set_error (GPG_ERR_UNSUPPORTED_ALGORITHM, NULL);
+      goto leave;
+    }
+
+  line = skip_options (line);
+  for (p=line; *p && *p != ' ' && *p != '\t'; p++)
+    ;
+  *p = '\0';
+  if (*line)
+    {
+      cache_nonce = xtrystrdup (line);
+      if (!cache_nonce)
+        {
+          err = out_of_core ();
+          goto leave;
+        }
+    }
+
+  err = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u", MAXLEN_HASHVALS);
+  if (!err)
+    err = assuan_inquire (ctx, "HASHVALS",
+                          &value, &valuelen, MAXLEN_HASHVALS);
+  if (err)
+    goto leave;
+  if (!valuelen || (valuelen % hashlen))
+    {
+      err = set_error (GPG_ERR_INV_LENGTH, "invalid length of hash list");
+      goto leave;
+    }
+
+  ctrl->digest.algo = algo;
+  ctrl->digest.raw_value = 0;
+  ctrl->digest.valuelen = 0;
+
+  if (opt.ignore_cache_for_signing)
+    cache_mode = CACHE_MODE_IGNORE;
+  else if (!ctrl->server_local->use_cache_for_signing)
+    cache_mode = CACHE_MODE_IGNORE;
+
+  init_membuf (&outbuf, 512);
+
+  err = agent_pksign_batch (ctrl, cache_nonce, ctrl->server_local->keydesc,
+                            value, hashlen, valuelen / hashlen,
+                            &outbuf, cache_mode);
+  if (err)
+    clear_outbuf (&outbuf);
+  else
+    err = write_and_clear_outbuf (ctx, &outbuf);
+
+ leave:
+  xfree (value);
+  xfree (cache_nonce);
+  xfree (ctrl->server_local->keydesc);
+  ctrl->server_local->keydesc = NULL;
+  return leave_cmd (ctx, err);
+}
+
+
 static const char hlp_pkdecrypt[] =
   "PKDECRYPT [<options>]\n"
   "\n"
@@ -2852,6 +2960,10 @@ static const char hlp_getinfo[] =
   "  cmd_has_option\n"
   "              - Returns OK if the command CMD implements the option OPT.\n"
   "  connections - Return number of active connections.\n"
+  "  worker_stats - Return statistics about the connection workers.\n"
+  "  stats [--reset]\n"
+  "              - Return performance counters and latency histograms.\n"
+  "                With --reset all values are cleared afterwards.\n"
   "  restricted  - Returns OK if the connection is in restricted mode.\n";
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
@@ -2992,6 +3104,32 @@ cmd_getinfo (assuan_context_t ctx, char *line)
                 get_agent_active_connection_count ());
       rc = assuan_send_data (ctx, numbuf, strlen (numbuf));
     }
+  else if (!strcmp (line, "stats") || !strcmp (line, "stats --reset"))
+    {
+      char *string = agent_stats_string ();
+
+      if (!string)
+        rc = gpg_error_from_syserror ();
+      else
+        {
+          rc = assuan_send_data (ctx, string, strlen (string));
+          xfree (string);
+          if (line[5])
+            agent_stats_reset ();
+        }
+    }
+  else if (!strcmp (line, "worker_stats"))
+    {
+      char *string = get_agent_worker_stats ();
+
+      if (!string)
+        rc = gpg_error_from_syserror ();
+      else
+        {
+          rc = assuan_send_data (ctx, string, strlen (string));
+          xfree (string);
+        }
+    }
   else
     rc = set_error (GPG_ERR_ASS_PARAMETER, "unknown value for WHAT");
   return rc;
@@ -3102,6 +3240,19 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
 
 
 
+/* Called by libassuan before all commands.  */
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *cmd)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  (void)cmd;
+
+  agent_stats_begin (&ctrl->server_local->cmd_start);
+  return 0;
+}
+
+
 /* Called by libassuan after all commands. ERR is the error from the
    last assuan operation and not the one returned from the command. */
 static void
@@ -3111,6 +3262,9 @@ post_cmd_notify (assuan_context_t ctx, gpg_error_t err)
 
   (void)err;
 
+  agent_stats_end_command (assuan_get_command_name (ctx),
+                           &ctrl->server_local->cmd_start);
+
   /* Switch off any I/O monitor controlled logging pausing. */
   ctrl->server_local->pause_io_logging = 0;
 }
@@ -3199,6 +3353,7 @@ register_commands (assuan_context_t ctx)
     { "SETKEYDESC",     cmd_setkeydesc,hlp_setkeydesc },
     { "SETHASH",        cmd_sethash,   hlp_sethash },
     { "PKSIGN",         cmd_pksign,    hlp_pksign },
+    { "PKSIGN_BATCH",   cmd_pksign_batch, hlp_pksign_batch },
     { "PKDECRYPT",      cmd_pkdecrypt, hlp_pkdecrypt },
     { "GENKEY",         cmd_genkey,    hlp_genkey },
     { "READKEY",        cmd_readkey,   hlp_readkey },
@@ -3235,6 +3390,7 @@ register_commands (assuan_context_t ctx)
       if (rc)
         return rc;
     }
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
   assuan_register_post_cmd_notify (ctx, post_cmd_notify);
   assuan_register_reset_notify (ctx, reset_notify);
   assuan_register_option_handler (ctx, option_handler);
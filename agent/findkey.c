@@ -152,6 +152,10 @@ agent_write_private_key (const unsigned char *grip,
   fname = make_filename (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR,
                          hexgrip, NULL);
 
+  /* The file may be updated in place; thus the file stamp may not
+     change.  */
+  agent_flush_key_cache (grip);
+
   /* FIXME: Write to a temp file first so that write failures during
      key updates won't lead to a key loss.  */
 
@@ -255,6 +259,23 @@ agent_write_private_key (const unsigned char *grip,
 }
 
 
+/* Wrapper around agent_unprotect which records the time taken.  */
+static gpg_error_t
+timed_unprotect (ctrl_t ctrl, const unsigned char *protectedkey,
+                 const char *passphrase, gnupg_isotime_t protected_at,
+                 unsigned char **result, size_t *resultlen)
+{
+  gpg_error_t err;
+  struct timespec start;
+
+  agent_stats_begin (&start);
+  err = agent_unprotect (ctrl, protectedkey, passphrase, protected_at,
+                         result, resultlen);
+  agent_stats_end (STATS_KEY_UNPROTECT, &start);
+  return err;
+}
+
+
 /* Callback function to try the unprotection from the passphrase query
    code. */
 static gpg_error_t
@@ -270,7 +291,7 @@ try_unprotect_cb (struct pin_entry_info_s *pi)
   assert (!arg->unprotected_key);
 
   arg->change_required = 0;
-  err = agent_unprotect (ctrl, arg->protected_key, pi->pin, protected_at,
+  err = timed_unprotect (ctrl, arg->protected_key, pi->pin, protected_at,
                          &arg->unprotected_key, &dummy);
   if (err)
     return err;
@@ -514,7 +535,7 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
       pw = agent_get_cache (cache_nonce, CACHE_MODE_NONCE);
       if (pw)
         {
-          rc = agent_unprotect (ctrl, *keybuf, pw, NULL, &result, &resultlen);
+          rc = timed_unprotect (ctrl, *keybuf, pw, NULL, &result, &resultlen);
           if (!rc)
             {
               if (r_passphrase)
@@ -539,7 +560,7 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
       pw = agent_get_cache (hexgrip, cache_mode);
       if (pw)
         {
-          rc = agent_unprotect (ctrl, *keybuf, pw, NULL, &result, &resultlen);
+          rc = timed_unprotect (ctrl, *keybuf, pw, NULL, &result, &resultlen);
           if (!rc)
             {
               if (cache_mode == CACHE_MODE_NORMAL)
@@ -577,7 +598,7 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
           pw = agent_get_cache (NULL, cache_mode);
           if (pw)
             {
-              rc = agent_unprotect (ctrl, *keybuf, pw, NULL,
+              rc = timed_unprotect (ctrl, *keybuf, pw, NULL,
                                     &result, &resultlen);
               if (!rc)
                 {
@@ -688,7 +709,7 @@ unprotect (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
    return it as an gcrypt S-expression object in RESULT.  On failure
    returns an error code and stores NULL at RESULT. */
 static gpg_error_t
-read_key_file (const unsigned char *grip, gcry_sexp_t *result)
+do_read_key_file (const unsigned char *grip, gcry_sexp_t *result)
 {
   int rc;
   char *fname;
@@ -811,6 +832,20 @@ read_key_file (const unsigned char *grip, gcry_sexp_t *result)
 }
 
 
+/* Same as do_read_key_file but records the time taken.  */
+static gpg_error_t
+read_key_file (const unsigned char *grip, gcry_sexp_t *result)
+{
+  gpg_error_t err;
+  struct timespec start;
+
+  agent_stats_begin (&start);
+  err = do_read_key_file (grip, result);
+  agent_stats_end (STATS_KEYFILE_LOAD, &start);
+  return err;
+}
+
+
 /* Remove the key identified by GRIP from the private key directory.  */
 static gpg_error_t
 remove_key_file (const unsigned char *grip)
@@ -823,6 +858,7 @@ remove_key_file (const unsigned char *grip)
   strcpy (hexgrip+40, ".key");
   fname = make_filename (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR,
                          hexgrip, NULL);
+  agent_flush_key_cache (grip);
   if (gnupg_remove (fname))
     err = gpg_error_from_syserror ();
   xfree (fname);
@@ -830,6 +866,86 @@ remove_key_file (const unsigned char *grip)
 }
 
 
+/* Store information to detect changes of the key file for GRIP at
+   R_STAMP.  */
+static gpg_error_t
+key_file_stamp (const unsigned char *grip, key_file_stamp_t *r_stamp)
+{
+  gpg_error_t err = 0;
+  char *fname;
+  char hexgrip[40+4+1];
+  struct stat st;
+
+  bin2hex (grip, 20, hexgrip);
+  strcpy (hexgrip+40, ".key");
+  fname = make_filename (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR,
+                         hexgrip, NULL);
+  if (stat (fname, &st))
+    err = gpg_error_from_syserror ();
+  else
+    {
+      memset (r_stamp, 0, sizeof *r_stamp);
+      r_stamp->dev = st.st_dev;
+      r_stamp->ino = st.st_ino;
+      r_stamp->size = st.st_size;
+      r_stamp->mtime = st.st_mtime;
+    }
+  xfree (fname);
+  return err;
+}
+
+
+/* Try to get the key GRIP from the cache of unprotected keys and
+   store it at RESULT.  STAMP describes the current key file.  A
+   protected key is only returned as long as its passphrase is in the
+   passphrase cache for CACHE_MODE; this way the cache does not change
+   when a passphrase needs to be entered.  */
+static gpg_error_t
+key_from_cache (const unsigned char *grip, const key_file_stamp_t *stamp,
+                cache_mode_t cache_mode, gcry_sexp_t *result)
+{
+  gpg_error_t err;
+  unsigned char *buf;
+  size_t buflen, erroff;
+  int is_protected;
+  char hexgrip[40+1];
+  char *pw;
+
+  err = agent_get_key_cache (grip, stamp, &is_protected, &buf, &buflen);
+  if (err)
+    {
+      agent_stats_count (STATS_KEY_CACHE_MISS);
+      return err;
+    }
+
+  if (is_protected)
+    {
+      bin2hex (grip, 20, hexgrip);
+      pw = agent_get_cache (hexgrip, cache_mode);
+      if (!pw)
+        {
+          agent_flush_key_cache (grip);
+          wipememory (buf, buflen);
+          xfree (buf);
+          agent_stats_count (STATS_KEY_CACHE_MISS);
+          return gpg_error (GPG_ERR_NOT_FOUND);
+        }
+      xfree (pw);
+      if (cache_mode == CACHE_MODE_NORMAL)
+        agent_store_cache_hit (hexgrip);
+    }
+
+  agent_stats_count (STATS_KEY_CACHE_HIT);
+  err = gcry_sexp_sscan (result, &erroff, (char*)buf, buflen);
+  wipememory (buf, buflen);
+  xfree (buf);
+  if (err)
+    log_error ("failed to build S-Exp (off=%u): %s\n",
+               (unsigned int)erroff, gpg_strerror (err));
+  return err;
+}
+
+
 /* Return the secret key as an S-Exp in RESULT after locating it using
    the GRIP.  If the operation shall be diverted to a token, an
    allocated S-expression with the shadow_info part from the file is
@@ -856,6 +972,10 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
   unsigned char *buf;
   size_t len, buflen, erroff;
   gcry_sexp_t s_skey;
+  key_file_stamp_t stamp;
+  int use_key_cache = 0;
+  int cacheable = 0;
+  int is_protected = 0;
 
   *result = NULL;
   if (shadow_info)
@@ -863,6 +983,17 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
   if (r_passphrase)
     *r_passphrase = NULL;
 
+  /* Try the cache of unprotected keys.  It is not used if the caller
+     needs the passphrase or wants to bypass the passphrase cache.  */
+  if (opt.unprotected_key_cache_ttl
+      && !cache_nonce && !r_passphrase && cache_mode != CACHE_MODE_IGNORE
+      && !key_file_stamp (grip, &stamp))
+    {
+      use_key_cache = 1;
+      if (!key_from_cache (grip, &stamp, cache_mode, result))
+        return 0;
+    }
+
   rc = read_key_file (grip, &s_skey);
   if (rc)
     {
@@ -881,13 +1012,14 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
   switch (agent_private_key_type (buf))
     {
     case PRIVATE_KEY_CLEAR:
+      cacheable = 1;
       break; /* no unprotection needed */
     case PRIVATE_KEY_OPENPGP_NONE:
       {
         unsigned char *buf_new;
         size_t buf_newlen;
 
-        rc = agent_unprotect (ctrl, buf, "", NULL, &buf_new, &buf_newlen);
+        rc = timed_unprotect (ctrl, buf, "", NULL, &buf_new, &buf_newlen);
         if (rc)
           log_error ("failed to convert unprotected openpgp key: %s\n",
                      gpg_strerror (rc));
@@ -895,6 +1027,7 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
           {
             xfree (buf);
             buf = buf_new;
+            cacheable = 1;
           }
       }
       break;
@@ -928,6 +1061,8 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
 	    if (rc)
 	      log_error ("failed to unprotect the secret key: %s\n",
 			 gpg_strerror (rc));
+            else
+              cacheable = is_protected = 1;
 	  }
 
 	xfree (desc_text_final);
@@ -978,6 +1113,8 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
     }
 
   buflen = gcry_sexp_canon_len (buf, 0, NULL, NULL);
+  if (use_key_cache && cacheable)
+    agent_put_key_cache (grip, &stamp, is_protected, buf, buflen);
   rc = gcry_sexp_sscan (&s_skey, &erroff, (char*)buf, buflen);
   wipememory (buf, buflen);
   xfree (buf);
@@ -985,6 +1122,8 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
     {
       log_error ("failed to build S-Exp (off=%u): %s\n",
                  (unsigned int)erroff, gpg_strerror (rc));
+      if (use_key_cache && cacheable)
+        agent_flush_key_cache (grip);
       if (r_passphrase)
         {
           xfree (*r_passphrase);
@@ -28,6 +28,7 @@
 #include <errno.h>
 #include <assert.h>
 #include <time.h>
+#include <limits.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #ifdef HAVE_W32_SYSTEM
@@ -105,6 +106,7 @@ enum cmd_and_opt_values
   oDefCacheTTLSSH,
   oMaxCacheTTL,
   oMaxCacheTTLSSH,
+  oUnprotectedKeyCacheTTL,
   oEnforcePassphraseConstraints,
   oMinPassphraseLen,
   oMinPassphraseNonalpha,
@@ -133,6 +135,8 @@ enum cmd_and_opt_values
   oPuttySupport,
   oDisableScdaemon,
   oDisableCheckOwnSocket,
+  oMaxWorkerThreads,
+  oMaxConnections,
   oWriteEnvFile
 };
 
@@ -181,6 +185,8 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_n (oDisableScdaemon, "disable-scdaemon",
                 /* */             N_("do not use the SCdaemon") ),
   ARGPARSE_s_n (oDisableCheckOwnSocket, "disable-check-own-socket", "@"),
+  ARGPARSE_s_u (oMaxWorkerThreads, "max-worker-threads", "@"),
+  ARGPARSE_s_s (oMaxConnections, "max-connections", "@"),
 
   ARGPARSE_s_s (oExtraSocket, "extra-socket",
                 /* */       N_("|NAME|accept some commands via NAME")),
@@ -208,6 +214,7 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_u (oDefCacheTTLSSH, "default-cache-ttl-ssh", "@" ),
   ARGPARSE_s_u (oMaxCacheTTL,    "max-cache-ttl",         "@" ),
   ARGPARSE_s_u (oMaxCacheTTLSSH, "max-cache-ttl-ssh",     "@" ),
+  ARGPARSE_s_u (oUnprotectedKeyCacheTTL, "unprotected-key-cache-ttl", "@" ),
 
   ARGPARSE_s_n (oEnforcePassphraseConstraints, "enforce-passphrase-constraints",
                 /* */                          "@"),
@@ -292,6 +299,14 @@ static struct debug_flags_s debug_flags [] =
 # define CHECK_OWN_SOCKET_INTERVAL  (60)
 #endif
 
+/* The maximum number of accepted connections waiting for a worker
+   thread.  Further connections are closed right away.  */
+#define CONN_QUEUE_MAX 256
+
+/* Number of seconds an idle worker thread waits for a new connection
+   before it terminates.  */
+#define WORKER_IDLE_TIMEOUT 30
+
 
 /* Flag indicating that the ssh-agent subsystem has been enabled.  */
 static int ssh_support;
@@ -389,6 +404,59 @@ static pid_t parent_pid = (pid_t)(-1);
 /* Number of active connections.  */
 static int active_connections;
 
+/* The maximum number of connection worker threads or 0 for no
+   limit.  */
+static unsigned int max_worker_threads;
+
+/* An accepted connection waiting for a worker thread.  */
+struct conn_job_s
+{
+  struct conn_job_s *next;
+  int sockidx;                /* Index into CONN_SOCKETS.  */
+  void *(*func) (void *arg);  /* The connection handler.  */
+  ctrl_t ctrl;                /* Its argument.  */
+  struct timespec queued_at;  /* Time the connection was accepted.  */
+};
+
+/* The queue of accepted connections and the lock and condition
+   variable used by the worker threads to wait for them.  */
+static struct conn_job_s *conn_queue;
+static struct conn_job_s **conn_queue_tail = &conn_queue;
+static npth_mutex_t worker_lock;
+static npth_cond_t worker_cond;
+
+/* State of the listening sockets.  The order must match the table in
+   handle_connections.  */
+static struct
+{
+  const char *name;
+  unsigned int max_active;    /* Configured limit or 0 for none.  */
+  unsigned int active;        /* Number of connections being served.  */
+  unsigned int queued;        /* Number of connections in the queue.  */
+} conn_sockets[] =
+  {
+    { "std" },
+    { "extra" },
+    { "browser" },
+    { "ssh" }
+  };
+
+/* Counters for GETINFO worker_stats.  Times are in milliseconds.  */
+static struct
+{
+  unsigned int workers;
+  unsigned int idle;
+  unsigned int busy;
+  unsigned int queued;
+  unsigned int queued_max;
+  unsigned long rejected;
+  unsigned long served;
+  unsigned long long wait_total;
+  unsigned long wait_max;
+  unsigned long long service_total;
+  unsigned long service_max;
+} worker_stats;
+
 /* This object is used to dispatch progress messages from Libgcrypt to
  * the right thread.  Given that we will have at max only a few dozen
  * connections at a time, using a linked list is the easiest way to
@@ -764,6 +832,39 @@ cleanup (void)
 
 
 
+/* Parse the argument of --max-connections which has the form
+   "[NAME:]N".  NAME is one of "std", "extra", "browser", or "ssh";
+   if it is not given the limit is set for all sockets.  */
+static void
+parse_max_connections (const char *string)
+{
+  const char *s;
+  char *endp;
+  unsigned long n;
+  int idx;
+
+  s = strchr (string, ':');
+  n = strtoul (s? s+1 : string, &endp, 10);
+  if (*endp || endp == (s? s+1 : string) || n > UINT_MAX)
+    {
+      log_error (_("invalid value for option '%s'\n"), "--max-connections");
+      return;
+    }
+
+  for (idx=0; idx < DIM (conn_sockets); idx++)
+    if (!s || (strlen (conn_sockets[idx].name) == s - string
+               && !strncmp (conn_sockets[idx].name, string, s - string)))
+      {
+        conn_sockets[idx].max_active = n;
+        if (s)
+          return;
+      }
+
+  if (s)
+    log_error (_("invalid value for option '%s'\n"), "--max-connections");
+}
+
+
 /* Handle options which are allowed to be reset after program start.
    Return true when the current option in PARGS could be handled and
    false if not.  As a special feature, passing a value of NULL for
@@ -789,6 +890,7 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
       opt.def_cache_ttl_ssh = DEFAULT_CACHE_TTL_SSH;
       opt.max_cache_ttl = MAX_CACHE_TTL;
       opt.max_cache_ttl_ssh = MAX_CACHE_TTL_SSH;
+      opt.unprotected_key_cache_ttl = 0;
       opt.enforce_passphrase_constraints = 0;
       opt.min_passphrase_len = MIN_PASSPHRASE_LEN;
       opt.min_passphrase_nonalpha = MIN_PASSPHRASE_NONALPHA;
@@ -848,6 +950,9 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
     case oDefCacheTTLSSH: opt.def_cache_ttl_ssh = pargs->r.ret_ulong; break;
     case oMaxCacheTTL: opt.max_cache_ttl = pargs->r.ret_ulong; break;
     case oMaxCacheTTLSSH: opt.max_cache_ttl_ssh = pargs->r.ret_ulong; break;
+    case oUnprotectedKeyCacheTTL:
+      opt.unprotected_key_cache_ttl = pargs->r.ret_ulong;
+      break;
 
     case oEnforcePassphraseConstraints:
       opt.enforce_passphrase_constraints=1;
@@ -926,12 +1031,20 @@ thread_init_once (void)
 static void
 initialize_modules (void)
 {
+  int err;
+
   thread_init_once ();
   assuan_set_system_hooks (ASSUAN_SYSTEM_NPTH);
   initialize_module_cache ();
   initialize_module_call_pinentry ();
   initialize_module_call_scd ();
   initialize_module_trustlist ();
+
+  err = npth_mutex_init (&worker_lock, NULL);
+  if (!err)
+    err = npth_cond_init (&worker_cond, NULL);
+  if (err)
+    log_fatal ("error initializing connection workers: %s\n", strerror (err));
 }
 
 
@@ -1201,6 +1314,14 @@ main (int argc, char **argv )
           socket_name_browser = pargs.r.ret_str;
           break;
 
+        case oMaxWorkerThreads:
+          max_worker_threads = pargs.r.ret_ulong;
+          break;
+
+        case oMaxConnections:
+          parse_max_connections (pargs.r.ret_str);
+          break;
+
         case oDebugQuickRandom:
           /* Only used by the first stage command line parser.  */
           break;
@@ -2726,8 +2847,215 @@ start_connection_thread_ssh (void *arg)
 }
 
 
-/* Connection handler loop.  Wait for connection requests and spawn a
-   thread after accepting a connection.  */
+/* Return the number of milliseconds elapsed since START.  */
+static unsigned long
+elapsed_ms (const struct timespec *start)
+{
+  struct timespec now;
+  long long ms;
+
+  npth_clock_gettime (&now);
+  ms = ((long long)(now.tv_sec - start->tv_sec) * 1000
+        + (now.tv_nsec - start->tv_nsec) / 1000000);
+  return ms < 0? 0 : (unsigned long)ms;
+}
+
+
+/* Remove the first connection from the queue whose socket is below
+   its limit and return it.  Returns NULL if there is none.  Must be
+   called with WORKER_LOCK held.  */
+static struct conn_job_s *
+take_conn_job (void)
+{
+  struct conn_job_s **jobp, *job;
+  unsigned int max;
+
+  for (jobp = &conn_queue; (job = *jobp); jobp = &job->next)
+    {
+      max = conn_sockets[job->sockidx].max_active;
+      if (max && conn_sockets[job->sockidx].active >= max)
+        continue;
+
+      *jobp = job->next;
+      if (!job->next)
+        conn_queue_tail = jobp;
+      job->next = NULL;
+      conn_sockets[job->sockidx].queued--;
+      conn_sockets[job->sockidx].active++;
+      worker_stats.queued--;
+      return job;
+    }
+
+  return NULL;
+}
+
+
+/* Wait for a connection which may be served right now and return it.
+   Returns NULL if none showed up within WORKER_IDLE_TIMEOUT seconds.
+   Must be called with WORKER_LOCK held.  */
+static struct conn_job_s *
+wait_conn_job (void)
+{
+  struct conn_job_s *job;
+  struct timespec abstime;
+  int ret = 0;
+
+  npth_clock_gettime (&abstime);
+  abstime.tv_sec += WORKER_IDLE_TIMEOUT;
+  while (!(job = take_conn_job ()) && !ret)
+    {
+      worker_stats.idle++;
+      ret = npth_cond_timedwait (&worker_cond, &worker_lock, &abstime);
+      worker_stats.idle--;
+    }
+
+  return job;
+}
+
+
+/* The main function of a connection worker thread.  It serves queued
+   connections until it has been idle for WORKER_IDLE_TIMEOUT
+   seconds.  */
+static void *
+connection_worker (void *arg)
+{
+  struct conn_job_s *job;
+  struct timespec started;
+  unsigned long wait_ms, service_ms;
+
+  (void)arg;
+
+  npth_mutex_lock (&worker_lock);
+  while ((job = wait_conn_job ()))
+    {
+      worker_stats.busy++;
+      npth_mutex_unlock (&worker_lock);
+
+      wait_ms = elapsed_ms (&job->queued_at);
+      npth_clock_gettime (&started);
+      job->func (job->ctrl);  /* Releases CTRL.  */
+      service_ms = elapsed_ms (&started);
+
+      npth_mutex_lock (&worker_lock);
+      conn_sockets[job->sockidx].active--;
+      worker_stats.busy--;
+      worker_stats.served++;
+      worker_stats.wait_total += wait_ms;
+      if (wait_ms > worker_stats.wait_max)
+        worker_stats.wait_max = wait_ms;
+      worker_stats.service_total += service_ms;
+      if (service_ms > worker_stats.service_max)
+        worker_stats.service_max = service_ms;
+      xfree (job);
+    }
+  worker_stats.workers--;
+  npth_mutex_unlock (&worker_lock);
+
+  return NULL;
+}
+
+
+/* Queue the connection CTRL accepted on the socket with index
+   SOCKIDX, to be served by FUNC, and make sure that a worker thread
+   will pick it up.  TATTR are the attributes for a new worker
+   thread.  Returns 0 on success or an errno value.  */
+static int
+queue_connection (int sockidx, void *(*func) (void *arg), ctrl_t ctrl,
+                  npth_attr_t *tattr)
+{
+  struct conn_job_s *job;
+  npth_t thread;
+  int ret;
+
+  job = xtrycalloc (1, sizeof *job);
+  if (!job)
+    return errno;
+  job->sockidx = sockidx;
+  job->func = func;
+  job->ctrl = ctrl;
+  npth_clock_gettime (&job->queued_at);
+
+  npth_mutex_lock (&worker_lock);
+  if (worker_stats.queued >= CONN_QUEUE_MAX)
+    {
+      worker_stats.rejected++;
+      npth_mutex_unlock (&worker_lock);
+      xfree (job);
+      return EAGAIN;
+    }
+
+  /* Start another worker unless enough idle workers are available or
+     the limit has been reached.  */
+  if (worker_stats.queued >= worker_stats.idle
+      && (!max_worker_threads || worker_stats.workers < max_worker_threads))
+    {
+      ret = npth_create (&thread, tattr, connection_worker, NULL);
+      if (!ret)
+        worker_stats.workers++;
+      else if (!worker_stats.workers)
+        {
+          npth_mutex_unlock (&worker_lock);
+          xfree (job);
+          return ret;
+        }
+      else
+        log_error ("error spawning connection worker: %s\n", strerror (ret));
+    }
+
+  *conn_queue_tail = job;
+  conn_queue_tail = &job->next;
+  conn_sockets[sockidx].queued++;
+  worker_stats.queued++;
+  if (worker_stats.queued > worker_stats.queued_max)
+    worker_stats.queued_max = worker_stats.queued;
+  if (worker_stats.idle)
+    npth_cond_signal (&worker_cond);
+  npth_mutex_unlock (&worker_lock);
+
+  return 0;
+}
+
+
+/* Return a malloced string with statistics about the connection
+   worker threads or NULL on error.  Times are given in
+   milliseconds.  */
+char *
+get_agent_worker_stats (void)
+{
+  membuf_t mb;
+  int idx;
+
+  init_membuf (&mb, 512);
+  npth_mutex_lock (&worker_lock);
+  put_membuf_printf (&mb, "workers %u\nidle %u\nbusy %u\nmax_workers %u\n",
+                     worker_stats.workers, worker_stats.idle,
+                     worker_stats.busy, max_worker_threads);
+  put_membuf_printf (&mb, "queued %u\nqueued_max %u\nrejected %lu\n",
+                     worker_stats.queued, worker_stats.queued_max,
+                     worker_stats.rejected);
+  put_membuf_printf (&mb, "served %lu\n", worker_stats.served);
+  put_membuf_printf (&mb, "wait_avg %lu\nwait_max %lu\n",
+                     worker_stats.served
+                     ? (unsigned long)(worker_stats.wait_total
+                                       / worker_stats.served) : 0,
+                     worker_stats.wait_max);
+  put_membuf_printf (&mb, "service_avg %lu\nservice_max %lu\n",
+                     worker_stats.served
+                     ? (unsigned long)(worker_stats.service_total
+                                       / worker_stats.served) : 0,
+                     worker_stats.service_max);
+  for (idx=0; idx < DIM (conn_sockets); idx++)
+    put_membuf_printf (&mb, "socket %s %u %u %u\n", conn_sockets[idx].name,
+                       conn_sockets[idx].active, conn_sockets[idx].queued,
+                       conn_sockets[idx].max_active);
+  npth_mutex_unlock (&worker_lock);
+  put_membuf (&mb, "", 1);
+  return get_membuf (&mb, NULL);
+}
+
+
+/* Connection handler loop.  Wait for connection requests and queue
+   them for a worker thread after accepting a connection.  */
 static void
 handle_connections (gnupg_fd_t listen_fd,
                     gnupg_fd_t listen_fd_extra,
@@ -2755,7 +3083,7 @@ handle_connections (gnupg_fd_t listen_fd,
     const char *name;
     void *(*func) (void *arg);
     gnupg_fd_t l_fd;
-  } listentbl[] = {
+  } listentbl[] = {  /* The order must match CONN_SOCKETS.  */
     { "std",     start_connection_thread_std   },
     { "extra",   start_connection_thread_extra },
     { "browser", start_connection_thread_browser },
@@ -2858,7 +3186,8 @@ handle_connections (gnupg_fd_t listen_fd,
       /* Shutdown test.  */
       if (shutdown_pending)
         {
-          if (active_connections == 0)
+          if (active_connections == 0
+              && !worker_stats.queued && !worker_stats.busy)
             break; /* ready */
 
           /* Do not accept new connections but keep on running the
@@ -2927,7 +3256,6 @@ handle_connections (gnupg_fd_t listen_fd,
         {
           int idx;
           ctrl_t ctrl;
-          npth_t thread;
 
           if (my_inotify_fd != -1
               && FD_ISSET (my_inotify_fd, &read_fdset)
@@ -2968,8 +3296,8 @@ handle_connections (gnupg_fd_t listen_fd,
               else
                 {
                   ctrl->thread_startup.fd = fd;
-                  ret = npth_create (&thread, &tattr,
-                                     listentbl[idx].func, ctrl);
+                  ret = queue_connection (idx, listentbl[idx].func, ctrl,
+                                          &tattr);
                   if (ret)
                     {
                       log_error ("error spawning connection handler for %s:"
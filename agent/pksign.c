@@ -270,6 +270,82 @@ do_encode_raw_pkcs1 (const byte *md, size_t mdlen, unsigned int nbits,
 
 
 
+/* Sign DATA of DATALEN bytes using the secret key S_SKEY and store
+   the signature S-expression at R_SIG.  The hash algorithm is taken
+   from CTRL.  */
+static gpg_error_t
+pksign_with_skey (ctrl_t ctrl, gcry_sexp_t s_skey,
+                  const unsigned char *data, size_t datalen,
+                  gcry_sexp_t *r_sig)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_hash = NULL;
+  gcry_sexp_t s_sig = NULL;
+  int dsaalgo = 0;
+
+  *r_sig = NULL;
+
+  /* Put the hash into a sexp */
+  if (agent_is_eddsa_key (s_skey))
+    err = do_encode_eddsa (data, datalen,
+                           &s_hash);
+  else if (ctrl->digest.algo == MD_USER_TLS_MD5SHA1)
+    err = do_encode_raw_pkcs1 (data, datalen,
+                               gcry_pk_get_nbits (s_skey),
+                               &s_hash);
+  else if ( (dsaalgo = agent_is_dsa_key (s_skey)) )
+    err = do_encode_dsa (data, datalen,
+                         dsaalgo, s_skey,
+                         &s_hash);
+  else
+    err = do_encode_md (data, datalen,
+                        ctrl->digest.algo,
+                        &s_hash,
+                        ctrl->digest.raw_value);
+  if (err)
+    goto leave;
+
+  if (DBG_CRYPTO)
+    {
+      gcry_log_debugsxp ("skey", s_skey);
+      gcry_log_debugsxp ("hash", s_hash);
+    }
+
+  /* sign */
+  err = gcry_pk_sign (&s_sig, s_hash, s_skey);
+  if (err)
+    {
+      log_error ("signing failed: %s\n", gpg_strerror (err));
+      goto leave;
+    }
+
+  if (DBG_CRYPTO)
+    gcry_log_debugsxp ("rslt", s_sig);
+
+  /* Check that the signature verification worked and nothing is
+   * fooling us.  Because Libgcrypt 1.7 does this for RSA internally
+   * there is no need to do it here again.  */
+  if (dsaalgo == 0 && GCRYPT_VERSION_NUMBER < 0x010700)
+    {
+      err = gcry_pk_verify (s_sig, s_hash, s_skey);
+      if (err)
+        {
+          log_error (_("checking created signature failed: %s\n"),
+                     gpg_strerror (err));
+          goto leave;
+        }
+    }
+
+  *r_sig = s_sig;
+  s_sig = NULL;
+
+ leave:
+  gcry_sexp_release (s_sig);
+  gcry_sexp_release (s_hash);
+  return err;
+}
+
+
 /* SIGN whatever information we have accumulated in CTRL and return
    the signature S-expression.  LOOKUP is an optional function to
    provide a way for lower layers to ask for the caching TTL.  If a
@@ -447,48 +523,9 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
   else
     {
       /* No smartcard, but a private key */
-      int dsaalgo = 0;
-
-      /* Put the hash into a sexp */
-      if (agent_is_eddsa_key (s_skey))
-        rc = do_encode_eddsa (data, datalen,
-                              &s_hash);
-      else if (ctrl->digest.algo == MD_USER_TLS_MD5SHA1)
-        rc = do_encode_raw_pkcs1 (data, datalen,
-                                  gcry_pk_get_nbits (s_skey),
-                                  &s_hash);
-      else if ( (dsaalgo = agent_is_dsa_key (s_skey)) )
-        rc = do_encode_dsa (data, datalen,
-                            dsaalgo, s_skey,
-                            &s_hash);
-      else
-        rc = do_encode_md (data, datalen,
-                           ctrl->digest.algo,
-                           &s_hash,
-                           ctrl->digest.raw_value);
+      rc = pksign_with_skey (ctrl, s_skey, data, datalen, &s_sig);
       if (rc)
         goto leave;
-
-      if (dsaalgo == 0 && GCRYPT_VERSION_NUMBER < 0x010700)
-        /* It's RSA and Libgcrypt < 1.7 */
-        check_signature = 1;
-
-      if (DBG_CRYPTO)
-        {
-          gcry_log_debugsxp ("skey", s_skey);
-          gcry_log_debugsxp ("hash", s_hash);
-        }
-
-      /* sign */
-      rc = gcry_pk_sign (&s_sig, s_hash, s_skey);
-      if (rc)
-        {
-          log_error ("signing failed: %s\n", gpg_strerror (rc));
-          goto leave;
-        }
-
-      if (DBG_CRYPTO)
-        gcry_log_debugsxp ("rslt", s_sig);
     }
 
   /* Check that the signature verification worked and nothing is
@@ -564,3 +601,85 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
 
   return rc;
 }
+
+
+/* Sign a list of NHASHES hash values of HASHLEN bytes each, stored
+   back to back in HASHES, with the key set in CTRL and write the
+   concatenated canonical signature S-expressions to OUTBUF.  The
+   hash algorithm is taken from CTRL.  The secret key is read and
+   unprotected only once for the whole list; for keys stored on a
+   smartcard each hash is passed to the card separately.  With a
+   CACHE_MODE of CACHE_MODE_IGNORE the user expects to be asked for
+   each signature and thus only a single hash value is accepted.  */
+gpg_error_t
+agent_pksign_batch (ctrl_t ctrl, const char *cache_nonce,
+                    const char *desc_text,
+                    const unsigned char *hashes, size_t hashlen,
+                    unsigned int nhashes,
+                    membuf_t *outbuf, cache_mode_t cache_mode)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_skey = NULL;
+  gcry_sexp_t s_sig = NULL;
+  unsigned char *shadow_info = NULL;
+  char *buf = NULL;
+  size_t len;
+  unsigned int idx;
+
+  if (!ctrl->have_keygrip)
+    return gpg_error (GPG_ERR_NO_SECKEY);
+  if (!hashlen || hashlen > MAX_DIGEST_LEN)
+    return gpg_error (GPG_ERR_INV_LENGTH);
+  if (cache_mode == CACHE_MODE_IGNORE && nhashes > 1)
+    {
+      log_info ("refusing to create %u signatures with one passphrase"
+                " entry while the cache is ignored for signing\n", nhashes);
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+
+  err = agent_key_from_file (ctrl, cache_nonce, desc_text, ctrl->keygrip,
+                             &shadow_info, cache_mode, NULL,
+                             &s_skey, NULL);
+  if (err)
+    {
+      if (gpg_err_code (err) != GPG_ERR_NO_SECKEY)
+        log_error ("failed to read the secret key\n");
+      goto leave;
+    }
+
+  for (idx=0; idx < nhashes; idx++)
+    {
+      const unsigned char *data = hashes + idx * hashlen;
+
+      if (shadow_info)
+        err = agent_pksign_do (ctrl, cache_nonce, desc_text, &s_sig,
+                               cache_mode, NULL, data, hashlen);
+      else
+        err = pksign_with_skey (ctrl, s_skey, data, hashlen, &s_sig);
+      if (err)
+        goto leave;
+
+      len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, NULL, 0);
+      assert (len);
+      buf = xtrymalloc (len);
+      if (!buf)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, buf, len);
+      assert (len);
+      put_membuf (outbuf, buf, len);
+      xfree (buf);
+      buf = NULL;
+      gcry_sexp_release (s_sig);
+      s_sig = NULL;
+    }
+
+ leave:
+  xfree (buf);
+  gcry_sexp_release (s_sig);
+  gcry_sexp_release (s_skey);
+  xfree (shadow_info);
+  return err;
+}
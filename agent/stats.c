@@ -0,0 +1,224 @@
+/* stats.c - Performance counters and latency histograms
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The agent keeps a few event counters and a latency histogram for
+ * each timed operation and for each Assuan command.  The histograms
+ * use power-of-two buckets in microseconds so that recording a value
+ * is a matter of a few instructions.  Because nPth runs only one
+ * thread at a time and none of the functions here may block, no
+ * locking is required.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <npth.h>
+
+#include "agent.h"
+
+
+/* The number of histogram buckets.  Bucket N counts durations of
+   less than 2^N microseconds which do not fit into bucket N-1; the
+   last bucket takes everything above.  */
+#define STATS_BUCKETS 26
+
+/* A latency histogram.  */
+struct stats_hist_s
+{
+  unsigned long count;
+  unsigned long long total;   /* Sum of all durations in us.  */
+  unsigned long max;          /* Largest duration in us.  */
+  unsigned long bucket[STATS_BUCKETS];
+};
+
+/* Per command statistics.  */
+struct cmd_stats_s
+{
+  struct cmd_stats_s *next;
+  struct stats_hist_s hist;
+  char name[1];
+};
+
+
+/* The names of the counters and timers as used by GETINFO.  The order
+   must match the enums in agent.h.  */
+static const char * const counter_names[STATS_N_COUNTERS] =
+  {
+    "cache_hit",
+    "cache_miss",
+    "key_cache_hit",
+    "key_cache_miss"
+  };
+
+static const char * const timer_names[STATS_N_TIMERS] =
+  {
+    "keyfile_load",
+    "key_unprotect",
+    "scd_op"
+  };
+
+static unsigned long counters[STATS_N_COUNTERS];
+static struct stats_hist_s timers[STATS_N_TIMERS];
+static struct cmd_stats_s *cmd_stats;
+
+
+
+/* Add the duration since START to HIST.  */
+static void
+hist_add (struct stats_hist_s *hist, const struct timespec *start)
+{
+  struct timespec now;
+  long long us;
+  unsigned long val;
+  int idx;
+
+  npth_clock_gettime (&now);
+  us = ((long long)(now.tv_sec - start->tv_sec) * 1000000
+        + (now.tv_nsec - start->tv_nsec) / 1000);
+  val = us < 0? 0 : (unsigned long)us;
+
+  for (idx=0; idx < STATS_BUCKETS - 1 && (val >> idx); idx++)
+    ;
+  hist->bucket[idx]++;
+  hist->count++;
+  hist->total += val;
+  if (val > hist->max)
+    hist->max = val;
+}
+
+
+/* Append a line describing HIST with the label NAME to MB.  */
+static void
+hist_print (membuf_t *mb, const char *prefix, const char *name,
+            const struct stats_hist_s *hist)
+{
+  int idx;
+
+  put_membuf_printf (mb, "%s %s %lu avg=%lu max=%lu",
+                     prefix, name, hist->count,
+                     hist->count? (unsigned long)(hist->total/hist->count):0,
+                     hist->max);
+  for (idx=0; idx < STATS_BUCKETS; idx++)
+    if (hist->bucket[idx])
+      {
+        if (idx == STATS_BUCKETS - 1)
+          put_membuf_printf (mb, " inf:%lu", hist->bucket[idx]);
+        else
+          put_membuf_printf (mb, " %lu:%lu", 1UL << idx, hist->bucket[idx]);
+      }
+  put_membuf (mb, "\n", 1);
+}
+
+
+
+/* Bump the counter COUNTER.  */
+void
+agent_stats_count (stats_counter_t counter)
+{
+  if (counter >= 0 && counter < STATS_N_COUNTERS)
+    counters[counter]++;
+}
+
+
+/* Store the current time at R_START for use by agent_stats_end.  */
+void
+agent_stats_begin (struct timespec *r_start)
+{
+  npth_clock_gettime (r_start);
+}
+
+
+/* Record the time elapsed since START for the timer TIMER.  */
+void
+agent_stats_end (stats_timer_t timer, const struct timespec *start)
+{
+  if (timer >= 0 && timer < STATS_N_TIMERS)
+    hist_add (timers + timer, start);
+}
+
+
+/* Record the time elapsed since START for the Assuan command NAME.  */
+void
+agent_stats_end_command (const char *name, const struct timespec *start)
+{
+  struct cmd_stats_s *cs;
+
+  if (!name)
+    return;
+
+  for (cs = cmd_stats; cs; cs = cs->next)
+    if (!strcmp (cs->name, name))
+      break;
+  if (!cs)
+    {
+      cs = xtrycalloc (1, sizeof *cs + strlen (name));
+      if (!cs)
+        return;  /* Not worth an error message.  */
+      strcpy (cs->name, name);
+      cs->next = cmd_stats;
+      cmd_stats = cs;
+    }
+  hist_add (&cs->hist, start);
+}
+
+
+/* Reset all counters and histograms.  */
+void
+agent_stats_reset (void)
+{
+  struct cmd_stats_s *cs;
+
+  memset (counters, 0, sizeof counters);
+  memset (timers, 0, sizeof timers);
+  for (cs = cmd_stats; cs; cs = cs->next)
+    memset (&cs->hist, 0, sizeof cs->hist);
+}
+
+
+/* Return a malloced string with all counters and histograms or NULL
+   on error.  Each line has the form
+
+     counter NAME VALUE
+
+   or
+
+     timer|cmd NAME COUNT avg=US max=US [LIMIT:N]...
+
+   where LIMIT:N tells that N durations were shorter than LIMIT
+   microseconds but not shorter than half of it.  */
+char *
+agent_stats_string (void)
+{
+  membuf_t mb;
+  struct cmd_stats_s *cs;
+  int idx;
+
+  init_membuf (&mb, 1024);
+  for (idx=0; idx < STATS_N_COUNTERS; idx++)
+    put_membuf_printf (&mb, "counter %s %lu\n",
+                       counter_names[idx], counters[idx]);
+  for (idx=0; idx < STATS_N_TIMERS; idx++)
+    hist_print (&mb, "timer", timer_names[idx], timers + idx);
+  for (cs = cmd_stats; cs; cs = cs->next)
+    if (cs->hist.count)
+      hist_print (&mb, "cmd", cs->name, &cs->hist);
+  put_membuf (&mb, "", 1);
+  return get_membuf (&mb, NULL);
+}
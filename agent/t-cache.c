@@ -0,0 +1,317 @@
+/* t-cache.c - Module tests for cache.c
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <npth.h>
+
+#include "agent.h"
+
+
+#define fail()  do { fprintf (stderr, "%s:%d: test failed\n",\
+                              __FILE__,__LINE__);            \
+                     exit (1);                               \
+                   } while(0)
+
+static int verbose;
+
+
+/* A model of the passphrase cache as it was implemented before it
+ * used a hash table and an expiry heap: a single list, new items in
+ * front, expired on each access by scanning the whole list.  The
+ * results of the cache are compared with those of this model.  */
+typedef struct model_item_s *MODEL_ITEM;
+struct model_item_s {
+  MODEL_ITEM next;
+  time_t created;
+  time_t accessed;
+  int ttl;
+  char *pw;
+  cache_mode_t cache_mode;
+  char key[1];
+};
+
+static MODEL_ITEM model;
+static time_t now;
+
+
+static void
+model_housekeeping (void)
+{
+  MODEL_ITEM r, rprev;
+  unsigned long maxttl;
+
+  /* The old implementation did this in three passes over the list;
+     as each item is looked at on its own one pass yields the same.  */
+  for (rprev = NULL, r = model; r; )
+    {
+      if (r->pw && r->ttl >= 0 && r->accessed + r->ttl < now)
+        {
+          xfree (r->pw);
+          r->pw = NULL;
+          r->accessed = now;
+        }
+
+      maxttl = (r->cache_mode == CACHE_MODE_SSH
+                ? opt.max_cache_ttl_ssh : opt.max_cache_ttl);
+      if (r->pw && r->created + maxttl < now)
+        {
+          xfree (r->pw);
+          r->pw = NULL;
+          r->accessed = now;
+        }
+
+      if (!r->pw && r->ttl >= 0 && r->accessed + 60*30 < now)
+        {
+          MODEL_ITEM r2 = r->next;
+
+          xfree (r);
+          if (!rprev)
+            model = r2;
+          else
+            rprev->next = r2;
+          r = r2;
+        }
+      else
+        {
+          rprev = r;
+          r = r->next;
+        }
+    }
+}
+
+
+static int
+model_matches (MODEL_ITEM r, const char *key, cache_mode_t cache_mode)
+{
+  if (strcmp (r->key, key))
+    return 0;
+  if (cache_mode != CACHE_MODE_USER && cache_mode != CACHE_MODE_NONCE)
+    return 1;
+  return r->cache_mode == cache_mode;
+}
+
+
+static void
+model_put (const char *key, cache_mode_t cache_mode,
+           const char *data, int ttl)
+{
+  MODEL_ITEM r;
+
+  model_housekeeping ();
+
+  if (!ttl)
+    ttl = (cache_mode == CACHE_MODE_SSH
+           ? opt.def_cache_ttl_ssh : opt.def_cache_ttl);
+  if ((!ttl && data) || cache_mode == CACHE_MODE_IGNORE)
+    return;
+
+  for (r = model; r; r = r->next)
+    if (model_matches (r, key, cache_mode))
+      break;
+  if (r)
+    {
+      xfree (r->pw);
+      r->pw = NULL;
+    }
+  else if (data)
+    {
+      r = xcalloc (1, sizeof *r + strlen (key));
+      strcpy (r->key, key);
+      r->next = model;
+      model = r;
+    }
+  if (r && data)
+    {
+      r->created = r->accessed = now;
+      r->ttl = ttl;
+      r->cache_mode = cache_mode;
+      r->pw = xstrdup (data);
+    }
+}
+
+
+static const char *
+model_get (const char *key, cache_mode_t cache_mode)
+{
+  MODEL_ITEM r;
+
+  if (cache_mode == CACHE_MODE_IGNORE)
+    return NULL;
+
+  model_housekeeping ();
+
+  for (r = model; r; r = r->next)
+    if (r->pw && model_matches (r, key, cache_mode))
+      {
+        r->accessed = now;
+        return r->pw;
+      }
+  return NULL;
+}
+
+
+static void
+model_flush (void)
+{
+  MODEL_ITEM r;
+
+  for (r = model; r; r = r->next)
+    if (r->pw)
+      {
+        xfree (r->pw);
+        r->pw = NULL;
+        r->accessed = 0;
+      }
+}
+
+
+static void
+model_release (void)
+{
+  MODEL_ITEM r;
+
+  while ((r = model))
+    {
+      model = r->next;
+      xfree (r->pw);
+      xfree (r);
+    }
+}
+
+
+
+/* Run a long sequence of random operations on the cache and the
+ * model while advancing the time and changing the max-cache-ttl
+ * options and check that every lookup yields the same result.  */
+static void
+test_agent_cache_model (void)
+{
+  static const cache_mode_t modes[] =
+    { CACHE_MODE_NORMAL, CACHE_MODE_USER, CACHE_MODE_SSH };
+  char key[32], val[32];
+  const char *expected;
+  char *value;
+  cache_mode_t mode;
+  int i, k, ttl;
+  unsigned int hits = 0;
+
+  opt.def_cache_ttl = 600;
+  opt.def_cache_ttl_ssh = 1800;
+  opt.max_cache_ttl = 7200;
+  opt.max_cache_ttl_ssh = 7200;
+
+  now = 1000000;
+  gnupg_set_time (now, 1);
+  srand (1);
+
+  for (i = 0; i < 200000; i++)
+    {
+      k = rand () % 3000;
+      snprintf (key, sizeof key, "K%d", k);
+      mode = modes[k % 3];
+      switch (rand () % 10)
+        {
+        case 0: case 1: case 2:
+          snprintf (val, sizeof val, "v%d-%d", k, i);
+          ttl = (k % 7 == 0)? -1 : (k % 5) * 100;
+          agent_put_cache (key, mode, val, ttl);
+          model_put (key, mode, val, ttl);
+          break;
+
+        case 3:
+          agent_put_cache (key, mode, NULL, 0);
+          model_put (key, mode, NULL, 0);
+          break;
+
+        default:
+          /* Look the key up with the mode used to store it or with
+             the normal mode, which matches items of any mode.  */
+          if (rand () % 4 == 0)
+            mode = CACHE_MODE_NORMAL;
+          value = agent_get_cache (key, mode);
+          expected = model_get (key, mode);
+          if (!value != !expected || (value && strcmp (value, expected)))
+            {
+              fprintf (stderr, "op %d: %s (mode %d): got '%s' expected '%s'\n",
+                       i, key, mode,
+                       value? value : "[none]", expected? expected : "[none]");
+              fail ();
+            }
+          if (value)
+            hits++;
+          xfree (value);
+          break;
+        }
+
+      if (!(i % 7))
+        {
+          now += rand () % 5;
+          gnupg_set_time (now, 1);
+        }
+      if (!(i % 50000))
+        {
+          agent_flush_cache ();
+          model_flush ();
+          opt.max_cache_ttl = 3600 + i / 10;
+        }
+    }
+
+  /* All items are expired after a day.  */
+  now += 86400;
+  gnupg_set_time (now, 1);
+  for (k = 0; k < 3000; k++)
+    {
+      snprintf (key, sizeof key, "K%d", k);
+      value = agent_get_cache (key, CACHE_MODE_NORMAL);
+      if (value)
+        fail ();
+    }
+
+  if (verbose)
+    printf ("%u hits\n", hits);
+  /* Make sure that the test did not only see misses.  */
+  if (!hits)
+    fail ();
+
+  agent_flush_cache ();
+  model_release ();
+  gnupg_set_time ((time_t)-1, 0);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+  npth_init ();
+  initialize_module_cache ();
+
+  test_agent_cache_model ();
+
+  deinitialize_module_cache ();
+  return 0;
+}
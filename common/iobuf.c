@@ -59,17 +59,31 @@
 
 /*-- Begin configurable part.  --*/
 
-/* The size of the internal buffers.
+/* The size of the internal buffers used for temporary and socket
+   pipelines and the minimum size of all buffers.
    NOTE: If you change this value you MUST also adjust the regression
-   test "armored_key_8192" in armor.test! */
+   test "armored_key_8192" in armor.scm! */
 #define IOBUF_BUFFER_SIZE  8192
 
+/* The default size of the internal buffers of pipelines opened on
+   files.  A larger value reduces the number of filter calls and
+   copies for bulk operations.  See iobuf_set_buffer_size.
+   NOTE: If you change this value you MUST also adjust the regression
+   test "armored_key_65536" in armor.scm! */
+#define DEFAULT_IOBUF_BUFFER_SIZE  (64*1024)
+
+/* The maximum size which can be set by iobuf_set_buffer_size.  */
+#define MAX_IOBUF_BUFFER_SIZE  (16*1024*1024)
+
 /* To avoid a potential DoS with compression packets we better limit
    the number of filters in a chain.  */
 #define MAX_NESTING_FILTER 64
 
 /*-- End configurable part.  --*/
 
+/* The buffer size used for new pipelines opened on files.  */
+static size_t iobuf_buffer_size = DEFAULT_IOBUF_BUFFER_SIZE;
+
 
 #ifdef HAVE_W32_SYSTEM
 # ifdef HAVE_W32CE_SYSTEM
@@ -1094,6 +1108,47 @@ iobuf_print_chain (iobuf_t a)
   return 0;
 }
 
+/* Set the buffer size of the pipeline A to KILOBYTE KiB or, if A is
+   NULL, the default size for pipelines opened on files.  With
+   KILOBYTE 0 the size is not changed.  Returns the former size in
+   KiB.  */
+unsigned int
+iobuf_set_buffer_size (iobuf_t a, unsigned int kilobyte)
+{
+  unsigned int old = (a? a->d.size : iobuf_buffer_size) / 1024;
+  size_t size;
+  byte *buf;
+
+  if (!kilobyte)
+    return old;
+
+  if (kilobyte < IOBUF_BUFFER_SIZE / 1024)
+    kilobyte = IOBUF_BUFFER_SIZE / 1024;
+  else if (kilobyte > MAX_IOBUF_BUFFER_SIZE / 1024)
+    kilobyte = MAX_IOBUF_BUFFER_SIZE / 1024;
+  size = (size_t)kilobyte * 1024;
+
+  if (!a)
+    iobuf_buffer_size = size;
+  else if ((a->use == IOBUF_INPUT || a->use == IOBUF_OUTPUT)
+           && a->d.start == a->d.len && size != a->d.size)
+    {
+      /* The buffer is empty; thus we can simply replace it.  Filters
+         pushed later onto A inherit the size.  The buffers of
+         temporary pipelines grow as needed and are not touched.  */
+      buf = xtrymalloc (size);
+      if (buf)
+        {
+          xfree (a->d.buf);
+          a->d.buf = buf;
+          a->d.size = size;
+          a->d.start = a->d.len = 0;
+        }
+    }
+  return old;
+}
+
+
 iobuf_t
 iobuf_alloc (int use, size_t bufsize)
 {
@@ -1288,7 +1343,7 @@ do_open (const char *fname, int special_filenames,
 	return NULL;
     }
 
-  a = iobuf_alloc (use, IOBUF_BUFFER_SIZE);
+  a = iobuf_alloc (use, iobuf_buffer_size);
   fcx = xmalloc (sizeof *fcx + strlen (fname));
   fcx->fp = fp;
   fcx->print_only_name = print_only;
@@ -1335,7 +1390,7 @@ do_iobuf_fdopen (int fd, const char *mode, int keep_open)
   fp = INT2FD (fd);
 
   a = iobuf_alloc (strchr (mode, 'w') ? IOBUF_OUTPUT : IOBUF_INPUT,
-		   IOBUF_BUFFER_SIZE);
+		   iobuf_buffer_size);
   fcx = xmalloc (sizeof *fcx + 20);
   fcx->fp = fp;
   fcx->print_only_name = 1;
@@ -1373,7 +1428,7 @@ iobuf_esopen (estream_t estream, const char *mode, int keep_open)
   size_t len = 0;
 
   a = iobuf_alloc (strchr (mode, 'w') ? IOBUF_OUTPUT : IOBUF_INPUT,
-		   IOBUF_BUFFER_SIZE);
+		   iobuf_buffer_size);
   fcx = xtrymalloc (sizeof *fcx + 30);
   fcx->fp = estream;
   fcx->print_only_name = 1;
@@ -1984,6 +2039,38 @@ iobuf_readbyte (iobuf_t a)
 }
 
 
+/* Read up to BUFLEN bytes from the filter A directly into BUFFER
+   bypassing A's internal buffer, which must be empty.  Returns the
+   number of bytes read or -1 if nothing could be read; in the latter
+   case the caller shall use underflow to handle the EOF or error.  */
+static int
+underflow_direct (iobuf_t a, byte *buffer, size_t buflen)
+{
+  byte *save_buf = a->d.buf;
+  size_t save_size = a->d.size;
+  int c;
+  size_t n;
+
+  assert (a->d.start == a->d.len);
+
+  /* Let underflow fill the caller's buffer.  We don't clear a
+     pending EOF here because that would release the filter together
+     with the buffer.  */
+  a->d.buf = buffer;
+  a->d.size = buflen;
+  a->d.start = a->d.len = 0;
+  c = underflow (a, 0);
+  n = a->d.len;
+  a->d.buf = save_buf;
+  a->d.size = save_size;
+  a->d.start = a->d.len = 0;
+
+  if (c == -1)
+    return -1;
+  return n;
+}
+
+
 int
 iobuf_read (iobuf_t a, void *buffer, unsigned int buflen)
 {
@@ -2033,6 +2120,20 @@ iobuf_read (iobuf_t a, void *buffer, unsigned int buflen)
 	  if (buf)
 	    buf += size;
 	}
+      if (buf && buflen - n >= a->d.size && a->use == IOBUF_INPUT
+          && a->filter && !a->filter_eof && !a->error)
+        /* The remaining request is larger than our buffer; thus let
+           the filter write directly into BUFFER.  */
+        {
+          int nread = underflow_direct (a, buf, buflen - n);
+
+          if (nread > 0)
+            {
+              n += nread;
+              buf += nread;
+              continue;
+            }
+        }
       if (n < buflen)
 	/* Draining the internal buffer didn't fill BUFFER.  Call
 	   underflow to read more data into the filter's internal
@@ -2204,6 +2305,33 @@ iobuf_temp_to_buffer (iobuf_t a, byte * buffer, size_t buflen)
   return n;
 }
 
+/* Write BUFLEN bytes from BUFFER to the output filter A without
+   copying them to A's internal buffer.  Note that the filter may
+   modify BUFFER.  */
+static int
+filter_flush_direct (iobuf_t a, byte *buffer, size_t buflen)
+{
+  byte *save_buf;
+  size_t save_size;
+  int rc;
+
+  assert (a->use == IOBUF_OUTPUT);
+
+  if (a->d.len && (rc = filter_flush (a)))
+    return rc;
+
+  save_buf = a->d.buf;
+  save_size = a->d.size;
+  a->d.buf = buffer;
+  a->d.size = a->d.len = buflen;
+  rc = filter_flush (a);
+  a->d.buf = save_buf;
+  a->d.size = save_size;
+  a->d.len = 0;
+  return rc;
+}
+
+
 /* Copies the data from the input iobuf SOURCE to the output iobuf
    DEST until either an error is encountered or EOF is reached.
    Returns the number of bytes copies.  */
@@ -2211,8 +2339,9 @@ size_t
 iobuf_copy (iobuf_t dest, iobuf_t source)
 {
   char *temp;
-  /* Use a 32 KB buffer.  */
-  const size_t temp_size = 32 * 1024;
+  /* Use a buffer of at least 32 KB and large enough so that the
+     data is passed directly between the filters.  */
+  size_t temp_size = 32 * 1024;
 
   size_t nread;
   size_t nwrote = 0;
@@ -2224,6 +2353,11 @@ iobuf_copy (iobuf_t dest, iobuf_t source)
   if (iobuf_error (dest))
     return -1;
 
+  if (temp_size < source->d.size)
+    temp_size = source->d.size;
+  if (temp_size < dest->d.size)
+    temp_size = dest->d.size;
+
   temp = xmalloc (temp_size);
   while (1)
     {
@@ -2232,14 +2366,17 @@ iobuf_copy (iobuf_t dest, iobuf_t source)
         /* EOF.  */
         break;
 
-      err = iobuf_write (dest, temp, nread);
+      if (dest->use == IOBUF_OUTPUT && nread >= dest->d.size)
+        err = filter_flush_direct (dest, temp, nread);
+      else
+        err = iobuf_write (dest, temp, nread);
       if (err)
         break;
       nwrote += nread;
     }
 
   /* Burn the buffer.  */
-  wipememory (temp, sizeof (temp));
+  wipememory (temp, temp_size);
   xfree (temp);
 
   return nwrote;
@@ -278,6 +278,16 @@ int  iobuf_is_pipe_filename (const char *fname);
    the typical read / write request).  */
 iobuf_t iobuf_alloc (int use, size_t bufsize);
 
+/* Set the size of the internal buffer of the pipeline A to KILOBYTE
+   KiB; filters pushed onto A later inherit the size.  The buffer of A
+   must be empty, otherwise the size is not changed; the size of a
+   temporary pipeline can't be changed either.  If A is NULL the
+   default size for pipelines opened on files from now on is set;
+   temporary and socket pipelines always start with 8 KiB.  The size
+   is limited to the range 8 KiB to 16 MiB; 0 does not change the
+   size.  Returns the former size in KiB.  */
+unsigned int iobuf_set_buffer_size (iobuf_t a, unsigned int kilobyte);
+
 /* Create an output filter that simply buffers data written to it.
    This is useful for collecting data for later processing.  The
    buffer can be written to in the usual way (iobuf_write, etc.).  The
@@ -480,9 +490,14 @@ int iobuf_readbyte (iobuf_t a);
 	iobuf_readbyte((a)) : ( (a)->nbytes++, (a)->d.buf[(a)->d.start++] ) )
 #define iobuf_get_noeof(a)    (iobuf_get((a))&0xff)
 
+/* Return the number of bytes which can be read from A without calling
+   its filter.  */
+#define iobuf_buffered(a)     ((a)->d.len - (a)->d.start)
+
 /* Fill BUF with up to BUFLEN bytes.  If a filter has no more data,
    returns -1 to indicate the EOF.  Otherwise returns the number of
-   bytes read.  */
+   bytes read.  If BUFLEN is at least the size of the internal buffer
+   the data is read directly into BUF.  */
 int iobuf_read (iobuf_t a, void *buf, unsigned buflen);
 
 /* Read a line of input (including the '\n') from the pipeline.
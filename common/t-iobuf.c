@@ -390,5 +390,126 @@ main (int argc, char *argv[])
     iobuf_close (iobuf);
   }
 
+  /* Read with a buffer larger than the iobuf's own buffer.  The data
+     is then passed directly to the filter and the buffering of the
+     pipeline must still be honored.  */
+  {
+    char *content = "abcdefghijklmnopq";
+    char *content2;
+    size_t len2 = 300 * 1024 + 17;
+    char *buffer;
+    size_t bufsize = 128 * 1024;
+    iobuf_t iobuf;
+    int rc;
+    int n;
+    size_t total;
+    size_t i;
+    struct content_filter_state *state;
+
+    content2 = malloc (len2 + 1);
+    buffer = malloc (bufsize);
+    assert (content2 && buffer);
+    for (i = 0; i < len2; i ++)
+      content2[i] = 'a' + (i * 7) % 26;
+    content2[len2] = 0;
+
+    iobuf = iobuf_temp_with_content (content, strlen (content));
+    rc = iobuf_push_filter (iobuf,
+			    content_filter,
+                            state=content_filter_new (content2));
+    assert (rc == 0);
+
+    /* Start with a small read so that the buffer is not empty.  */
+    n = iobuf_read (iobuf, buffer, 10);
+    assert (n == 10);
+    assert (memcmp (buffer, content2, 10) == 0);
+    total = n;
+
+    /* Once the filter is exhausted, the underlying content follows.
+       There may be an EOF in between.  */
+    while ((n = iobuf_read (iobuf, buffer, bufsize)) != -1
+           || total < len2 + strlen (content))
+      {
+        if (n == -1)
+          {
+            assert (total == len2);
+            continue;
+          }
+        assert (n > 0);
+        for (i = 0; i < n; i ++, total ++)
+          {
+            assert (total < len2 + strlen (content));
+            if (total < len2)
+              assert (buffer[i] == content2[total]);
+            else
+              assert (buffer[i] == content[total - len2]);
+          }
+      }
+    assert (total == len2 + strlen (content));
+
+    iobuf_close (iobuf);
+    free (state);
+    free (buffer);
+    free (content2);
+  }
+
+  /* Change the buffer size of a single pipeline.  The size of a
+     pipeline which has buffered data must not change.  */
+  {
+    char *content = "0123456789";
+    char *content2;
+    size_t len2 = 200 * 1024 + 3;
+    char buffer[1000];
+    iobuf_t iobuf;
+    int rc;
+    int n;
+    size_t total;
+    size_t i;
+    unsigned int old;
+    struct content_filter_state *state;
+
+    content2 = malloc (len2 + 1);
+    assert (content2);
+    for (i = 0; i < len2; i ++)
+      content2[i] = 'a' + (i * 11) % 26;
+    content2[len2] = 0;
+
+    old = iobuf_set_buffer_size (NULL, 0);
+    iobuf = iobuf_temp_with_content (content, strlen (content));
+    rc = iobuf_push_filter (iobuf,
+			    content_filter,
+                            state=content_filter_new (content2));
+    assert (rc == 0);
+
+    assert (iobuf_set_buffer_size (iobuf, 0) == 8);
+    assert (iobuf_set_buffer_size (iobuf, 128) == 8);
+    assert (iobuf_set_buffer_size (iobuf, 0) == 128);
+    /* The default for file pipelines is not affected.  */
+    assert (iobuf_set_buffer_size (NULL, 0) == old);
+
+    n = iobuf_read (iobuf, buffer, 10);
+    assert (n == 10);
+    assert (memcmp (buffer, content2, 10) == 0);
+    total = n;
+
+    /* Data is buffered; thus the size is kept.  */
+    assert (iobuf_set_buffer_size (iobuf, 32) == 128);
+    assert (iobuf_set_buffer_size (iobuf, 0) == 128);
+
+    while (total < len2
+           && (n = iobuf_read (iobuf, buffer, sizeof buffer)) != -1)
+      {
+        assert (n > 0);
+        for (i = 0; i < n && total < len2; i ++, total ++)
+          assert (buffer[i] == content2[total]);
+        assert (i == n);
+      }
+    assert (total == len2);
+
+    iobuf_close (iobuf);
+    free (state);
+    free (content2);
+  }
+
   return 0;
 }
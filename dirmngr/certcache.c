@@ -35,6 +35,9 @@
 
 #define MAX_NONPERM_CACHED_CERTS 1000
 
+/* The number of slots of the secondary indexes.  */
+#define INDEX_SLOTS 256
+
 /* Constants used to classify search patterns.  */
 enum pattern_class
   {
@@ -56,16 +59,23 @@ enum pattern_class
 /* A certificate cache item.  This consists of a the KSBA cert object
    and some meta data for easier lookup.  We use a hash table to keep
    track of all items and use the (randomly distributed) first byte of
-   the fingerprint directly as the hash which makes it pretty easy. */
+   the fingerprint directly as the hash which makes it pretty easy.
+   Valid items are additionally linked into the secondary indexes on
+   the subject DN, the issuer DN plus serial number and the subject
+   key identifier.  */
 struct cert_item_s
 {
   struct cert_item_s *next; /* Next item with the same hash value. */
+  struct cert_item_s *next_subject; /* Next item in the subject index. */
+  struct cert_item_s *next_issuer;  /* Next item in the issuer index.  */
+  struct cert_item_s *next_ski;     /* Next item in the SKI index.  */
   ksba_cert_t cert;         /* The KSBA cert object or NULL is this is
                                not a valid item.  */
   unsigned char fpr[20];    /* The fingerprint of this object. */
   char *issuer_dn;          /* The malloced issuer DN.  */
   ksba_sexp_t sn;           /* The malloced serial number  */
   char *subject_dn;         /* The malloced subject DN - maybe NULL.  */
+  ksba_sexp_t ski;          /* The malloced subject key id - maybe NULL. */
 
   /* If this field is set the certificate has been taken from some
    * configuration and shall not be flushed from the cache.  */
@@ -81,6 +91,13 @@ typedef struct cert_item_s *cert_item_t;
    the first byte of the fingerprint.  */
 static cert_item_t cert_cache[256];
 
+/* The secondary indexes.  They are chained through the next_subject,
+   next_issuer and next_ski fields of the items and only hold valid
+   items.  */
+static cert_item_t subject_index[INDEX_SLOTS];
+static cert_item_t issuer_index[INDEX_SLOTS];
+static cert_item_t ski_index[INDEX_SLOTS];
+
 /* This is the global cache_lock variable. In general locking is not
    needed but it would take extra efforts to make sure that no
    indirect use of npth functions is done, so we simply lock it
@@ -167,6 +184,121 @@ compare_serialno (ksba_sexp_t serial1, ksba_sexp_t serial2 )
 
 
 
+/* Return the length of the canonical S-expression SEXP or 0 if it is
+   not valid.  */
+static size_t
+sexp_length (ksba_const_sexp_t sexp)
+{
+  return gcry_sexp_canon_len ((const unsigned char *)sexp, 0, NULL, NULL);
+}
+
+
+/* Mix LENGTH bytes of BUFFER into the hash value H and return it.  */
+static unsigned int
+hash_buffer (unsigned int h, const void *buffer, size_t length)
+{
+  const unsigned char *p = buffer;
+
+  for (; length; length--, p++)
+    h = h * 31 + *p;
+  return h;
+}
+
+
+/* Return the subject index slot for SUBJECT_DN.  */
+static unsigned int
+subject_slot (const char *subject_dn)
+{
+  return hash_buffer (0, subject_dn, strlen (subject_dn)) % INDEX_SLOTS;
+}
+
+
+/* Return the issuer index slot for ISSUER_DN and SERIALNO.  */
+static unsigned int
+issuer_slot (const char *issuer_dn, ksba_const_sexp_t serialno)
+{
+  unsigned int h;
+
+  h = hash_buffer (0, issuer_dn, strlen (issuer_dn));
+  h = hash_buffer (h, serialno, sexp_length (serialno));
+  return h % INDEX_SLOTS;
+}
+
+
+/* Return the SKI index slot for KEYID.  */
+static unsigned int
+ski_slot (ksba_const_sexp_t keyid)
+{
+  return hash_buffer (0, keyid, sexp_length (keyid)) % INDEX_SLOTS;
+}
+
+
+/* Link the valid item CI into the secondary indexes.  */
+static void
+index_item (cert_item_t ci)
+{
+  unsigned int idx;
+
+  if (ci->subject_dn)
+    {
+      idx = subject_slot (ci->subject_dn);
+      ci->next_subject = subject_index[idx];
+      subject_index[idx] = ci;
+    }
+
+  idx = issuer_slot (ci->issuer_dn, ci->sn);
+  ci->next_issuer = issuer_index[idx];
+  issuer_index[idx] = ci;
+
+  if (ci->ski)
+    {
+      idx = ski_slot (ci->ski);
+      ci->next_ski = ski_index[idx];
+      ski_index[idx] = ci;
+    }
+}
+
+
+/* Remove the item CI from the secondary indexes.  This must be
+   called before the fields used for hashing are released.  It is
+   fine to call this for an item which has not been indexed.  */
+static void
+unindex_item (cert_item_t ci)
+{
+  cert_item_t *pp;
+
+  if (ci->subject_dn)
+    for (pp = subject_index + subject_slot (ci->subject_dn); *pp;
+         pp = &(*pp)->next_subject)
+      if (*pp == ci)
+        {
+          *pp = ci->next_subject;
+          break;
+        }
+  ci->next_subject = NULL;
+
+  if (ci->issuer_dn && ci->sn)
+    for (pp = issuer_index + issuer_slot (ci->issuer_dn, ci->sn); *pp;
+         pp = &(*pp)->next_issuer)
+      if (*pp == ci)
+        {
+          *pp = ci->next_issuer;
+          break;
+        }
+  ci->next_issuer = NULL;
+
+  if (ci->ski)
+    for (pp = ski_index + ski_slot (ci->ski); *pp; pp = &(*pp)->next_ski)
+      if (*pp == ci)
+        {
+          *pp = ci->next_ski;
+          break;
+        }
+  ci->next_ski = NULL;
+}
+
+
+
 /* Return a malloced canonical S-Expression with the serial number
  * converted from the hex string HEXSN.  Return NULL on memory
  * error.  */
@@ -230,12 +362,16 @@ clean_cache_slot (cert_item_t ci)
   if (!ci->cert)
     return; /* Already cleaned.  */
 
+  unindex_item (ci);
+
   ksba_free (ci->sn);
   ci->sn = NULL;
   ksba_free (ci->issuer_dn);
   ci->issuer_dn = NULL;
   ksba_free (ci->subject_dn);
   ci->subject_dn = NULL;
+  ksba_free (ci->ski);
+  ci->ski = NULL;
   cert = ci->cert;
   ci->cert = NULL;
 
@@ -340,8 +476,11 @@ put_cert (ksba_cert_t cert, int permanent, unsigned int trustclass,
       return gpg_error (GPG_ERR_INV_CERT_OBJ);
     }
   ci->subject_dn = ksba_cert_get_subject (cert, 0);
+  if (ksba_cert_get_subj_key_id (cert, NULL, &ci->ski))
+    ci->ski = NULL;
   ci->permanent = !!permanent;
   ci->trustclasses = trustclass;
+  index_item (ci);
 
   if (!permanent)
     total_nonperm_certificates++;
@@ -756,6 +895,11 @@ cert_cache_deinit (int full)
           cert_cache[i] = NULL;
         }
     }
+  /* All valid items have been removed from the indexes by
+     clean_cache_slot; clear them anyway to be safe.  */
+  memset (subject_index, 0, sizeof subject_index);
+  memset (issuer_index, 0, sizeof issuer_index);
+  memset (ski_index, 0, sizeof ski_index);
 
   total_nonperm_certificates = 0;
   initialization_done = 0;
@@ -924,22 +1068,18 @@ get_cert_byhexfpr (const char *string)
 ksba_cert_t
 get_cert_bysn (const char *issuer_dn, ksba_sexp_t serialno)
 {
-  /* Simple and inefficient implementation.   fixme! */
   cert_item_t ci;
-  int i;
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && !strcmp (ci->issuer_dn, issuer_dn)
-            && !compare_serialno (ci->sn, serialno))
-          {
-            ksba_cert_ref (ci->cert);
-            release_cache_lock ();
-            return ci->cert;
-          }
-    }
+  for (ci=issuer_index[issuer_slot (issuer_dn, serialno)]; ci;
+       ci = ci->next_issuer)
+    if (ci->cert && !strcmp (ci->issuer_dn, issuer_dn)
+        && !compare_serialno (ci->sn, serialno))
+      {
+        ksba_cert_ref (ci->cert);
+        release_cache_lock ();
+        return ci->cert;
+      }
 
   release_cache_lock ();
   return NULL;
@@ -978,26 +1118,47 @@ get_cert_byissuer (const char *issuer_dn, unsigned int seq)
 ksba_cert_t
 get_cert_bysubject (const char *subject_dn, unsigned int seq)
 {
-  /* Simple and very inefficient implementation and API.  fixme! */
   cert_item_t ci;
-  int i;
 
   if (!subject_dn)
     return NULL;
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && ci->subject_dn
-            && !strcmp (ci->subject_dn, subject_dn))
-          if (!seq--)
-            {
-              ksba_cert_ref (ci->cert);
-              release_cache_lock ();
-              return ci->cert;
-            }
-    }
+  for (ci=subject_index[subject_slot (subject_dn)]; ci; ci = ci->next_subject)
+    if (ci->cert && ci->subject_dn
+        && !strcmp (ci->subject_dn, subject_dn))
+      if (!seq--)
+        {
+          ksba_cert_ref (ci->cert);
+          release_cache_lock ();
+          return ci->cert;
+        }
+
+  release_cache_lock ();
+  return NULL;
+}
+
+
+/* Return the certificate matching SUBJECT_DN and the subject key
+   identifier KEYID.  */
+static ksba_cert_t
+get_cert_bysubject_ski (const char *subject_dn, ksba_sexp_t keyid)
+{
+  cert_item_t ci;
+
+  if (!subject_dn)
+    return NULL;
+
+  acquire_cache_read_lock ();
+  for (ci=ski_index[ski_slot (keyid)]; ci; ci = ci->next_ski)
+    if (ci->cert && ci->subject_dn
+        && !cmp_simple_canon_sexp (ci->ski, keyid)
+        && !strcmp (ci->subject_dn, subject_dn))
+      {
+        ksba_cert_ref (ci->cert);
+        release_cache_lock ();
+        return ci->cert;
+      }
 
   release_cache_lock ();
   return NULL;
@@ -1422,7 +1583,6 @@ ksba_cert_t
 find_cert_bysubject (ctrl_t ctrl, const char *subject_dn, ksba_sexp_t keyid)
 {
   gpg_error_t err;
-  int seq;
   ksba_cert_t cert = NULL;
   cert_fetch_context_t context = NULL;
   ksba_sexp_t subj;
@@ -1437,40 +1597,30 @@ find_cert_bysubject (ctrl_t ctrl, const char *subject_dn, ksba_sexp_t keyid)
     {
       cert_item_t ci;
       cert_ref_t cr;
-      int i;
 
       /* For efficiency reasons we won't use get_cert_bysubject here. */
       acquire_cache_read_lock ();
-      for (i=0; i < 256; i++)
-        for (ci=cert_cache[i]; ci; ci = ci->next)
-          if (ci->cert && ci->subject_dn
-              && !strcmp (ci->subject_dn, subject_dn))
-            for (cr=ctrl->ocsp_certs; cr; cr = cr->next)
-              if (!memcmp (ci->fpr, cr->fpr, 20))
-                {
-                  ksba_cert_ref (ci->cert);
-                  release_cache_lock ();
-                  return ci->cert; /* We use this certificate. */
-                }
+      for (ci=subject_index[subject_slot (subject_dn)]; ci;
+           ci = ci->next_subject)
+        if (ci->cert && ci->subject_dn
+            && !strcmp (ci->subject_dn, subject_dn))
+          for (cr=ctrl->ocsp_certs; cr; cr = cr->next)
+            if (!memcmp (ci->fpr, cr->fpr, 20))
+              {
+                ksba_cert_ref (ci->cert);
+                release_cache_lock ();
+                return ci->cert; /* We use this certificate. */
+              }
       release_cache_lock ();
       if (DBG_LOOKUP)
         log_debug ("find_cert_bysubject: certificate not in ocsp_certs\n");
     }
 
   /* No check whether the certificate is cached.  */
-  for (seq=0; (cert = get_cert_bysubject (subject_dn, seq)); seq++)
-    {
-      if (!keyid)
-        break; /* No keyid requested, so return the first one found. */
-      if (!ksba_cert_get_subj_key_id (cert, NULL, &subj)
-          && !cmp_simple_canon_sexp (keyid, subj))
-        {
-          xfree (subj);
-          break; /* Found matching cert. */
-        }
-      xfree (subj);
-      ksba_cert_release (cert);
-    }
+  if (keyid)
+    cert = get_cert_bysubject_ski (subject_dn, keyid);
+  else
+    cert = get_cert_bysubject (subject_dn, 0);
   if (cert)
     return cert; /* Done.  */
 
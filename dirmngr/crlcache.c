@@ -101,6 +101,7 @@
 #ifndef HAVE_W32_SYSTEM
 #include <sys/utsname.h>
 #endif
+#include <npth.h>
 #ifdef MKDIR_TAKES_ONE_ARG
 #undef mkdir
 #define mkdir(a,b) mkdir(a)
@@ -125,6 +126,11 @@
    idea anyway to limit the number of opened cache files. */
 #define MAX_OPEN_DB_FILES 5
 
+/* The minimum number of seconds between two background refreshes of
+   the same CRL.  This keeps us from hammering a server which is not
+   able to deliver a new CRL.  */
+#define REFRESH_RETRY_INTERVAL (10*60)
+
 
 static const char oidstr_crlNumber[] = "2.5.29.20";
 /* static const char oidstr_issuingDistributionPoint[] = "2.5.29.28"; */
@@ -171,6 +177,27 @@ struct crl_cache_s
 typedef struct crl_cache_s *crl_cache_t;
 
 
+/* The loads of the CRL from one URL.  We use this to make sure that
+   the same CRL is not downloaded and inserted several times at once
+   and to limit the background refreshes of that CRL.  The object is
+   kept as long as a load is running or a refresh has been started,
+   because the cache entry is replaced by each load.  */
+struct crl_load_s
+{
+  struct crl_load_s *next;
+  int running;          /* A load is in progress.  */
+  unsigned int loads;   /* Number of finished loads.  */
+  gpg_error_t err;      /* The result of the last load.  */
+  unsigned int waiters; /* Number of threads waiting for a load.  */
+  time_t refresh_started;  /* Time the last background refresh has
+                              been started or 0.  */
+  ksba_isotime_t refresh_next_update; /* The nextUpdate of the CRL
+                                         that refresh was started for.  */
+  char url[1];          /* The URL of the CRL.  */
+};
+typedef struct crl_load_s *crl_load_t;
+
+
 /* Prototypes.  */
 static crl_cache_entry_t find_entry (crl_cache_entry_t first,
                                      const char *issuer_hash);
@@ -181,6 +208,15 @@ static crl_cache_entry_t find_entry (crl_cache_entry_t first,
    right at startup.  */
 static crl_cache_t current_cache;
 
+/* The list of CRL loads.  */
+static crl_load_t crl_loads;
+
+/* The lock and the condition used to wait for a CRL load.  The
+   condition is signaled whenever a load finishes.  */
+static npth_mutex_t crl_loads_lock;
+static npth_cond_t crl_loads_cond;
+static int crl_loads_initialized;
+
 
 
 
@@ -379,6 +415,24 @@ release_one_cache_entry (crl_cache_entry_t entry)
 }
 
 
+/* Remove all entries marked for deletion and not in use from CACHE
+   and release them.  */
+static void
+drop_deleted_entries (crl_cache_t cache)
+{
+  crl_cache_entry_t e, *pp;
+
+  for (pp = &cache->entries; (e = *pp); )
+    if (e->deleted && !e->cdb_use_count)
+      {
+        *pp = e->next;
+        release_one_cache_entry (e);
+      }
+    else
+      pp = &e->next;
+}
+
+
 /* Release the CACHE object. */
 static void
 release_cache (crl_cache_t cache)
@@ -1181,23 +1235,10 @@ unlock_db_file (crl_cache_t cache, crl_cache_entry_t entry)
       entry->cdb_lru_count++;
     }
 
-  /* If the entry was marked for deletion in the meantime do it now.
-     We do this for the sake of Pth thread safeness. */
-  if (!entry->cdb_use_count && entry->deleted)
-    {
-      crl_cache_entry_t eprev, enext;
-
-      enext = entry->next;
-      for (eprev = cache->entries;
-           eprev && eprev->next != entry; eprev = eprev->next)
-        ;
-      assert (eprev);
-      if (eprev == cache->entries)
-        cache->entries = enext;
-      else
-        eprev->next = enext;
-      /* FIXME: Do we leak ENTRY? */
-    }
+  /* An entry marked for deletion in the meantime is kept in the list
+     until the next call to drop_deleted_entries; our caller may still
+     be using ENTRY.  */
+  (void)cache;
 }
 
 
@@ -1226,6 +1267,19 @@ crl_cache_init(void)
       return;
     }
 
+  if (!crl_loads_initialized)
+    {
+      int rc;
+
+      rc = npth_mutex_init (&crl_loads_lock, NULL);
+      if (!rc)
+        rc = npth_cond_init (&crl_loads_cond, NULL);
+      if (rc)
+        log_fatal ("can't initialize the CRL load lock: %s\n",
+                   strerror (rc));
+      crl_loads_initialized = 1;
+    }
+
   err = open_dir (&cache);
   if (err)
     log_fatal (_("failed to create a new cache object: %s\n"),
@@ -1259,6 +1313,243 @@ crl_cache_flush (void)
 }
 
 
+/* Return true if URL uses a scheme we may fetch a CRL from.  */
+static int
+crl_url_usable_p (const char *url)
+{
+  if (!strncmp (url, "ldap:", 5) || !strncmp (url, "ldaps:", 6))
+    return !opt.ignore_ldap_dp;
+  if (!strncmp (url, "http:", 5) || !strncmp (url, "https:", 6))
+    return !opt.ignore_http_dp;
+  return 0; /* Unknown scheme or a file name.  */
+}
+
+
+/* Unlink LOAD from the list of loads and release it unless it is
+   still needed.  */
+static void
+release_load (crl_load_t load)
+{
+  crl_load_t *pp;
+
+  if (load->running || load->waiters || load->refresh_started)
+    return;
+
+  for (pp = &crl_loads; *pp; pp = &(*pp)->next)
+    if (*pp == load)
+      {
+        *pp = load->next;
+        break;
+      }
+  xfree (load);
+}
+
+
+/* Return the load object for the CRL from URL or NULL.  */
+static crl_load_t
+find_load (const char *url)
+{
+  crl_load_t load;
+
+  for (load = crl_loads; load; load = load->next)
+    if (!strcmp (load->url, url))
+      return load;
+  return NULL;
+}
+
+
+/* Return the load object for the CRL from URL and create it if
+   needed.  Returns NULL on error.  */
+static crl_load_t
+get_load (const char *url)
+{
+  crl_load_t load;
+
+  load = find_load (url);
+  if (load)
+    return load;
+
+  load = xtrycalloc (1, sizeof *load + strlen (url));
+  if (!load)
+    return NULL;
+  strcpy (load->url, url);
+  load->next = crl_loads;
+  crl_loads = load;
+  return load;
+}
+
+
+/* Fetch the CRL from URL and insert it into the cache.  If that CRL
+   is already being loaded by another thread, wait for it and return
+   its result.  */
+static gpg_error_t
+fetch_and_insert (ctrl_t ctrl, const char *url)
+{
+  gpg_error_t err;
+  crl_load_t load;
+  ksba_reader_t reader = NULL;
+
+  load = find_load (url);
+  if (load && load->running)
+    {
+      unsigned int loads = load->loads;
+
+      if (opt.verbose)
+        log_info ("waiting for the CRL from '%s'\n", url);
+      load->waiters++;
+      npth_mutex_lock (&crl_loads_lock);
+      while (load->loads == loads)
+        npth_cond_wait (&crl_loads_cond, &crl_loads_lock);
+      npth_mutex_unlock (&crl_loads_lock);
+      err = load->err;
+      load->waiters--;
+      release_load (load);
+      return err;
+    }
+
+  load = get_load (url);
+  if (!load)
+    return gpg_error_from_syserror ();
+  load->running = 1;
+
+  if (opt.verbose)
+    log_info ("fetching CRL from '%s'\n", url);
+  err = crl_fetch (ctrl, url, &reader);
+  if (err)
+    log_error (_("crl_fetch via DP failed: %s\n"), gpg_strerror (err));
+  else
+    {
+      if (opt.verbose)
+        log_info ("inserting CRL (reader %p)\n", reader);
+      err = crl_cache_insert (ctrl, url, reader);
+      if (err)
+        log_error (_("crl_cache_insert via DP failed: %s\n"),
+                   gpg_strerror (err));
+    }
+  crl_close_reader (reader);
+
+  npth_mutex_lock (&crl_loads_lock);
+  load->running = 0;
+  load->err = err;
+  load->loads++;
+  npth_cond_broadcast (&crl_loads_cond);
+  npth_mutex_unlock (&crl_loads_lock);
+  release_load (load);
+  return err;
+}
+
+
+/* Parameters for refresh_thread.  */
+struct refresh_parm_s
+{
+  char *http_proxy;
+  unsigned int http_no_crl:1;
+  char url[1];
+};
+
+
+/* Thread to load a new version of a cached CRL.  */
+static void *
+refresh_thread (void *arg)
+{
+  struct refresh_parm_s *parm = arg;
+  struct server_control_s ctrlbuf;
+  gpg_error_t err;
+
+  memset (&ctrlbuf, 0, sizeof ctrlbuf);
+  dirmngr_init_default_ctrl (&ctrlbuf);
+  xfree (ctrlbuf.http_proxy);
+  ctrlbuf.http_proxy = parm->http_proxy;
+  ctrlbuf.http_no_crl = parm->http_no_crl;
+
+  err = fetch_and_insert (&ctrlbuf, parm->url);
+  if (err)
+    log_info ("background refresh of the CRL from '%s' failed: %s\n",
+              parm->url, gpg_strerror (err));
+
+  dirmngr_deinit_default_ctrl (&ctrlbuf);
+  xfree (parm);
+  return NULL;
+}
+
+
+/* Start a thread to load a new version of the CRL cached in ENTRY.
+   This is a no-op if a load of that CRL is already running or a
+   refresh has been started recently.  It is also a no-op if a
+   refresh already yielded a CRL with the same nextUpdate; the issuer
+   has then not yet published a newer one.  */
+static void
+start_refresh (ctrl_t ctrl, crl_cache_entry_t entry)
+{
+  struct refresh_parm_s *parm;
+  crl_load_t load;
+  npth_t thread;
+  npth_attr_t tattr;
+  time_t now;
+  int rc;
+
+  if (!crl_url_usable_p (entry->url))
+    return;
+  now = gnupg_get_time ();
+  load = find_load (entry->url);
+  if (load)
+    {
+      if (load->running)
+        return;
+      if (load->refresh_started
+          && (now - load->refresh_started < REFRESH_RETRY_INTERVAL
+              || (!load->err && !strcmp (load->refresh_next_update,
+                                         entry->next_update))))
+        return;
+    }
+  else
+    {
+      load = get_load (entry->url);
+      if (!load)
+        return;
+    }
+  load->refresh_started = now;
+  gnupg_copy_time (load->refresh_next_update, entry->next_update);
+
+  parm = xtrycalloc (1, sizeof *parm + strlen (entry->url));
+  if (!parm)
+    return;
+  strcpy (parm->url, entry->url);
+  if (ctrl->http_proxy)
+    {
+      parm->http_proxy = xtrystrdup (ctrl->http_proxy);
+      if (!parm->http_proxy)
+        {
+          xfree (parm);
+          return;
+        }
+    }
+  parm->http_no_crl = ctrl->http_no_crl;
+
+  rc = npth_attr_init (&tattr);
+  if (rc)
+    {
+      log_error ("error preparing CRL refresh thread: %s\n", strerror (rc));
+      goto failed;
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+  rc = npth_create (&thread, &tattr, refresh_thread, parm);
+  npth_attr_destroy (&tattr);
+  if (rc)
+    {
+      log_error ("error spawning CRL refresh thread: %s\n", strerror (rc));
+      goto failed;
+    }
+  if (opt.verbose)
+    log_info ("refreshing CRL from '%s' in the background\n", entry->url);
+  return;
+
+ failed:
+  xfree (parm->http_proxy);
+  xfree (parm);
+}
+
+
 /* Check whether the certificate identified by ISSUER_HASH and
    SN/SNLEN is valid; i.e. not listed in our cache.  With
    FORCE_REFRESH set to true, a new CRL will be retrieved even if the
@@ -1319,6 +1610,18 @@ cache_isvalid (ctrl_t ctrl, const char *issuer_hash,
         }
     }
 
+  /* If the CRL expires soon, load a new one in the background.  Until
+     it has been swapped in we keep on using this one.  */
+  if (opt.crl_refresh_ahead)
+    {
+      gnupg_isotime_t tmptime;
+
+      gnupg_copy_time (tmptime, current_time);
+      add_seconds_to_isotime (tmptime, (int)opt.crl_refresh_ahead);
+      if (strcmp (entry->next_update, tmptime) < 0)
+        start_refresh (ctrl, entry);
+    }
+
   if (entry->invalid)
     {
       log_info (_("available CRL for issuer ID %s can't be used\n"),
@@ -2179,6 +2482,13 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   entry->check_trust_anchor = trust_anchor;
   trust_anchor = NULL;
 
+  /* Parsing a large CRL takes a while and other threads are served
+     from the old entry meanwhile.  The swap below does not yield, thus
+     they either see the old or the new entry.  Make sure to use the
+     current cache object in case it has been replaced in the
+     meantime.  */
+  cache = get_current_cache ();
+
   /* Check whether we already have an entry for this issuer and mark
      it as deleted. We better use a loop, just in case duplicates got
      somehow into the list. */
@@ -2226,10 +2536,12 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
     }
   xfree (fname); fname = NULL; /*(let the cleanup code not try to remove it)*/
 
-  /* Link the new entry in. */
+  /* Link the new entry in and release the old ones unless they are
+     still in use. */
   entry->next = cache->entries;
   cache->entries = entry;
   entry = NULL;
+  drop_deleted_entries (cache);
 
   err = update_dir (cache);
   if (err)
@@ -2270,6 +2582,12 @@ list_one_crl_entry (crl_cache_t cache, crl_cache_entry_t e, estream_t fp)
   int warn = 0;
   const unsigned char *s;
 
+  /* Lock the file first so that E can't be released while we are
+     writing to FP.  */
+  cdb = lock_db_file (cache, e);
+  if (!cdb)
+    return gpg_error (GPG_ERR_GENERAL);
+
   es_fputs ("--------------------------------------------------------\n", fp );
   es_fprintf (fp, _("Begin CRL dump (retrieved via %s)\n"), e->url );
   es_fprintf (fp, " Issuer:\t%s\n", e->issuer );
@@ -2302,10 +2620,6 @@ list_one_crl_entry (crl_cache_t cache, crl_cache_entry_t e, estream_t fp)
   if ((e->invalid & ~3))
     es_fprintf (fp, _(" ERROR: The CRL will not be used\n"));
 
-  cdb = lock_db_file (cache, e);
-  if (!cdb)
-    return gpg_error (GPG_ERR_GENERAL);
-
   if (!e->dbfile_checked)
     es_fprintf (fp, _(" ERROR: This cached CRL may have been tampered with!\n"));
 
@@ -2376,9 +2690,9 @@ list_one_crl_entry (crl_cache_t cache, crl_cache_entry_t e, estream_t fp)
   if (rc)
     log_error (_("error reading cache entry from db: %s\n"), strerror (rc));
 
-  unlock_db_file (cache, e);
   es_fprintf (fp, _("End CRL dump\n") );
   es_putc ('\n', fp);
+  unlock_db_file (cache, e);
 
   return (rc||warn)? gpg_error (GPG_ERR_GENERAL) : 0;
 }
@@ -2476,41 +2790,14 @@ crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
           if (!distpoint_uri)
             continue;
 
-          if (!strncmp (distpoint_uri, "ldap:", 5)
-              || !strncmp (distpoint_uri, "ldaps:", 6))
-            {
-              if (opt.ignore_ldap_dp)
-                continue;
-            }
-          else if (!strncmp (distpoint_uri, "http:", 5)
-                   || !strncmp (distpoint_uri, "https:", 6))
-            {
-              if (opt.ignore_http_dp)
-                continue;
-            }
-          else
-            continue; /* Skip unknown schemes. */
+          if (!crl_url_usable_p (distpoint_uri))
+            continue; /* Skip unknown or ignored schemes. */
 
           any_dist_point = 1;
 
-          if (opt.verbose)
-            log_info ("fetching CRL from '%s'\n", distpoint_uri);
-          err = crl_fetch (ctrl, distpoint_uri, &reader);
+          err = fetch_and_insert (ctrl, distpoint_uri);
           if (err)
             {
-              log_error (_("crl_fetch via DP failed: %s\n"),
-                         gpg_strerror (err));
-              last_err = err;
-              continue; /* with the next name. */
-            }
-
-          if (opt.verbose)
-            log_info ("inserting CRL (reader %p)\n", reader);
-          err = crl_cache_insert (ctrl, distpoint_uri, reader);
-          if (err)
-            {
-              log_error (_("crl_cache_insert via DP failed: %s\n"),
-                         gpg_strerror (err));
               last_err = err;
               continue; /* with the next name. */
             }
@@ -2529,10 +2816,6 @@ crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
          code for documentation. */
       issuername_uri =  ksba_name_get_uri (issuername, 0);
       ksba_name_release (issuername); issuername = NULL;
-
-      /* Close the reader.  */
-      crl_close_reader (reader);
-      reader = NULL;
     }
   if (gpg_err_code (err) == GPG_ERR_EOF)
     err = 0;
@@ -61,6 +61,7 @@
 #include "certcache.h"
 #include "crlcache.h"
 #include "crlfetch.h"
+#include "ocspcache.h"
 #include "misc.h"
 #if USE_LDAP
 # include "ldapserver.h"
@@ -117,6 +118,7 @@ enum cmd_and_opt_values {
   oIgnoreLDAPDP,
   oIgnoreHTTPDP,
   oIgnoreOCSPSvcUrl,
+  oCRLRefreshAhead,
   oHonorHTTPProxy,
   oHTTPProxy,
   oLDAPProxy,
@@ -129,6 +131,9 @@ enum cmd_and_opt_values {
   oOCSPMaxClockSkew,
   oOCSPMaxPeriod,
   oOCSPCurrentPeriod,
+  oOCSPCacheSize,
+  oOCSPCachePersist,
+  oOCSPStalePeriod,
   oMaxReplies,
   oHkpCaCert,
   oFakedSystemTime,
@@ -147,6 +152,8 @@ enum cmd_and_opt_values {
   oStandardResolver,
   oRecursiveResolver,
   oResolverTimeout,
+  oHTTPKeepAlive,
+  oHTTPMaxIdle,
   aTest
 };
 
@@ -194,6 +201,7 @@ static ARGPARSE_OPTS opts[] = {
                 N_("ignore LDAP CRL distribution points")),
   ARGPARSE_s_n (oIgnoreOCSPSvcUrl, "ignore-ocsp-service-url",
                 N_("ignore certificate contained OCSP service URLs")),
+  ARGPARSE_s_u (oCRLRefreshAhead, "crl-refresh-ahead", "@"),
 
   ARGPARSE_s_s (oHTTPProxy,  "http-proxy",
                 N_("|URL|redirect all HTTP requests to URL")),
@@ -217,6 +225,11 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_i (oOCSPMaxClockSkew, "ocsp-max-clock-skew", "@"),
   ARGPARSE_s_i (oOCSPMaxPeriod,    "ocsp-max-period", "@"),
   ARGPARSE_s_i (oOCSPCurrentPeriod, "ocsp-current-period", "@"),
+  ARGPARSE_s_u (oOCSPCacheSize, "ocsp-cache-size",
+                N_("|N|cache up to N OCSP responses")),
+  ARGPARSE_s_n (oOCSPCachePersist, "ocsp-cache-persist",
+                N_("store the OCSP cache on disk")),
+  ARGPARSE_s_u (oOCSPStalePeriod, "ocsp-stale-period", "@"),
 
   ARGPARSE_s_i (oMaxReplies, "max-replies",
                 N_("|N|do not return more than N items in one query")),
@@ -250,6 +263,8 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_n (oStandardResolver, "standard-resolver", "@"),
   ARGPARSE_s_n (oRecursiveResolver, "recursive-resolver", "@"),
   ARGPARSE_s_i (oResolverTimeout, "resolver-timeout", "@"),
+  ARGPARSE_s_u (oHTTPKeepAlive, "http-keep-alive", "@"),
+  ARGPARSE_s_u (oHTTPMaxIdle, "http-max-idle", "@"),
 
   ARGPARSE_group (302,N_("@\n(See the \"info\" manual for a complete listing "
                          "of all commands and options)\n")),
@@ -276,6 +291,10 @@ static struct debug_flags_s debug_flags [] =
 
 #define DEFAULT_MAX_REPLIES 10
 #define DEFAULT_LDAP_TIMEOUT 100 /* arbitrary large timeout */
+#define DEFAULT_HTTP_KEEP_ALIVE 15 /* Seconds to keep idle connections. */
+#define DEFAULT_HTTP_MAX_IDLE 4    /* Idle connections per server.  */
+#define DEFAULT_OCSP_CACHE_SIZE 1024 /* Number of cached OCSP responses. */
+#define DEFAULT_CRL_REFRESH_AHEAD (60*60) /* Seconds before NEXT_UPDATE.  */
 
 /* For the cleanup handler we need to keep track of the socket's name.  */
 static const char *socket_name;
@@ -306,6 +325,10 @@ static volatile int shutdown_pending;
 /* Flags to indicate that we shall not watch our own socket. */
 static int disable_check_own_socket;
 
+/* Values for --http-keep-alive and --http-max-idle.  */
+static unsigned int http_keep_alive;
+static unsigned int http_max_idle;
+
 /* Flag to control the Tor mode.  */
 static enum
   { TOR_MODE_AUTO = 0,  /* Switch to NO or YES         */
@@ -579,12 +602,16 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
       opt.ignore_http_dp = 0;
       opt.ignore_ldap_dp = 0;
       opt.ignore_ocsp_service_url = 0;
+      opt.crl_refresh_ahead = DEFAULT_CRL_REFRESH_AHEAD;
       opt.allow_ocsp = 0;
       opt.allow_version_check = 0;
       opt.ocsp_responder = NULL;
       opt.ocsp_max_clock_skew = 10 * 60;      /* 10 minutes.  */
       opt.ocsp_max_period = 90 * 86400;       /* 90 days.  */
       opt.ocsp_current_period = 3 * 60 * 60;  /* 3 hours. */
+      opt.ocsp_cache_size = DEFAULT_OCSP_CACHE_SIZE;
+      opt.ocsp_cache_persist = 0;
+      opt.ocsp_stale_period = 0;
       opt.max_replies = DEFAULT_MAX_REPLIES;
       while (opt.ocsp_signer)
         {
@@ -602,6 +629,9 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
       disable_check_own_socket = 0;
       enable_standard_resolver (0);
       set_dns_timeout (0);
+      http_keep_alive = DEFAULT_HTTP_KEEP_ALIVE;
+      http_max_idle = DEFAULT_HTTP_MAX_IDLE;
+      http_set_keep_alive (http_keep_alive, http_max_idle);
       return 1;
     }
 
@@ -648,6 +678,7 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
     case oIgnoreHTTPDP: opt.ignore_http_dp = 1; break;
     case oIgnoreLDAPDP: opt.ignore_ldap_dp = 1; break;
     case oIgnoreOCSPSvcUrl: opt.ignore_ocsp_service_url = 1; break;
+    case oCRLRefreshAhead: opt.crl_refresh_ahead = pargs->r.ret_ulong; break;
 
     case oAllowOCSP: opt.allow_ocsp = 1; break;
     case oAllowVersionCheck: opt.allow_version_check = 1; break;
@@ -658,6 +689,9 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
     case oOCSPMaxClockSkew: opt.ocsp_max_clock_skew = pargs->r.ret_int; break;
     case oOCSPMaxPeriod: opt.ocsp_max_period = pargs->r.ret_int; break;
     case oOCSPCurrentPeriod: opt.ocsp_current_period = pargs->r.ret_int; break;
+    case oOCSPCacheSize: opt.ocsp_cache_size = pargs->r.ret_ulong; break;
+    case oOCSPCachePersist: opt.ocsp_cache_persist = 1; break;
+    case oOCSPStalePeriod: opt.ocsp_stale_period = pargs->r.ret_ulong; break;
 
     case oMaxReplies: opt.max_replies = pargs->r.ret_int; break;
 
@@ -703,12 +737,16 @@ parse_rereadable_options (ARGPARSE_ARGS *pargs, int reread)
       set_dns_timeout (pargs->r.ret_int);
       break;
 
+    case oHTTPKeepAlive: http_keep_alive = pargs->r.ret_ulong; break;
+    case oHTTPMaxIdle: http_max_idle = pargs->r.ret_ulong; break;
+
     default:
       return 0; /* Not handled. */
     }
 
   set_dns_verbose (opt.verbose, !!DBG_DNS);
   http_set_verbose (opt.verbose, !!DBG_NETWORK);
+  http_set_keep_alive (http_keep_alive, http_max_idle);
   set_dns_disable_ipv4 (opt.disable_ipv4);
   set_dns_disable_ipv6 (opt.disable_ipv6);
 
@@ -1085,6 +1123,7 @@ main (int argc, char **argv)
       thread_init ();
       cert_cache_init (hkp_cacert_filenames);
       crl_cache_init ();
+      ocsp_cache_init ();
       http_register_netactivity_cb (netactivity_action);
       start_command_handler (ASSUAN_INVALID_FD);
       shutdown_reaper ();
@@ -1120,6 +1159,7 @@ main (int argc, char **argv)
       thread_init ();
       cert_cache_init (hkp_cacert_filenames);
       crl_cache_init ();
+      ocsp_cache_init ();
       http_register_netactivity_cb (netactivity_action);
       handle_connections (3);
       shutdown_reaper ();
@@ -1327,6 +1367,7 @@ main (int argc, char **argv)
       thread_init ();
       cert_cache_init (hkp_cacert_filenames);
       crl_cache_init ();
+      ocsp_cache_init ();
       http_register_netactivity_cb (netactivity_action);
       handle_connections (fd);
       shutdown_reaper ();
@@ -1478,6 +1519,7 @@ main (int argc, char **argv)
 static void
 cleanup (void)
 {
+  ocsp_cache_deinit ();
   crl_cache_deinit ();
   cert_cache_deinit (1);
   reload_dns_stuff (1);
@@ -1787,12 +1829,15 @@ dirmngr_sighup_action (void)
   log_info (_("SIGHUP received - "
               "re-reading configuration and flushing caches\n"));
   reread_configuration ();
+  ocsp_cache_deinit ();
   cert_cache_deinit (0);
   crl_cache_deinit ();
   cert_cache_init (hkp_cacert_filenames);
   crl_cache_init ();
+  ocsp_cache_init ();
   reload_dns_stuff (0);
   ks_hkp_reload ();
+  http_flush_idle_connections (1);
 }
 
 
@@ -1820,6 +1865,7 @@ handle_signal (int signo)
 
     case SIGUSR1:
       cert_cache_print_stats ();
+      ocsp_cache_print_stats ();
       break;
 
     case SIGUSR2:
@@ -1880,6 +1926,7 @@ housekeeping_thread (void *arg)
   dirmngr_init_default_ctrl (&ctrlbuf);
 
   ks_hkp_housekeeping (curtime);
+  ocsp_cache_save ();
   if (network_activity_seen)
     {
       network_activity_seen = 0;
@@ -1927,6 +1974,8 @@ time_for_housekeeping_p (time_t curtime)
 static void
 handle_tick (void)
 {
+  http_flush_idle_connections (0);
+
   if (time_for_housekeeping_p (gnupg_get_time ()))
     {
       npth_t thread;
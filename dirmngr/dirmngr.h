@@ -107,6 +107,9 @@ struct
   int ignore_ldap_dp;     /* Ignore LDAP CRL distribution points.  */
   int ignore_ocsp_service_url; /* Ignore OCSP service URLs as given in
                                   the certificate.  */
+  unsigned int crl_refresh_ahead; /* Seconds before NEXT_UPDATE at which
+                                     a CRL is refreshed in the
+                                     background.  */
 
   /* A list of certificate extension OIDs which are ignored so that
      one can claim that a critical extension has been handled.  One
@@ -130,6 +133,11 @@ struct
                                        considered valid after thisUpdate. */
   unsigned int ocsp_current_period; /* Seconds a response is considered
                                        current after nextUpdate. */
+  unsigned int ocsp_cache_size;     /* Max. number of cached responses.  */
+  int ocsp_cache_persist;           /* Store the OCSP cache on disk.  */
+  unsigned int ocsp_stale_period;   /* Seconds a cached response may be
+                                       used after nextUpdate while it is
+                                       being refreshed.  */
 
   strlist_t keyserver;              /* List of default keyservers.  */
 } opt;
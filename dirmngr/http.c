@@ -97,6 +97,7 @@
 #include <assuan.h>  /* We need the socket wrapper.  */
 
 #include "../common/util.h"
+#include "../common/membuf.h"
 #include "../common/i18n.h"
 #include "../common/sysutils.h" /* (gnupg_fd_t) */
 #include "dns-stuff.h"
@@ -127,6 +128,9 @@
 
 #define HTTP_PROXY_ENV           "http_proxy"
 #define MAX_LINELEN 20000  /* Max. length of a HTTP header line. */
+#define MAX_CHUNK_LINELEN 1024 /* Max. length of a chunk size line. */
+#define COOKIE_BUFSIZE 4096    /* Size of the read cookie's buffer.  */
+#define CONN_POOL_MAX 64       /* Max. number of idle connections.  */
 #define VALID_URI_CHARS "abcdefghijklmnopqrstuvwxyz"   \
                         "ABCDEFGHIJKLMNOPQRSTUVWXYZ"   \
                         "01234567890@"                 \
@@ -154,6 +158,8 @@ static uri_tuple_t parse_tuple (char *string);
 static gpg_error_t send_request (http_t hd, const char *httphost,
                                  const char *auth,const char *proxy,
 				 const char *srvtag,strlist_t headers);
+static gpg_error_t tls_handshake (http_t hd, const char *server);
+static gpg_error_t reopen_connection (http_t hd);
 static char *build_rel_path (parsed_uri_t uri);
 static gpg_error_t parse_response (http_t hd);
 
@@ -208,9 +214,56 @@ struct cookie_s
      the content length.  */
   uint64_t content_length;
   unsigned int content_length_valid:1;
+
+  /* True if the response may be followed by another request on the
+     same connection.  */
+  unsigned int keep_alive:1;
+
+  /* Set by the write cookie if a write to a reused connection
+     failed.  */
+  unsigned int write_failed:1;
+
+  /* How the body of a response is delimited; see the FRAMING_
+     constants.  */
+  int framing;
+
+  /* The number of consecutive newlines seen while scanning for the
+     end of the header and a flag telling that a non-empty line has
+     been seen.  */
+  unsigned int hdr_nl;
+  unsigned int hdr_seen:1;
+
+  /* The remaining length of the current chunk and a flag telling that
+     the CRLF after a chunk still needs to be read.  */
+  uint64_t chunk_left;
+  unsigned int chunk_crlf:1;
+
+  /* Data read from the network but not yet returned to estream.  */
+  char *buf;
+  size_t buflen;
+  size_t bufpos;
+
+  /* The "timeout" value of a Keep-Alive header or 0.  */
+  unsigned int keep_alive_timeout;
+
+  /* The malloced key used to return the connection to the pool or
+     NULL if the connection can't be reused.  */
+  char *pool_key;
+
+  /* If not NULL the write cookie records everything written.  */
+  membuf_t *replay;
 };
 typedef struct cookie_s *cookie_t;
 
+/* Values for the FRAMING field of a read cookie.  */
+#define FRAMING_NONE     0  /* Read up to EOF or the content length.  */
+#define FRAMING_HEADER   1  /* Return only data up to the empty line. */
+#define FRAMING_CHUNKED  2  /* Decode a chunked transfer encoding.    */
+#define FRAMING_DONE     3  /* The header or the body has been read.  */
+
+static gpgrt_ssize_t cookie_write_raw (cookie_t c,
+                                       const void *buffer, size_t size);
+
 
 /* Simple cookie functions.  Here the cookie is an int with the
  * socket. */
@@ -242,7 +295,7 @@ struct http_session_s
 #endif /*HTTP_USE_GNUTLS*/
 #ifdef USE_TLS
   tls_session_t tls_session;
-  struct {
+  struct http_session_verify_s {
     int done;      /* Verifciation has been done.  */
     int rc;        /* TLS verification return code.  */
     unsigned int status; /* Verification status.  */
@@ -298,6 +351,11 @@ struct http_context_s
   size_t buffer_size;
   unsigned int flags;
   header_t headers;      /* Received headers. */
+  unsigned int is_http_1_1:1; /* The response is HTTP/1.1.  */
+  unsigned int reused:1; /* The connection was taken from the pool.  */
+  char *pool_key;        /* Malloced key if the connection may be pooled. */
+  http_session_t pool_session; /* Holds the swapped-out TLS session.  */
+  membuf_t replay;       /* The request as sent over a reused connection. */
 };
 
 
@@ -629,8 +687,8 @@ close_tls_session (http_session_t sess)
       gnutls_deinit (sess->tls_session);
       if (sess->certcred)
         gnutls_certificate_free_credentials (sess->certcred);
+      sess->certcred = NULL;
 # endif /*HTTP_USE_GNUTLS*/
-      xfree (sess->servername);
       sess->tls_session = NULL;
     }
 }
@@ -656,6 +714,7 @@ session_unref (int lnr, http_session_t sess)
 
 #ifdef USE_TLS
   close_tls_session (sess);
+  xfree (sess->servername);
 #endif /*USE_TLS*/
 
   sess->magic = 0xdeadbeef;
@@ -868,6 +927,298 @@ http_session_set_log_cb (http_session_t sess,
 
 
 
+/* An idle connection kept in the pool for reuse by a later request
+ * to the same server.  */
+struct conn_pool_item_s
+{
+  struct conn_pool_item_s *next;
+  my_socket_t sock;        /* We own one reference.  */
+  http_session_t session;  /* The session with the TLS state or NULL.  */
+  time_t expires;          /* Close the connection at this time.  */
+  char key[1];             /* The key as made by make_pool_key.  */
+};
+typedef struct conn_pool_item_s *conn_pool_item_t;
+
+/* The pool of idle connections.  It is shared by all threads; no
+ * locking is required because none of the pool functions blocks.  */
+static conn_pool_item_t conn_pool;
+static unsigned int conn_pool_count;
+
+/* The idle timeout in seconds and the maximum number of idle
+ * connections to the same server.  A timeout of 0 disables the
+ * pool.  */
+static unsigned int conn_pool_timeout;
+static unsigned int conn_pool_max_per_host;
+
+
+/* Release the pool item ITEM which must already be unlinked.  */
+static void
+release_pool_item (conn_pool_item_t item)
+{
+  if (opt_debug)
+    log_debug ("http.c:pool: closing idle connection fd %d to '%s'\n",
+               (int)item->sock->fd, item->key);
+  http_session_unref (item->session);
+  my_socket_unref (item->sock, NULL, NULL);
+  xfree (item);
+  conn_pool_count--;
+}
+
+
+/* Configure the pool of idle connections.  Connections are kept open
+ * for at most TIMEOUT seconds after a request and at most
+ * MAX_PER_HOST connections to the same server are kept.  A TIMEOUT
+ * of 0 disables the keeping of connections.  */
+void
+http_set_keep_alive (unsigned int timeout, unsigned int max_per_host)
+{
+  conn_pool_timeout = max_per_host? timeout : 0;
+  conn_pool_max_per_host = max_per_host;
+  if (!conn_pool_timeout)
+    http_flush_idle_connections (1);
+}
+
+
+/* Close all idle connections which are expired or, if ALL is set,
+ * all idle connections.  */
+void
+http_flush_idle_connections (int all)
+{
+  conn_pool_item_t item, next, *prevp;
+  time_t now = gnupg_get_time ();
+
+  for (prevp = &conn_pool, item = conn_pool; item; item = next)
+    {
+      next = item->next;
+      if (all || item->expires <= now)
+        {
+          *prevp = next;
+          release_pool_item (item);
+        }
+      else
+        prevp = &item->next;
+    }
+}
+
+
+/* Return true if the request in HD may use a pooled connection.  */
+static int
+pool_usable_p (http_t hd, const char *proxy, const char *srvtag)
+{
+  const char *s;
+
+  if (!conn_pool_timeout)
+    return 0;
+  if (!(hd->req_type == HTTP_REQ_GET || hd->req_type == HTTP_REQ_POST))
+    return 0;
+  if ((hd->flags & (HTTP_FLAG_FORCE_TOR | HTTP_FLAG_SHUTDOWN
+                    | HTTP_FLAG_IGNORE_CL)))
+    return 0;
+  if (srvtag || (proxy && *proxy))
+    return 0;
+  if ((hd->flags & HTTP_FLAG_TRY_PROXY)
+      && (s = getenv (HTTP_PROXY_ENV)) && *s)
+    return 0;
+#ifndef HTTP_USE_GNUTLS
+  /* Only with GNUTLS do we know how to keep the TLS state.  */
+  if (hd->uri->use_tls)
+    return 0;
+#endif
+  return 1;
+}
+
+
+/* Return a malloced key describing the connection used for HD to
+ * SERVER and PORT.  For TLS the key includes the name sent via SNI
+ * and the session flags which control the verification.  Returns
+ * NULL and sets ERRNO on error.  */
+static char *
+make_pool_key (http_t hd, const char *server, unsigned short port)
+{
+  if (hd->uri->use_tls)
+    return xtryasprintf ("https://%s:%hu %s %x", server, port,
+                         hd->session->servername? hd->session->servername:"",
+                         hd->session->flags);
+  return xtryasprintf ("http://%s:%hu", server, port);
+}
+
+
+/* Return true if the idle connection SOCK has neither been closed by
+ * the peer nor has pending data.  */
+static int
+idle_connection_ok_p (my_socket_t sock, http_session_t session)
+{
+  fd_set rfds;
+  struct timeval tv;
+
+#ifdef HTTP_USE_GNUTLS
+  if (session && gnutls_record_check_pending (session->tls_session))
+    return 0;
+#else
+  (void)session;
+#endif
+  FD_ZERO (&rfds);
+  FD_SET (FD2INT (sock->fd), &rfds);
+  tv.tv_sec = 0;
+  tv.tv_usec = 0;
+  return !select (FD2INT (sock->fd) + 1, &rfds, NULL, NULL, &tv);
+}
+
+
+#ifdef HTTP_USE_GNUTLS
+/* Exchange the TLS state of the sessions A and B.  */
+static void
+swap_tls_state (http_session_t a, http_session_t b)
+{
+  gnutls_certificate_credentials_t certcred;
+  tls_session_t tls_session;
+  struct http_session_verify_s verify;
+
+  certcred = a->certcred;
+  a->certcred = b->certcred;
+  b->certcred = certcred;
+  tls_session = a->tls_session;
+  a->tls_session = b->tls_session;
+  b->tls_session = tls_session;
+  verify = a->verify;
+  a->verify = b->verify;
+  b->verify = verify;
+}
+#endif /*HTTP_USE_GNUTLS*/
+
+
+/* Try to take an idle connection for HD from the pool.  On success
+ * HD->SOCK is set and true is returned.  */
+static int
+take_pooled_connection (http_t hd)
+{
+  conn_pool_item_t item, *prevp;
+  time_t now = gnupg_get_time ();
+
+  prevp = &conn_pool;
+  while ((item = *prevp))
+    {
+      if (strcmp (item->key, hd->pool_key))
+        {
+          prevp = &item->next;
+          continue;
+        }
+      *prevp = item->next;
+      if (item->expires <= now
+          || !idle_connection_ok_p (item->sock, item->session))
+        {
+          release_pool_item (item);
+          continue;
+        }
+
+      if (opt_debug)
+        log_debug ("http.c:pool: reusing connection fd %d to '%s'\n",
+                   (int)item->sock->fd, item->key);
+      hd->sock = item->sock;
+#ifdef HTTP_USE_GNUTLS
+      if (item->session)
+        {
+          /* Move the established TLS state into the caller's session
+           * object and keep the unused state of the caller for the
+           * case that we need to reconnect.  */
+          swap_tls_state (hd->session, item->session);
+          hd->pool_session = item->session;
+        }
+#endif /*HTTP_USE_GNUTLS*/
+      xfree (item);
+      conn_pool_count--;
+      hd->reused = 1;
+      init_membuf (&hd->replay, 1024);
+      return 1;
+    }
+
+  return 0;
+}
+
+
+/* Release the state kept by HD for retrying a request which was sent
+ * over a reused connection.  */
+static void
+drop_reuse_state (http_t hd)
+{
+  if (hd->reused)
+    {
+      xfree (get_membuf (&hd->replay, NULL));
+      hd->reused = 0;
+    }
+  http_session_unref (hd->pool_session);
+  hd->pool_session = NULL;
+}
+
+
+/* Put the connection of the read cookie C into the pool.  Returns
+ * true if the pool took over the socket and the session of C.  */
+static int
+park_connection (cookie_t c)
+{
+  conn_pool_item_t item;
+  unsigned int count, timeout;
+
+  if (!conn_pool_timeout || !c->sock)
+    return 0;
+
+  timeout = conn_pool_timeout;
+  if (c->keep_alive_timeout)
+    {
+      /* Stay clear of the server's timeout.  */
+      if (c->keep_alive_timeout < 2)
+        return 0;
+      if (c->keep_alive_timeout - 1 < timeout)
+        timeout = c->keep_alive_timeout - 1;
+    }
+
+  if (c->use_tls)
+    {
+      /* The TLS state can only be taken over if nobody else uses
+       * the session object.  */
+      if (!c->session || c->session->refcount != 1
+          || !c->session->tls_session)
+        return 0;
+    }
+
+  http_flush_idle_connections (0);
+  if (conn_pool_count >= CONN_POOL_MAX)
+    return 0;
+  for (count = 0, item = conn_pool; item; item = item->next)
+    if (!strcmp (item->key, c->pool_key))
+      count++;
+  if (count >= conn_pool_max_per_host)
+    return 0;
+
+  item = xtrymalloc (sizeof *item + strlen (c->pool_key));
+  if (!item)
+    return 0;
+  strcpy (item->key, c->pool_key);
+  item->sock = c->sock;
+  c->sock = NULL;
+  item->session = NULL;
+  if (c->use_tls)
+    {
+      item->session = c->session;
+      c->session = NULL;
+      /* The callbacks may refer to objects of the last request.  */
+      item->session->cert_log_cb = NULL;
+      item->session->verify_cb = NULL;
+      item->session->verify_cb_value = NULL;
+    }
+  item->expires = gnupg_get_time () + timeout;
+  item->next = conn_pool;
+  conn_pool = item;
+  conn_pool_count++;
+
+  if (opt_debug)
+    log_debug ("http.c:pool: keeping connection fd %d to '%s'\n",
+               (int)item->sock->fd, item->key);
+  return 1;
+}
+
+
+
 
 /* Start a HTTP retrieval and on success store at R_HD a context
    pointer for completing the request and to wait for the response.
@@ -907,7 +1258,9 @@ http_open (http_t *r_hd, http_req_t reqtype, const char *url,
         es_fclose (hd->fp_read);
       if (hd->fp_write)
         es_fclose (hd->fp_write);
+      drop_reuse_state (hd);
       http_session_unref (hd->session);
+      xfree (hd->pool_key);
       xfree (hd);
     }
   else
@@ -1069,6 +1422,7 @@ http_wait_response (http_t hd)
     shutdown (FD2INT (hd->sock->fd), 1);
   hd->in_data = 0;
 
+ again:
   /* Create a new cookie and a stream for reading.  */
   cookie = xtrycalloc (1, sizeof *cookie);
   if (!cookie)
@@ -1076,6 +1430,7 @@ http_wait_response (http_t hd)
   cookie->sock = my_socket_ref (hd->sock);
   cookie->session = http_session_ref (hd->session);
   cookie->use_tls = hd->uri->use_tls;
+  cookie->framing = FRAMING_HEADER;
 
   hd->read_cookie = cookie;
   hd->fp_read = es_fopencookie (cookie, "r", cookie_functions);
@@ -1090,6 +1445,27 @@ http_wait_response (http_t hd)
     }
 
   err = parse_response (hd);
+  if (err && hd->reused)
+    {
+      /* The server may have closed the idle connection before our
+       * request arrived.  Send the request again over a new
+       * connection.  */
+      if (opt_verbose)
+        log_info ("http.c: reused connection failed: %s - retrying\n",
+                  gpg_strerror (err));
+      es_fclose (hd->fp_read);
+      hd->fp_read = NULL;
+      hd->read_cookie = NULL;
+      err = reopen_connection (hd);
+      if (err)
+        return err;
+      goto again;
+    }
+  drop_reuse_state (hd);
+
+  /* Without a header (HTTP/0.9) the body extends up to EOF.  */
+  if (!err && cookie->framing == FRAMING_HEADER)
+    cookie->framing = FRAMING_NONE;
 
   if (!err)
     err = es_onclose (hd->fp_read, 1, fp_onclose_notification, hd);
@@ -1143,9 +1519,11 @@ http_close (http_t hd, int keep_read_stream)
     es_fclose (hd->fp_read);
   if (hd->fp_write)
     es_fclose (hd->fp_write);
+  drop_reuse_state (hd);
   http_session_unref (hd->session);
   hd->magic = 0xdeadbeef;
   http_release_parsed_uri (hd->uri);
+  xfree (hd->pool_key);
   while (hd->headers)
     {
       header_t tmp = hd->headers->next;
@@ -1629,6 +2007,239 @@ is_hostname_port (const char *string)
 }
 
 
+/* Run the TLS handshake for HD over its already connected socket and
+ * verify the server's certificate.  SERVER is only used for
+ * diagnostics.  */
+static gpg_error_t
+tls_handshake (http_t hd, const char *server)
+{
+#if USE_TLS
+  gpg_error_t err;
+#endif /*USE_TLS*/
+
+#if HTTP_USE_NTBTLS
+  estream_t in, out;
+
+  my_socket_ref (hd->sock);
+
+  /* Until we support send/recv in estream under Windows we need
+   * to use es_fopencookie.  */
+#ifdef HAVE_W32_SYSTEM
+  in = es_fopencookie ((void*)(unsigned int)hd->sock->fd, "rb",
+                       simple_cookie_functions);
+#else
+  in = es_fdopen_nc (hd->sock->fd, "rb");
+#endif
+  if (!in)
+    {
+      err = gpg_error_from_syserror ();
+      return err;
+    }
+
+#ifdef HAVE_W32_SYSTEM
+  out = es_fopencookie ((void*)(unsigned int)hd->sock->fd, "wb",
+                        simple_cookie_functions);
+#else
+  out = es_fdopen_nc (hd->sock->fd, "wb");
+#endif
+  if (!out)
+    {
+      err = gpg_error_from_syserror ();
+      es_fclose (in);
+      return err;
+    }
+
+  err = ntbtls_set_transport (hd->session->tls_session, in, out);
+  if (err)
+    {
+      log_info ("TLS set_transport failed: %s <%s>\n",
+                gpg_strerror (err), gpg_strsource (err));
+      return err;
+    }
+
+#ifdef HTTP_USE_NTBTLS
+  if (hd->session->verify_cb)
+    {
+      err = ntbtls_set_verify_cb (hd->session->tls_session,
+                                  my_ntbtls_verify_cb, hd);
+      if (err)
+        {
+          log_error ("ntbtls_set_verify_cb failed: %s\n",
+                     gpg_strerror (err));
+          return err;
+        }
+    }
+#endif /*HTTP_USE_NTBTLS*/
+
+  while ((err = ntbtls_handshake (hd->session->tls_session)))
+    {
+      switch (err)
+        {
+        default:
+          log_info ("TLS handshake failed: %s <%s>\n",
+                    gpg_strerror (err), gpg_strsource (err));
+          return err;
+        }
+    }
+
+  hd->session->verify.done = 0;
+
+  /* Try the available verify callbacks until one returns success
+   * or a real error.  Note that NTBTLS does the verification
+   * during the handshake via   */
+#ifdef HTTP_USE_NTBTLS
+  err = 0; /* Fixme check that the CB has been called.  */
+#else
+  err = gpg_error (GPG_ERR_NOT_IMPLEMENTED);
+#endif
+
+  if (hd->session->verify_cb
+      && gpg_err_source (err) == GPG_ERR_SOURCE_DIRMNGR
+      && gpg_err_code (err) == GPG_ERR_NOT_IMPLEMENTED)
+    err = hd->session->verify_cb (hd->session->verify_cb_value,
+                                  hd, hd->session,
+                                  (hd->flags | hd->session->flags),
+                                  hd->session->tls_session);
+
+  if (tls_callback
+      && gpg_err_source (err) == GPG_ERR_SOURCE_DIRMNGR
+      && gpg_err_code (err) == GPG_ERR_NOT_IMPLEMENTED)
+    err = tls_callback (hd, hd->session, 0);
+
+  if (gpg_err_source (err) == GPG_ERR_SOURCE_DIRMNGR
+      && gpg_err_code (err) == GPG_ERR_NOT_IMPLEMENTED)
+    err = http_verify_server_credentials (hd->session);
+
+  if (err)
+    {
+      log_info ("TLS connection authentication failed: %s <%s>\n",
+                gpg_strerror (err), gpg_strsource (err));
+      return err;
+    }
+
+#elif HTTP_USE_GNUTLS
+  int rc;
+
+  my_socket_ref (hd->sock);
+  gnutls_transport_set_ptr (hd->session->tls_session, hd->sock);
+  gnutls_transport_set_pull_function (hd->session->tls_session,
+                                      my_gnutls_read);
+  gnutls_transport_set_push_function (hd->session->tls_session,
+                                      my_gnutls_write);
+
+ handshake_again:
+  do
+    {
+      rc = gnutls_handshake (hd->session->tls_session);
+    }
+  while (rc == GNUTLS_E_INTERRUPTED || rc == GNUTLS_E_AGAIN);
+  if (rc < 0)
+    {
+      if (rc == GNUTLS_E_WARNING_ALERT_RECEIVED
+          || rc == GNUTLS_E_FATAL_ALERT_RECEIVED)
+        {
+          gnutls_alert_description_t alertno;
+          const char *alertstr;
+
+          alertno = gnutls_alert_get (hd->session->tls_session);
+          alertstr = gnutls_alert_get_name (alertno);
+          log_info ("TLS handshake %s: %s (alert %d)\n",
+                    rc == GNUTLS_E_WARNING_ALERT_RECEIVED
+                    ? "warning" : "failed",
+                    alertstr, (int)alertno);
+          if (alertno == GNUTLS_A_UNRECOGNIZED_NAME && server)
+            log_info ("  (sent server name '%s')\n", server);
+
+          if (rc == GNUTLS_E_WARNING_ALERT_RECEIVED)
+            goto handshake_again;
+        }
+      else
+        log_info ("TLS handshake failed: %s\n", gnutls_strerror (rc));
+      return gpg_err_make (default_errsource, GPG_ERR_NETWORK);
+    }
+
+  hd->session->verify.done = 0;
+  if (tls_callback)
+    err = tls_callback (hd, hd->session, 0);
+  else
+    err = http_verify_server_credentials (hd->session);
+  if (err)
+    {
+      log_info ("TLS connection authentication failed: %s\n",
+                gpg_strerror (err));
+      return err;
+    }
+#else /*!HTTP_USE_GNUTLS && !HTTP_USE_NTBTLS*/
+  (void)hd;
+  (void)server;
+#endif /*!HTTP_USE_GNUTLS && !HTTP_USE_NTBTLS*/
+
+  return 0;
+}
+
+
+/* Replace the failed reused connection of HD by a new connection and
+ * send the recorded request again.  */
+static gpg_error_t
+reopen_connection (http_t hd)
+{
+  gpg_error_t err;
+  const char *server;
+  unsigned short port;
+  assuan_fd_t sock;
+  struct cookie_s tmpcookie;
+  char *request;
+  size_t requestlen;
+
+  request = get_membuf (&hd->replay, &requestlen);
+  hd->reused = 0;
+  if (!request)
+    {
+      err = gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
+      drop_reuse_state (hd);
+      return err;
+    }
+
+#ifdef HTTP_USE_GNUTLS
+  /* Get back the still unused TLS state of the caller's session.  */
+  if (hd->pool_session)
+    swap_tls_state (hd->session, hd->pool_session);
+#endif /*HTTP_USE_GNUTLS*/
+  drop_reuse_state (hd);
+  my_socket_unref (hd->sock, NULL, NULL);
+  hd->sock = NULL;
+
+  server = *hd->uri->host ? hd->uri->host : "localhost";
+  port = hd->uri->port ? hd->uri->port : 80;
+  err = connect_server (server, port, hd->flags, NULL, &sock);
+  if (err)
+    goto leave;
+  hd->sock = my_socket_new (sock);
+  if (!hd->sock)
+    {
+      err = gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
+      goto leave;
+    }
+  if (hd->uri->use_tls)
+    {
+      err = tls_handshake (hd, server);
+      if (err)
+        goto leave;
+    }
+
+  memset (&tmpcookie, 0, sizeof tmpcookie);
+  tmpcookie.sock = hd->sock;
+  tmpcookie.session = hd->session;
+  tmpcookie.use_tls = hd->uri->use_tls;
+  if (cookie_write_raw (&tmpcookie, request, requestlen) < 0)
+    err = gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
+
+ leave:
+  xfree (request);
+  return err;
+}
+
+
 /*
  * Send a HTTP request to the server
  * Returns 0 if the request was successful
@@ -1708,6 +2319,16 @@ send_request (http_t hd, const char *httphost, const char *auth,
     }
 #endif /*USE_TLS*/
 
+  /* Reuse an idle connection if possible.  */
+  if (pool_usable_p (hd, proxy, srvtag))
+    {
+      hd->pool_key = make_pool_key (hd, server, port);
+      if (!hd->pool_key)
+        return gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
+      if (take_pooled_connection (hd))
+        goto connected;
+    }
+
   if ( (proxy && *proxy)
        || ( (hd->flags & HTTP_FLAG_TRY_PROXY)
             && (http_proxy = getenv (HTTP_PROXY_ENV))
@@ -1783,173 +2404,17 @@ send_request (http_t hd, const char *httphost, const char *auth,
     }
 
 
-#if HTTP_USE_NTBTLS
   if (hd->uri->use_tls)
     {
-      estream_t in, out;
-
-      my_socket_ref (hd->sock);
-
-      /* Until we support send/recv in estream under Windows we need
-       * to use es_fopencookie.  */
-#ifdef HAVE_W32_SYSTEM
-      in = es_fopencookie ((void*)(unsigned int)hd->sock->fd, "rb",
-                           simple_cookie_functions);
-#else
-      in = es_fdopen_nc (hd->sock->fd, "rb");
-#endif
-      if (!in)
-        {
-          err = gpg_error_from_syserror ();
-          xfree (proxy_authstr);
-          return err;
-        }
-
-#ifdef HAVE_W32_SYSTEM
-      out = es_fopencookie ((void*)(unsigned int)hd->sock->fd, "wb",
-                            simple_cookie_functions);
-#else
-      out = es_fdopen_nc (hd->sock->fd, "wb");
-#endif
-      if (!out)
-        {
-          err = gpg_error_from_syserror ();
-          es_fclose (in);
-          xfree (proxy_authstr);
-          return err;
-        }
-
-      err = ntbtls_set_transport (hd->session->tls_session, in, out);
+      err = tls_handshake (hd, server);
       if (err)
         {
-          log_info ("TLS set_transport failed: %s <%s>\n",
-                    gpg_strerror (err), gpg_strsource (err));
           xfree (proxy_authstr);
           return err;
         }
-
-#ifdef HTTP_USE_NTBTLS
-      if (hd->session->verify_cb)
-        {
-          err = ntbtls_set_verify_cb (hd->session->tls_session,
-                                      my_ntbtls_verify_cb, hd);
-          if (err)
-            {
-              log_error ("ntbtls_set_verify_cb failed: %s\n",
-                         gpg_strerror (err));
-              xfree (proxy_authstr);
-              return err;
-            }
-        }
-#endif /*HTTP_USE_NTBTLS*/
-
-      while ((err = ntbtls_handshake (hd->session->tls_session)))
-        {
-          switch (err)
-            {
-            default:
-              log_info ("TLS handshake failed: %s <%s>\n",
-                        gpg_strerror (err), gpg_strsource (err));
-              xfree (proxy_authstr);
-              return err;
-            }
-        }
-
-      hd->session->verify.done = 0;
-
-      /* Try the available verify callbacks until one returns success
-       * or a real error.  Note that NTBTLS does the verification
-       * during the handshake via   */
-#ifdef HTTP_USE_NTBTLS
-      err = 0; /* Fixme check that the CB has been called.  */
-#else
-      err = gpg_error (GPG_ERR_NOT_IMPLEMENTED);
-#endif
-
-      if (hd->session->verify_cb
-          && gpg_err_source (err) == GPG_ERR_SOURCE_DIRMNGR
-          && gpg_err_code (err) == GPG_ERR_NOT_IMPLEMENTED)
-        err = hd->session->verify_cb (hd->session->verify_cb_value,
-                                      hd, hd->session,
-                                      (hd->flags | hd->session->flags),
-                                      hd->session->tls_session);
-
-      if (tls_callback
-          && gpg_err_source (err) == GPG_ERR_SOURCE_DIRMNGR
-          && gpg_err_code (err) == GPG_ERR_NOT_IMPLEMENTED)
-        err = tls_callback (hd, hd->session, 0);
-
-      if (gpg_err_source (err) == GPG_ERR_SOURCE_DIRMNGR
-          && gpg_err_code (err) == GPG_ERR_NOT_IMPLEMENTED)
-        err = http_verify_server_credentials (hd->session);
-
-      if (err)
-        {
-          log_info ("TLS connection authentication failed: %s <%s>\n",
-                    gpg_strerror (err), gpg_strsource (err));
-          xfree (proxy_authstr);
-          return err;
-        }
-
     }
-#elif HTTP_USE_GNUTLS
-  if (hd->uri->use_tls)
-    {
-      int rc;
 
-      my_socket_ref (hd->sock);
-      gnutls_transport_set_ptr (hd->session->tls_session, hd->sock);
-      gnutls_transport_set_pull_function (hd->session->tls_session,
-                                          my_gnutls_read);
-      gnutls_transport_set_push_function (hd->session->tls_session,
-                                          my_gnutls_write);
-
-    handshake_again:
-      do
-        {
-          rc = gnutls_handshake (hd->session->tls_session);
-        }
-      while (rc == GNUTLS_E_INTERRUPTED || rc == GNUTLS_E_AGAIN);
-      if (rc < 0)
-        {
-          if (rc == GNUTLS_E_WARNING_ALERT_RECEIVED
-              || rc == GNUTLS_E_FATAL_ALERT_RECEIVED)
-            {
-              gnutls_alert_description_t alertno;
-              const char *alertstr;
-
-              alertno = gnutls_alert_get (hd->session->tls_session);
-              alertstr = gnutls_alert_get_name (alertno);
-              log_info ("TLS handshake %s: %s (alert %d)\n",
-                        rc == GNUTLS_E_WARNING_ALERT_RECEIVED
-                        ? "warning" : "failed",
-                        alertstr, (int)alertno);
-              if (alertno == GNUTLS_A_UNRECOGNIZED_NAME && server)
-                log_info ("  (sent server name '%s')\n", server);
-
-              if (rc == GNUTLS_E_WARNING_ALERT_RECEIVED)
-                goto handshake_again;
-            }
-          else
-            log_info ("TLS handshake failed: %s\n", gnutls_strerror (rc));
-          xfree (proxy_authstr);
-          return gpg_err_make (default_errsource, GPG_ERR_NETWORK);
-        }
-
-      hd->session->verify.done = 0;
-      if (tls_callback)
-        err = tls_callback (hd, hd->session, 0);
-      else
-        err = http_verify_server_credentials (hd->session);
-      if (err)
-        {
-          log_info ("TLS connection authentication failed: %s\n",
-                    gpg_strerror (err));
-          xfree (proxy_authstr);
-          return err;
-        }
-    }
-#endif /*HTTP_USE_GNUTLS*/
+ connected:
 
   if (auth || hd->uri->auth)
     {
@@ -2010,12 +2475,15 @@ send_request (http_t hd, const char *httphost, const char *auth,
       else
         snprintf (portstr, sizeof portstr, ":%u", port);
 
+      /* We use HTTP/1.1 only if we are able to keep the connection
+       * open; a HTTP/1.0 request makes the server close it.  */
       request = es_bsprintf
-        ("%s %s%s HTTP/1.0\r\nHost: %s%s\r\n%s",
+        ("%s %s%s HTTP/%s\r\nHost: %s%s\r\n%s",
          hd->req_type == HTTP_REQ_GET ? "GET" :
          hd->req_type == HTTP_REQ_HEAD ? "HEAD" :
          hd->req_type == HTTP_REQ_POST ? "POST" : "OOPS",
          *p == '/' ? "" : "/", p,
+         hd->pool_key? "1.1" : "1.0",
          httphost? httphost : server,
          portstr,
          authstr? authstr:"");
@@ -2047,6 +2515,8 @@ send_request (http_t hd, const char *httphost, const char *auth,
     hd->write_cookie = cookie;
     cookie->use_tls = hd->uri->use_tls;
     cookie->session = http_session_ref (hd->session);
+    if (hd->reused)
+      cookie->replay = &hd->replay;
 
     hd->fp_write = es_fopencookie (cookie, "w", cookie_functions);
     if (!hd->fp_write)
@@ -2258,6 +2728,25 @@ http_get_header (http_t hd, const char *name)
 }
 
 
+/* Return true if the comma delimited header VALUE has the element
+   TOKEN.  The comparison is case-insensitive.  VALUE may be NULL.  */
+static int
+header_has_token (const char *value, const char *token)
+{
+  size_t n = strlen (token);
+
+  while (value && *value)
+    {
+      value += strspn (value, " \t,");
+      if (!ascii_strncasecmp (value, token, n)
+          && (!value[n] || strchr (" \t,;", value[n])))
+        return 1;
+      value = strchr (value, ',');
+    }
+  return 0;
+}
+
+
 /* Return a newly allocated and NULL terminated array with pointers to
    header names.  The array must be released with xfree() and its
    content is only values as long as no other request has been
@@ -2333,6 +2822,7 @@ parse_response (http_t hd)
     }
   if (!p2)
     return 0; /* Also assume http 0.9. */
+  hd->is_http_1_1 = !strcmp (p, "1.1");
   p = p2;
   /* TODO: Add HTTP version number check. */
   if ((p2 = strpbrk (p, " \t")))
@@ -2373,14 +2863,39 @@ parse_response (http_t hd)
     }
   while (len && *line);
 
+  /* Figure out how the body is delimited.  */
   cookie->content_length_valid = 0;
-  if (!(hd->flags & HTTP_FLAG_IGNORE_CL))
+  cookie->framing = FRAMING_NONE;
+  if (hd->status_code == 204 || hd->status_code == 304)
+    cookie->framing = FRAMING_DONE;  /* These never have a body.  */
+  else if ((s = http_get_header (hd, "Transfer-Encoding"))
+           && !ascii_strcasecmp (s, "chunked"))
+    cookie->framing = FRAMING_CHUNKED;
+  else if (!(hd->flags & HTTP_FLAG_IGNORE_CL))
     {
       s = http_get_header (hd, "Content-Length");
       if (s)
         {
           cookie->content_length_valid = 1;
           cookie->content_length = string_to_u64 (s);
+          if (!cookie->content_length)
+            cookie->framing = FRAMING_DONE;
+        }
+    }
+
+  /* Decide whether the connection may be reused once the body has
+   * been read.  */
+  if (hd->pool_key && hd->is_http_1_1
+      && (cookie->framing != FRAMING_NONE || cookie->content_length_valid)
+      && !header_has_token (http_get_header (hd, "Connection"), "close"))
+    {
+      cookie->pool_key = xtrystrdup (hd->pool_key);
+      if (cookie->pool_key)
+        {
+          cookie->keep_alive = 1;
+          s = http_get_header (hd, "Keep-Alive");
+          if (s && (s = strstr (s, "timeout=")))
+            cookie->keep_alive_timeout = atoi (s + 8);
         }
     }
 
@@ -2781,21 +3296,12 @@ write_server (assuan_fd_t sock, const char *data, size_t length)
 
 
 
-/* Read handler for estream.  */
+/* Read up to SIZE bytes from the connection of C.  */
 static gpgrt_ssize_t
-cookie_read (void *cookie, void *buffer, size_t size)
+cookie_read_raw (cookie_t c, void *buffer, size_t size)
 {
-  cookie_t c = cookie;
   int nread;
 
-  if (c->content_length_valid)
-    {
-      if (!c->content_length)
-        return 0; /* EOF */
-      if (c->content_length < size)
-        size = c->content_length;
-    }
-
 #if HTTP_USE_NTBTLS
   if (c->use_tls && c->session && c->session->tls_session)
     {
@@ -2845,23 +3351,245 @@ cookie_read (void *cookie, void *buffer, size_t size)
       nread = read_server (c->sock->fd, buffer, size);
     }
 
+  return (gpgrt_ssize_t)nread;
+}
+
+
+/* Make sure that the buffer of C has data.  Returns 1 on success, 0
+ * on EOF and -1 on error.  */
+static int
+fill_cookie_buffer (cookie_t c)
+{
+  gpgrt_ssize_t nread;
+
+  if (c->bufpos < c->buflen)
+    return 1;
+  if (!c->buf)
+    {
+      c->buf = xtrymalloc (COOKIE_BUFSIZE);
+      if (!c->buf)
+        return -1;
+    }
+  nread = cookie_read_raw (c, c->buf, COOKIE_BUFSIZE);
+  if (nread <= 0)
+    return nread? -1 : 0;
+  c->buflen = nread;
+  c->bufpos = 0;
+  return 1;
+}
+
+
+/* Read up to SIZE bytes from C with data left in the buffer taking
+ * precedence.  */
+static gpgrt_ssize_t
+cookie_read_buffered (cookie_t c, void *buffer, size_t size)
+{
+  size_t n;
+
+  if (c->bufpos == c->buflen)
+    return cookie_read_raw (c, buffer, size);
+
+  n = c->buflen - c->bufpos;
+  if (n > size)
+    n = size;
+  memcpy (buffer, c->buf + c->bufpos, n);
+  c->bufpos += n;
+  return n;
+}
+
+
+/* Read the header of the response but nothing beyond the empty line
+ * which terminates it.  Data following the header is kept in the
+ * buffer of C.  */
+static gpgrt_ssize_t
+cookie_read_header (cookie_t c, void *buffer, size_t size)
+{
+  const char *p;
+  size_t n;
+  int rc;
+
+  rc = fill_cookie_buffer (c);
+  if (rc <= 0)
+    return rc;
+
+  p = c->buf + c->bufpos;
+  for (n = 0; c->bufpos + n < c->buflen && n < size; )
+    {
+      switch (p[n++])
+        {
+        case '\n':
+          if (c->hdr_seen && ++c->hdr_nl == 2)
+            c->framing = FRAMING_DONE;
+          break;
+        case '\r':
+          break;
+        default:
+          c->hdr_seen = 1;
+          c->hdr_nl = 0;
+          break;
+        }
+      if (c->framing == FRAMING_DONE)
+        break;
+    }
+  memcpy (buffer, p, n);
+  c->bufpos += n;
+  return n;
+}
+
+
+/* Read a line of a chunked body into LINE which has a size of
+ * LINESIZE.  The line ending is stripped.  Returns 0 on success, -1
+ * on error.  */
+static int
+read_chunk_line (cookie_t c, char *line, size_t linesize)
+{
+  size_t n = 0;
+  int rc, ch;
+
+  for (;;)
+    {
+      rc = fill_cookie_buffer (c);
+      if (rc <= 0)
+        {
+          if (!rc)
+            gpg_err_set_errno (EIO); /* Premature EOF.  */
+          return -1;
+        }
+      ch = ((unsigned char *)c->buf)[c->bufpos++];
+      if (ch == '\n')
+        break;
+      if (n + 1 >= linesize)
+        {
+          gpg_err_set_errno (EIO); /* Line too long.  */
+          return -1;
+        }
+      line[n++] = ch;
+    }
+  if (n && line[n-1] == '\r')
+    n--;
+  line[n] = 0;
+  return 0;
+}
+
+
+/* Read handler for a body using the chunked transfer encoding.  */
+static gpgrt_ssize_t
+cookie_read_chunked (cookie_t c, void *buffer, size_t size)
+{
+  char line[MAX_CHUNK_LINELEN];
+  const char *s;
+  gpgrt_ssize_t nread;
+
+  while (!c->chunk_left)
+    {
+      if (c->chunk_crlf)
+        {
+          if (read_chunk_line (c, line, sizeof line))
+            return -1;
+          if (*line)
+            {
+              gpg_err_set_errno (EIO);
+              return -1;
+            }
+          c->chunk_crlf = 0;
+        }
+
+      /* Parse the chunk size and ignore the chunk extensions.  */
+      if (read_chunk_line (c, line, sizeof line))
+        return -1;
+      s = line;
+      if (!hexdigitp (s))
+        {
+          gpg_err_set_errno (EIO);
+          return -1;
+        }
+      for (; hexdigitp (s); s++)
+        {
+          if (c->chunk_left >> 60)
+            {
+              gpg_err_set_errno (EIO);
+              return -1;
+            }
+          c->chunk_left = (c->chunk_left << 4) | xtoi_1 (s);
+        }
+
+      if (!c->chunk_left)
+        {
+          /* This is the last chunk; skip the trailer.  */
+          do
+            {
+              if (read_chunk_line (c, line, sizeof line))
+                return -1;
+            }
+          while (*line);
+          c->framing = FRAMING_DONE;
+          return 0;
+        }
+    }
+
+  if (size > c->chunk_left)
+    size = c->chunk_left;
+  nread = cookie_read_buffered (c, buffer, size);
+  if (nread > 0)
+    {
+      c->chunk_left -= nread;
+      if (!c->chunk_left)
+        c->chunk_crlf = 1;
+    }
+  else if (!nread)
+    {
+      gpg_err_set_errno (EIO); /* Premature EOF.  */
+      nread = -1;
+    }
+
+  return nread;
+}
+
+
+/* Read handler for estream.  */
+static gpgrt_ssize_t
+cookie_read (void *cookie, void *buffer, size_t size)
+{
+  cookie_t c = cookie;
+  gpgrt_ssize_t nread;
+
+  switch (c->framing)
+    {
+    case FRAMING_HEADER:  return cookie_read_header (c, buffer, size);
+    case FRAMING_CHUNKED: return cookie_read_chunked (c, buffer, size);
+    case FRAMING_DONE:    return 0; /* EOF */
+    default: break;
+    }
+
+  if (c->content_length_valid)
+    {
+      if (!c->content_length)
+        return 0; /* EOF */
+      if (c->content_length < size)
+        size = c->content_length;
+    }
+
+  nread = cookie_read_buffered (c, buffer, size);
+
   if (c->content_length_valid && nread > 0)
     {
       if (nread < c->content_length)
         c->content_length -= nread;
       else
-        c->content_length = 0;
+        {
+          c->content_length = 0;
+          c->framing = FRAMING_DONE;
+        }
     }
 
-  return (gpgrt_ssize_t)nread;
+  return nread;
 }
 
-/* Write handler for estream.  */
+/* Write SIZE bytes from BUFFER to the connection of C.  */
 static gpgrt_ssize_t
-cookie_write (void *cookie, const void *buffer_arg, size_t size)
+cookie_write_raw (cookie_t c, const void *buffer_arg, size_t size)
 {
   const char *buffer = buffer_arg;
-  cookie_t c = cookie;
   int nwritten = 0;
 
 #if HTTP_USE_NTBTLS
@@ -2924,6 +3652,26 @@ cookie_write (void *cookie, const void *buffer_arg, size_t size)
 }
 
 
+/* Write handler for estream.  */
+static gpgrt_ssize_t
+cookie_write (void *cookie, const void *buffer, size_t size)
+{
+  cookie_t c = cookie;
+
+  if (!c->replay)
+    return cookie_write_raw (c, buffer, size);
+
+  /* On a reused connection we record the request so that it can be
+   * sent again over a new connection in case the server closed the
+   * idle connection meanwhile.  Write errors are ignored here because
+   * the missing response triggers the retry.  */
+  put_membuf (c->replay, buffer, size);
+  if (!c->write_failed && cookie_write_raw (c, buffer, size) < 0)
+    c->write_failed = 1;
+  return size;
+}
+
+
 #if defined(HAVE_W32_SYSTEM) && defined(HTTP_USE_NTBTLS)
 static gpgrt_ssize_t
 simple_cookie_read (void *cookie, void *buffer, size_t size)
@@ -2985,6 +3733,11 @@ cookie_close (void *cookie)
   if (!c)
     return 0;
 
+  /* Keep the connection if the response has been read completely.  */
+  if (c->keep_alive && c->framing == FRAMING_DONE
+      && c->bufpos == c->buflen && park_connection (c))
+    ;
+  else
 #if HTTP_USE_NTBTLS
   if (c->use_tls && c->session && c->session->tls_session)
     {
@@ -3003,6 +3756,8 @@ cookie_close (void *cookie)
 
   if (c->session)
     http_session_unref (c->session);
+  xfree (c->buf);
+  xfree (c->pool_key);
   xfree (c);
   return 0;
 }
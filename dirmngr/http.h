@@ -110,6 +110,8 @@ void http_set_verbose (int verbose, int debug);
 void http_register_tls_callback (gpg_error_t (*cb)(http_t,http_session_t,int));
 void http_register_tls_ca (const char *fname);
 void http_register_netactivity_cb (void (*cb)(void));
+void http_set_keep_alive (unsigned int timeout, unsigned int max_per_host);
+void http_flush_idle_connections (int all);
 
 
 gpg_error_t http_session_new (http_session_t *r_session,
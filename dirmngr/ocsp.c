@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <assert.h>
+#include <npth.h>
 
 #include "dirmngr.h"
 #include "misc.h"
@@ -30,10 +31,14 @@
 #include "validate.h"
 #include "certcache.h"
 #include "ocsp.h"
+#include "ocspcache.h"
 
 /* The maximum size we allow as a response from an OCSP reponder. */
 #define MAX_RESPONSE_SIZE 65536
 
+/* The maximum number of certificates we check with one request.  */
+#define MAX_TARGETS_PER_REQUEST 32
+
 
 static const char oidstr_ocsp[] = "1.3.6.1.5.5.7.48.1";
 
@@ -114,12 +119,13 @@ read_response (estream_t fp, unsigned char **r_buffer, size_t *r_buflen)
 }
 
 
-/* Construct an OCSP request, send it to the configured OCSP responder
-   and parse the response. On success the OCSP context may be used to
-   further process the response. */
+/* Construct an OCSP request for the targets already added to OCSP,
+   send it to the configured OCSP responder and parse the response. On
+   success the OCSP context may be used to further process the
+   response. */
 static gpg_error_t
 do_ocsp_request (ctrl_t ctrl, ksba_ocsp_t ocsp, gcry_md_hd_t md,
-                 const char *url, ksba_cert_t cert, ksba_cert_t issuer_cert)
+                 const char *url)
 {
   gpg_error_t err;
   unsigned char *request, *response;
@@ -146,13 +152,6 @@ do_ocsp_request (ctrl_t ctrl, ksba_ocsp_t ocsp, gcry_md_hd_t md,
       return gpg_error (GPG_ERR_NOT_SUPPORTED);
     }
 
-  err = ksba_ocsp_add_target (ocsp, cert, issuer_cert);
-  if (err)
-    {
-      log_error (_("error setting OCSP target: %s\n"), gpg_strerror (err));
-      return err;
-    }
-
   {
     size_t n;
     unsigned char nonce[32];
@@ -309,10 +308,13 @@ do_ocsp_request (ctrl_t ctrl, ksba_ocsp_t ocsp, gcry_md_hd_t md,
 
 /* Validate that CERT is indeed valid to sign an OCSP response. If
    SIGNER_FPR_LIST is not NULL we simply check that CERT matches one
-   of the fingerprints in this list. */
+   of the fingerprints in this list.  If the client has been asked
+   to validate CERT and R_SIGNER_FPR is not NULL, the fingerprint of
+   CERT is stored there. */
 static gpg_error_t
 validate_responder_cert (ctrl_t ctrl, ksba_cert_t cert,
-                         fingerprint_list_t signer_fpr_list)
+                         fingerprint_list_t signer_fpr_list,
+                         char **r_signer_fpr)
 {
   gpg_error_t err;
   char *fpr;
@@ -352,7 +354,13 @@ validate_responder_cert (ctrl_t ctrl, ksba_cert_t cert,
          all. */
       fpr = get_fingerprint_hexstring (cert);
       dirmngr_status (ctrl, "ONLY_VALID_IF_CERT_VALID", fpr, NULL);
-      xfree (fpr);
+      if (r_signer_fpr)
+        {
+          xfree (*r_signer_fpr);
+          *r_signer_fpr = fpr;
+        }
+      else
+        xfree (fpr);
       err = 0;
     }
 
@@ -363,7 +371,8 @@ validate_responder_cert (ctrl_t ctrl, ksba_cert_t cert,
 /* Helper for check_signature. */
 static int
 check_signature_core (ctrl_t ctrl, ksba_cert_t cert, gcry_sexp_t s_sig,
-                      gcry_sexp_t s_hash, fingerprint_list_t signer_fpr_list)
+                      gcry_sexp_t s_hash, fingerprint_list_t signer_fpr_list,
+                      char **r_signer_fpr)
 {
   gpg_error_t err;
   ksba_sexp_t pubkey;
@@ -378,7 +387,8 @@ check_signature_core (ctrl_t ctrl, ksba_cert_t cert, gcry_sexp_t s_sig,
   if (!err)
     err = gcry_pk_verify (s_sig, s_hash, s_pkey);
   if (!err)
-    err = validate_responder_cert (ctrl, cert, signer_fpr_list);
+    err = validate_responder_cert (ctrl, cert, signer_fpr_list,
+                                   r_signer_fpr);
   if (!err)
     {
       gcry_sexp_release (s_pkey);
@@ -396,11 +406,11 @@ check_signature_core (ctrl_t ctrl, ksba_cert_t cert, gcry_sexp_t s_sig,
    the response.  This function automagically finds the correct public
    key.  If SIGNER_FPR_LIST is not NULL, the default OCSP reponder has been
    used and thus the certificate is one of those identified by
-   the fingerprints. */
+   the fingerprints.  R_SIGNER_FPR is passed to validate_responder_cert. */
 static gpg_error_t
 check_signature (ctrl_t ctrl,
                  ksba_ocsp_t ocsp, gcry_sexp_t s_sig, gcry_md_hd_t md,
-                 fingerprint_list_t signer_fpr_list)
+                 fingerprint_list_t signer_fpr_list, char **r_signer_fpr)
 {
   gpg_error_t err;
   int algo, cert_idx;
@@ -438,7 +448,7 @@ check_signature (ctrl_t ctrl,
       if (cert)
         {
           err = check_signature_core (ctrl, cert, s_sig, s_hash,
-                                      signer_fpr_list);
+                                      signer_fpr_list, r_signer_fpr);
           ksba_cert_release (cert);
           cert = NULL;
           if (!err)
@@ -502,7 +512,7 @@ check_signature (ctrl_t ctrl,
       if (cert)
         {
           err = check_signature_core (ctrl, cert, s_sig, s_hash,
-                                      signer_fpr_list);
+                                      signer_fpr_list, r_signer_fpr);
           ksba_cert_release (cert);
           if (!err)
             {
@@ -518,80 +528,127 @@ check_signature (ctrl_t ctrl,
 }
 
 
-/* Check whether the certificate either given by fingerprint CERT_FPR
-   or directly through the CERT object is valid by running an OCSP
-   transaction.  With FORCE_DEFAULT_RESPONDER set only the configured
-   default responder is used. */
-gpg_error_t
-ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
-              int force_default_responder)
+/* Log the certificate status ST if requested and return the error
+   code matching it.  In case CERT has been revoked, our cached
+   validation status is invalidated.  */
+static gpg_error_t
+evaluate_status (ksba_cert_t cert, ocsp_status_t st)
 {
   gpg_error_t err;
-  ksba_ocsp_t ocsp = NULL;
-  ksba_cert_t issuer_cert = NULL;
-  ksba_sexp_t sigval = NULL;
-  gcry_sexp_t s_sig = NULL;
-  ksba_isotime_t current_time;
-  ksba_isotime_t this_update, next_update, revocation_time, produced_at;
-  ksba_isotime_t tmp_time;
-  ksba_status_t status;
-  ksba_crl_reason_t reason;
-  char *url_buffer = NULL;
-  const char *url;
-  gcry_md_hd_t md = NULL;
-  int i, idx;
-  char *oid;
-  ksba_name_t name;
-  fingerprint_list_t default_signer = NULL;
 
-  /* Get the certificate.  */
-  if (cert)
+  /* In case the certificate has been revoked, we better invalidate
+     our cached validation status. */
+  if (st->status == KSBA_STATUS_REVOKED)
     {
-      ksba_cert_ref (cert);
-
-      err = find_issuing_cert (ctrl, cert, &issuer_cert);
+      time_t validated_at = 0; /* That is: No cached validation available. */
+      err = ksba_cert_set_user_data (cert, "validated_at",
+                                     &validated_at, sizeof (validated_at));
       if (err)
         {
-          log_error (_("issuer certificate not found: %s\n"),
+          log_error ("set_user_data(validated_at) failed: %s\n",
                      gpg_strerror (err));
-          goto leave;
+          /* The certificate is anyway revoked, and that is a more
+             important message than the failure of our cache. */
         }
     }
-  else
+
+
+  if (opt.verbose)
     {
-      cert = get_cert_local (ctrl, cert_fpr);
-      if (!cert)
-        {
-          log_error (_("caller did not return the target certificate\n"));
-          err = gpg_error (GPG_ERR_GENERAL);
-          goto leave;
-        }
-      issuer_cert = get_issuing_cert_local (ctrl, NULL);
-      if (!issuer_cert)
-        {
-          log_error (_("caller did not return the issuing certificate\n"));
-          err = gpg_error (GPG_ERR_GENERAL);
-          goto leave;
-        }
+      log_info (_("certificate status is: %s  (this=%s  next=%s)\n"),
+                st->status == KSBA_STATUS_GOOD? _("good"):
+                st->status == KSBA_STATUS_REVOKED? _("revoked"):
+                st->status == KSBA_STATUS_UNKNOWN? _("unknown"):
+                st->status == KSBA_STATUS_NONE? _("none"): "?",
+                st->this_update, st->next_update);
+      if (st->status == KSBA_STATUS_REVOKED)
+        log_info (_("certificate has been revoked at: %s due to: %s\n"),
+                  st->revocation_time,
+                  st->reason == KSBA_CRLREASON_UNSPECIFIED?   "unspecified":
+                  st->reason == KSBA_CRLREASON_KEY_COMPROMISE? "key compromise":
+                  st->reason == KSBA_CRLREASON_CA_COMPROMISE?   "CA compromise":
+                  st->reason == KSBA_CRLREASON_AFFILIATION_CHANGED?
+                                                      "affiliation changed":
+                  st->reason == KSBA_CRLREASON_SUPERSEDED?   "superseded":
+                  st->reason == KSBA_CRLREASON_CESSATION_OF_OPERATION?
+                                                  "cessation of operation":
+                  st->reason == KSBA_CRLREASON_CERTIFICATE_HOLD?
+                                                  "certificate on hold":
+                  st->reason == KSBA_CRLREASON_REMOVE_FROM_CRL?
+                                                  "removed from CRL":
+                  st->reason == KSBA_CRLREASON_PRIVILEGE_WITHDRAWN?
+                                                  "privilege withdrawn":
+                  st->reason == KSBA_CRLREASON_AA_COMPROMISE? "AA compromise":
+                  st->reason == KSBA_CRLREASON_OTHER?   "other":"?");
+
     }
 
-  /* Create an OCSP instance.  */
-  err = ksba_ocsp_new (&ocsp);
-  if (err)
+
+  if (st->status == KSBA_STATUS_REVOKED)
+    err = gpg_error (GPG_ERR_CERT_REVOKED);
+  else if (st->status == KSBA_STATUS_UNKNOWN)
+    err = gpg_error (GPG_ERR_NO_DATA);
+  else if (st->status != KSBA_STATUS_GOOD)
+    err = gpg_error (GPG_ERR_GENERAL);
+  else
+    err = 0;
+
+  return err;
+}
+
+
+/* A certificate to be checked along with the result of the check.  */
+struct ocsp_target_s
+{
+  ksba_cert_t cert;
+  ksba_cert_t issuer_cert;
+  char *url;                /* The responder to ask (malloced).  */
+  gpg_error_t err;          /* The result of the check.  */
+  struct ocsp_status_s st;  /* The status as returned by the responder.  */
+  unsigned int cacheable:1; /* ST passed all checks.  */
+  unsigned int done:1;      /* No need to ask the responder.  */
+};
+typedef struct ocsp_target_s *ocsp_target_t;
+
+
+/* Release the resources of the N targets at TARGETS but not the
+   array itself.  */
+static void
+release_targets (ocsp_target_t targets, int n)
+{
+  int i;
+
+  for (i=0; i < n; i++)
     {
-      log_error (_("failed to allocate OCSP context: %s\n"),
-                 gpg_strerror (err));
-      goto leave;
+      ksba_cert_release (targets[i].cert);
+      ksba_cert_release (targets[i].issuer_cert);
+      xfree (targets[i].url);
+      xfree (targets[i].st.signer_fpr);
     }
+}
 
 
-
-  /* Figure out the OCSP responder to use.
+/* Figure out the OCSP responder to use for CERT and store it as a
+   malloced string at R_URL.  R_VIA_DEFAULT is set if that is the
+   default responder.
      1. Try to get the reponder from the certificate.
         We do only take http and https style URIs into account.
      2. If this fails use the default responder, if any.
-   */
-  url = NULL;
+   With FORCE_DEFAULT_RESPONDER set only the default responder is
+   used. */
+static gpg_error_t
+get_responder_url (ksba_cert_t cert, int force_default_responder,
+                   char **r_url, int *r_via_default)
+{
+  gpg_error_t err = 0;
+  char *url = NULL;
+  int i, idx;
+  char *oid;
+  ksba_name_t name;
+
+  *r_url = NULL;
+  *r_via_default = 0;
+
   for (idx=0; !url && !opt.ignore_ocsp_service_url && !force_default_responder
          && !(err=ksba_cert_get_authority_info_access (cert, idx,
                                                        &oid, &name)); idx++)
@@ -603,7 +660,7 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
               char *p = ksba_name_get_uri (name, i);
               if (p && (!ascii_strncasecmp (p, "http:", 5)
                         || !ascii_strncasecmp (p, "https:", 6)))
-                url = url_buffer = p;
+                url = p;
               else
                 xfree (p);
             }
@@ -614,24 +671,25 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
   if (err && gpg_err_code (err) != GPG_ERR_EOF)
     {
       log_error (_("can't get authorityInfoAccess: %s\n"), gpg_strerror (err));
-      goto leave;
+      xfree (url);
+      return err;
     }
   if (!url)
     {
       if (!opt.ocsp_responder || !*opt.ocsp_responder)
         {
           log_info (_("no default OCSP responder defined\n"));
-          err = gpg_error (GPG_ERR_CONFIGURATION);
-          goto leave;
+          return gpg_error (GPG_ERR_CONFIGURATION);
         }
       if (!opt.ocsp_signer)
         {
           log_info (_("no default OCSP signer defined\n"));
-          err = gpg_error (GPG_ERR_CONFIGURATION);
-          goto leave;
+          return gpg_error (GPG_ERR_CONFIGURATION);
         }
-      url = opt.ocsp_responder;
-      default_signer = opt.ocsp_signer;
+      url = xtrystrdup (opt.ocsp_responder);
+      if (!url)
+        return gpg_error_from_syserror ();
+      *r_via_default = 1;
       if (opt.verbose)
         log_info (_("using default OCSP responder '%s'\n"), url);
     }
@@ -641,6 +699,107 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
         log_info (_("using OCSP responder '%s'\n"), url);
     }
 
+  *r_url = url;
+  return 0;
+}
+
+
+/* Check the times of the status ST against the current time.  Return
+   true if they are acceptable.  If not, R_ERR is set to an error
+   code unless it already has one.  */
+static int
+check_status_times (ocsp_status_t st, gpg_error_t *r_err)
+{
+  ksba_isotime_t current_time;
+  ksba_isotime_t tmp_time;
+  int okay = 1;
+
+  /* Allow for some clock skew. */
+  gnupg_get_isotime (current_time);
+  add_seconds_to_isotime (current_time, opt.ocsp_max_clock_skew);
+
+  if (strcmp (st->this_update, current_time) > 0 )
+    {
+      log_error (_("OCSP responder returned a status in the future\n"));
+      log_info ("used now: %s  this_update: %s\n",
+                current_time, st->this_update);
+      okay = 0;
+    }
+
+  /* Check that THIS_UPDATE is not too far back in the past. */
+  gnupg_copy_time (tmp_time, st->this_update);
+  add_seconds_to_isotime (tmp_time,
+                          opt.ocsp_max_period+opt.ocsp_max_clock_skew);
+  if (!*tmp_time || strcmp (tmp_time, current_time) < 0 )
+    {
+      log_error (_("OCSP responder returned a non-current status\n"));
+      log_info ("used now: %s  this_update: %s\n",
+                current_time, st->this_update);
+      okay = 0;
+    }
+
+  /* Check that we are not beyound NEXT_UPDATE  (plus some extra time). */
+  if (*st->next_update)
+    {
+      gnupg_copy_time (tmp_time, st->next_update);
+      add_seconds_to_isotime (tmp_time,
+                              opt.ocsp_current_period+opt.ocsp_max_clock_skew);
+      if (!*tmp_time && strcmp (tmp_time, current_time) < 0 )
+        {
+          log_error (_("OCSP responder returned an too old status\n"));
+          log_info ("used now: %s  next_update: %s\n",
+                    current_time, st->next_update);
+          okay = 0;
+        }
+    }
+
+  if (!okay && !*r_err)
+    *r_err = gpg_error (GPG_ERR_TIME_CONFLICT);
+  return okay;
+}
+
+
+/* Ask the responder at URL about the NTARGETS certificates given by
+   TARGETS using a single request.  VIA_DEFAULT tells that URL is the
+   default responder.  The results are stored in the targets. */
+static void
+query_responder (ctrl_t ctrl, ocsp_target_t *targets, int ntargets,
+                 const char *url, int via_default)
+{
+  gpg_error_t err;
+  ksba_ocsp_t ocsp = NULL;
+  ksba_sexp_t sigval = NULL;
+  gcry_sexp_t s_sig = NULL;
+  ksba_isotime_t produced_at;
+  gcry_md_hd_t md = NULL;
+  char *signer_fpr = NULL;
+  ocsp_target_t t;
+  int i;
+
+  if (opt.verbose && ntargets > 1)
+    log_info ("checking %d certificates with one OCSP request\n", ntargets);
+
+  /* Create an OCSP instance.  */
+  err = ksba_ocsp_new (&ocsp);
+  if (err)
+    {
+      log_error (_("failed to allocate OCSP context: %s\n"),
+                 gpg_strerror (err));
+      goto leave;
+    }
+
+  for (i=0; i < ntargets; i++)
+    {
+      err = ksba_ocsp_add_target (ocsp, targets[i]->cert,
+                                  targets[i]->issuer_cert);
+      if (err)
+        {
+          log_error (_("error setting OCSP target: %s\n"),
+                     gpg_strerror (err));
+          goto leave;
+        }
+    }
+
   /* Ask the OCSP responder. */
   err = gcry_md_open (&md, GCRY_MD_SHA1, 0);
   if (err)
@@ -649,7 +808,7 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
                  gpg_strerror (err));
       goto leave;
     }
-  err = do_ocsp_request (ctrl, ocsp, md, url, cert, issuer_cert);
+  err = do_ocsp_request (ctrl, ocsp, md, url);
   if (err)
     goto leave;
 
@@ -664,132 +823,343 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
     goto leave;
   xfree (sigval);
   sigval = NULL;
-  err = check_signature (ctrl, ocsp, s_sig, md, default_signer);
+  err = check_signature (ctrl, ocsp, s_sig, md,
+                         via_default? opt.ocsp_signer : NULL, &signer_fpr);
   if (err)
     goto leave;
 
-  /* We only support one certificate per request.  Check that the
-     answer matches the right certificate. */
-  err = ksba_ocsp_get_status (ocsp, cert,
-                              &status, this_update, next_update,
-                              revocation_time, &reason);
+  /* Now pick the answer for each certificate. */
+  for (i=0; i < ntargets; i++)
+    {
+      t = targets[i];
+      t->st.via_default = !!via_default;
+      t->err = ksba_ocsp_get_status (ocsp, t->cert,
+                                     &t->st.status,
+                                     t->st.this_update, t->st.next_update,
+                                     t->st.revocation_time, &t->st.reason);
+      if (t->err)
+        {
+          log_error (_("error getting OCSP status for target"
+                       " certificate: %s\n"), gpg_strerror (t->err));
+          continue;
+        }
+      if (signer_fpr)
+        {
+          t->st.signer_fpr = xtrystrdup (signer_fpr);
+          if (!t->st.signer_fpr)
+            {
+              t->err = gpg_error_from_syserror ();
+              continue;
+            }
+        }
+
+      t->err = evaluate_status (t->cert, &t->st);
+      if (check_status_times (&t->st, &t->err)
+          && (!t->err || gpg_err_code (t->err) == GPG_ERR_CERT_REVOKED))
+        t->cacheable = 1;
+    }
+
+ leave:
   if (err)
+    for (i=0; i < ntargets; i++)
+      targets[i]->err = err;
+  gcry_md_close (md);
+  gcry_sexp_release (s_sig);
+  xfree (sigval);
+  xfree (signer_fpr);
+  ksba_ocsp_release (ocsp);
+}
+
+
+/* Run the OCSP transactions for all NTARGETS certificates in TARGETS
+   not yet marked as done.  Certificates handled by the same responder
+   are put into one request.  With FORCE_DEFAULT_RESPONDER set only
+   the configured default responder is used. */
+static void
+query_targets (ctrl_t ctrl, ocsp_target_t targets, int ntargets,
+               int force_default_responder)
+{
+  ocsp_target_t batch[MAX_TARGETS_PER_REQUEST];
+  int nbatch;
+  int i, j;
+  int via_default;
+
+  for (i=0; i < ntargets; i++)
     {
-      log_error (_("error getting OCSP status for target certificate: %s\n"),
-                 gpg_strerror (err));
-      goto leave;
+      if (targets[i].done)
+        continue;
+      targets[i].err = get_responder_url (targets[i].cert,
+                                          force_default_responder,
+                                          &targets[i].url, &via_default);
+      targets[i].st.via_default = !!via_default;
+      if (targets[i].err)
+        targets[i].done = 1;
     }
 
-  /* In case the certificate has been revoked, we better invalidate
-     our cached validation status. */
-  if (status == KSBA_STATUS_REVOKED)
+  for (i=0; i < ntargets; i++)
     {
-      time_t validated_at = 0; /* That is: No cached validation available. */
-      err = ksba_cert_set_user_data (cert, "validated_at",
-                                     &validated_at, sizeof (validated_at));
-      if (err)
-        {
-          log_error ("set_user_data(validated_at) failed: %s\n",
-                     gpg_strerror (err));
-          err = 0; /* The certificate is anyway revoked, and that is a
-                      more important message than the failure of our
-                      cache. */
-        }
+      if (targets[i].done)
+        continue;
+      nbatch = 0;
+      for (j=i; j < ntargets && nbatch < DIM (batch); j++)
+        if (!targets[j].done
+            && targets[j].st.via_default == targets[i].st.via_default
+            && !strcmp (targets[j].url, targets[i].url))
+          {
+            targets[j].done = 1;
+            batch[nbatch++] = targets + j;
+          }
+      query_responder (ctrl, batch, nbatch, targets[i].url,
+                       targets[i].st.via_default);
     }
+}
+
 
+/* Parameters for refresh_thread.  */
+struct refresh_parm_s
+{
+  ksba_cert_t cert;
+  ksba_cert_t issuer_cert;
+  int force_default_responder;
+  char *http_proxy;
+  unsigned int http_no_crl:1;
+};
+
+
+/* Thread to replace a stale cache entry by a fresh response.  */
+static void *
+refresh_thread (void *arg)
+{
+  struct refresh_parm_s *parm = arg;
+  struct server_control_s ctrlbuf;
+  struct ocsp_target_s target;
+
+  memset (&ctrlbuf, 0, sizeof ctrlbuf);
+  dirmngr_init_default_ctrl (&ctrlbuf);
+  xfree (ctrlbuf.http_proxy);
+  ctrlbuf.http_proxy = parm->http_proxy;
+  ctrlbuf.http_no_crl = parm->http_no_crl;
+
+  memset (&target, 0, sizeof target);
+  target.cert = parm->cert;
+  target.issuer_cert = parm->issuer_cert;
 
   if (opt.verbose)
-    {
-      log_info (_("certificate status is: %s  (this=%s  next=%s)\n"),
-                status == KSBA_STATUS_GOOD? _("good"):
-                status == KSBA_STATUS_REVOKED? _("revoked"):
-                status == KSBA_STATUS_UNKNOWN? _("unknown"):
-                status == KSBA_STATUS_NONE? _("none"): "?",
-                this_update, next_update);
-      if (status == KSBA_STATUS_REVOKED)
-        log_info (_("certificate has been revoked at: %s due to: %s\n"),
-                  revocation_time,
-                  reason == KSBA_CRLREASON_UNSPECIFIED?   "unspecified":
-                  reason == KSBA_CRLREASON_KEY_COMPROMISE? "key compromise":
-                  reason == KSBA_CRLREASON_CA_COMPROMISE?   "CA compromise":
-                  reason == KSBA_CRLREASON_AFFILIATION_CHANGED?
-                                                      "affiliation changed":
-                  reason == KSBA_CRLREASON_SUPERSEDED?   "superseded":
-                  reason == KSBA_CRLREASON_CESSATION_OF_OPERATION?
-                                                  "cessation of operation":
-                  reason == KSBA_CRLREASON_CERTIFICATE_HOLD?
-                                                  "certificate on hold":
-                  reason == KSBA_CRLREASON_REMOVE_FROM_CRL?
-                                                  "removed from CRL":
-                  reason == KSBA_CRLREASON_PRIVILEGE_WITHDRAWN?
-                                                  "privilege withdrawn":
-                  reason == KSBA_CRLREASON_AA_COMPROMISE? "AA compromise":
-                  reason == KSBA_CRLREASON_OTHER?   "other":"?");
+    log_info ("refreshing cached OCSP status\n");
+  query_targets (&ctrlbuf, &target, 1, parm->force_default_responder);
+  if (target.cacheable)
+    ocsp_cache_put (target.cert, target.issuer_cert, &target.st);
+  else
+    ocsp_cache_refresh_failed (target.cert, target.issuer_cert);
+
+  release_targets (&target, 1);
+  release_ctrl_ocsp_certs (&ctrlbuf);
+  dirmngr_deinit_default_ctrl (&ctrlbuf);
+  xfree (parm);
+  return NULL;
+}
+
 
+/* Start a thread to refresh the cached status of CERT.  */
+static void
+start_refresh (ctrl_t ctrl, ksba_cert_t cert, ksba_cert_t issuer_cert,
+               int force_default_responder)
+{
+  struct refresh_parm_s *parm;
+  npth_t thread;
+  npth_attr_t tattr;
+  int rc;
+
+  parm = xtrycalloc (1, sizeof *parm);
+  if (!parm)
+    goto failed;
+  if (ctrl->http_proxy)
+    {
+      parm->http_proxy = xtrystrdup (ctrl->http_proxy);
+      if (!parm->http_proxy)
+        goto failed;
     }
+  parm->http_no_crl = ctrl->http_no_crl;
+  parm->force_default_responder = force_default_responder;
+  ksba_cert_ref (cert);
+  parm->cert = cert;
+  ksba_cert_ref (issuer_cert);
+  parm->issuer_cert = issuer_cert;
+
+  rc = npth_attr_init (&tattr);
+  if (rc)
+    {
+      log_error ("error preparing OCSP refresh thread: %s\n", strerror (rc));
+      goto failed;
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+  rc = npth_create (&thread, &tattr, refresh_thread, parm);
+  npth_attr_destroy (&tattr);
+  if (rc)
+    {
+      log_error ("error spawning OCSP refresh thread: %s\n", strerror (rc));
+      goto failed;
+    }
+  return;
 
+ failed:
+  if (parm)
+    {
+      ksba_cert_release (parm->cert);
+      ksba_cert_release (parm->issuer_cert);
+      xfree (parm->http_proxy);
+      xfree (parm);
+    }
+  ocsp_cache_refresh_failed (cert, issuer_cert);
+}
 
-  if (status == KSBA_STATUS_REVOKED)
-    err = gpg_error (GPG_ERR_CERT_REVOKED);
-  else if (status == KSBA_STATUS_UNKNOWN)
-    err = gpg_error (GPG_ERR_NO_DATA);
-  else if (status != KSBA_STATUS_GOOD)
-    err = gpg_error (GPG_ERR_GENERAL);
 
-  /* Allow for some clock skew. */
-  gnupg_get_isotime (current_time);
-  add_seconds_to_isotime (current_time, opt.ocsp_max_clock_skew);
+/* Check the NTARGETS certificates in TARGETS which are not yet marked
+   as done.  Cached responses are used if possible; the others are
+   fetched and then put into the cache.  */
+static void
+check_targets (ctrl_t ctrl, ocsp_target_t targets, int ntargets,
+               int force_default_responder)
+{
+  ocsp_target_t t;
+  ocsp_cache_result_t cached;
+  int i;
 
-  if (strcmp (this_update, current_time) > 0 )
+  /* Try the cache first.  A stale entry is used as well but we then
+     ask the responder in the background.  */
+  for (i=0; i < ntargets; i++)
     {
-      log_error (_("OCSP responder returned a status in the future\n"));
-      log_info ("used now: %s  this_update: %s\n", current_time, this_update);
-      if (!err)
-        err = gpg_error (GPG_ERR_TIME_CONFLICT);
+      t = targets + i;
+      if (t->done)
+        continue;
+      cached = ocsp_cache_get (t->cert, t->issuer_cert,
+                               force_default_responder, &t->st);
+      if (cached == OCSP_CACHE_MISS)
+        continue;
+
+      if (opt.verbose)
+        log_info (_("using cached OCSP status\n"));
+      if (t->st.signer_fpr)
+        dirmngr_status (ctrl, "ONLY_VALID_IF_CERT_VALID",
+                        t->st.signer_fpr, NULL);
+      t->err = evaluate_status (t->cert, &t->st);
+      if (cached == OCSP_CACHE_STALE)
+        start_refresh (ctrl, t->cert, t->issuer_cert,
+                       force_default_responder);
+      t->done = 1;
     }
 
-  /* Check that THIS_UPDATE is not too far back in the past. */
-  gnupg_copy_time (tmp_time, this_update);
-  add_seconds_to_isotime (tmp_time,
-                          opt.ocsp_max_period+opt.ocsp_max_clock_skew);
-  if (!*tmp_time || strcmp (tmp_time, current_time) < 0 )
+  query_targets (ctrl, targets, ntargets, force_default_responder);
+
+  for (i=0; i < ntargets; i++)
+    if (targets[i].cacheable)
+      ocsp_cache_put (targets[i].cert, targets[i].issuer_cert,
+                      &targets[i].st);
+}
+
+
+/* Check whether the certificate either given by fingerprint CERT_FPR
+   or directly through the CERT object is valid by running an OCSP
+   transaction.  With FORCE_DEFAULT_RESPONDER set only the configured
+   default responder is used.  Responses are cached; see
+   ocspcache.c. */
+gpg_error_t
+ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
+              int force_default_responder)
+{
+  gpg_error_t err;
+  ksba_cert_t issuer_cert = NULL;
+  struct ocsp_target_s target;
+
+  memset (&target, 0, sizeof target);
+
+  /* Get the certificate.  */
+  if (cert)
     {
-      log_error (_("OCSP responder returned a non-current status\n"));
-      log_info ("used now: %s  this_update: %s\n",
-                current_time, this_update);
-      if (!err)
-        err = gpg_error (GPG_ERR_TIME_CONFLICT);
-    }
+      ksba_cert_ref (cert);
 
-  /* Check that we are not beyound NEXT_UPDATE  (plus some extra time). */
-  if (*next_update)
+      err = find_issuing_cert (ctrl, cert, &issuer_cert);
+      if (err)
+        {
+          log_error (_("issuer certificate not found: %s\n"),
+                     gpg_strerror (err));
+          goto leave;
+        }
+    }
+  else
     {
-      gnupg_copy_time (tmp_time, next_update);
-      add_seconds_to_isotime (tmp_time,
-                              opt.ocsp_current_period+opt.ocsp_max_clock_skew);
-      if (!*tmp_time && strcmp (tmp_time, current_time) < 0 )
+      cert = get_cert_local (ctrl, cert_fpr);
+      if (!cert)
         {
-          log_error (_("OCSP responder returned an too old status\n"));
-          log_info ("used now: %s  next_update: %s\n",
-                    current_time, next_update);
-          if (!err)
-            err = gpg_error (GPG_ERR_TIME_CONFLICT);
+          log_error (_("caller did not return the target certificate\n"));
+          err = gpg_error (GPG_ERR_GENERAL);
+          goto leave;
+        }
+      issuer_cert = get_issuing_cert_local (ctrl, NULL);
+      if (!issuer_cert)
+        {
+          log_error (_("caller did not return the issuing certificate\n"));
+          err = gpg_error (GPG_ERR_GENERAL);
+          goto leave;
         }
     }
 
+  target.cert = cert;
+  target.issuer_cert = issuer_cert;
+  cert = issuer_cert = NULL;
+  check_targets (ctrl, &target, 1, force_default_responder);
+  err = target.err;
 
  leave:
-  gcry_md_close (md);
-  gcry_sexp_release (s_sig);
-  xfree (sigval);
+  release_targets (&target, 1);
   ksba_cert_release (issuer_cert);
   ksba_cert_release (cert);
-  ksba_ocsp_release (ocsp);
-  xfree (url_buffer);
   return err;
 }
 
 
+/* Check the validity of the NCERTS certificates in the array CERTS
+   like ocsp_isvalid does.  The result for each certificate is stored
+   at the same index in R_ERRS.  Certificates handled by the same
+   responder are checked with a single request.  Returns an error
+   only if the function failed as a whole.  */
+gpg_error_t
+ocsp_isvalid_many (ctrl_t ctrl, ksba_cert_t *certs, gpg_error_t *r_errs,
+                   int ncerts, int force_default_responder)
+{
+  ocsp_target_t targets;
+  int i;
+
+  if (!ncerts)
+    return 0;
+  targets = xtrycalloc (ncerts, sizeof *targets);
+  if (!targets)
+    return gpg_error_from_syserror ();
+
+  for (i=0; i < ncerts; i++)
+    {
+      ksba_cert_ref (certs[i]);
+      targets[i].cert = certs[i];
+      targets[i].err = find_issuing_cert (ctrl, certs[i],
+                                          &targets[i].issuer_cert);
+      if (targets[i].err)
+        {
+          log_error (_("issuer certificate not found: %s\n"),
+                     gpg_strerror (targets[i].err));
+          targets[i].done = 1;
+        }
+    }
+
+  check_targets (ctrl, targets, ncerts, force_default_responder);
+
+  for (i=0; i < ncerts; i++)
+    r_errs[i] = targets[i].err;
+  release_targets (targets, ncerts);
+  xfree (targets);
+  return 0;
+}
+
+
 /* Release the list of OCSP certificates hold in the CTRL object. */
 void
 release_ctrl_ocsp_certs (ctrl_t ctrl)
@@ -25,6 +25,11 @@
 gpg_error_t ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
                           int force_default_responder);
 
+/* Check the validity of several certificates at once.  */
+gpg_error_t ocsp_isvalid_many (ctrl_t ctrl, ksba_cert_t *certs,
+                               gpg_error_t *r_errs, int ncerts,
+                               int force_default_responder);
+
 /* Release the list of OCSP certificates hold in the CTRL object. */
 void release_ctrl_ocsp_certs (ctrl_t ctrl);
 
@@ -0,0 +1,643 @@
+/* ocspcache.c - OCSP response cache
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of DirMngr.
+ *
+ * DirMngr is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * DirMngr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* The OCSP cache keeps the verified status of certificates as
+   returned by OCSP responders.  Entries are keyed by the keygrip of
+   the issuer's public key and the serial number of the certificate;
+   this is the same information an OCSP CertID carries.  Only
+   responses with a nextUpdate are stored and an entry is used as
+   long as nextUpdate has not been reached.  If --ocsp-stale-period
+   is set, an entry may also be used for that many seconds after
+   nextUpdate while the caller fetches a fresh response in the
+   background.  An entry is never used once its thisUpdate is older
+   than --ocsp-max-period, which is the limit for fresh responses.
+
+   If --ocsp-cache-persist is used the cache is written to the file
+   "ocsp-cache.txt" in the cache directory.  The file is a simple
+   line oriented text file:
+
+     v 1
+     KEY STATUS THIS_UPDATE NEXT_UPDATE REV_TIME REASON FLAGS SIGNER
+
+   KEY is the hex encoded keygrip of the issuer, a dot and the hex
+   encoded serial number.  STATUS is "g" for good or "r" for revoked.
+   The times are ISO times, REASON is the numeric CRL reason and
+   FLAGS is "d" if the default responder was used or "-".  SIGNER is
+   the fingerprint of a responder certificate which the client still
+   needs to validate or "-".  Empty time fields are given as "-".
+
+   Because nPth runs only one thread at a time and none of the
+   functions modifying the cache may block, no locking is
+   required.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "dirmngr.h"
+#include "misc.h"
+#include "../common/membuf.h"
+#include "ocspcache.h"
+
+/* The name of the file to persist the cache.  */
+#define OCSPCACHE_FILE "ocsp-cache.txt"
+
+/* The version of the file format.  */
+#define OCSPCACHE_VERSION 1
+
+/* The number of hash buckets.  */
+#define OCSPCACHE_BUCKETS 256
+
+
+/* An entry in the cache.  */
+struct ocsp_cache_item_s
+{
+  struct ocsp_cache_item_s *next;
+  time_t last_used;
+  struct ocsp_status_s st;
+  unsigned int refreshing:1;  /* A refresh has been started.  */
+  char key[1];
+};
+typedef struct ocsp_cache_item_s *ocsp_cache_item_t;
+
+
+static ocsp_cache_item_t cache_table[OCSPCACHE_BUCKETS];
+static unsigned int cache_count;
+static int cache_dirty;
+
+/* Some counters for the stats.  */
+static struct
+{
+  unsigned long hits;
+  unsigned long stale;
+  unsigned long misses;
+  unsigned long stored;
+  unsigned long evicted;
+} cache_stats;
+
+
+
+/* Return a malloced string with the cache key for CERT issued by
+   ISSUER_CERT or NULL on error.  */
+static char *
+make_key (ksba_cert_t cert, ksba_cert_t issuer_cert)
+{
+  gpg_error_t err;
+  ksba_sexp_t pubkey, serial;
+  unsigned char grip[20];
+  const unsigned char *s;
+  unsigned long n;
+  char *endp;
+  char *key = NULL;
+
+  pubkey = ksba_cert_get_public_key (issuer_cert);
+  if (!pubkey)
+    return NULL;
+  err = keygrip_from_canon_sexp (pubkey, gcry_sexp_canon_len (pubkey, 0,
+                                                                NULL, NULL),
+                                 grip);
+  ksba_free (pubkey);
+  if (err)
+    return NULL;
+
+  serial = ksba_cert_get_serial (cert);
+  if (!serial)
+    return NULL;
+  s = serial;
+  if (*s != '(')
+    goto leave;
+  n = strtoul ((const char *)s+1, &endp, 10);
+  s = (const unsigned char *)endp;
+  if (!n || *s != ':')
+    goto leave;
+  s++;
+
+  key = xtrymalloc (2*20 + 1 + 2*n + 1);
+  if (!key)
+    goto leave;
+  bin2hex (grip, 20, key);
+  key[40] = '.';
+  bin2hex (s, n, key + 41);
+
+ leave:
+  ksba_free (serial);
+  return key;
+}
+
+
+/* Return the bucket index for KEY.  */
+static unsigned int
+hash_key (const char *key)
+{
+  unsigned int h = 0;
+
+  for (; *key; key++)
+    h = h * 31 + *(const unsigned char *)key;
+  return h % OCSPCACHE_BUCKETS;
+}
+
+
+/* Return the entry for KEY or NULL.  */
+static ocsp_cache_item_t
+find_item (const char *key)
+{
+  ocsp_cache_item_t ci;
+
+  for (ci = cache_table[hash_key (key)]; ci; ci = ci->next)
+    if (!strcmp (ci->key, key))
+      return ci;
+  return NULL;
+}
+
+
+/* Unlink CI from the cache and release it.  */
+static void
+drop_item (ocsp_cache_item_t ci)
+{
+  ocsp_cache_item_t *pp;
+
+  for (pp = cache_table + hash_key (ci->key); *pp; pp = &(*pp)->next)
+    if (*pp == ci)
+      {
+        *pp = ci->next;
+        break;
+      }
+  xfree (ci->st.signer_fpr);
+  xfree (ci);
+  cache_count--;
+  cache_dirty = 1;
+}
+
+
+/* Return the time up to which ST may be used at all.  This is never
+   later than the time up to which ocsp.c accepts a fresh response
+   with the same thisUpdate.  */
+static void
+usable_until (ocsp_status_t st, gnupg_isotime_t r_time)
+{
+  gnupg_isotime_t max_time;
+
+  gnupg_copy_time (r_time, st->next_update);
+  if (opt.ocsp_stale_period)
+    add_seconds_to_isotime (r_time, opt.ocsp_stale_period);
+
+  gnupg_copy_time (max_time, st->this_update);
+  add_seconds_to_isotime (max_time,
+                          opt.ocsp_max_period + opt.ocsp_max_clock_skew);
+  if (strcmp (max_time, r_time) < 0)
+    gnupg_copy_time (r_time, max_time);
+}
+
+
+/* Make room for a new entry by removing all entries beyond their
+   stale period and, if that does not suffice, the least recently
+   used one.  */
+static void
+make_room (void)
+{
+  gnupg_isotime_t current_time, tmp_time;
+  ocsp_cache_item_t ci, cinext, oldest;
+  int idx;
+
+  gnupg_get_isotime (current_time);
+  oldest = NULL;
+  for (idx=0; idx < OCSPCACHE_BUCKETS; idx++)
+    for (ci = cache_table[idx]; ci; ci = cinext)
+      {
+        cinext = ci->next;
+        usable_until (&ci->st, tmp_time);
+        if (strcmp (tmp_time, current_time) < 0)
+          drop_item (ci);
+        else if (!oldest || ci->last_used < oldest->last_used)
+          oldest = ci;
+      }
+
+  if (cache_count >= opt.ocsp_cache_size && oldest)
+    {
+      drop_item (oldest);
+      cache_stats.evicted++;
+    }
+}
+
+
+/* Insert a copy of ST under KEY.  Returns the new item or NULL.  */
+static ocsp_cache_item_t
+insert_item (const char *key, ocsp_status_t st, time_t last_used)
+{
+  ocsp_cache_item_t ci;
+  unsigned int h;
+
+  ci = find_item (key);
+  if (ci)
+    drop_item (ci);
+  else if (cache_count >= opt.ocsp_cache_size)
+    make_room ();
+  if (cache_count >= opt.ocsp_cache_size)
+    return NULL;
+
+  ci = xtrycalloc (1, sizeof *ci + strlen (key));
+  if (!ci)
+    return NULL;
+  strcpy (ci->key, key);
+  ci->st = *st;
+  ci->st.signer_fpr = NULL;
+  if (st->signer_fpr)
+    {
+      ci->st.signer_fpr = xtrystrdup (st->signer_fpr);
+      if (!ci->st.signer_fpr)
+        {
+          xfree (ci);
+          return NULL;
+        }
+    }
+  ci->last_used = last_used;
+
+  h = hash_key (key);
+  ci->next = cache_table[h];
+  cache_table[h] = ci;
+  cache_count++;
+  cache_dirty = 1;
+  return ci;
+}
+
+
+/* Release all entries.  */
+static void
+release_all (void)
+{
+  ocsp_cache_item_t ci, cinext;
+  int idx;
+
+  for (idx=0; idx < OCSPCACHE_BUCKETS; idx++)
+    {
+      for (ci = cache_table[idx]; ci; ci = cinext)
+        {
+          cinext = ci->next;
+          xfree (ci->st.signer_fpr);
+          xfree (ci);
+        }
+      cache_table[idx] = NULL;
+    }
+  cache_count = 0;
+  cache_dirty = 0;
+}
+
+
+/* Parse one record of the cache file.  Returns true on success.  */
+static int
+parse_record (char *line, time_t now)
+{
+  char *fields[8];
+  struct ocsp_status_s st;
+
+  if (split_fields (line, fields, DIM (fields)) != DIM (fields))
+    return 0;
+
+  memset (&st, 0, sizeof st);
+  if (!strcmp (fields[1], "g"))
+    st.status = KSBA_STATUS_GOOD;
+  else if (!strcmp (fields[1], "r"))
+    st.status = KSBA_STATUS_REVOKED;
+  else
+    return 0;
+  if (strlen (fields[2]) != 15 || strlen (fields[3]) != 15
+      || !string2isotime (st.this_update, fields[2])
+      || !string2isotime (st.next_update, fields[3]))
+    return 0;
+  if (strcmp (fields[4], "-")
+      && (strlen (fields[4]) != 15
+          || !string2isotime (st.revocation_time, fields[4])))
+    return 0;
+  st.reason = strtoul (fields[5], NULL, 10);
+  st.via_default = !strcmp (fields[6], "d");
+  if (strcmp (fields[7], "-"))
+    st.signer_fpr = fields[7];
+
+  return !!insert_item (fields[0], &st, now);
+}
+
+
+/* Load the cache from disk if persistence has been enabled.  */
+void
+ocsp_cache_init (void)
+{
+  char *fname;
+  estream_t fp;
+  char line[512];
+  int lineno = 0;
+  int version_seen = 0;
+  time_t now;
+  gnupg_isotime_t current_time, tmp_time;
+  ocsp_cache_item_t ci, cinext;
+  int idx;
+
+  if (!opt.ocsp_cache_persist || !opt.ocsp_cache_size)
+    return;
+
+  fname = make_filename (opt.homedir_cache, OCSPCACHE_FILE, NULL);
+  fp = es_fopen (fname, "r");
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        log_error (_("error opening '%s': %s\n"), fname, strerror (errno));
+      xfree (fname);
+      return;
+    }
+
+  now = gnupg_get_time ();
+  while (es_fgets (line, DIM (line), fp))
+    {
+      lineno++;
+      if (!*line || line[strlen (line)-1] != '\n')
+        {
+          log_error (_("%s:%u: line too long - skipped\n"), fname, lineno);
+          break;
+        }
+      trim_spaces (line);
+      if (!*line || *line == '#')
+        continue;
+      if (!version_seen)
+        {
+          if (strcmp (line, "v " STR2 (OCSPCACHE_VERSION)))
+            {
+              log_info ("%s: unknown version - ignored\n", fname);
+              break;
+            }
+          version_seen = 1;
+        }
+      else if (!parse_record (line, now))
+        log_info ("%s:%u: invalid record - ignored\n", fname, lineno);
+    }
+  if (es_ferror (fp))
+    log_error (_("error reading '%s': %s\n"), fname, strerror (errno));
+  es_fclose (fp);
+
+  /* Remove entries which are not anymore of use.  */
+  gnupg_get_isotime (current_time);
+  for (idx=0; idx < OCSPCACHE_BUCKETS; idx++)
+    for (ci = cache_table[idx]; ci; ci = cinext)
+      {
+        cinext = ci->next;
+        usable_until (&ci->st, tmp_time);
+        if (strcmp (tmp_time, current_time) < 0)
+          drop_item (ci);
+      }
+
+  if (opt.verbose)
+    log_info ("%u OCSP responses loaded from '%s'\n", cache_count, fname);
+  xfree (fname);
+  cache_dirty = 0;
+}
+
+
+/* Save the cache if persistence is enabled and release it.  */
+void
+ocsp_cache_deinit (void)
+{
+  ocsp_cache_save ();
+  release_all ();
+}
+
+
+/* Write the cache to disk if it has changed since the last save.  To
+   avoid races with other threads, the content is first assembled in
+   memory and written only after that.  */
+void
+ocsp_cache_save (void)
+{
+  membuf_t mb;
+  ocsp_cache_item_t ci;
+  char *buffer = NULL;
+  size_t buflen;
+  char *fname = NULL;
+  char *tmpfname = NULL;
+  estream_t fp = NULL;
+  int idx;
+
+  if (!opt.ocsp_cache_persist || !cache_dirty)
+    return;
+
+  init_membuf (&mb, 4096);
+  put_membuf_str (&mb, "# Dirmngr OCSP cache - do not edit\n"
+                  "v " STR2 (OCSPCACHE_VERSION) "\n");
+  for (idx=0; idx < OCSPCACHE_BUCKETS; idx++)
+    for (ci = cache_table[idx]; ci; ci = ci->next)
+      put_membuf_printf (&mb, "%s %s %s %s %s %d %s %s\n",
+                         ci->key,
+                         ci->st.status == KSBA_STATUS_REVOKED? "r":"g",
+                         ci->st.this_update,
+                         ci->st.next_update,
+                         *ci->st.revocation_time? ci->st.revocation_time:"-",
+                         (int)ci->st.reason,
+                         ci->st.via_default? "d":"-",
+                         ci->st.signer_fpr? ci->st.signer_fpr : "-");
+  buffer = get_membuf (&mb, &buflen);
+  if (!buffer)
+    {
+      log_error ("error building the OCSP cache: %s\n",
+                 gpg_strerror (gpg_error_from_syserror ()));
+      return;
+    }
+  cache_dirty = 0;
+
+  fname = make_filename (opt.homedir_cache, OCSPCACHE_FILE, NULL);
+  tmpfname = strconcat (fname, ".tmp", NULL);
+  if (!tmpfname)
+    goto leave;
+  fp = es_fopen (tmpfname, "w");
+  if (!fp)
+    {
+      log_error (_("error creating '%s': %s\n"), tmpfname, strerror (errno));
+      goto leave;
+    }
+  if (es_fwrite (buffer, buflen, 1, fp) != 1)
+    {
+      log_error (_("error writing '%s': %s\n"), tmpfname, strerror (errno));
+      goto leave;
+    }
+  if (es_fclose (fp))
+    {
+      fp = NULL;
+      log_error (_("error closing '%s': %s\n"), tmpfname, strerror (errno));
+      goto leave;
+    }
+  fp = NULL;
+
+#ifdef HAVE_W32_SYSTEM
+  /* No atomic mv on W32 systems.  */
+  gnupg_remove (fname);
+#endif
+  if (rename (tmpfname, fname))
+    log_error (_("error renaming '%s' to '%s': %s\n"),
+               tmpfname, fname, strerror (errno));
+
+ leave:
+  if (fp)
+    {
+      es_fclose (fp);
+      gnupg_remove (tmpfname);
+    }
+  xfree (tmpfname);
+  xfree (fname);
+  xfree (buffer);
+}
+
+
+/* Print some statistics to the log file.  */
+void
+ocsp_cache_print_stats (void)
+{
+  log_info (_("OCSP cache: %u entries; %lu hits, %lu stale, %lu misses,"
+              " %lu stored, %lu evicted\n"),
+            cache_count, cache_stats.hits, cache_stats.stale,
+            cache_stats.misses, cache_stats.stored, cache_stats.evicted);
+}
+
+
+/* Lookup the status of CERT issued by ISSUER_CERT.  On a hit the
+   status is copied to R_STATUS; the caller must release its
+   SIGNER_FPR.  OCSP_CACHE_STALE is returned only to the first caller
+   using a stale entry; that caller is expected to fetch a fresh
+   response and to store it using ocsp_cache_put or to call
+   ocsp_cache_refresh_failed.  Other callers get OCSP_CACHE_HIT for
+   the stale entry meanwhile.  With FORCE_DEFAULT_RESPONDER set only
+   entries received from the default responder are used.  */
+ocsp_cache_result_t
+ocsp_cache_get (ksba_cert_t cert, ksba_cert_t issuer_cert,
+                int force_default_responder, ocsp_status_t r_status)
+{
+  ocsp_cache_result_t result;
+  ocsp_cache_item_t ci;
+  gnupg_isotime_t current_time, tmp_time;
+  char *key;
+
+  memset (r_status, 0, sizeof *r_status);
+  if (!opt.ocsp_cache_size)
+    return OCSP_CACHE_MISS;
+
+  key = make_key (cert, issuer_cert);
+  if (!key)
+    return OCSP_CACHE_MISS;
+  ci = find_item (key);
+  xfree (key);
+  if (!ci || ((force_default_responder || opt.ignore_ocsp_service_url)
+              && !ci->st.via_default))
+    {
+      cache_stats.misses++;
+      return OCSP_CACHE_MISS;
+    }
+
+  gnupg_get_isotime (current_time);
+  usable_until (&ci->st, tmp_time);
+  if (strcmp (tmp_time, current_time) < 0
+      || (!opt.ocsp_stale_period
+          && strcmp (current_time, ci->st.next_update) >= 0))
+    {
+      if (DBG_CACHE)
+        log_debug ("OCSP cache entry '%s' expired\n", ci->key);
+      drop_item (ci);
+      cache_stats.misses++;
+      return OCSP_CACHE_MISS;
+    }
+
+  if (strcmp (current_time, ci->st.next_update) < 0)
+    result = OCSP_CACHE_HIT;
+  else
+    {
+      if (ci->refreshing)
+        result = OCSP_CACHE_HIT;
+      else
+        {
+          ci->refreshing = 1;
+          result = OCSP_CACHE_STALE;
+        }
+      cache_stats.stale++;
+    }
+
+  *r_status = ci->st;
+  r_status->signer_fpr = NULL;
+  if (ci->st.signer_fpr)
+    {
+      r_status->signer_fpr = xtrystrdup (ci->st.signer_fpr);
+      if (!r_status->signer_fpr)
+        {
+          /* We can't tell the client about the responder
+             certificate; thus we may not use this entry.  */
+          ci->refreshing = 0;
+          cache_stats.misses++;
+          return OCSP_CACHE_MISS;
+        }
+    }
+  ci->last_used = gnupg_get_time ();
+  if (result == OCSP_CACHE_HIT)
+    cache_stats.hits++;
+  if (DBG_CACHE)
+    log_debug ("OCSP cache %s for '%s'\n",
+               result == OCSP_CACHE_HIT? "hit":"stale hit", ci->key);
+  return result;
+}
+
+
+/* Store STATUS for CERT issued by ISSUER_CERT.  Responses without a
+   nextUpdate and responses with a status other than good or revoked
+   are not cached.  */
+void
+ocsp_cache_put (ksba_cert_t cert, ksba_cert_t issuer_cert,
+                ocsp_status_t status)
+{
+  char *key;
+
+  if (!opt.ocsp_cache_size || !*status->next_update
+      || !*status->this_update
+      || (status->status != KSBA_STATUS_GOOD
+          && status->status != KSBA_STATUS_REVOKED))
+    return;
+
+  key = make_key (cert, issuer_cert);
+  if (!key)
+    return;
+  if (insert_item (key, status, gnupg_get_time ()))
+    {
+      cache_stats.stored++;
+      if (DBG_CACHE)
+        log_debug ("OCSP cache entry '%s' stored (next=%s)\n",
+                   key, status->next_update);
+    }
+  xfree (key);
+}
+
+
+/* Tell the cache that a refresh of the stale entry for CERT issued
+   by ISSUER_CERT failed.  The next lookup will try again.  */
+void
+ocsp_cache_refresh_failed (ksba_cert_t cert, ksba_cert_t issuer_cert)
+{
+  ocsp_cache_item_t ci;
+  char *key;
+
+  key = make_key (cert, issuer_cert);
+  if (!key)
+    return;
+  ci = find_item (key);
+  if (ci)
+    ci->refreshing = 0;
+  xfree (key);
+}
@@ -0,0 +1,73 @@
+/* ocspcache.h - OCSP response cache
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of DirMngr.
+ *
+ * DirMngr is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * DirMngr is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef OCSPCACHE_H
+#define OCSPCACHE_H
+
+/* The result of an OCSP cache lookup.  */
+typedef enum
+  {
+    OCSP_CACHE_MISS = 0,   /* No usable entry.  */
+    OCSP_CACHE_HIT,        /* Entry found and still current.  */
+    OCSP_CACHE_STALE       /* Entry found but past nextUpdate; it may
+                              be used while a refresh is running.  */
+  }
+ocsp_cache_result_t;
+
+/* The verified status of a certificate as returned by a responder.  */
+struct ocsp_status_s
+{
+  ksba_status_t status;
+  ksba_isotime_t this_update;
+  ksba_isotime_t next_update;
+  ksba_isotime_t revocation_time;
+  ksba_crl_reason_t reason;
+  char *signer_fpr;  /* Malloced fingerprint of a responder certificate
+                        which still needs to be validated by the
+                        client or NULL.  */
+  unsigned int via_default:1; /* Answered by the default responder.  */
+};
+typedef struct ocsp_status_s *ocsp_status_t;
+
+
+/* Load the cache from disk if persistence has been enabled.  */
+void ocsp_cache_init (void);
+
+/* Save the cache if persistence is enabled and release it.  */
+void ocsp_cache_deinit (void);
+
+/* Write the cache to disk if it has changed since the last save.  */
+void ocsp_cache_save (void);
+
+/* Print some statistics to the log file.  */
+void ocsp_cache_print_stats (void);
+
+/* Lookup the status of CERT issued by ISSUER_CERT.  */
+ocsp_cache_result_t ocsp_cache_get (ksba_cert_t cert, ksba_cert_t issuer_cert,
+                                    int force_default_responder,
+                                    ocsp_status_t r_status);
+
+/* Store STATUS for CERT issued by ISSUER_CERT.  */
+void ocsp_cache_put (ksba_cert_t cert, ksba_cert_t issuer_cert,
+                     ocsp_status_t status);
+
+/* Tell the cache that a refresh of the stale entry for CERT failed.  */
+void ocsp_cache_refresh_failed (ksba_cert_t cert, ksba_cert_t issuer_cert);
+
+#endif /*OCSPCACHE_H*/
@@ -1308,6 +1308,187 @@ cmd_checkocsp (assuan_context_t ctx, char *line)
 }
 
 
+static const char hlp_checkocsp_batch[] =
+  "CHECKOCSP_BATCH [--force-default-responder] <fingerprint>...\n"
+  "\n"
+  "Check the certificates given by the FINGERPRINTs (SHA-1 hash of the\n"
+  "entire X.509 certificate blob) like CHECKOCSP does.  Certificates\n"
+  "handled by the same OCSP responder are checked with one request.\n"
+  "For each certificate not known to dirmngr the function inquires it\n"
+  "using an\n"
+  "\n"
+  "   INQUIRE TARGETCERT <fingerprint>\n"
+  "\n"
+  "and the caller is expected to return the certificate as a binary\n"
+  "blob.  The result for each certificate is returned in a status line\n"
+  "\n"
+  "   S OCSP_STATUS <fingerprint> <error_code>\n"
+  "\n"
+  "with an ERROR_CODE of 0 if the certificate validity has been\n"
+  "confirmed.  ONLY_VALID_IF_CERT_VALID status lines apply to all\n"
+  "certificates.  The return value is an error only if the command\n"
+  "failed as a whole.";
+static gpg_error_t
+cmd_checkocsp_batch (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err = 0;
+  int force_default_responder;
+  unsigned char fprbuffer[20], fpr2[20];
+  char hexfpr[41];
+  ksba_cert_t *certs = NULL;
+  gpg_error_t *errs = NULL;
+  char **fprs = NULL;
+  int ncerts, i;
+  const char *s;
+
+  force_default_responder = has_option (line, "--force-default-responder");
+  line = skip_options (line);
+
+  for (ncerts=0, s=line; *s; ncerts++)
+    {
+      while (*s && *s != ' ')
+        s++;
+      while (*s == ' ')
+        s++;
+    }
+  if (!ncerts)
+    {
+      err = set_error (GPG_ERR_ASS_PARAMETER, "no fingerprint given");
+      goto leave;
+    }
+
+  certs = xtrycalloc (ncerts, sizeof *certs);
+  errs = xtrycalloc (ncerts, sizeof *errs);
+  fprs = xtrycalloc (ncerts, sizeof *fprs);
+  if (!certs || !errs || !fprs)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  for (i=0; i < ncerts; i++)
+    {
+      if (!get_fingerprint_from_line (line, fprbuffer))
+        {
+          err = set_error (GPG_ERR_ASS_PARAMETER, "invalid fingerprint");
+          goto leave;
+        }
+      bin2hex (fprbuffer, 20, hexfpr);
+      fprs[i] = xtrystrdup (hexfpr);
+      if (!fprs[i])
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      while (*line && *line != ' ')
+        line++;
+      while (*line == ' ')
+        line++;
+
+      certs[i] = get_cert_byfpr (fprbuffer);
+      if (!certs[i])
+        {
+          /* We do not have this certificate yet.  Inquire it from
+             the client.  */
+          unsigned char *value = NULL;
+          size_t valuelen;
+          char *buf;
+
+          buf = strconcat ("TARGETCERT ", hexfpr, NULL);
+          if (!buf)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+          err = assuan_inquire (ctrl->server_local->assuan_ctx, buf,
+                                &value, &valuelen, MAX_CERT_LENGTH);
+          xfree (buf);
+          if (err)
+            {
+              log_error (_("assuan_inquire failed: %s\n"),
+                         gpg_strerror (err));
+              goto leave;
+            }
+
+          if (!valuelen) /* No data returned.  */
+            errs[i] = gpg_error (GPG_ERR_MISSING_CERT);
+          else
+            {
+              errs[i] = ksba_cert_new (&certs[i]);
+              if (!errs[i])
+                errs[i] = ksba_cert_init_from_mem (certs[i], value, valuelen);
+              if (!errs[i]
+                  && memcmp (cert_compute_fpr (certs[i], fpr2), fprbuffer, 20))
+                errs[i] = gpg_error (GPG_ERR_BAD_CERT);
+              if (errs[i])
+                {
+                  ksba_cert_release (certs[i]);
+                  certs[i] = NULL;
+                }
+            }
+          xfree (value);
+        }
+    }
+
+  if (!opt.allow_ocsp)
+    {
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+
+  /* Check all certificates we got.  We compact the arrays for this
+     and expand the results afterwards.  */
+  {
+    ksba_cert_t *okcerts;
+    gpg_error_t *okerrs;
+    int nok;
+
+    okcerts = xtrycalloc (ncerts, sizeof *okcerts);
+    okerrs = xtrycalloc (ncerts, sizeof *okerrs);
+    if (!okcerts || !okerrs)
+      err = gpg_error_from_syserror ();
+    else
+      {
+        for (nok=i=0; i < ncerts; i++)
+          if (certs[i])
+            okcerts[nok++] = certs[i];
+        err = ocsp_isvalid_many (ctrl, okcerts, okerrs, nok,
+                                 force_default_responder);
+        for (nok=i=0; !err && i < ncerts; i++)
+          if (certs[i])
+            errs[i] = okerrs[nok++];
+      }
+    xfree (okcerts);
+    xfree (okerrs);
+    if (err)
+      goto leave;
+  }
+
+  for (i=0; i < ncerts; i++)
+    {
+      char numbuf[35];
+
+      snprintf (numbuf, sizeof numbuf, "%u", errs[i]);
+      err = dirmngr_status (ctrl, "OCSP_STATUS", fprs[i], numbuf, NULL);
+      if (err)
+        goto leave;
+    }
+
+ leave:
+  if (certs)
+    for (i=0; i < ncerts; i++)
+      ksba_cert_release (certs[i]);
+  if (fprs)
+    for (i=0; i < ncerts; i++)
+      xfree (fprs[i]);
+  xfree (certs);
+  xfree (errs);
+  xfree (fprs);
+  return leave_cmd (ctx, err);
+}
+
+
 
 static int
 lookup_cert_by_url (assuan_context_t ctx, const char *url)
@@ -2493,6 +2674,7 @@ register_commands (assuan_context_t ctx)
     { "ISVALID",    cmd_isvalid,    hlp_isvalid },
     { "CHECKCRL",   cmd_checkcrl,   hlp_checkcrl },
     { "CHECKOCSP",  cmd_checkocsp,  hlp_checkocsp },
+    { "CHECKOCSP_BATCH", cmd_checkocsp_batch, hlp_checkocsp_batch },
     { "LOOKUP",     cmd_lookup,     hlp_lookup },
     { "LOADCRL",    cmd_loadcrl,    hlp_loadcrl },
     { "LISTCRLS",   cmd_listcrls,   hlp_listcrls },
@@ -36,10 +36,18 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#ifndef HAVE_W32_SYSTEM
+# include <signal.h>
+# include <sys/socket.h>
+# include <sys/wait.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+#endif
 #include <assuan.h>
 
 #include "../common/util.h"
 #include "../common/logging.h"
+#include "t-support.h"
 #include "http.h"
 
 #include <ksba.h>
@@ -188,6 +196,311 @@ prepend_srcdir (const char *fname)
 }
 
 
+#ifndef HAVE_W32_SYSTEM
+/* Responses of the local test server.  The server inserts an
+ * "X-Conn" header with the number of the connection after the
+ * status line and pauses at each form feed, so that the client sees
+ * the data split across several reads.  */
+static struct
+{
+  const char *path;
+  const char *response;
+} local_responses[] =
+  {
+    { "/chunked",
+      "HTTP/1.1 200 OK\r\n"
+      "Transfer-Encoding: chunked\r\n"
+      "Trailer: X-Checksum\r\n"
+      "\r\n"
+      "7;name=value\r\n"
+      "Hello, \r\n"
+      "6;foo;bar=\"a b\"\r\n"
+      "world!\r\n"
+      "0;last\r\n"
+      "X-Checksum: 42\r\n"
+      "X-More: yes\r\n"
+      "\r\n" },
+    { "/split-chunked",
+      "HTTP/1.1 200 OK\r\n"
+      "Transfer-Encoding: chunked\r\n"
+      "\r\f\n"
+      "4\r\f\n"
+      "Wi\fki\r\n"
+      "5;x=y\f\r\n"
+      "pedia\r\n"
+      "0\r\n"
+      "A: b\f\r\n"
+      "\r\n" },
+    { "/length",
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Length: 10\r\n"
+      "\r\n"
+      "0123456789" },
+    { "/204",
+      "HTTP/1.1 204 No Content\r\n"
+      "\r\n" },
+    { "/304",
+      "HTTP/1.1 304 Not Modified\r\n"
+      "Content-Length: 1000\r\n"
+      "\r\n" },
+    { "/split",
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Length: 6\r\n"
+      "\r\f\n"
+      "ab\fcdef" },
+    { "/split2",
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Length: 3\r\n\f"
+      "\r\n"
+      "xyz" },
+    { "/close-after",
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Length: 5\r\n"
+      "\r\n"
+      "close" },
+    { "/drop-next",
+      "HTTP/1.1 200 OK\r\n"
+      "Content-Length: 4\r\n"
+      "\r\n"
+      "drop" }
+  };
+
+
+/* Write LENGTH bytes from DATA to FD.  */
+static void
+write_all (int fd, const char *data, size_t length)
+{
+  ssize_t n;
+
+  while (length)
+    {
+      n = write (fd, data, length);
+      if (n < 0)
+        _exit (1);
+      data += n;
+      length -= n;
+    }
+}
+
+
+/* Serve the requests on connection number CONNNO at FD.  */
+static void
+serve_connection (int fd, unsigned int connno)
+{
+  char buffer[4096];
+  char xconn[40];
+  size_t len = 0;
+  ssize_t n;
+  char *end, *path, *p;
+  const char *s, *ff;
+  int i, drop_next = 0;
+
+  for (;;)
+    {
+      /* Read the request header.  */
+      buffer[len] = 0;
+      while (!(end = strstr (buffer, "\r\n\r\n")))
+        {
+          if (len + 1 >= sizeof buffer)
+            _exit (1);
+          n = read (fd, buffer + len, sizeof buffer - len - 1);
+          if (n <= 0)
+            _exit (0);
+          len += n;
+          buffer[len] = 0;
+        }
+      if (drop_next)
+        _exit (0);
+
+      path = strchr (buffer, ' ');
+      if (!path || !(p = strchr (++path, ' ')))
+        _exit (1);
+      *p = 0;
+      for (i=0; i < DIM (local_responses); i++)
+        if (!strcmp (local_responses[i].path, path))
+          break;
+      if (i == DIM (local_responses))
+        _exit (1);
+
+      s = local_responses[i].response;
+      p = strstr (s, "\r\n");
+      write_all (fd, s, p + 2 - s);
+      snprintf (xconn, sizeof xconn, "X-Conn: %u\r\n", connno);
+      write_all (fd, xconn, strlen (xconn));
+      for (s = p + 2; (ff = strchr (s, '\f')); s = ff + 1)
+        {
+          write_all (fd, s, ff - s);
+          usleep (50000);
+        }
+      write_all (fd, s, strlen (s));
+
+      if (!strcmp (path, "/close-after"))
+        _exit (0);
+      drop_next = !strcmp (path, "/drop-next");
+
+      end += 4;
+      len -= end - buffer;
+      memmove (buffer, end, len);
+    }
+}
+
+
+/* Start the local test server and return its process id.  The port
+ * is stored at R_PORT.  */
+static pid_t
+start_local_server (unsigned short *r_port)
+{
+  struct sockaddr_in addr;
+  socklen_t addrlen;
+  unsigned int connno = 0;
+  int fd, conn;
+  pid_t pid;
+
+  fd = socket (AF_INET, SOCK_STREAM, 0);
+  if (fd == -1)
+    fail (1);
+  memset (&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  addrlen = sizeof addr;
+  if (bind (fd, (struct sockaddr *)&addr, sizeof addr)
+      || listen (fd, 5)
+      || getsockname (fd, (struct sockaddr *)&addr, &addrlen))
+    fail (2);
+  *r_port = ntohs (addr.sin_port);
+
+  pid = fork ();
+  if (pid == -1)
+    fail (3);
+  if (pid)
+    {
+      close (fd);
+      return pid;
+    }
+
+  signal (SIGCHLD, SIG_IGN);
+  for (;;)
+    {
+      conn = accept (fd, NULL, NULL);
+      if (conn == -1)
+        continue;
+      connno++;
+      if (!fork ())
+        {
+          close (fd);
+          serve_connection (conn, connno);
+          _exit (0);
+        }
+      close (conn);
+    }
+}
+
+
+/* Fetch PATH from the local server at PORT and check that the status
+ * code is STATUS and the body is BODY.  Returns the number of the
+ * connection used by the server.  */
+static unsigned int
+local_fetch (unsigned short port, const char *path,
+             unsigned int status, const char *body)
+{
+  gpg_error_t err;
+  http_t hd;
+  char *url;
+  char buffer[256];
+  size_t len, n;
+  const char *s;
+  unsigned int connno;
+
+  url = xasprintf ("http://127.0.0.1:%hu%s", port, path);
+  err = http_open_document (&hd, url, NULL, 0, NULL, NULL, NULL, NULL);
+  if (err)
+    {
+      log_error ("can't get '%s': %s\n", url, gpg_strerror (err));
+      fail (10);
+    }
+  if (http_get_status_code (hd) != status)
+    {
+      log_error ("'%s': status %u\n", url, http_get_status_code (hd));
+      fail (11);
+    }
+
+  len = 0;
+  while (!es_read (http_get_read_ptr (hd), buffer + len,
+                   sizeof buffer - 1 - len, &n) && n)
+    len += n;
+  buffer[len] = 0;
+  if (strcmp (buffer, body))
+    {
+      log_error ("'%s': body '%s'\n", url, buffer);
+      fail (12);
+    }
+
+  s = http_get_header (hd, "X-Conn");
+  if (!s)
+    fail (13);
+  connno = atoi (s);
+  if (verbose)
+    log_info ("%s: ok (connection %u)\n", path, connno);
+
+  http_close (hd, 0);
+  xfree (url);
+  return connno;
+}
+
+
+/* Check the framing of response bodies and the reuse of connections
+ * using a server on the loopback interface.  */
+static void
+run_local_tests (void)
+{
+  unsigned short port;
+  pid_t pid;
+  unsigned int conn;
+
+  signal (SIGPIPE, SIG_IGN);
+  pid = start_local_server (&port);
+  http_set_keep_alive (30, 2);
+
+  /* The chunk extensions and the trailer must be skipped so that the
+     next request can use the same connection.  */
+  conn = local_fetch (port, "/chunked", 200, "Hello, world!");
+  if (local_fetch (port, "/split-chunked", 200, "Wikipedia") != conn)
+    fail (20);
+  if (local_fetch (port, "/length", 200, "0123456789") != conn)
+    fail (21);
+
+  /* 204 and 304 responses have no body, despite a Content-Length.  */
+  if (local_fetch (port, "/204", 204, "") != conn)
+    fail (22);
+  if (local_fetch (port, "/304", 304, "") != conn)
+    fail (23);
+
+  /* The end of the header is split across reads.  */
+  if (local_fetch (port, "/split", 200, "abcdef") != conn)
+    fail (24);
+  if (local_fetch (port, "/split2", 200, "xyz") != conn)
+    fail (25);
+
+  /* The server closes the idle connection.  */
+  if (local_fetch (port, "/close-after", 200, "close") != conn)
+    fail (26);
+  usleep (100000);
+  if (local_fetch (port, "/length", 200, "0123456789") == conn)
+    fail (27);
+
+  /* The server closes the connection after receiving the next
+     request; the request is sent again over a new connection.  */
+  conn = local_fetch (port, "/drop-next", 200, "drop");
+  if (local_fetch (port, "/length", 200, "0123456789") == conn)
+    fail (28);
+
+  http_set_keep_alive (0, 0);
+  kill (pid, SIGTERM);
+  waitpid (pid, NULL, 0);
+}
+#endif /*!HAVE_W32_SYSTEM*/
+
+
 int
 main (int argc, char **argv)
 {
@@ -218,7 +531,8 @@ main (int argc, char **argv)
         }
       else if (!strcmp (*argv, "--help"))
         {
-          fputs ("usage: " PGM " URL\n"
+          fputs ("usage: " PGM " [URL]\n"
+                 "Without URL tests using a local server are run.\n"
                  "Options:\n"
                  "  --verbose         print timings etc.\n"
                  "  --debug           flyswatter\n"
@@ -292,6 +606,14 @@ main (int argc, char **argv)
           exit (1);
         }
     }
+#ifndef HAVE_W32_SYSTEM
+  if (!argc)
+    {
+      assuan_sock_init ();
+      run_local_tests ();
+      return 0;
+    }
+#endif
   if (argc != 1)
     {
       fprintf (stderr, PGM ": no or too many URLS given\n");
@@ -37,6 +37,10 @@
 
 #define MIN_PARTIAL_SIZE 512
 
+/* The size and number of the chunks used with --crypt-pipeline.  */
+#define PIPELINE_CHUNKSIZE (64*1024)
+#define PIPELINE_NCHUNKS   8
+
 
 static void
 write_header( cipher_filter_context_t *cfx, IOBUF a )
@@ -107,6 +111,63 @@ write_header( cipher_filter_context_t *cfx, IOBUF a )
 
 
 
+/* Pipeline stage to hash the plaintext for the MDC.  */
+static gpg_error_t
+hash_stage (void *opaque, pipeline_chunk_t chunk)
+{
+  cipher_filter_context_t *cfx = opaque;
+
+  gcry_md_write (cfx->mdc_hash, chunk->buf + chunk->off, chunk->len);
+  return 0;
+}
+
+
+/* Pipeline stage to encrypt the data in place.  */
+static gpg_error_t
+encrypt_stage (void *opaque, pipeline_chunk_t chunk)
+{
+  cipher_filter_context_t *cfx = opaque;
+
+  if (!chunk->len)
+    return 0;
+  return gcry_cipher_encrypt (cfx->cipher_hd, chunk->buf + chunk->off,
+                              chunk->len, NULL, 0);
+}
+
+
+/* Pipeline stage to write the ciphertext to the next filter.  */
+static gpg_error_t
+write_stage (void *opaque, pipeline_chunk_t chunk)
+{
+  cipher_filter_context_t *cfx = opaque;
+
+  if (!chunk->len)
+    return 0;
+  return iobuf_write (cfx->pipeline_out, chunk->buf + chunk->off, chunk->len);
+}
+
+
+/* Start the threads to hash, encrypt and write the data to A.  On
+ * error the data is processed by the caller's thread.  */
+static void
+start_pipeline (cipher_filter_context_t *cfx, IOBUF a)
+{
+  pipeline_stage_fnc_t fncs[3];
+  gpg_error_t err;
+  int n = 0;
+
+  if (cfx->mdc_hash)
+    fncs[n++] = hash_stage;
+  fncs[n++] = encrypt_stage;
+  fncs[n++] = write_stage;
+  cfx->pipeline_out = a;
+  err = pipeline_new (&cfx->pipeline, 0, n, fncs, cfx,
+                      PIPELINE_NCHUNKS, PIPELINE_CHUNKSIZE, 0);
+  if (err)
+    log_info ("can't start encryption pipeline: %s\n", gpg_strerror (err));
+}
+
+
 /****************
  * This filter is used to en/de-cipher data with a conventional algorithm
  */
@@ -125,13 +186,28 @@ cipher_filter( void *opaque, int control,
 	log_assert(a);
 	if( !cfx->header ) {
 	    write_header( cfx, a );
+	    if (opt.crypt_pipeline)
+		start_pipeline (cfx, a);
+	}
+	if (cfx->pipeline)
+	    rc = pipeline_write (cfx->pipeline, buf, size);
+	else {
+	    if (cfx->mdc_hash)
+		gcry_md_write (cfx->mdc_hash, buf, size);
+	    gcry_cipher_encrypt (cfx->cipher_hd, buf, size, NULL, 0);
+	    rc = iobuf_write( a, buf, size );
 	}
-	if (cfx->mdc_hash)
-	    gcry_md_write (cfx->mdc_hash, buf, size);
-	gcry_cipher_encrypt (cfx->cipher_hd, buf, size, NULL, 0);
-	rc = iobuf_write( a, buf, size );
     }
     else if( control == IOBUFCTRL_FREE ) {
+	if (cfx->pipeline) {
+	    /* Finish all queued data before the MDC is written.  */
+	    rc = pipeline_close (cfx->pipeline);
+	    pipeline_release (cfx->pipeline);
+	    cfx->pipeline = NULL;
+	    if (rc)
+		log_error ("encryption pipeline failed: %s\n",
+			   gpg_strerror (rc));
+	}
 	if( cfx->mdc_hash ) {
 	    byte *hash;
 	    int hashlen = gcry_md_get_algo_dlen (gcry_md_get_algo
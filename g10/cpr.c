@@ -40,7 +40,9 @@
 
 
 /* The stream to output the status information.  Output is disabled if
-   this is NULL.  */
+   this is NULL.  Each line is written with the stream locked because
+   status lines may also be written by the worker threads of the
+   --crypt-pipeline; for example by the progress filter.  */
 static estream_t statusfp;
 
 
@@ -152,11 +154,12 @@ write_status_strings (int no, const char *text, ...)
   if (!statusfp || !status_currently_allowed (no) )
     return;  /* Not enabled or allowed. */
 
-  es_fputs ("[GNUPG:] ", statusfp);
-  es_fputs (get_status_string (no), statusfp);
+  es_flockfile (statusfp);
+  es_fputs_unlocked ("[GNUPG:] ", statusfp);
+  es_fputs_unlocked (get_status_string (no), statusfp);
   if ( text )
     {
-      es_putc ( ' ', statusfp);
+      es_putc_unlocked (' ', statusfp);
       va_start (arg_ptr, text);
       s = text;
       do
@@ -164,17 +167,18 @@ write_status_strings (int no, const char *text, ...)
           for (; *s; s++)
             {
               if (*s == '\n')
-                es_fputs ("\\n", statusfp);
+                es_fputs_unlocked ("\\n", statusfp);
               else if (*s == '\r')
-                es_fputs ("\\r", statusfp);
+                es_fputs_unlocked ("\\r", statusfp);
               else
-                es_fputc (*(const byte *)s, statusfp);
+                es_putc_unlocked (*(const byte *)s, statusfp);
             }
         }
       while ((s = va_arg (arg_ptr, const char*)));
       va_end (arg_ptr);
     }
-  es_putc ('\n', statusfp);
+  es_putc_unlocked ('\n', statusfp);
+  es_funlockfile (statusfp);
   if (es_fflush (statusfp) && opt.exit_on_status_write_error)
     g10_exit (0);
 }
@@ -198,16 +202,18 @@ write_status_printf (int no, const char *format, ...)
   if (!statusfp || !status_currently_allowed (no) )
     return;  /* Not enabled or allowed. */
 
-  es_fputs ("[GNUPG:] ", statusfp);
-  es_fputs (get_status_string (no), statusfp);
+  es_flockfile (statusfp);
+  es_fputs_unlocked ("[GNUPG:] ", statusfp);
+  es_fputs_unlocked (get_status_string (no), statusfp);
   if (format)
     {
-      es_putc ( ' ', statusfp);
+      es_putc_unlocked (' ', statusfp);
       va_start (arg_ptr, format);
-      es_vfprintf (statusfp, format, arg_ptr);
+      es_vfprintf_unlocked (statusfp, format, arg_ptr);
       va_end (arg_ptr);
     }
-  es_putc ('\n', statusfp);
+  es_putc_unlocked ('\n', statusfp);
+  es_funlockfile (statusfp);
   if (es_fflush (statusfp) && opt.exit_on_status_write_error)
     g10_exit (0);
 }
@@ -220,8 +226,10 @@ write_status_error (const char *where, gpg_error_t err)
   if (!statusfp || !status_currently_allowed (STATUS_ERROR))
     return;  /* Not enabled or allowed. */
 
-  es_fprintf (statusfp, "[GNUPG:] %s %s %u\n",
-              get_status_string (STATUS_ERROR), where, err);
+  es_flockfile (statusfp);
+  es_fprintf_unlocked (statusfp, "[GNUPG:] %s %s %u\n",
+                       get_status_string (STATUS_ERROR), where, err);
+  es_funlockfile (statusfp);
   if (es_fflush (statusfp) && opt.exit_on_status_write_error)
     g10_exit (0);
 }
@@ -234,8 +242,11 @@ write_status_errcode (const char *where, int errcode)
   if (!statusfp || !status_currently_allowed (STATUS_ERROR))
     return;  /* Not enabled or allowed. */
 
-  es_fprintf (statusfp, "[GNUPG:] %s %s %u\n",
-              get_status_string (STATUS_ERROR), where, gpg_err_code (errcode));
+  es_flockfile (statusfp);
+  es_fprintf_unlocked (statusfp, "[GNUPG:] %s %s %u\n",
+                       get_status_string (STATUS_ERROR), where,
+                       gpg_err_code (errcode));
+  es_funlockfile (statusfp);
   if (es_fflush (statusfp) && opt.exit_on_status_write_error)
     g10_exit (0);
 }
@@ -248,8 +259,10 @@ write_status_failure (const char *where, gpg_error_t err)
   if (!statusfp || !status_currently_allowed (STATUS_FAILURE))
     return;  /* Not enabled or allowed. */
 
-  es_fprintf (statusfp, "[GNUPG:] %s %s %u\n",
-              get_status_string (STATUS_FAILURE), where, err);
+  es_flockfile (statusfp);
+  es_fprintf_unlocked (statusfp, "[GNUPG:] %s %s %u\n",
+                       get_status_string (STATUS_FAILURE), where, err);
+  es_funlockfile (statusfp);
   if (es_fflush (statusfp) && opt.exit_on_status_write_error)
     g10_exit (0);
 }
@@ -273,6 +286,7 @@ write_status_text_and_buffer (int no, const char *string,
   if (!statusfp || !status_currently_allowed (no))
     return;  /* Not enabled or allowed. */
 
+  es_flockfile (statusfp);
   if (wrap == -1)
     {
       lower_limit--;
@@ -285,16 +299,16 @@ write_status_text_and_buffer (int no, const char *string,
     {
       if (dowrap)
         {
-          es_fprintf (statusfp, "[GNUPG:] %s ", text);
+          es_fprintf_unlocked (statusfp, "[GNUPG:] %s ", text);
           count = dowrap = 0;
           if (first && string)
             {
-              es_fputs (string, statusfp);
+              es_fputs_unlocked (string, statusfp);
               count += strlen (string);
               /* Make sure that there is a space after the string.  */
               if (*string && string[strlen (string)-1] != ' ')
                 {
-                  es_putc (' ', statusfp);
+                  es_putc_unlocked (' ', statusfp);
                   count++;
                 }
             }
@@ -316,20 +330,21 @@ write_status_text_and_buffer (int no, const char *string,
           s--; n++;
         }
       if (s != buffer)
-        es_fwrite (buffer, s-buffer, 1, statusfp);
+        es_fprintf_unlocked (statusfp, "%.*s", (int)(s-buffer), buffer);
       if ( esc )
         {
-          es_fprintf (statusfp, "%%%02X", *(const byte*)s );
+          es_fprintf_unlocked (statusfp, "%%%02X", *(const byte*)s );
           s++; n--;
         }
       buffer = s;
       len = n;
       if (dowrap && len)
-        es_putc ('\n', statusfp);
+        es_putc_unlocked ('\n', statusfp);
     }
   while (len);
 
-  es_putc ('\n',statusfp);
+  es_putc_unlocked ('\n', statusfp);
+  es_funlockfile (statusfp);
   if (es_fflush (statusfp) && opt.exit_on_status_write_error)
     g10_exit (0);
 }
@@ -29,6 +29,12 @@
 #include "options.h"
 #include "../common/i18n.h"
 #include "../common/status.h"
+#include "main.h"
+
+
+/* The size and number of the chunks used with --crypt-pipeline.  */
+#define PIPELINE_CHUNKSIZE (64*1024)
+#define PIPELINE_NCHUNKS   8
 
 
 static int mdc_decode_filter ( void *opaque, int control, IOBUF a,
@@ -46,6 +52,10 @@ typedef struct decode_filter_context_s
   int  refcount;
   int  partial;   /* Working on a partial length packet.  */
   size_t length;  /* If !partial: Remaining bytes in the packet.  */
+  pipeline_t pipeline;  /* Used with --crypt-pipeline.  */
+  IOBUF pipeline_in;    /* The input of the pipeline.  */
+  int pipeline_tried;   /* Set once we tried to start the pipeline.  */
+  size_t defer_len;     /* Number of bytes in DEFER (pipeline only).  */
 } *decode_filter_ctx_t;
 
 
@@ -59,6 +69,8 @@ release_dfx_context (decode_filter_ctx_t dfx)
   log_assert (dfx->refcount);
   if ( !--dfx->refcount )
     {
+      pipeline_release (dfx->pipeline);
+      dfx->pipeline = NULL;
       gcry_cipher_close (dfx->cipher_hd);
       dfx->cipher_hd = NULL;
       gcry_md_close (dfx->mdc_hash);
@@ -254,7 +266,9 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek)
     proc_packets (ctrl, procctx, ed->buf );
 
   ed->buf = NULL;
-  if (dfx->eof_seen > 1 )
+  if (dfx->pipeline && (rc = pipeline_close (dfx->pipeline)))
+    log_error ("decryption pipeline failed: %s\n", gpg_strerror (rc));
+  else if (dfx->eof_seen > 1 )
     rc = gpg_error (GPG_ERR_INV_PACKET);
   else if ( ed->mdc_method )
     {
@@ -296,6 +310,133 @@ decrypt_data (ctrl_t ctrl, void *procctx, PKT_encrypted *ed, DEK *dek)
 
 
 
+/* Pipeline stage to read the ciphertext.  */
+static gpg_error_t
+read_stage (void *opaque, pipeline_chunk_t chunk)
+{
+  decode_filter_ctx_t dfx = opaque;
+  size_t size = chunk->size - chunk->off;
+  int n;
+
+  if (!dfx->partial)
+    {
+      if (!dfx->length)
+        {
+          chunk->eof = 1; /* Normal EOF.  */
+          return 0;
+        }
+      if (size > dfx->length)
+        size = dfx->length;
+    }
+
+  n = iobuf_read (dfx->pipeline_in, chunk->buf + chunk->off, size);
+  if (n == -1)
+    {
+      chunk->eof = dfx->partial? 1 : 3; /* Normal or premature EOF.  */
+      return iobuf_error (dfx->pipeline_in);
+    }
+  chunk->len = n;
+  if (!dfx->partial)
+    {
+      dfx->length -= n;
+      if (!dfx->length)
+        chunk->eof = 1; /* Normal EOF.  */
+    }
+  return 0;
+}
+
+
+/* Pipeline stage to decrypt the data in place.  With an MDC the
+ * trailing 22 bytes are held back in the same way as done by
+ * mdc_decode_filter; the headroom of the chunks is used to prepend
+ * the bytes held back from the previous chunk.  */
+static gpg_error_t
+decrypt_stage (void *opaque, pipeline_chunk_t chunk)
+{
+  decode_filter_ctx_t dfx = opaque;
+  size_t n;
+
+  if (dfx->mdc_hash)
+    {
+      chunk->off -= dfx->defer_len;
+      memcpy (chunk->buf + chunk->off, dfx->defer, dfx->defer_len);
+      chunk->len += dfx->defer_len;
+      n = chunk->len > 22? 22 : chunk->len;
+      chunk->len -= n;
+      memcpy (dfx->defer, chunk->buf + chunk->off + chunk->len, n);
+      dfx->defer_len = n;
+      dfx->defer_filled = (n == 22);
+    }
+
+  if (chunk->len)
+    gcry_cipher_decrypt (dfx->cipher_hd, chunk->buf + chunk->off,
+                         chunk->len, NULL, 0);
+
+  if (chunk->eof)
+    {
+      if (dfx->mdc_hash && !dfx->defer_filled)
+        dfx->eof_seen = 2; /* EOF with incomplete hash.  */
+      else
+        dfx->eof_seen = chunk->eof;
+    }
+  return 0;
+}
+
+
+/* Pipeline stage to hash the plaintext for the MDC.  */
+static gpg_error_t
+hash_stage (void *opaque, pipeline_chunk_t chunk)
+{
+  decode_filter_ctx_t dfx = opaque;
+
+  gcry_md_write (dfx->mdc_hash, chunk->buf + chunk->off, chunk->len);
+  return 0;
+}
+
+
+/* Return true if the data shall be taken from the pipeline.  The
+ * pipeline is started on the first call if requested; A is the
+ * filter's input.  */
+static int
+use_pipeline (decode_filter_ctx_t dfx, IOBUF a)
+{
+  pipeline_stage_fnc_t fncs[3];
+  gpg_error_t err;
+  int n = 0;
+
+  if (!dfx->pipeline_tried && opt.crypt_pipeline)
+    {
+      dfx->pipeline_tried = 1;
+      fncs[n++] = read_stage;
+      fncs[n++] = decrypt_stage;
+      if (dfx->mdc_hash)
+        fncs[n++] = hash_stage;
+      dfx->pipeline_in = a;
+      err = pipeline_new (&dfx->pipeline, 1, n, fncs, dfx,
+                          PIPELINE_NCHUNKS, PIPELINE_CHUNKSIZE + 22, 22);
+      if (err)
+        log_info ("can't start decryption pipeline: %s\n",
+                  gpg_strerror (err));
+    }
+  return !!dfx->pipeline;
+}
+
+
+/* The UNDERFLOW handler of the filters in pipeline mode.  */
+static int
+pipeline_underflow (decode_filter_ctx_t dfx, byte *buf, size_t *ret_len)
+{
+  gpg_error_t err;
+  size_t n;
+
+  err = pipeline_read (dfx->pipeline, buf, *ret_len, &n);
+  *ret_len = n;
+  if (err)
+    return err;
+  return n? 0 : -1;
+}
+
+
 static int
 mdc_decode_filter (void *opaque, int control, IOBUF a,
                    byte *buf, size_t *ret_len)
@@ -313,7 +454,11 @@ mdc_decode_filter (void *opaque, int control, IOBUF a,
      packet is not followed by other data.  This used to be a long
      standing bug which was fixed on 2009-10-02.  */
 
-  if ( control == IOBUFCTRL_UNDERFLOW && dfx->eof_seen )
+  if ( control == IOBUFCTRL_UNDERFLOW && use_pipeline (dfx, a) )
+    {
+      rc = pipeline_underflow (dfx, buf, ret_len);
+    }
+  else if ( control == IOBUFCTRL_UNDERFLOW && dfx->eof_seen )
     {
       *ret_len = 0;
       rc = -1;
@@ -440,7 +585,11 @@ decode_filter( void *opaque, int control, IOBUF a, byte *buf, size_t *ret_len)
   int c, rc = 0;
 
 
-  if ( control == IOBUFCTRL_UNDERFLOW && fc->eof_seen )
+  if ( control == IOBUFCTRL_UNDERFLOW && use_pipeline (fc, a) )
+    {
+      rc = pipeline_underflow (fc, buf, ret_len);
+    }
+  else if ( control == IOBUFCTRL_UNDERFLOW && fc->eof_seen )
     {
       *ret_len = 0;
       rc = -1;
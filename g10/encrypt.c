@@ -209,6 +209,9 @@ encrypt_simple (const char *filename, int mode, int use_seskey)
       return rc;
     }
 
+  if (opt.crypt_pipeline)
+    push_readahead_filter (inp);
+
   handle_progress (pfx, inp, filename);
 
   if (opt.textmode)
@@ -557,6 +560,9 @@ encrypt_crypt (ctrl_t ctrl, int filefd, const char *filename,
   if (opt.verbose)
     log_info (_("reading from '%s'\n"), iobuf_get_fname_nonnull (inp));
 
+  if (opt.crypt_pipeline)
+    push_readahead_filter (inp);
+
   handle_progress (pfx, inp, filename);
 
   if (opt.textmode)
@@ -96,6 +96,8 @@ typedef struct {
     gcry_md_hd_t mdc_hash;
     byte enchash[20];
     int create_mdc; /* flag will be set by the cipher filter */
+    struct pipeline_s *pipeline; /* Used with --crypt-pipeline.  */
+    IOBUF pipeline_out;          /* The output of the pipeline.  */
 } cipher_filter_context_t;
 
 
@@ -159,4 +161,7 @@ void release_progress_context (progress_filter_context_t *pfx);
 void handle_progress (progress_filter_context_t *pfx,
 		      iobuf_t inp, const char *name);
 
+/*-- pipeline.c --*/
+void push_readahead_filter (iobuf_t a);
+
 #endif /*G10_FILTER_H*/
@@ -202,6 +202,8 @@ copy_public_key (PKT_public_key *d, PKT_public_key *s)
   d->seckey_info = NULL;
   d->user_id = scopy_user_id (s->user_id);
   d->prefs = copy_prefs (s->prefs);
+  d->updateurl = s->updateurl? xstrdup (s->updateurl) : NULL;
+  d->serialno = s->serialno? xstrdup (s->serialno) : NULL;
 
   n = pubkey_get_npkey (s->pubkey_algo);
   i = 0;
@@ -261,6 +263,9 @@ copy_signature( PKT_signature *d, PKT_signature *s )
     d->pka_info = s->pka_info? cp_pka_info (s->pka_info) : NULL;
     d->hashed = cp_subpktarea (s->hashed);
     d->unhashed = cp_subpktarea (s->unhashed);
+    /* TRUST_REGEXP points into the hashed area.  */
+    if (s->trust_regexp && s->hashed)
+      d->trust_regexp = d->hashed->data + (s->trust_regexp - s->hashed->data);
     if (s->signers_uid)
       d->signers_uid = xstrdup (s->signers_uid);
     if(s->numrevkeys)
@@ -273,6 +278,46 @@ copy_signature( PKT_signature *d, PKT_signature *s )
 }
 
 
+/*
+ * deep copy of the user ID
+ */
+PKT_user_id *
+copy_user_id (PKT_user_id *s)
+{
+  PKT_user_id *d;
+  int i;
+
+  d = xmalloc (sizeof *d + s->len);
+  memcpy (d, s, sizeof *d + s->len);
+  d->ref = 1;
+  if (s->attrib_data)
+    {
+      d->attrib_data = xmalloc (s->attrib_len? s->attrib_len : 1);
+      memcpy (d->attrib_data, s->attrib_data, s->attrib_len);
+    }
+  if (s->attribs)
+    {
+      /* The attributes point into ATTRIB_DATA.  */
+      d->attribs = xmalloc (s->numattribs * sizeof *d->attribs);
+      for (i=0; i < s->numattribs; i++)
+        {
+          d->attribs[i] = s->attribs[i];
+          d->attribs[i].data = (d->attrib_data
+                                + (s->attribs[i].data - s->attrib_data));
+        }
+    }
+  if (s->namehash)
+    {
+      d->namehash = xmalloc (20);
+      memcpy (d->namehash, s->namehash, 20);
+    }
+  d->prefs = copy_prefs (s->prefs);
+  d->updateurl = s->updateurl? xstrdup (s->updateurl) : NULL;
+  d->mbox = s->mbox? xstrdup (s->mbox) : NULL;
+  return d;
+}
+
+
 /*
  * shallow copy of the user ID
  */
@@ -228,6 +228,8 @@ enum cmd_and_opt_values
     oCompletesNeeded,
     oMarginalsNeeded,
     oMaxCertDepth,
+    oTrustDBThreads,
+    oTrustDBCacheSize,
     oLoadExtension,
     oCompliance,
     oGnuPG,
@@ -300,6 +302,7 @@ enum cmd_and_opt_values
     oNoForceMDC,
     oDisableMDC,
     oNoDisableMDC,
+    oCryptPipeline,
     oS2KMode,
     oS2KDigest,
     oS2KCipher,
@@ -315,6 +318,7 @@ enum cmd_and_opt_values
     oKeyServerOptions,
     oImportOptions,
     oImportFilter,
+    oImportThreads,
     oExportOptions,
     oExportFilter,
     oListOptions,
@@ -408,6 +412,7 @@ enum cmd_and_opt_values
     oAllowWeakDigestAlgos,
     oFakedSystemTime,
     oNoAutostart,
+    oIOBufSize,
     oPrintPKARecords,
     oPrintDANERecords,
     oTOFUDefaultPolicy,
@@ -597,6 +602,7 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_n (oNoForceMDC, "no-force-mdc", "@"),
   ARGPARSE_s_n (oDisableMDC, "disable-mdc", "@"),
   ARGPARSE_s_n (oNoDisableMDC, "no-disable-mdc", "@"),
+  ARGPARSE_s_n (oCryptPipeline, "crypt-pipeline", "@"),
 
   ARGPARSE_s_n (oDisableSignerUID, "disable-signer-uid", "@"),
 
@@ -616,6 +622,7 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_s (oKeyServerOptions, "keyserver-options", "@"),
   ARGPARSE_s_s (oImportOptions, "import-options", "@"),
   ARGPARSE_s_s (oImportFilter,  "import-filter", "@"),
+  ARGPARSE_s_i (oImportThreads, "import-threads", "@"),
   ARGPARSE_s_s (oExportOptions, "export-options", "@"),
   ARGPARSE_s_s (oExportFilter,  "export-filter", "@"),
   ARGPARSE_s_s (oListOptions,   "list-options", "@"),
@@ -637,6 +644,8 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_i (oCompletesNeeded, "completes-needed", "@"),
   ARGPARSE_s_i (oMarginalsNeeded, "marginals-needed", "@"),
   ARGPARSE_s_i (oMaxCertDepth,	"max-cert-depth", "@" ),
+  ARGPARSE_s_i (oTrustDBThreads, "trustdb-threads", "@"),
+  ARGPARSE_s_u (oTrustDBCacheSize, "trustdb-cache-size", "@"),
   ARGPARSE_s_s (oTrustedKey, "trusted-key", "@"),
 
   ARGPARSE_s_s (oLoadExtension, "load-extension", "@"),  /* Dummy.  */
@@ -879,6 +888,7 @@ static ARGPARSE_OPTS opts[] = {
   ARGPARSE_s_s (oAutoKeyLocate, "auto-key-locate", "@"),
   ARGPARSE_s_n (oNoAutoKeyLocate, "no-auto-key-locate", "@"),
   ARGPARSE_s_n (oNoAutostart, "no-autostart", "@"),
+  ARGPARSE_s_u (oIOBufSize, "iobuf-size", "@"),
 
   /* Dummy options with warnings.  */
   ARGPARSE_s_n (oUseAgent,      "use-agent", "@"),
@@ -2784,6 +2794,16 @@ main (int argc, char **argv)
 	  case oCompletesNeeded: opt.completes_needed = pargs.r.ret_int; break;
 	  case oMarginalsNeeded: opt.marginals_needed = pargs.r.ret_int; break;
 	  case oMaxCertDepth: opt.max_cert_depth = pargs.r.ret_int; break;
+	  case oTrustDBThreads:
+            opt.trustdb_threads = pargs.r.ret_int;
+            if (opt.trustdb_threads < 0)
+              opt.trustdb_threads = 0;
+            else if (opt.trustdb_threads > 64)
+              opt.trustdb_threads = 64;
+	    break;
+	  case oTrustDBCacheSize:
+            opt.trustdb_cache_size = pargs.r.ret_ulong;
+	    break;
 
 #ifndef NO_TRUST_MODELS
 	  case oTrustDBName: trustdb_name = pargs.r.ret_str; break;
@@ -2950,6 +2970,7 @@ main (int argc, char **argv)
 	  case oNoForceMDC: opt.force_mdc = 0; break;
 	  case oDisableMDC: opt.disable_mdc = 1; break;
 	  case oNoDisableMDC: opt.disable_mdc = 0; break;
+	  case oCryptPipeline: opt.crypt_pipeline = 1; break;
 
           case oDisableSignerUID: opt.flags.disable_signer_uid = 1; break;
 
@@ -3200,6 +3221,13 @@ main (int argc, char **argv)
 	    if (rc)
               log_error (_("invalid filter option: %s\n"), gpg_strerror (rc));
 	    break;
+	  case oImportThreads:
+            opt.import_threads = pargs.r.ret_int;
+            if (opt.import_threads < 0)
+              opt.import_threads = 0;
+            else if (opt.import_threads > 64)
+              opt.import_threads = 64;
+	    break;
 	  case oExportOptions:
 	    if(!parse_export_options(pargs.r.ret_str,&opt.export_options,1))
 	      {
@@ -3524,6 +3552,10 @@ main (int argc, char **argv)
 
           case oNoAutostart: opt.autostart = 0; break;
 
+          case oIOBufSize:
+            iobuf_set_buffer_size (NULL, pargs.r.ret_ulong);
+            break;
+
 	  case oDefaultNewKeyAlgo:
             opt.def_new_key_algo = pargs.r.ret_str;
             break;
@@ -5010,6 +5042,10 @@ g10_exit( int rc )
   if (opt.debug)
     gcry_control (GCRYCTL_DUMP_SECMEM_STATS );
 
+#ifdef USE_TOFU
+  tofu_flush_on_exit ();
+#endif
+
   emergency_cleanup ();
 
   rc = rc? rc : log_get_errorcount(0)? 2 : g10_errors_seen? 1 : 0;
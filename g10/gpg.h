@@ -99,6 +99,9 @@ struct server_control_s
 
   /* This is used to cache a key data base handle.  */
   KEYDB_HANDLE cached_getkey_kdb;
+
+  /* The signer cache used while verify_files runs (see verify.c).  */
+  struct verify_cache_s *verify_cache;
 };
 
 
@@ -762,6 +762,14 @@ tofu_end_batch_update (ctrl_t ctrl)
   (void)ctrl;
 }
 
+gpg_error_t
+tofu_preload_bindings (ctrl_t ctrl)
+{
+  (void)ctrl;
+
+  return 0;
+}
+
 gpg_error_t
 tofu_notice_key_changed (ctrl_t ctrl, kbnode_t kb)
 {
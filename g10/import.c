@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <npth.h>
 
 #include "gpg.h"
 #include "options.h"
@@ -93,6 +94,44 @@ struct import_filter_s
 struct import_filter_s import_filter;
 
 
+/* The pipeline used with --import-threads.  The keyblocks are read
+ * and queued by the main thread; worker threads take them from the
+ * queue and check their self-signatures.  The main thread then
+ * imports the keyblocks in the original order.  The results of the
+ * checks are passed via the signature cache flags so that
+ * chk_self_sigs does not need to check them again.  All queue
+ * operations are done with the nPth global lock held; the checks
+ * themselves and the main thread's import run unprotected.  */
+enum import_job_states
+  {
+    IMPORT_JOB_PENDING,
+    IMPORT_JOB_RUNNING,
+    IMPORT_JOB_DONE
+  };
+
+struct import_job_s
+{
+  struct import_job_s *next;
+  kbnode_t keyblock;
+  enum import_job_states state;
+};
+typedef struct import_job_s *import_job_t;
+
+struct import_pipeline_s
+{
+  npth_mutex_t lock;
+  npth_cond_t cond;        /* Signaled on state changes.  */
+  int stop;                /* Request the workers to terminate.  */
+  int nthreads;            /* Number of running workers.  */
+  npth_t *threads;         /* The workers.  */
+  unsigned int depth;      /* Max. number of queued jobs.  */
+  unsigned int njobs;      /* Number of queued jobs.  */
+  import_job_t head;       /* The oldest job.  */
+  import_job_t tail;       /* The newest job.  */
+  import_job_t pending;    /* The oldest pending job or NULL.  */
+};
+typedef struct import_pipeline_s *import_pipeline_t;
+
 static int import (ctrl_t ctrl,
                    IOBUF inp, const char* fname, struct import_stats_s *stats,
 		   unsigned char **fpr, size_t *fpr_len, unsigned int options,
@@ -540,6 +579,326 @@ import_keys_es_stream (ctrl_t ctrl, estream_t fp,
 }
 
 
+/* Check the self-signatures of KEYBLOCK and store the results in the
+ * signature cache flags.  This is the part of chk_self_sigs which
+ * does not require any global state and may thus run in a worker
+ * thread; everything else, including signatures which would
+ * require a diagnostic, is left to chk_self_sigs.  */
+static void
+precheck_self_sigs (kbnode_t keyblock)
+{
+  PKT_public_key *pk;
+  kbnode_t n, unode = NULL, knode = NULL;
+  PACKET *packet;
+  PKT_signature *sig;
+  const struct weakhash *weak;
+  u32 keyid[2];
+  gpg_error_t err;
+
+  if (keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
+    return;
+  pk = keyblock->pkt->pkt.public_key;
+  keyid_from_pk (pk, keyid);
+
+  for (n = keyblock->next; n; n = n->next)
+    {
+      if (n->pkt->pkttype == PKT_USER_ID)
+        {
+          unode = n;
+          continue;
+        }
+      if (n->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+        {
+          knode = n;
+          continue;
+        }
+      if (n->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+
+      sig = n->pkt->pkt.signature;
+      if (sig->flags.checked || sig->flags.unknown_critical
+          || keyid[0] != sig->keyid[0] || keyid[1] != sig->keyid[1])
+        continue;
+
+      /* Select the packet like check_key_signature2 does.  */
+      if (sig->sig_class == 0x1f || sig->sig_class == 0x20)
+        packet = keyblock->pkt;
+      else if (sig->sig_class == 0x18 || sig->sig_class == 0x28)
+        packet = knode? knode->pkt : NULL;
+      else if ((sig->sig_class >= 0x10 && sig->sig_class <= 0x13)
+               || sig->sig_class == 0x30)
+        packet = unode? unode->pkt : NULL;
+      else
+        packet = NULL;
+      if (!packet)
+        continue;
+
+      /* A weak digest algorithm shall be reported only once.  */
+      if (!opt.flags.allow_weak_digest_algos)
+        {
+          for (weak = opt.weak_digests; weak; weak = weak->next)
+            if (sig->digest_algo == weak->algo)
+              break;
+          if (weak)
+            continue;
+        }
+
+      err = check_signature_over_key_or_uid (NULL, pk, sig, keyblock, packet,
+                                             NULL, NULL);
+      if (!err)
+        {
+          sig->flags.checked = 1;
+          sig->flags.valid = 1;
+        }
+      else if (gpg_err_code (err) == GPG_ERR_BAD_SIGNATURE)
+        {
+          sig->flags.checked = 1;
+          sig->flags.valid = 0;
+        }
+    }
+}
+
+
+/* The thread function of the import workers.  */
+static void *
+import_worker_thread (void *arg)
+{
+  import_pipeline_t pl = arg;
+  import_job_t job;
+
+  npth_mutex_lock (&pl->lock);
+  for (;;)
+    {
+      while (!pl->stop && !pl->pending)
+        npth_cond_wait (&pl->cond, &pl->lock);
+      if (pl->stop)
+        break;
+
+      job = pl->pending;
+      pl->pending = job->next;
+      job->state = IMPORT_JOB_RUNNING;
+      npth_mutex_unlock (&pl->lock);
+
+      npth_unprotect ();
+      precheck_self_sigs (job->keyblock);
+      npth_protect ();
+
+      npth_mutex_lock (&pl->lock);
+      job->state = IMPORT_JOB_DONE;
+      npth_cond_broadcast (&pl->cond);
+    }
+  npth_mutex_unlock (&pl->lock);
+
+  return NULL;
+}
+
+
+/* Release the import pipeline PL and all keyblocks still queued.
+ * This must be called by the main thread.  */
+static void
+import_pipeline_release (import_pipeline_t pl)
+{
+  import_job_t job;
+  int i;
+
+  if (!pl)
+    return;
+
+  npth_main_enter ();
+  npth_mutex_lock (&pl->lock);
+  pl->stop = 1;
+  npth_cond_broadcast (&pl->cond);
+  npth_mutex_unlock (&pl->lock);
+  for (i=0; i < pl->nthreads; i++)
+    npth_join (pl->threads[i], NULL);
+
+  while ((job = pl->head))
+    {
+      pl->head = job->next;
+      release_kbnode (job->keyblock);
+      xfree (job);
+    }
+  npth_cond_destroy (&pl->cond);
+  npth_mutex_destroy (&pl->lock);
+  npth_main_leave (-1);
+  xfree (pl->threads);
+  xfree (pl);
+}
+
+
+/* Create a new import pipeline with NTHREADS workers.  On success
+ * the main thread runs unprotected until import_pipeline_release is
+ * called.  Returns NULL on error.  */
+static import_pipeline_t
+import_pipeline_new (int nthreads)
+{
+  gpg_error_t err;
+  import_pipeline_t pl;
+  npth_attr_t tattr;
+  int i;
+
+  pl = xtrycalloc (1, sizeof *pl);
+  if (!pl)
+    return NULL;
+  pl->threads = xtrycalloc (nthreads, sizeof *pl->threads);
+  if (!pl->threads || npth_main_enter ())
+    {
+      xfree (pl->threads);
+      xfree (pl);
+      return NULL;
+    }
+  pl->depth = 4 * nthreads;
+  npth_mutex_init (&pl->lock, NULL);
+  npth_cond_init (&pl->cond, NULL);
+
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  for (i=0; i < nthreads; i++)
+    {
+      err = gpg_error_from_errno (npth_create (&pl->threads[i], &tattr,
+                                               import_worker_thread, pl));
+      if (err)
+        {
+          log_info ("error spawning import worker: %s\n",
+                    gpg_strerror (err));
+          break;
+        }
+      pl->nthreads++;
+    }
+  npth_attr_destroy (&tattr);
+
+  if (opt.verbose)
+    log_info (_("using %d threads to check self-signatures\n"),
+              pl->nthreads);
+
+  npth_main_leave (1);
+  return pl;
+}
+
+
+/* Remove the oldest job from the pipeline PL and return its keyblock
+ * after the self-signatures have been checked.  If no worker has
+ * taken up the job yet, the check is done by the calling thread.
+ * Returns NULL if the pipeline is empty.  */
+static kbnode_t
+import_pipeline_pop (import_pipeline_t pl)
+{
+  import_job_t job;
+  kbnode_t keyblock;
+  int run_here = 0;
+
+  npth_main_enter ();
+  npth_mutex_lock (&pl->lock);
+  job = pl->head;
+  if (job)
+    {
+      if (job->state == IMPORT_JOB_PENDING)
+        {
+          /* The oldest job is always the first pending one.  */
+          pl->pending = job->next;
+          job->state = IMPORT_JOB_RUNNING;
+          run_here = 1;
+        }
+      else
+        {
+          while (job->state != IMPORT_JOB_DONE)
+            npth_cond_wait (&pl->cond, &pl->lock);
+        }
+      pl->head = job->next;
+      if (!pl->head)
+        pl->tail = NULL;
+      pl->njobs--;
+    }
+  npth_mutex_unlock (&pl->lock);
+  npth_main_leave (0);
+
+  if (!job)
+    return NULL;
+
+  keyblock = job->keyblock;
+  xfree (job);
+  if (run_here)
+    precheck_self_sigs (keyblock);
+  return keyblock;
+}
+
+
+/* Queue KEYBLOCK in the pipeline PL.  If the queue is full the
+ * keyblock of the oldest job is returned (see import_pipeline_pop);
+ * otherwise NULL is returned.  */
+static kbnode_t
+import_pipeline_push (import_pipeline_t pl, kbnode_t keyblock)
+{
+  import_job_t job;
+
+  job = xcalloc (1, sizeof *job);
+  job->keyblock = keyblock;
+  job->state = IMPORT_JOB_PENDING;
+
+  npth_main_enter ();
+  npth_mutex_lock (&pl->lock);
+  if (pl->tail)
+    pl->tail->next = job;
+  else
+    pl->head = job;
+  pl->tail = job;
+  if (!pl->pending)
+    pl->pending = job;
+  pl->njobs++;
+  npth_cond_broadcast (&pl->cond);
+  npth_mutex_unlock (&pl->lock);
+  npth_main_leave (0);
+
+  if (pl->njobs < pl->depth)
+    return NULL;
+  return import_pipeline_pop (pl);
+}
+
+
+/* Import the KEYBLOCK read by import and release it.  */
+static int
+import_keyblock (ctrl_t ctrl, kbnode_t keyblock, struct import_stats_s *stats,
+                 unsigned char **fpr, size_t *fpr_len, unsigned int options,
+                 import_screener_t screener, void *screener_arg)
+{
+  int rc;
+
+  if (keyblock->pkt->pkttype == PKT_PUBLIC_KEY)
+    rc = import_one (ctrl, keyblock,
+                     stats, fpr, fpr_len, options, 0, 0,
+                     screener, screener_arg);
+  else if (keyblock->pkt->pkttype == PKT_SECRET_KEY)
+    rc = import_secret_one (ctrl, keyblock, stats,
+                            opt.batch, options, 0,
+                            screener, screener_arg);
+  else if (keyblock->pkt->pkttype == PKT_SIGNATURE
+           && keyblock->pkt->pkt.signature->sig_class == 0x20 )
+    rc = import_revoke_cert (ctrl, keyblock, stats);
+  else
+    {
+      log_info (_("skipping block of type %d\n"), keyblock->pkt->pkttype);
+      rc = 0;
+    }
+  release_kbnode (keyblock);
+
+  /* fixme: we should increment the not imported counter but
+     this does only make sense if we keep on going despite of
+     errors.  For now we do this only if the imported key is too
+     large. */
+  if (gpg_err_code (rc) == GPG_ERR_TOO_LARGE
+      && gpg_err_source (rc) == GPG_ERR_SOURCE_KEYBOX)
+    {
+      stats->not_imported++;
+    }
+  else if (rc)
+    return rc;
+
+  if (!(++stats->count % 100) && !opt.quiet)
+    log_info (_("%lu keys processed so far\n"), stats->count );
+  return 0;
+}
+
+
 static int
 import (ctrl_t ctrl, IOBUF inp, const char* fname,struct import_stats_s *stats,
 	unsigned char **fpr,size_t *fpr_len, unsigned int options,
@@ -550,7 +909,10 @@ import (ctrl_t ctrl, IOBUF inp, const char* fname,struct import_stats_s *stats,
                                 grasp the return semantics of
                                 read_block. */
   int rc = 0;
+  int read_rc;
   int v3keys;
+  int import_failed = 0;
+  import_pipeline_t pipeline = NULL;
 
   getkey_disable_caches ();
 
@@ -564,46 +926,49 @@ import (ctrl_t ctrl, IOBUF inp, const char* fname,struct import_stats_s *stats,
       release_armor_context (afx);
     }
 
+  /* The self-signature checks are passed to chk_self_sigs via the
+   * signature cache; thus the pipeline is useless without it.  */
+  if (opt.import_threads > 0 && !opt.no_sig_cache)
+    pipeline = import_pipeline_new (opt.import_threads);
+
   while (!(rc = read_block (inp, !!(options & IMPORT_RESTORE),
                             &pending_pkt, &keyblock, &v3keys)))
     {
       stats->v3keys += v3keys;
-      if (keyblock->pkt->pkttype == PKT_PUBLIC_KEY)
-        rc = import_one (ctrl, keyblock,
-                         stats, fpr, fpr_len, options, 0, 0,
-                         screener, screener_arg);
-      else if (keyblock->pkt->pkttype == PKT_SECRET_KEY)
-        rc = import_secret_one (ctrl, keyblock, stats,
-                                opt.batch, options, 0,
-                                screener, screener_arg);
-      else if (keyblock->pkt->pkttype == PKT_SIGNATURE
-               && keyblock->pkt->pkt.signature->sig_class == 0x20 )
-        rc = import_revoke_cert (ctrl, keyblock, stats);
-      else
+      if (pipeline)
         {
-          log_info (_("skipping block of type %d\n"), keyblock->pkt->pkttype);
-	}
-      release_kbnode (keyblock);
-
-      /* fixme: we should increment the not imported counter but
-         this does only make sense if we keep on going despite of
-         errors.  For now we do this only if the imported key is too
-         large. */
-      if (gpg_err_code (rc) == GPG_ERR_TOO_LARGE
-            && gpg_err_source (rc) == GPG_ERR_SOURCE_KEYBOX)
+          keyblock = import_pipeline_push (pipeline, keyblock);
+          if (!keyblock)
+            continue;
+        }
+      rc = import_keyblock (ctrl, keyblock, stats, fpr, fpr_len, options,
+                            screener, screener_arg);
+      if (rc)
         {
-          stats->not_imported++;
+          import_failed = 1;
+          break;
         }
-      else if (rc)
-        break;
-
-      if (!(++stats->count % 100) && !opt.quiet)
-        log_info (_("%lu keys processed so far\n"), stats->count );
     }
   stats->v3keys += v3keys;
-  if (rc == -1)
-    rc = 0;
-  else if (rc && gpg_err_code (rc) != GPG_ERR_INV_KEYRING)
+  if (!import_failed)
+    {
+      /* Import the keyblocks still in the pipeline.  This is also
+       * done after a read error so that the keyblocks read before the
+       * error are not lost; the read error is reported afterwards.  */
+      read_rc = rc == -1? 0 : rc;
+      rc = 0;
+      while (pipeline && (keyblock = import_pipeline_pop (pipeline)))
+        {
+          rc = import_keyblock (ctrl, keyblock, stats, fpr, fpr_len, options,
+                                screener, screener_arg);
+          if (rc)
+            break;
+        }
+      if (!rc)
+        rc = read_rc;
+    }
+  import_pipeline_release (pipeline);
+  if (rc && gpg_err_code (rc) != GPG_ERR_INV_KEYRING)
     log_error (_("error reading '%s': %s\n"), fname, gpg_strerror (rc));
 
   return rc;
@@ -1380,6 +1745,17 @@ apply_drop_sig_filter (ctrl_t ctrl, kbnode_t keyblock, recsel_expr_t selector)
 }
 
 
+/* Store the signature check results of KEYBLOCK, which has just been
+ * written using HD, with the keyblock in the database.  FPR is the
+ * fingerprint of the primary key.  */
+static void
+store_sig_cache (KEYDB_HANDLE hd, kbnode_t keyblock, const byte *fpr)
+{
+  if (!keydb_search_reset (hd) && !keydb_search_fpr (hd, fpr))
+    keydb_update_sig_cache (hd, keyblock);
+}
+
+
 /*
  * Try to import one keyblock. Return an error only in serious cases,
  * but never for an invalid keyblock.  It uses log_error to increase
@@ -1611,7 +1987,9 @@ import_one (ctrl_t ctrl,
       if (rc)
         log_error (_("error writing keyring '%s': %s\n"),
                    keydb_get_resource_name (hd), gpg_strerror (rc));
-      else if (!(opt.import_options & IMPORT_KEEP_OWNERTTRUST))
+      else
+        store_sig_cache (hd, keyblock, fpr2);
+      if (!rc && !(opt.import_options & IMPORT_KEEP_OWNERTTRUST))
         {
           /* This should not be possible since we delete the
              ownertrust when a key is deleted, but it can happen if
@@ -1621,7 +1999,7 @@ import_one (ctrl_t ctrl,
 
           clear_ownertrusts (ctrl, pk);
           if (non_self)
-            revalidation_mark (ctrl);
+            revalidation_mark_key (ctrl, pk);
         }
       keydb_release (hd);
 
@@ -1712,8 +2090,12 @@ import_one (ctrl_t ctrl,
           if (rc)
             log_error (_("error writing keyring '%s': %s\n"),
                        keydb_get_resource_name (hd), gpg_strerror (rc) );
-          else if (non_self)
-            revalidation_mark (ctrl);
+          else
+            {
+              store_sig_cache (hd, keyblock_orig, fpr2);
+              if (non_self)
+                revalidation_mark_key (ctrl, pk);
+            }
 
           /* We are ready.  */
           if (!opt.quiet && !silent)
@@ -2468,7 +2850,7 @@ import_revoke_cert (ctrl_t ctrl, kbnode_t node, struct import_stats_s *stats)
   if (get_ownertrust (ctrl, pk) == TRUST_ULTIMATE)
     clear_ownertrusts (ctrl, pk);
 
-  revalidation_mark (ctrl);
+  revalidation_mark_key (ctrl, pk);
 
  leave:
   keydb_release (hd);
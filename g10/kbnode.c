@@ -109,6 +109,49 @@ clone_kbnode( KBNODE node )
 }
 
 
+/* Return a deep copy of KEYBLOCK or NULL if KEYBLOCK contains packets
+ * which can't be copied (e.g. secret keys).  The flags of the nodes
+ * are not copied.  */
+kbnode_t
+copy_keyblock (kbnode_t keyblock)
+{
+  kbnode_t root = NULL;
+  kbnode_t *tail = &root;
+  kbnode_t node;
+  PACKET *pkt;
+
+  for (node = keyblock; node; node = node->next)
+    {
+      pkt = xmalloc (sizeof *pkt);
+      pkt->pkttype = node->pkt->pkttype;
+      switch (pkt->pkttype)
+        {
+        case PKT_PUBLIC_KEY:
+        case PKT_PUBLIC_SUBKEY:
+          pkt->pkt.public_key = copy_public_key (NULL,
+                                                 node->pkt->pkt.public_key);
+          break;
+        case PKT_USER_ID:
+        case PKT_ATTRIBUTE:
+          pkt->pkt.user_id = copy_user_id (node->pkt->pkt.user_id);
+          break;
+        case PKT_SIGNATURE:
+          pkt->pkt.signature = copy_signature (NULL,
+                                               node->pkt->pkt.signature);
+          break;
+        default:
+          xfree (pkt);
+          release_kbnode (root);
+          return NULL;
+        }
+      *tail = new_kbnode (pkt);
+      tail = &(*tail)->next;
+    }
+
+  return root;
+}
+
+
 void
 release_kbnode( KBNODE n )
 {
@@ -29,6 +29,7 @@
 
 #include "gpg.h"
 #include "../common/util.h"
+#include "../common/host2net.h"
 #include "options.h"
 #include "main.h" /*try_make_homedir ()*/
 #include "packet.h"
@@ -67,27 +68,43 @@ static void *primary_keydb;
 /* Whether we have successfully registered any resource.  */
 static int any_registered;
 
-/* This is a simple cache used to return the last result of a
-   successful fingerprint search.  This works only for keybox resources
-   because (due to lack of a copy_keyblock function) we need to store
-   an image of the keyblock which is fortunately instantly available
-   for keyboxes.  */
-enum keyblock_cache_states {
-  KEYBLOCK_CACHE_EMPTY,
-  KEYBLOCK_CACHE_PREPARED,
-  KEYBLOCK_CACHE_FILLED
+/* This is a cache of parsed keyblocks used to avoid parsing the same
+   keyblock again and again; for example when verifying many
+   signatures made by the same keys.  This works only for keybox
+   resources because there each keyblock comes with a checksum which
+   we use, along with the resource, to identify a cached keyblock.
+   Thus there is no way to get a stale keyblock even if another
+   process modified the keybox.  The cache is process wide and
+   limited in the number of keyblocks and the total length of their
+   images; the least recently used keyblock is evicted first.  */
+#define KEYBLOCK_CACHE_BUCKETS   256
+#define KEYBLOCK_CACHE_MAX_ITEMS 256
+#define KEYBLOCK_CACHE_MAX_BYTES (8*1024*1024)
+
+struct keyblock_cache_item
+{
+  struct keyblock_cache_item *next;     /* Next item in the bucket.  */
+  struct keyblock_cache_item *lru_prev; /* Next more recently used.  */
+  struct keyblock_cache_item *lru_next; /* Next less recently used.  */
+  void *token;                /* The resource holding the keyblock.  */
+  byte checksum[20];          /* The checksum of the keybox blob.  */
+  size_t imagelen;            /* The length of the keyblock image.  */
+  kbnode_t keyblock;          /* The parsed keyblock (flags cleared).  */
 };
 
-struct keyblock_cache {
-  enum keyblock_cache_states state;
-  byte fpr[MAX_FINGERPRINT_LEN];
-  iobuf_t iobuf; /* Image of the keyblock.  */
-  int pk_no;
-  int uid_no;
-  /* Offset of the record in the keybox.  */
-  int resource;
-  off_t offset;
-};
+static struct keyblock_cache_item *keyblock_cache[KEYBLOCK_CACHE_BUCKETS];
+
+static struct
+{
+  struct keyblock_cache_item *lru_head;  /* The most recently used.  */
+  struct keyblock_cache_item *lru_tail;  /* The least recently used.  */
+  unsigned int count;     /* Number of cached keyblocks.  */
+  size_t bytes;           /* Total length of their images.  */
+  unsigned int hits;      /* Number of keyblocks taken from the cache.  */
+  unsigned int misses;    /* Number of keyblocks not in the cache.  */
+  unsigned int evictions; /* Number of keyblocks dropped due to size.  */
+  unsigned int flushes;   /* Number of flushes.  */
+} keyblock_cache_stats;
 
 
 struct keydb_handle
@@ -122,10 +139,6 @@ struct keydb_handle
   /* The number of resources in ACTIVE.  */
   int used;
 
-  /* Cache of the last found and parsed key block (only used for
-     keyboxes, not keyrings).  */
-  struct keyblock_cache keyblock_cache;
-
   /* Copy of ALL_RESOURCES when keydb_new is called.  */
   struct resource_item active[MAX_KEYDB_RESOURCES];
 };
@@ -135,29 +148,35 @@ struct keydb_handle
    exist, we don't have to spend time looking it up.  This
    particularly helps the --list-sigs and --check-sigs commands.
 
-   The cache stores the results in a hash using separate chaining.
-   Concretely: we use the LSB of the keyid to index the hash table and
-   each bucket consists of a linked list of entries.  An entry
-   consists of the 64-bit key id.  If a key id is not in the cache,
+   The cache is an open addressing hash table with linear probing.
+   The LSB of the keyid selects the first slot to probe; the table is
+   doubled in size whenever it becomes half full so that probe
+   sequences stay short even when checking large numbers of
+   signatures from unknown keys.  If a key id is not in the cache,
    then we don't know whether it is in the DB or not.
 
-   To simplify the cache consistency protocol, we simply flush the
-   whole cache whenever a key is inserted or updated.  */
+   When a keyblock is inserted or updated we remove the key ids of
+   its primary key and subkeys from the cache; deleting a keyblock
+   can't turn a negative answer into a wrong one and thus does not
+   touch the cache at all.  */
 
-#define KID_NOT_FOUND_CACHE_BUCKETS 256
-static struct kid_not_found_cache_bucket *
-  kid_not_found_cache[KID_NOT_FOUND_CACHE_BUCKETS];
+#define KID_NOT_FOUND_CACHE_MINSIZE 256
 
-struct kid_not_found_cache_bucket
+struct kid_not_found_cache_slot
 {
-  struct kid_not_found_cache_bucket *next;
   u32 kid[2];
+  int used;
 };
 
+static struct kid_not_found_cache_slot *kid_not_found_cache;
+static unsigned int kid_not_found_cache_size;  /* Always a power of 2.  */
+
 struct
 {
   unsigned int count;   /* The current number of entries in the hash table.  */
   unsigned int peak;    /* The peak of COUNT.  */
+  unsigned int size;    /* The peak number of slots.  */
+  unsigned int removals;/* The number of entries removed due to updates.  */
   unsigned int flushes; /* The number of flushes.  */
 } kid_not_found_stats;
 
@@ -173,9 +192,10 @@ struct
   unsigned int delete_keyblocks;/* Number of delete_keyblock calls.       */
   unsigned int search_resets;   /* Number of keydb_search_reset calls.    */
   unsigned int found;           /* Number of successful keydb_search calls. */
-  unsigned int found_cached;    /* Ditto but from the cache.              */
   unsigned int notfound;        /* Number of failed keydb_search calls.   */
   unsigned int notfound_cached; /* Ditto but from the cache.              */
+  unsigned int sigstatus_updates; /* Number of keydb_update_sig_cache
+                                     calls which wrote to the keybox.  */
 } keydb_stats;
 
 
@@ -183,6 +203,22 @@ static int lock_all (KEYDB_HANDLE hd);
 static void unlock_all (KEYDB_HANDLE hd);
 
 
+/* Return the index of the slot for KID in the kid_not_found_cache.
+   This is either the slot holding KID or the first free slot of its
+   probe sequence.  The table must not be full.  */
+static unsigned int
+kid_not_found_slot (struct kid_not_found_cache_slot *table,
+                    unsigned int size, u32 *kid)
+{
+  unsigned int i;
+
+  for (i = kid[1] & (size - 1); table[i].used; i = (i + 1) & (size - 1))
+    if (table[i].kid[0] == kid[0] && table[i].kid[1] == kid[1])
+      break;
+  return i;
+}
+
+
 /* Check whether the keyid KID is in key id is definitely not in the
    database.
 
@@ -198,16 +234,16 @@ static void unlock_all (KEYDB_HANDLE hd);
 static int
 kid_not_found_p (u32 *kid)
 {
-  struct kid_not_found_cache_bucket *k;
-
-  for (k = kid_not_found_cache[kid[0] % KID_NOT_FOUND_CACHE_BUCKETS]; k; k = k->next)
-    if (k->kid[0] == kid[0] && k->kid[1] == kid[1])
-      {
-        if (DBG_CACHE)
-          log_debug ("keydb: kid_not_found_p (%08lx%08lx) => not in DB\n",
-                     (ulong)kid[0], (ulong)kid[1]);
-        return 1;
-      }
+  if (kid_not_found_cache
+      && kid_not_found_cache[kid_not_found_slot (kid_not_found_cache,
+                                                 kid_not_found_cache_size,
+                                                 kid)].used)
+    {
+      if (DBG_CACHE)
+        log_debug ("keydb: kid_not_found_p (%08lx%08lx) => not in DB\n",
+                   (ulong)kid[0], (ulong)kid[1]);
+      return 1;
+    }
 
   if (DBG_CACHE)
     log_debug ("keydb: kid_not_found_p (%08lx%08lx) => indeterminate\n",
@@ -216,65 +252,312 @@ kid_not_found_p (u32 *kid)
 }
 
 
-/* Insert the keyid KID into the kid_not_found_cache.  FOUND is whether
-   the key is in the key database or not.
-
-   Note this function does not check whether the key id is already in
-   the cache.  As such, kid_not_found_p() should be called first.  */
+/* Insert the keyid KID into the kid_not_found_cache.  Inserting a key
+   id which is already in the cache is a no-op.  The cache is only an
+   optimization; thus if we run out of core we simply don't cache.  */
 static void
 kid_not_found_insert (u32 *kid)
 {
-  struct kid_not_found_cache_bucket *k;
+  unsigned int i;
 
   if (DBG_CACHE)
     log_debug ("keydb: kid_not_found_insert (%08lx%08lx)\n",
                (ulong)kid[0], (ulong)kid[1]);
-  k = xmalloc (sizeof *k);
-  k->kid[0] = kid[0];
-  k->kid[1] = kid[1];
-  k->next = kid_not_found_cache[kid[0] % KID_NOT_FOUND_CACHE_BUCKETS];
-  kid_not_found_cache[kid[0] % KID_NOT_FOUND_CACHE_BUCKETS] = k;
+
+  if (2 * (kid_not_found_stats.count + 1) > kid_not_found_cache_size)
+    {
+      struct kid_not_found_cache_slot *table;
+      unsigned int size, n;
+
+      size = (kid_not_found_cache_size? 2 * kid_not_found_cache_size
+              /**/                    : KID_NOT_FOUND_CACHE_MINSIZE);
+      table = xtrycalloc (size, sizeof *table);
+      if (!table)
+        return;
+      for (n = 0; n < kid_not_found_cache_size; n++)
+        if (kid_not_found_cache[n].used)
+          table[kid_not_found_slot (table, size,
+                                    kid_not_found_cache[n].kid)]
+            = kid_not_found_cache[n];
+      xfree (kid_not_found_cache);
+      kid_not_found_cache = table;
+      kid_not_found_cache_size = size;
+      if (size > kid_not_found_stats.size)
+        kid_not_found_stats.size = size;
+    }
+
+  i = kid_not_found_slot (kid_not_found_cache, kid_not_found_cache_size, kid);
+  if (kid_not_found_cache[i].used)
+    return;
+  kid_not_found_cache[i].kid[0] = kid[0];
+  kid_not_found_cache[i].kid[1] = kid[1];
+  kid_not_found_cache[i].used = 1;
   kid_not_found_stats.count++;
+  if (kid_not_found_stats.count > kid_not_found_stats.peak)
+    kid_not_found_stats.peak = kid_not_found_stats.count;
 }
 
 
-/* Flush the kid not found cache.  */
+/* Remove the keyid KID from the kid_not_found_cache.  We use backward
+   shift deletion so that no tombstones are required.  */
 static void
-kid_not_found_flush (void)
+kid_not_found_remove (u32 *kid)
 {
-  struct kid_not_found_cache_bucket *k, *knext;
-  int i;
-
-  if (DBG_CACHE)
-    log_debug ("keydb: kid_not_found_flush\n");
+  unsigned int mask, i, j, home;
 
   if (!kid_not_found_stats.count)
     return;
 
-  for (i=0; i < DIM(kid_not_found_cache); i++)
+  mask = kid_not_found_cache_size - 1;
+  i = kid_not_found_slot (kid_not_found_cache, kid_not_found_cache_size, kid);
+  if (!kid_not_found_cache[i].used)
+    return;
+
+  if (DBG_CACHE)
+    log_debug ("keydb: kid_not_found_remove (%08lx%08lx)\n",
+               (ulong)kid[0], (ulong)kid[1]);
+
+  for (j = (i + 1) & mask; kid_not_found_cache[j].used; j = (j + 1) & mask)
     {
-      for (k = kid_not_found_cache[i]; k; k = knext)
+      /* Move the entry at J into the hole at I unless its home slot
+         lies cyclically within (I, J].  */
+      home = kid_not_found_cache[j].kid[1] & mask;
+      if (((j - home) & mask) >= ((j - i) & mask))
         {
-          knext = k->next;
-          xfree (k);
+          kid_not_found_cache[i] = kid_not_found_cache[j];
+          i = j;
         }
-      kid_not_found_cache[i] = NULL;
     }
-  if (kid_not_found_stats.count > kid_not_found_stats.peak)
-    kid_not_found_stats.peak = kid_not_found_stats.count;
+  kid_not_found_cache[i].used = 0;
+  kid_not_found_stats.count--;
+  kid_not_found_stats.removals++;
+}
+
+
+/* Remove the key ids of all keys in KEYBLOCK from the
+   kid_not_found_cache.  This is called before a keyblock is written
+   to the database.  */
+static void
+kid_not_found_remove_keyblock (kbnode_t keyblock)
+{
+  kbnode_t node;
+  u32 kid[2];
+
+  if (!kid_not_found_stats.count)
+    return;
+
+  for (node = keyblock; node; node = node->next)
+    if (node->pkt->pkttype == PKT_PUBLIC_KEY
+        || node->pkt->pkttype == PKT_PUBLIC_SUBKEY
+        || node->pkt->pkttype == PKT_SECRET_KEY
+        || node->pkt->pkttype == PKT_SECRET_SUBKEY)
+      {
+        keyid_from_pk (node->pkt->pkt.public_key, kid);
+        kid_not_found_remove (kid);
+      }
+}
+
+
+/* Flush the kid not found cache.  */
+static void
+kid_not_found_flush (void)
+{
+  if (DBG_CACHE)
+    log_debug ("keydb: kid_not_found_flush\n");
+
+  if (!kid_not_found_stats.count)
+    return;
+
+  xfree (kid_not_found_cache);
+  kid_not_found_cache = NULL;
+  kid_not_found_cache_size = 0;
   kid_not_found_stats.count = 0;
   kid_not_found_stats.flushes++;
 }
 
 
+/* Return the hash bucket for a keyblock with CHECKSUM.  */
+static struct keyblock_cache_item **
+keyblock_cache_bucket (const byte *checksum)
+{
+  return &keyblock_cache[buf16_to_uint (checksum) % KEYBLOCK_CACHE_BUCKETS];
+}
+
+
+/* Remove ITEM from the keyblock cache and release it.  */
 static void
-keyblock_cache_clear (struct keydb_handle *hd)
+keyblock_cache_remove (struct keyblock_cache_item *item)
 {
-  hd->keyblock_cache.state = KEYBLOCK_CACHE_EMPTY;
-  iobuf_close (hd->keyblock_cache.iobuf);
-  hd->keyblock_cache.iobuf = NULL;
-  hd->keyblock_cache.resource = -1;
-  hd->keyblock_cache.offset = -1;
+  struct keyblock_cache_item **bucket;
+
+  for (bucket = keyblock_cache_bucket (item->checksum);
+       *bucket != item; bucket = &(*bucket)->next)
+    ;
+  *bucket = item->next;
+
+  if (item->lru_prev)
+    item->lru_prev->lru_next = item->lru_next;
+  else
+    keyblock_cache_stats.lru_head = item->lru_next;
+  if (item->lru_next)
+    item->lru_next->lru_prev = item->lru_prev;
+  else
+    keyblock_cache_stats.lru_tail = item->lru_prev;
+
+  keyblock_cache_stats.count--;
+  keyblock_cache_stats.bytes -= item->imagelen;
+  release_kbnode (item->keyblock);
+  xfree (item);
+}
+
+
+/* Return the cached keyblock of the resource TOKEN with CHECKSUM or
+   NULL if it is not in the cache.  A found keyblock is marked as the
+   most recently used one.  */
+static struct keyblock_cache_item *
+keyblock_cache_lookup (void *token, const byte *checksum)
+{
+  struct keyblock_cache_item *item;
+
+  for (item = *keyblock_cache_bucket (checksum); item; item = item->next)
+    if (item->token == token && !memcmp (item->checksum, checksum, 20))
+      break;
+  if (!item)
+    {
+      keyblock_cache_stats.misses++;
+      return NULL;
+    }
+  keyblock_cache_stats.hits++;
+
+  if (item->lru_prev)
+    {
+      /* Move to the front of the LRU list.  */
+      item->lru_prev->lru_next = item->lru_next;
+      if (item->lru_next)
+        item->lru_next->lru_prev = item->lru_prev;
+      else
+        keyblock_cache_stats.lru_tail = item->lru_prev;
+      item->lru_prev = NULL;
+      item->lru_next = keyblock_cache_stats.lru_head;
+      keyblock_cache_stats.lru_head->lru_prev = item;
+      keyblock_cache_stats.lru_head = item;
+    }
+  return item;
+}
+
+
+/* Put a copy of KEYBLOCK, which has been parsed from an image of
+   length IMAGELEN found in resource TOKEN with CHECKSUM, into the
+   keyblock cache.  */
+static void
+keyblock_cache_insert (void *token, const byte *checksum,
+                       kbnode_t keyblock, size_t imagelen)
+{
+  struct keyblock_cache_item *item, **bucket;
+  kbnode_t copy;
+
+  if (imagelen > KEYBLOCK_CACHE_MAX_BYTES / 4)
+    return;  /* Too large to be worth caching.  */
+
+  copy = copy_keyblock (keyblock);
+  if (!copy)
+    return;
+
+  while (keyblock_cache_stats.lru_tail
+         && (keyblock_cache_stats.count >= KEYBLOCK_CACHE_MAX_ITEMS
+             || (keyblock_cache_stats.bytes + imagelen
+                 > KEYBLOCK_CACHE_MAX_BYTES)))
+    {
+      keyblock_cache_remove (keyblock_cache_stats.lru_tail);
+      keyblock_cache_stats.evictions++;
+    }
+
+  item = xmalloc_clear (sizeof *item);
+  item->token = token;
+  memcpy (item->checksum, checksum, 20);
+  item->imagelen = imagelen;
+  item->keyblock = copy;
+
+  bucket = keyblock_cache_bucket (checksum);
+  item->next = *bucket;
+  *bucket = item;
+  item->lru_next = keyblock_cache_stats.lru_head;
+  if (item->lru_next)
+    item->lru_next->lru_prev = item;
+  else
+    keyblock_cache_stats.lru_tail = item;
+  keyblock_cache_stats.lru_head = item;
+  keyblock_cache_stats.count++;
+  keyblock_cache_stats.bytes += imagelen;
+}
+
+
+/* Change the checksum of the cached ITEM to CHECKSUM.  This is used
+   after the blob has been updated in place.  */
+static void
+keyblock_cache_rekey (struct keyblock_cache_item *item, const byte *checksum)
+{
+  struct keyblock_cache_item **bucket;
+
+  for (bucket = keyblock_cache_bucket (item->checksum);
+       *bucket != item; bucket = &(*bucket)->next)
+    ;
+  *bucket = item->next;
+
+  memcpy (item->checksum, checksum, 20);
+  bucket = keyblock_cache_bucket (checksum);
+  item->next = *bucket;
+  *bucket = item;
+}
+
+
+/* Flush the keyblock cache.  */
+static void
+keyblock_cache_flush (void)
+{
+  if (DBG_CACHE)
+    log_debug ("keydb: keyblock_cache_flush\n");
+
+  if (!keyblock_cache_stats.count)
+    return;
+
+  while (keyblock_cache_stats.lru_head)
+    keyblock_cache_remove (keyblock_cache_stats.lru_head);
+  keyblock_cache_stats.flushes++;
+}
+
+
+/* Set the flag bit 0 of the PK_NO-th key and the flag bit 1 of the
+   UID_NO-th user id of KEYBLOCK.  This is what parse_keyblock_image
+   does while parsing.  */
+static void
+mark_keyblock_nodes (kbnode_t keyblock, int pk_no, int uid_no)
+{
+  kbnode_t node;
+  int pk_count, uid_count;
+
+  pk_count = uid_count = 0;
+  for (node = keyblock; node; node = node->next)
+    {
+      switch (node->pkt->pkttype)
+        {
+        case PKT_PUBLIC_KEY:
+        case PKT_PUBLIC_SUBKEY:
+        case PKT_SECRET_KEY:
+        case PKT_SECRET_SUBKEY:
+          if (++pk_count == pk_no)
+            node->flag |= 1;
+          break;
+
+        case PKT_USER_ID:
+          if (++uid_count == uid_no)
+            node->flag |= 2;
+          break;
+
+        default:
+          break;
+        }
+    }
 }
 
 
@@ -814,8 +1097,8 @@ keydb_add_resource (const char *url, unsigned int flags)
                 all_resources[used_resources].u.kb = NULL; /* Not used here */
                 all_resources[used_resources].token = token;
 
-                /* FIXME: Do a compress run if needed and no other
-                   user is currently using the keybox. */
+                /* A compress run is done after updates and
+                   deletions; see keydb_update_keyblock.  */
 
                 used_resources++;
               }
@@ -846,7 +1129,11 @@ keydb_add_resource (const char *url, unsigned int flags)
       write_status_error ("add_keyblock_resource", err);
     }
   else
-    any_registered = 1;
+    {
+      /* The new resource may hold keys we already looked for.  */
+      kid_not_found_flush ();
+      any_registered = 1;
+    }
   xfree (filename);
   return err;
 }
@@ -865,15 +1152,26 @@ keydb_dump_stats (void)
             keydb_stats.update_keyblocks,
             keydb_stats.insert_keyblocks,
             keydb_stats.delete_keyblocks);
-  log_info ("       reset=%u found=%u not=%u cache=%u not=%u\n",
+  log_info ("       reset=%u found=%u not=%u (cached=%u) sigstatus=%u\n",
             keydb_stats.search_resets,
             keydb_stats.found,
             keydb_stats.notfound,
-            keydb_stats.found_cached,
-            keydb_stats.notfound_cached);
-  log_info ("kid_not_found_cache: count=%u peak=%u flushes=%u\n",
+            keydb_stats.notfound_cached,
+            keydb_stats.sigstatus_updates);
+  log_info ("keyblock_cache: count=%u bytes=%zu hits=%u misses=%u"
+            " evictions=%u flushes=%u\n",
+            keyblock_cache_stats.count,
+            keyblock_cache_stats.bytes,
+            keyblock_cache_stats.hits,
+            keyblock_cache_stats.misses,
+            keyblock_cache_stats.evictions,
+            keyblock_cache_stats.flushes);
+  log_info ("kid_not_found_cache: count=%u peak=%u size=%u removals=%u"
+            " flushes=%u\n",
             kid_not_found_stats.count,
             kid_not_found_stats.peak,
+            kid_not_found_stats.size,
+            kid_not_found_stats.removals,
             kid_not_found_stats.flushes);
 }
 
@@ -980,7 +1278,6 @@ keydb_release (KEYDB_HANDLE hd)
         }
     }
 
-  keyblock_cache_clear (hd);
   xfree (hd);
 }
 
@@ -1060,7 +1357,7 @@ lock_all (KEYDB_HANDLE hd)
           rc = keyring_lock (hd->active[i].u.kr, 1);
           break;
         case KEYDB_RESOURCE_TYPE_KEYBOX:
-          rc = keybox_lock (hd->active[i].u.kb, 1);
+          rc = keybox_lock (hd->active[i].u.kb, 1, -1);
           break;
         }
     }
@@ -1078,7 +1375,7 @@ lock_all (KEYDB_HANDLE hd)
               keyring_lock (hd->active[i].u.kr, 0);
               break;
             case KEYDB_RESOURCE_TYPE_KEYBOX:
-              keybox_lock (hd->active[i].u.kb, 0);
+              keybox_lock (hd->active[i].u.kb, 0, 0);
               break;
             }
         }
@@ -1111,7 +1408,7 @@ unlock_all (KEYDB_HANDLE hd)
           keyring_lock (hd->active[i].u.kr, 0);
           break;
         case KEYDB_RESOURCE_TYPE_KEYBOX:
-          keybox_lock (hd->active[i].u.kb, 0);
+          keybox_lock (hd->active[i].u.kb, 0, 0);
           break;
         }
     }
@@ -1326,6 +1623,43 @@ parse_keyblock_image (iobuf_t iobuf, int pk_no, int uid_no,
 }
 
 
+/* Set the signature cache flags of KEYBLOCK from the signature
+ * status stored in the blob last found by the keybox handle KBHD.
+ * Signatures whose status is known from the keyblock or the blob are
+ * marked as stored.  */
+static void
+apply_sigstatus (KEYBOX_HANDLE kbhd, kbnode_t keyblock)
+{
+  u32 *sigstatus = NULL;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen = 0;
+  kbnode_t node;
+  PKT_signature *sig;
+  u32 n;
+
+  if (opt.no_sig_cache || keybox_get_sigstatus (kbhd, &sigstatus))
+    return;
+
+  for (n=0, node = keyblock; node; node = node->next)
+    if (node->pkt->pkttype == PKT_SIGNATURE)
+      {
+        sig = node->pkt->pkt.signature;
+        n++;
+        if (!sig->flags.checked && sigstatus && n <= sigstatus[0]
+            && sigstatus[n])
+          {
+            if (!fprlen)
+              fingerprint_from_pk (keyblock->pkt->pkt.public_key,
+                                   fpr, &fprlen);
+            sig_cache_from_status (fpr, fprlen, sig, sigstatus[n]);
+          }
+        if (sig->flags.checked)
+          sig->flags.stored = 1;
+      }
+  xfree (sigstatus);
+}
+
+
 /* Return the keyblock last found by keydb_search() in *RET_KB.
  *
  * On success, the function returns 0 and the caller must free *RET_KB
@@ -1348,29 +1682,6 @@ keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
   if (DBG_CLOCK)
     log_clock ("keydb_get_keybock enter");
 
-  if (hd->keyblock_cache.state == KEYBLOCK_CACHE_FILLED)
-    {
-      err = iobuf_seek (hd->keyblock_cache.iobuf, 0);
-      if (err)
-	{
-	  log_error ("keydb_get_keyblock: failed to rewind iobuf for cache\n");
-	  keyblock_cache_clear (hd);
-	}
-      else
-	{
-	  err = parse_keyblock_image (hd->keyblock_cache.iobuf,
-				      hd->keyblock_cache.pk_no,
-				      hd->keyblock_cache.uid_no,
-				      ret_kb);
-	  if (err)
-	    keyblock_cache_clear (hd);
-	  if (DBG_CLOCK)
-	    log_clock (err? "keydb_get_keyblock leave (cached, failed)"
-		       : "keydb_get_keyblock leave (cached)");
-	  return err;
-	}
-    }
-
   if (hd->found < 0 || hd->found >= hd->used)
     return gpg_error (GPG_ERR_VALUE_NOT_FOUND);
 
@@ -1386,31 +1697,43 @@ keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
       {
         iobuf_t iobuf;
         int pk_no, uid_no;
+        byte checksum[20];
+        struct keyblock_cache_item *item;
+        int use_cache = 0;
+
+        if (!hd->no_caching
+            && !keybox_get_keyblock_checksum (hd->active[hd->found].u.kb,
+                                              checksum, &pk_no, &uid_no))
+          {
+            use_cache = 1;
+            item = keyblock_cache_lookup (hd->active[hd->found].token,
+                                          checksum);
+            if (item && (*ret_kb = copy_keyblock (item->keyblock)))
+              {
+                mark_keyblock_nodes (*ret_kb, pk_no, uid_no);
+                keydb_stats.get_keyblocks++;
+                if (DBG_CLOCK)
+                  log_clock ("keydb_get_keyblock leave (cached)");
+                return 0;
+              }
+          }
 
         err = keybox_get_keyblock (hd->active[hd->found].u.kb,
                                    &iobuf, &pk_no, &uid_no);
         if (!err)
           {
             err = parse_keyblock_image (iobuf, pk_no, uid_no, ret_kb);
-            if (!err && hd->keyblock_cache.state == KEYBLOCK_CACHE_PREPARED)
-              {
-                hd->keyblock_cache.state     = KEYBLOCK_CACHE_FILLED;
-                hd->keyblock_cache.iobuf     = iobuf;
-                hd->keyblock_cache.pk_no     = pk_no;
-                hd->keyblock_cache.uid_no    = uid_no;
-              }
-            else
-              {
-                iobuf_close (iobuf);
-              }
+            if (!err)
+              apply_sigstatus (hd->active[hd->found].u.kb, *ret_kb);
+            if (!err && use_cache)
+              keyblock_cache_insert (hd->active[hd->found].token, checksum,
+                                     *ret_kb, iobuf_get_temp_length (iobuf));
+            iobuf_close (iobuf);
           }
       }
       break;
     }
 
-  if (hd->keyblock_cache.state != KEYBLOCK_CACHE_FILLED)
-    keyblock_cache_clear (hd);
-
   if (!err)
     keydb_stats.get_keyblocks++;
 
@@ -1421,6 +1744,132 @@ keydb_get_keyblock (KEYDB_HANDLE hd, KBNODE *ret_kb)
 }
 
 
+/* Store the signature verification results cached in KEYBLOCK, which
+ * must be the keyblock last returned by keydb_get_keyblock for HD,
+ * with the keyblock in the database so that other processes need not
+ * verify these signatures again.  This is only done for keyboxes and
+ * only if new results are available.  Errors are not fatal; in
+ * particular we don't wait for a locked keybox.  */
+gpg_error_t
+keydb_update_sig_cache (KEYDB_HANDLE hd, kbnode_t keyblock)
+{
+  gpg_error_t err;
+  KEYBOX_HANDLE kbhd;
+  u32 *sigstatus;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen = 0;
+  kbnode_t node;
+  u32 n, status;
+  int changed = 0;
+
+  if (!hd || !keyblock)
+    return gpg_error (GPG_ERR_INV_ARG);
+
+  if (opt.dry_run || opt.no_sig_cache)
+    return 0;
+
+  if (hd->found < 0 || hd->found >= hd->used)
+    return gpg_error (GPG_ERR_VALUE_NOT_FOUND);
+
+  if (hd->active[hd->found].type != KEYDB_RESOURCE_TYPE_KEYBOX)
+    return 0;
+  kbhd = hd->active[hd->found].u.kb;
+
+  err = keybox_get_sigstatus (kbhd, &sigstatus);
+  if (err || !sigstatus)
+    return err;
+
+  /* We only need to compute status words for results which are not
+   * yet stored; this replaces unusable status words as well.  */
+  for (n=0, node = keyblock; node; node = node->next)
+    if (node->pkt->pkttype == PKT_SIGNATURE && !is_deleted_kbnode (node))
+      {
+        if (++n > sigstatus[0])
+          break;
+        if (node->pkt->pkt.signature->flags.stored
+            || !node->pkt->pkt.signature->flags.checked)
+          continue;
+        if (!fprlen)
+          {
+            if (!keybox_is_writable (hd->active[hd->found].token))
+              goto leave;
+            fingerprint_from_pk (keyblock->pkt->pkt.public_key, fpr, &fprlen);
+          }
+        status = sig_cache_to_status (fpr, fprlen, node->pkt->pkt.signature);
+        if (status != sigstatus[n])
+          {
+            sigstatus[n] = status;
+            changed = 1;
+          }
+        else
+          node->pkt->pkt.signature->flags.stored = 1;
+      }
+  if (n != sigstatus[0] || node)
+    changed = 0;  /* KEYBLOCK does not match the blob.  */
+
+  if (changed)
+    {
+      byte checksum[20], newchecksum[20];
+      int pk_no, uid_no, have_checksum;
+
+      /* The checksum changes along with the status words; thus get
+         the old one to find the keyblock in the cache.  */
+      have_checksum = !keybox_get_keyblock_checksum (kbhd, checksum,
+                                                     &pk_no, &uid_no);
+      err = keybox_set_sigstatus (kbhd, sigstatus, newchecksum);
+      if (err)
+        {
+          if (DBG_CACHE)
+            log_debug ("keydb: storing signature status failed: %s\n",
+                       gpg_strerror (err));
+          err = 0;
+        }
+      else
+        {
+          struct keyblock_cache_item *item;
+          kbnode_t cnode;
+
+          keydb_stats.sigstatus_updates++;
+
+          for (node = keyblock; node; node = node->next)
+            if (node->pkt->pkttype == PKT_SIGNATURE
+                && node->pkt->pkt.signature->flags.checked)
+              node->pkt->pkt.signature->flags.stored = 1;
+
+          /* Also update the parsed copy in the keyblock cache.  */
+          if (have_checksum)
+            for (item = *keyblock_cache_bucket (checksum); item;
+                 item = item->next)
+              if (item->token == hd->active[hd->found].token
+                  && !memcmp (item->checksum, checksum, 20))
+                {
+                  for (node = keyblock, cnode = item->keyblock;
+                       node && cnode; node = node->next, cnode = cnode->next)
+                    if (node->pkt->pkttype == PKT_SIGNATURE
+                        && cnode->pkt->pkttype == PKT_SIGNATURE
+                        && !cnode->pkt->pkt.signature->flags.checked
+                        && (cnode->pkt->pkt.signature->timestamp
+                            == node->pkt->pkt.signature->timestamp))
+                      {
+                        cnode->pkt->pkt.signature->flags.checked
+                          = node->pkt->pkt.signature->flags.checked;
+                        cnode->pkt->pkt.signature->flags.valid
+                          = node->pkt->pkt.signature->flags.valid;
+                        cnode->pkt->pkt.signature->flags.stored
+                          = node->pkt->pkt.signature->flags.stored;
+                      }
+                  keyblock_cache_rekey (item, newchecksum);
+                  break;
+                }
+        }
+    }
+
+ leave:
+  xfree (sigstatus);
+  return err;
+}
+
+
 /* Build a keyblock image from KEYBLOCK.  Returns 0 on success and
  * only then stores a new iobuf object at R_IOBUF.  */
 static gpg_error_t
@@ -1493,8 +1942,8 @@ keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
 
-  kid_not_found_flush ();
-  keyblock_cache_clear (hd);
+  kid_not_found_remove_keyblock (kb);
+  keyblock_cache_flush ();
 
   if (opt.dry_run)
     return 0;
@@ -1540,6 +1989,11 @@ keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
                                           iobuf_get_temp_length (iobuf));
             iobuf_close (iobuf);
           }
+        /* The old blob has only been flagged as deleted.  Reclaim
+           the space if enough of them have accumulated.  We still
+           hold the lock.  */
+        if (!err)
+          keybox_compress (hd->active[hd->found].u.kb);
       }
       break;
     }
@@ -1570,8 +2024,8 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
 
-  kid_not_found_flush ();
-  keyblock_cache_clear (hd);
+  kid_not_found_remove_keyblock (kb);
+  keyblock_cache_flush ();
 
   if (opt.dry_run)
     return 0;
@@ -1634,8 +2088,7 @@ keydb_delete_keyblock (KEYDB_HANDLE hd)
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
 
-  kid_not_found_flush ();
-  keyblock_cache_clear (hd);
+  keyblock_cache_flush ();
 
   if (hd->found < 0 || hd->found >= hd->used)
     return gpg_error (GPG_ERR_VALUE_NOT_FOUND);
@@ -1657,6 +2110,8 @@ keydb_delete_keyblock (KEYDB_HANDLE hd)
       break;
     case KEYDB_RESOURCE_TYPE_KEYBOX:
       rc = keybox_delete (hd->active[hd->found].u.kb);
+      if (!rc)
+        keybox_compress (hd->active[hd->found].u.kb);
       break;
     }
 
@@ -1782,8 +2237,6 @@ keydb_search_reset (KEYDB_HANDLE hd)
   if (!hd)
     return gpg_error (GPG_ERR_INV_ARG);
 
-  keyblock_cache_clear (hd);
-
   if (DBG_CLOCK)
     log_clock ("keydb_search_reset");
 
@@ -1879,35 +2332,6 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
       return gpg_error (GPG_ERR_NOT_FOUND);
     }
 
-  /* NB: If one of the exact search modes below is used in a loop to
-     walk over all keys (with the same fingerprint) the caching must
-     have been disabled for the handle.  */
-  if (!hd->no_caching
-      && ndesc == 1
-      && (desc[0].mode == KEYDB_SEARCH_MODE_FPR20
-          || desc[0].mode == KEYDB_SEARCH_MODE_FPR)
-      && hd->keyblock_cache.state  == KEYBLOCK_CACHE_FILLED
-      && !memcmp (hd->keyblock_cache.fpr, desc[0].u.fpr, 20)
-      /* Make sure the current file position occurs before the cached
-         result to avoid an infinite loop.  */
-      && (hd->current < hd->keyblock_cache.resource
-          || (hd->current == hd->keyblock_cache.resource
-              && (keybox_offset (hd->active[hd->current].u.kb)
-                  <= hd->keyblock_cache.offset))))
-    {
-      /* (DESCINDEX is already set).  */
-      if (DBG_CLOCK)
-        log_clock ("keydb_search leave (cached)");
-
-      hd->current = hd->keyblock_cache.resource;
-      /* HD->KEYBLOCK_CACHE.OFFSET is the last byte in the record.
-         Seek just beyond that.  */
-      keybox_seek (hd->active[hd->current].u.kb,
-                   hd->keyblock_cache.offset + 1);
-      keydb_stats.found_cached++;
-      return 0;
-    }
-
   rc = -1;
   while ((rc == -1 || gpg_err_code (rc) == GPG_ERR_EOF)
          && hd->current >= 0 && hd->current < hd->used)
@@ -1963,23 +2387,6 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
         ? gpg_error (GPG_ERR_NOT_FOUND)
         : rc);
 
-  keyblock_cache_clear (hd);
-  if (!hd->no_caching
-      && !rc
-      && ndesc == 1 && (desc[0].mode == KEYDB_SEARCH_MODE_FPR20
-                        || desc[0].mode == KEYDB_SEARCH_MODE_FPR)
-      && hd->active[hd->current].type == KEYDB_RESOURCE_TYPE_KEYBOX)
-    {
-      hd->keyblock_cache.state = KEYBLOCK_CACHE_PREPARED;
-      hd->keyblock_cache.resource = hd->current;
-      /* The current offset is at the start of the next record.  Since
-         a record is at least 1 byte, we just use offset - 1, which is
-         within the record.  */
-      hd->keyblock_cache.offset
-        = keybox_offset (hd->active[hd->current].u.kb) - 1;
-      memcpy (hd->keyblock_cache.fpr, desc[0].u.fpr, 20);
-    }
-
   if (gpg_err_code (rc) == GPG_ERR_NOT_FOUND
       && ndesc == 1 && desc[0].mode == KEYDB_SEARCH_MODE_LONG_KID && was_reset
       && !already_in_cache)
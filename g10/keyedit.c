@@ -2815,7 +2815,7 @@ keyedit_menu (ctrl_t ctrl, const char *username, strlist_t locusr,
 
 	  if (update_trust)
 	    {
-	      revalidation_mark (ctrl);
+	      revalidation_mark_key (ctrl, keyblock->pkt->pkt.public_key);
 	      update_trust = 0;
 	    }
 	  goto leave;
@@ -2987,7 +2987,7 @@ keyedit_quick_adduid (ctrl_t ctrl, const char *username, const char *newuid)
         }
 
       if (update_trust)
-        revalidation_mark (ctrl);
+        revalidation_mark_key (ctrl, keyblock->pkt->pkt.public_key);
     }
 
  leave:
@@ -3060,7 +3060,7 @@ keyedit_quick_revuid (ctrl_t ctrl, const char *username, const char *uidtorev)
               goto leave;
             }
 
-          revalidation_mark (ctrl);
+          revalidation_mark_key (ctrl, keyblock->pkt->pkt.public_key);
           goto leave;
         }
     }
@@ -3127,7 +3127,7 @@ keyedit_quick_set_primary (ctrl_t ctrl, const char *username,
           log_error (_("update failed: %s\n"), gpg_strerror (err));
           goto leave;
         }
-      revalidation_mark (ctrl);
+      revalidation_mark_key (ctrl, keyblock->pkt->pkt.public_key);
     }
   else
     err = gpg_error (GPG_ERR_GENERAL);
@@ -3356,7 +3356,7 @@ keyedit_quick_sign (ctrl_t ctrl, const char *fpr, strlist_t uids,
     log_info (_("Key not changed so no update needed.\n"));
 
   if (update_trust)
-    revalidation_mark (ctrl);
+    revalidation_mark_key (ctrl, keyblock->pkt->pkt.public_key);
 
 
  leave:
@@ -3493,7 +3493,7 @@ keyedit_quick_set_expire (ctrl_t ctrl, const char *fpr, const char *expirestr)
           goto leave;
         }
       if (update_trust)
-        revalidation_mark (ctrl);
+        revalidation_mark_key (ctrl, keyblock->pkt->pkt.public_key);
     }
   else
     log_info (_("Key not changed so no update needed.\n"));
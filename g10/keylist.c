@@ -136,6 +136,11 @@ public_key_list (ctrl_t ctrl, strlist_t list, int locate_mode)
 
 #ifdef USE_TOFU
   tofu_begin_batch_update (ctrl);
+  /* When listing all keys we look up the policy of nearly every
+   * binding; thus read them all at once.  */
+  if (!locate_mode && !list
+      && (opt.trust_model == TM_TOFU || opt.trust_model == TM_TOFU_PGP))
+    tofu_preload_bindings (ctrl);
 #endif
 
   if (locate_mode)
@@ -557,6 +562,8 @@ list_all (ctrl_t ctrl, int secret, int mark_secret)
           merge_keys_and_selfsig (ctrl, keyblock);
           list_keyblock (ctrl, keyblock, secret, any_secret, opt.fingerprint,
                          &listctx);
+          if (listctx.check_sigs)
+            keydb_update_sig_cache (hd, keyblock);
         }
       release_kbnode (keyblock);
       keyblock = NULL;
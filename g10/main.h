@@ -248,6 +248,12 @@ int sign_symencrypt_file (ctrl_t ctrl, const char *fname, strlist_t locusr);
 /*-- sig-check.c --*/
 void sig_check_dump_stats (void);
 
+/* Convert the cached verification result of SIG from and to the
+   status word stored in a keybox.  */
+u32 sig_cache_to_status (const byte *fpr, size_t fprlen, PKT_signature *sig);
+void sig_cache_from_status (const byte *fpr, size_t fprlen,
+                            PKT_signature *sig, u32 status);
+
 /* SIG is a revocation signature.  Check if any of PK's designated
    revokers generated it.  If so, return 0.  Note: this function
    (correctly) doesn't care if the designated revoker is revoked.  */
@@ -354,6 +360,35 @@ gcry_mpi_t encode_session_key( int openpgp_pk_algo, DEK *dek, unsigned nbits );
 gcry_mpi_t encode_md_value (PKT_public_key *pk,
                             gcry_md_hd_t md, int hash_algo );
 
+/*-- pipeline.c --*/
+struct pipeline_s;
+typedef struct pipeline_s *pipeline_t;
+
+/* A data buffer passed through a pipeline.  */
+struct pipeline_chunk_s
+{
+  byte *buf;      /* The buffer with a size of SIZE.  */
+  size_t size;
+  size_t off;     /* The data starts at BUF+OFF ...  */
+  size_t len;     /* ... and has a length of LEN.  */
+  int eof;        /* Set if this is the last chunk.  */
+};
+typedef struct pipeline_chunk_s *pipeline_chunk_t;
+
+typedef gpg_error_t (*pipeline_stage_fnc_t) (void *opaque,
+                                             pipeline_chunk_t chunk);
+
+gpg_error_t npth_main_enter (void);
+void npth_main_leave (int delta);
+gpg_error_t pipeline_new (pipeline_t *r_pl, int pull, int nstages,
+                          pipeline_stage_fnc_t *fncs, void *opaque,
+                          int nchunks, size_t chunksize, size_t headroom);
+gpg_error_t pipeline_write (pipeline_t pl, const void *buffer, size_t len);
+gpg_error_t pipeline_read (pipeline_t pl, void *buffer, size_t size,
+                           size_t *r_nread);
+gpg_error_t pipeline_close (pipeline_t pl);
+void pipeline_release (pipeline_t pl);
+
 /*-- import.c --*/
 struct import_stats_s;
 typedef struct import_stats_s *import_stats_t;
@@ -474,6 +509,10 @@ void print_key_line (ctrl_t ctrl, estream_t fp, PKT_public_key *pk, int secret);
 void print_file_status( int status, const char *name, int what );
 int verify_signatures (ctrl_t ctrl, int nfiles, char **files );
 int verify_files (ctrl_t ctrl, int nfiles, char **files );
+kbnode_t verify_get_pubkeyblock (ctrl_t ctrl, u32 *keyid);
+unsigned int verify_get_validity (ctrl_t ctrl, kbnode_t kb,
+                                  PKT_public_key *pk, PKT_user_id *uid,
+                                  PKT_signature *sig, int may_ask);
 int gpg_verify (ctrl_t ctrl, int sig_fd, int data_fd, estream_t out_fp);
 
 /*-- decrypt.c --*/
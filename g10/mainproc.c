@@ -1965,9 +1965,9 @@ check_sig_and_print (CTX c, kbnode_t node)
 
       /* FIXME: We should have the public key in PK and thus the
        * keyblock has already been fetched.  Thus we could use the
-       * fingerprint or PK itself to lookup the entire keyblock.  That
-       * would best be done with a cache.  */
-      keyblock = get_pubkeyblock (c->ctrl, sig->keyid);
+       * fingerprint or PK itself to lookup the entire keyblock.
+       * With --verify-files this is served from a cache.  */
+      keyblock = verify_get_pubkeyblock (c->ctrl, sig->keyid);
 
       snprintf (keyid_str, sizeof keyid_str, "%08lX%08lX [uncertain] ",
                 (ulong)sig->keyid[0], (ulong)sig->keyid[1]);
@@ -2005,8 +2005,8 @@ check_sig_and_print (CTX c, kbnode_t node)
 	     does not print a LF we need to compute the validity
 	     before calling that function.  */
           if ((opt.verify_options & VERIFY_SHOW_UID_VALIDITY))
-            valid = get_validity (c->ctrl, keyblock, mainpk,
-                                  un->pkt->pkt.user_id, NULL, 0);
+            valid = verify_get_validity (c->ctrl, keyblock, mainpk,
+                                         un->pkt->pkt.user_id, NULL, 0);
           else
             valid = 0; /* Not used.  */
 
@@ -2107,8 +2107,9 @@ check_sig_and_print (CTX c, kbnode_t node)
 		       actually ask the user to update any trust
 		       information.  */
                     valid = (trust_value_to_string
-                             (get_validity (c->ctrl, keyblock, mainpk,
-                                            un->pkt->pkt.user_id, NULL, 0)));
+                             (verify_get_validity (c->ctrl, keyblock, mainpk,
+                                                   un->pkt->pkt.user_id,
+                                                   NULL, 0)));
                   log_printf (" [%s]\n",valid);
                 }
               else
@@ -92,6 +92,7 @@ struct
   int def_cipher_algo;
   int force_mdc;
   int disable_mdc;
+  int crypt_pipeline;  /* Use threads for bulk en- and decryption.  */
   int def_digest_algo;
   int cert_digest_algo;
   int compress_algo;
@@ -168,6 +169,9 @@ struct
   int exec_disable;
   int exec_path_set;
   unsigned int import_options;
+  int import_threads;  /* Number of threads used to check self-sigs.  */
+  int trustdb_threads; /* Number of threads used to check certifications.  */
+  unsigned int trustdb_cache_size; /* Size of the tdbio cache in KiB.  */
   unsigned int export_options;
   unsigned int list_options;
   unsigned int verify_options;
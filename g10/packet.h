@@ -195,6 +195,8 @@ typedef struct
   {
     unsigned checked:1;         /* Signature has been checked. */
     unsigned valid:1;           /* Signature is good (if checked is set). */
+    unsigned stored:1;          /* CHECKED and VALID are stored in the
+                                   keybox.  */
     unsigned chosen_selfsig:1;  /* A selfsig that is the chosen one. */
     unsigned unknown_critical:1;
     unsigned exportable:1;
@@ -846,6 +848,7 @@ void free_packet (PACKET *pkt, parse_packet_ctx_t parsectx);
 prefitem_t *copy_prefs (const prefitem_t *prefs);
 PKT_public_key *copy_public_key( PKT_public_key *d, PKT_public_key *s );
 PKT_signature *copy_signature( PKT_signature *d, PKT_signature *s );
+PKT_user_id *copy_user_id (PKT_user_id *s);
 PKT_user_id *scopy_user_id (PKT_user_id *sd );
 int cmp_public_keys( PKT_public_key *a, PKT_public_key *b );
 int cmp_signatures( PKT_signature *a, PKT_signature *b );
@@ -0,0 +1,698 @@
+/* pipeline.c - Run data processing stages in separate threads
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/* A pipeline connects the main thread with a fixed number of worker
+ * threads, the stages, by means of a ring of chunk buffers.  Each
+ * chunk carries a state telling which party may process it next.
+ * In push mode the main thread fills the chunks (pipeline_write) and
+ * the stages consume them in order; the last stage hands the chunk
+ * back to the main thread.  In pull mode the first stage fills the
+ * chunks and the main thread consumes them (pipeline_read).  Because
+ * all parties walk the ring in the same order, the order of the data
+ * is retained and each stage may keep state across chunks.
+ *
+ * All queue operations are done with the nPth global lock held; the
+ * stage functions and the main thread outside of the pipeline
+ * functions run unprotected.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_SELECT_H
+# include <sys/select.h>
+#endif
+#include <npth.h>
+
+#include "gpg.h"
+#include "../common/util.h"
+#include "../common/iobuf.h"
+#include "options.h"
+#include "filter.h"
+#include "main.h"
+
+
+/* The size and number of the chunks used by the read-ahead filter.  */
+#define READAHEAD_CHUNKSIZE (64*1024)
+#define READAHEAD_NCHUNKS   4
+
+
+struct pipeline_s
+{
+  npth_mutex_t lock;
+  npth_cond_t cond;          /* Signaled on state changes.  */
+  int pull;                  /* True for pull mode.  */
+  int stop;                  /* Request the workers to terminate.  */
+  int closed;                /* pipeline_close has been called.  */
+  int finished;              /* The main thread has seen the EOF.  */
+  gpg_error_t err;           /* The first error of a stage.  */
+
+  int nstages;               /* Number of stage functions.  */
+  pipeline_stage_fnc_t *fncs;/* The stage functions.  */
+  void *opaque;              /* Their argument.  */
+  npth_t *threads;           /* The worker threads.  */
+  int nthreads;              /* Number of running workers.  */
+
+  size_t headroom;           /* Space reserved in front of the data.  */
+  size_t size;               /* Allocated size of each buffer.  */
+  int nchunks;               /* Number of chunks in the ring.  */
+  struct pipeline_chunk_s *chunks;
+  int *states;               /* The role allowed to process a chunk.  */
+  int *pos;                  /* The next chunk for each role.  */
+};
+
+/* The context of the read-ahead filter.  */
+struct readahead_filter_s
+{
+  pipeline_t pipeline;
+  iobuf_t chain;          /* The source of the data.  */
+  int failed;             /* Do not try to create a pipeline.  */
+  int fd;                 /* The file descriptor of CHAIN or -1.  */
+  int cancel_fd[2];       /* Pipe to wake up a waiting stage.  */
+};
+
+/* The arguments of a worker thread.  */
+struct pipeline_worker_s
+{
+  pipeline_t pl;
+  int stage;
+};
+
+
+/* True if npth_init has been called.  */
+static int npth_initialized;
+
+/* Number of active parallel sections.  While this is not zero the
+ * main thread runs without the nPth global lock.  */
+static int parallel_depth;
+
+
+/* Prepare the main thread for calling nPth functions.  This
+ * initializes nPth on first use and takes the global lock if the
+ * main thread is in a parallel section.  Must be followed by a call
+ * to npth_main_leave.  */
+gpg_error_t
+npth_main_enter (void)
+{
+  gpg_error_t err;
+
+  if (!npth_initialized)
+    {
+      err = gpg_error_from_errno (npth_init ());
+      if (err)
+        {
+          log_error ("npth_init failed: %s\n", gpg_strerror (err));
+          return err;
+        }
+      npth_initialized = 1;
+    }
+  else if (parallel_depth)
+    npth_protect ();
+  return 0;
+}
+
+
+/* Counterpart to npth_main_enter.  DELTA is 1 to begin a parallel
+ * section, -1 to end one and 0 otherwise.  */
+void
+npth_main_leave (int delta)
+{
+  parallel_depth += delta;
+  log_assert (parallel_depth >= 0);
+  if (parallel_depth)
+    npth_unprotect ();
+}
+
+
+/* Return the role number of the main thread.  */
+static int
+main_role (pipeline_t pl)
+{
+  return pl->pull? pl->nstages : 0;
+}
+
+
+/* Pass chunk of ROLE to the next role.  Called with the lock held.  */
+static void
+advance (pipeline_t pl, int role)
+{
+  int idx = pl->pos[role];
+
+  pl->states[idx] = (role + 1) % (pl->nstages + 1);
+  pl->pos[role] = (idx + 1) % pl->nchunks;
+  npth_cond_broadcast (&pl->cond);
+}
+
+
+/* The thread function of the stages.  */
+static void *
+pipeline_worker_thread (void *arg)
+{
+  struct pipeline_worker_s *parm = arg;
+  pipeline_t pl = parm->pl;
+  int stage = parm->stage;
+  int role = pl->pull? stage : stage + 1;
+  pipeline_chunk_t chunk;
+  gpg_error_t err;
+  int skip, eof;
+
+  xfree (parm);
+
+  npth_mutex_lock (&pl->lock);
+  for (;;)
+    {
+      while (!pl->stop && pl->states[pl->pos[role]] != role)
+        npth_cond_wait (&pl->cond, &pl->lock);
+      if (pl->stop)
+        break;
+
+      chunk = pl->chunks + pl->pos[role];
+      skip = !!pl->err;
+      npth_mutex_unlock (&pl->lock);
+
+      if (pl->pull && !stage)
+        {
+          chunk->off = pl->headroom;
+          chunk->len = 0;
+          chunk->eof = skip;
+        }
+      err = 0;
+      if (!skip)
+        {
+          npth_unprotect ();
+          err = pl->fncs[stage] (pl->opaque, chunk);
+          npth_protect ();
+        }
+
+      npth_mutex_lock (&pl->lock);
+      if (err)
+        {
+          if (!pl->err)
+            pl->err = err;
+          chunk->eof = 1;
+        }
+      eof = chunk->eof;
+      advance (pl, role);
+      if (eof)
+        break;
+    }
+  npth_mutex_unlock (&pl->lock);
+
+  return NULL;
+}
+
+
+/* Create a new pipeline with NSTAGES stage functions FNCS, which are
+ * called with OPAQUE as their first argument.  If PULL is set the
+ * first stage produces the data and the main thread reads it using
+ * pipeline_read; otherwise the main thread produces the data using
+ * pipeline_write.  NCHUNKS buffers of CHUNKSIZE bytes are used; the
+ * data of a chunk initially starts at offset HEADROOM.  On success
+ * the pipeline is stored at R_PL and the main thread runs
+ * unprotected until the pipeline is released.  */
+gpg_error_t
+pipeline_new (pipeline_t *r_pl, int pull, int nstages,
+              pipeline_stage_fnc_t *fncs, void *opaque,
+              int nchunks, size_t chunksize, size_t headroom)
+{
+  gpg_error_t err;
+  pipeline_t pl;
+  npth_attr_t tattr;
+  int i;
+
+  *r_pl = NULL;
+  log_assert (nstages > 0 && nchunks > 0 && chunksize > headroom);
+
+  pl = xtrycalloc (1, sizeof *pl);
+  if (!pl)
+    return gpg_error_from_syserror ();
+  pl->pull = pull;
+  pl->nstages = nstages;
+  pl->opaque = opaque;
+  pl->headroom = headroom;
+  pl->size = chunksize;
+  pl->nchunks = nchunks;
+  pl->fncs = xtrycalloc (nstages, sizeof *pl->fncs);
+  pl->threads = xtrycalloc (nstages, sizeof *pl->threads);
+  pl->pos = xtrycalloc (nstages + 1, sizeof *pl->pos);
+  pl->states = xtrycalloc (nchunks, sizeof *pl->states);
+  pl->chunks = xtrycalloc (nchunks, sizeof *pl->chunks);
+  if (!pl->fncs || !pl->threads || !pl->pos || !pl->states || !pl->chunks)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  memcpy (pl->fncs, fncs, nstages * sizeof *fncs);
+  for (i=0; i < nchunks; i++)
+    {
+      pl->chunks[i].buf = xtrymalloc (chunksize);
+      if (!pl->chunks[i].buf)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      pl->chunks[i].size = chunksize;
+    }
+
+  err = npth_main_enter ();
+  if (err)
+    goto leave;
+
+  npth_mutex_init (&pl->lock, NULL);
+  npth_cond_init (&pl->cond, NULL);
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  for (i=0; i < nstages; i++)
+    {
+      struct pipeline_worker_s *parm;
+
+      parm = xtrymalloc (sizeof *parm);
+      if (!parm)
+        {
+          err = gpg_error_from_syserror ();
+          break;
+        }
+      parm->pl = pl;
+      parm->stage = i;
+      err = gpg_error_from_errno (npth_create (&pl->threads[i], &tattr,
+                                               pipeline_worker_thread, parm));
+      if (err)
+        {
+          log_error ("error spawning pipeline worker: %s\n",
+                     gpg_strerror (err));
+          xfree (parm);
+          break;
+        }
+      pl->nthreads++;
+    }
+  npth_attr_destroy (&tattr);
+  npth_main_leave (1);
+
+  if (err)
+    {
+      /* A partial pipeline is of no use.  */
+      pipeline_release (pl);
+      return err;
+    }
+
+  *r_pl = pl;
+  return 0;
+
+ leave:
+  if (pl->chunks)
+    for (i=0; i < nchunks; i++)
+      xfree (pl->chunks[i].buf);
+  xfree (pl->chunks);
+  xfree (pl->states);
+  xfree (pl->pos);
+  xfree (pl->threads);
+  xfree (pl->fncs);
+  xfree (pl);
+  return err;
+}
+
+
+/* Wait until the main thread may process the next chunk and return
+ * it.  Returns NULL if the pipeline has been stopped.  Called with
+ * the lock held.  */
+static pipeline_chunk_t
+wait_for_chunk (pipeline_t pl)
+{
+  int role = main_role (pl);
+
+  while (!pl->stop && pl->states[pl->pos[role]] != role)
+    npth_cond_wait (&pl->cond, &pl->lock);
+  if (pl->stop)
+    return NULL;
+  return pl->chunks + pl->pos[role];
+}
+
+
+/* Feed LEN bytes from BUFFER into the push mode pipeline PL.  Returns
+ * an error if a stage failed.  */
+gpg_error_t
+pipeline_write (pipeline_t pl, const void *buffer, size_t len)
+{
+  const byte *p = buffer;
+  pipeline_chunk_t chunk;
+  gpg_error_t err = 0;
+  size_t n;
+
+  log_assert (!pl->pull && !pl->closed);
+
+  npth_main_enter ();
+  npth_mutex_lock (&pl->lock);
+  while (len && !(err = pl->err))
+    {
+      chunk = wait_for_chunk (pl);
+      if (!chunk)
+        {
+          err = gpg_error (GPG_ERR_CANCELED);
+          break;
+        }
+      npth_mutex_unlock (&pl->lock);
+
+      n = chunk->size - pl->headroom;
+      if (n > len)
+        n = len;
+      chunk->off = pl->headroom;
+      chunk->len = n;
+      chunk->eof = 0;
+      memcpy (chunk->buf + chunk->off, p, n);
+      p += n;
+      len -= n;
+
+      npth_mutex_lock (&pl->lock);
+      advance (pl, main_role (pl));
+    }
+  npth_mutex_unlock (&pl->lock);
+  npth_main_leave (0);
+
+  return err;
+}
+
+
+/* Read up to SIZE bytes from the pull mode pipeline PL into BUFFER
+ * and store the number of bytes read at R_NREAD.  At EOF 0 is stored
+ * there.  Returns an error if a stage failed.  */
+gpg_error_t
+pipeline_read (pipeline_t pl, void *buffer, size_t size, size_t *r_nread)
+{
+  byte *p = buffer;
+  pipeline_chunk_t chunk;
+  gpg_error_t err = 0;
+  size_t nread = 0;
+  size_t n;
+  int eof;
+
+  log_assert (pl->pull);
+
+  *r_nread = 0;
+  if (pl->finished)
+    return 0;
+  if (pl->closed)
+    return gpg_error (GPG_ERR_CANCELED);
+
+  npth_main_enter ();
+  npth_mutex_lock (&pl->lock);
+  while (nread < size)
+    {
+      chunk = wait_for_chunk (pl);
+      if (!chunk)
+        {
+          err = gpg_error (GPG_ERR_CANCELED);
+          break;
+        }
+      if ((err = pl->err))
+        break;
+      npth_mutex_unlock (&pl->lock);
+
+      n = chunk->len;
+      if (n > size - nread)
+        n = size - nread;
+      memcpy (p, chunk->buf + chunk->off, n);
+      p += n;
+      nread += n;
+      chunk->off += n;
+      chunk->len -= n;
+      eof = chunk->eof;
+
+      npth_mutex_lock (&pl->lock);
+      if (!chunk->len)
+        {
+          advance (pl, main_role (pl));
+          if (eof)
+            {
+              pl->finished = 1;
+              break;
+            }
+        }
+      /* Return what we have instead of waiting for more.  */
+      if (nread && pl->states[pl->pos[main_role (pl)]] != main_role (pl))
+        break;
+    }
+  npth_mutex_unlock (&pl->lock);
+  npth_main_leave (0);
+
+  if (err)
+    return err;
+  *r_nread = nread;
+  return 0;
+}
+
+
+/* Terminate the pipeline PL and wait for its workers.  In push mode
+ * all data written so far is processed first; in pull mode the
+ * workers are stopped.  Returns the first error of a stage.  This
+ * function may be called several times.  */
+gpg_error_t
+pipeline_close (pipeline_t pl)
+{
+  pipeline_chunk_t chunk;
+  int i;
+
+  if (!pl)
+    return 0;
+  if (pl->closed)
+    return pl->err;
+  pl->closed = 1;
+
+  npth_main_enter ();
+  npth_mutex_lock (&pl->lock);
+  if (pl->pull)
+    pl->stop = 1;
+  else if ((chunk = wait_for_chunk (pl)))
+    {
+      chunk->off = pl->headroom;
+      chunk->len = 0;
+      chunk->eof = 1;
+      advance (pl, main_role (pl));
+    }
+  npth_cond_broadcast (&pl->cond);
+  npth_mutex_unlock (&pl->lock);
+  for (i=0; i < pl->nthreads; i++)
+    npth_join (pl->threads[i], NULL);
+  pl->nthreads = 0;
+  npth_main_leave (0);
+
+  return pl->err;
+}
+
+
+/* Release the pipeline PL.  This terminates the workers if needed.
+ * This must be called by the main thread.  */
+void
+pipeline_release (pipeline_t pl)
+{
+  int i;
+
+  if (!pl)
+    return;
+
+  npth_main_enter ();
+  npth_mutex_lock (&pl->lock);
+  pl->closed = 1;
+  pl->stop = 1;
+  npth_cond_broadcast (&pl->cond);
+  npth_mutex_unlock (&pl->lock);
+  for (i=0; i < pl->nthreads; i++)
+    npth_join (pl->threads[i], NULL);
+  npth_cond_destroy (&pl->cond);
+  npth_mutex_destroy (&pl->lock);
+  npth_main_leave (-1);
+
+  for (i=0; i < pl->nchunks; i++)
+    {
+      /* The chunks may have carried plaintext.  */
+      wipememory (pl->chunks[i].buf, pl->chunks[i].size);
+      xfree (pl->chunks[i].buf);
+    }
+  xfree (pl->chunks);
+  xfree (pl->states);
+  xfree (pl->pos);
+  xfree (pl->threads);
+  xfree (pl->fncs);
+  xfree (pl);
+}
+
+
+
+#ifndef HAVE_W32_SYSTEM
+/* Wait until data can be read from the file descriptor of the
+ * read-ahead filter RFX or the filter is released.  */
+static gpg_error_t
+readahead_wait (struct readahead_filter_s *rfx)
+{
+  fd_set rfds;
+  int nfds;
+
+  nfds = (rfx->fd > rfx->cancel_fd[0]? rfx->fd : rfx->cancel_fd[0]) + 1;
+  do
+    {
+      FD_ZERO (&rfds);
+      FD_SET (rfx->fd, &rfds);
+      FD_SET (rfx->cancel_fd[0], &rfds);
+    }
+  while (select (nfds, &rfds, NULL, NULL, NULL) == -1 && errno == EINTR);
+
+  if (FD_ISSET (rfx->cancel_fd[0], &rfds))
+    return gpg_error (GPG_ERR_CANCELED);
+  if (!FD_ISSET (rfx->fd, &rfds))
+    return gpg_error_from_syserror ();
+  return 0;
+}
+#endif /*!HAVE_W32_SYSTEM*/
+
+
+/* The stage function of the read-ahead filter.  */
+static gpg_error_t
+readahead_stage (void *opaque, pipeline_chunk_t chunk)
+{
+  struct readahead_filter_s *rfx = opaque;
+  byte *p = chunk->buf + chunk->off;
+  size_t size = chunk->size - chunk->off;
+  gpg_error_t err;
+  size_t nbuf;
+  int n;
+
+  if (rfx->fd != -1)
+    {
+      /* Do not block in read(2) so that the filter can be released
+       * at any time; for example when reading from a terminal.  Thus
+       * we wait for data and then take only what the underlying
+       * filter returns from a single read.  */
+#ifndef HAVE_W32_SYSTEM
+      if (!iobuf_buffered (rfx->chain) && (err = readahead_wait (rfx)))
+        {
+          chunk->eof = 1;
+          return err;
+        }
+#endif
+      n = iobuf_read (rfx->chain, p, 1);
+      nbuf = iobuf_buffered (rfx->chain);
+      if (nbuf > size - 1)
+        nbuf = size - 1;
+      if (n != -1 && nbuf)
+        n += iobuf_read (rfx->chain, p + 1, nbuf);
+    }
+  else
+    n = iobuf_read (rfx->chain, p, size);
+  if (n == -1)
+    {
+      chunk->eof = 1;
+      return iobuf_error (rfx->chain);
+    }
+  chunk->len = n;
+  return 0;
+}
+
+
+/* This filter reads the data from the underlying pipeline in a
+ * separate thread so that reading overlaps with the processing done
+ * by the main thread.  */
+static int
+readahead_filter (void *opaque, int control,
+                  iobuf_t chain, byte *buf, size_t *ret_len)
+{
+  struct readahead_filter_s *rfx = opaque;
+  pipeline_stage_fnc_t fnc = readahead_stage;
+  gpg_error_t err;
+  size_t n;
+  int rc = 0;
+
+  if (control == IOBUFCTRL_UNDERFLOW)
+    {
+      if (!rfx->pipeline && !rfx->failed)
+        {
+          /* Start the thread only on the first read so that nothing
+           * is read before the data is actually needed.  */
+          rfx->chain = chain;
+#ifndef HAVE_W32_SYSTEM
+          if (!chain->chain && (rfx->fd = iobuf_get_fd (chain)) != -1
+              && pipe (rfx->cancel_fd))
+            {
+              rfx->fd = -1;
+              rfx->cancel_fd[0] = rfx->cancel_fd[1] = -1;
+            }
+#endif
+          if (pipeline_new (&rfx->pipeline, 1, 1, &fnc, rfx,
+                            READAHEAD_NCHUNKS, READAHEAD_CHUNKSIZE, 0))
+            rfx->failed = 1;
+        }
+
+      if (rfx->pipeline)
+        {
+          err = pipeline_read (rfx->pipeline, buf, *ret_len, &n);
+          if (err)
+            rc = err;
+          else if (!n)
+            rc = -1; /* EOF */
+          *ret_len = n;
+        }
+      else
+        {
+          rc = iobuf_read (chain, buf, *ret_len);
+          if (rc == -1)
+            *ret_len = 0;
+          else
+            {
+              *ret_len = rc;
+              rc = 0;
+            }
+        }
+    }
+  else if (control == IOBUFCTRL_FREE)
+    {
+      /* Wake up the stage if it waits for input.  */
+      if (rfx->cancel_fd[1] != -1 && write (rfx->cancel_fd[1], "", 1) != 1)
+        log_error ("error waking up the read-ahead thread: %s\n",
+                   strerror (errno));
+      pipeline_release (rfx->pipeline);
+      if (rfx->cancel_fd[0] != -1)
+        {
+          close (rfx->cancel_fd[0]);
+          close (rfx->cancel_fd[1]);
+        }
+      xfree (rfx);
+    }
+  else if (control == IOBUFCTRL_DESC)
+    {
+      mem2str (buf, "readahead_filter", *ret_len);
+    }
+  return rc;
+}
+
+
+/* Push a filter onto the input pipeline A which reads ahead in a
+ * separate thread.  */
+void
+push_readahead_filter (iobuf_t a)
+{
+  struct readahead_filter_s *rfx;
+
+  rfx = xtrycalloc (1, sizeof *rfx);
+  if (!rfx)
+    return;  /* Reading ahead is only an optimization.  */
+  rfx->fd = -1;
+  rfx->cancel_fd[0] = rfx->cancel_fd[1] = -1;
+  if (iobuf_push_filter (a, readahead_filter, rfx))
+    xfree (rfx);
+}
@@ -26,6 +26,7 @@
 
 #include "gpg.h"
 #include "../common/util.h"
+#include "../common/host2net.h"
 #include "packet.h"
 #include "keydb.h"
 #include "main.h"
@@ -552,6 +553,111 @@ cache_sig_result ( PKT_signature *sig, int result )
 }
 
 
+/* The status words used to store the result of a signature check in
+ * a keybox blob.  The low 30 bits are a check value binding the
+ * status to the signature.  */
+#define SIGSTATUS_GOOD   0x40000000
+#define SIGSTATUS_BAD    0x80000000
+#define SIGSTATUS_MASK   0x3fffffff
+
+/* Compute the check value for a keybox status word for the signature
+ * SIG on the keyblock whose primary key has the fingerprint FPR,FPRLEN.
+ * The value covers the identity of the signature including its
+ * signature values and the issuer as stated by the signature.  */
+static u32
+sigstatus_checkval (const byte *fpr, size_t fprlen, PKT_signature *sig)
+{
+  gcry_md_hd_t md;
+  const byte *p;
+  byte buf[17];
+  size_t n;
+  unsigned int nbits;
+  u32 checkval;
+  int i;
+
+  if (gcry_md_open (&md, GCRY_MD_SHA1, 0))
+    return 0;  /* Never matches a valid status word.  */
+
+  gcry_md_write (md, fpr, fprlen);
+  buf[0] = sig->version;
+  buf[1] = sig->sig_class;
+  buf[2] = sig->pubkey_algo;
+  buf[3] = sig->digest_algo;
+  ulongtobuf (buf+4, sig->timestamp);
+  ulongtobuf (buf+8, sig->keyid[0]);
+  ulongtobuf (buf+12, sig->keyid[1]);
+  buf[16] = sig->digest_start[0];
+  gcry_md_write (md, buf, 17);
+  gcry_md_putc (md, sig->digest_start[1]);
+
+  p = sig->hashed? parse_sig_subpkt (sig->hashed, SIGSUBPKT_ISSUER_FPR, &n)
+    /**/         : NULL;
+  if (p)
+    gcry_md_write (md, p, n);
+
+  for (i=0; i < pubkey_get_nsig (sig->pubkey_algo); i++)
+    {
+      if (!sig->data[i])
+        continue;
+      if (gcry_mpi_get_flag (sig->data[i], GCRYMPI_FLAG_OPAQUE))
+        {
+          p = gcry_mpi_get_opaque (sig->data[i], &nbits);
+          if (p)
+            gcry_md_write (md, p, (nbits+7)/8);
+        }
+      else
+        {
+          unsigned char *tmp;
+
+          if (!gcry_mpi_aprint (GCRYMPI_FMT_USG, &tmp, &n, sig->data[i]))
+            {
+              gcry_md_write (md, tmp, n);
+              gcry_free (tmp);
+            }
+        }
+    }
+
+  p = gcry_md_read (md, GCRY_MD_SHA1);
+  checkval = buf32_to_u32 (p) & SIGSTATUS_MASK;
+  gcry_md_close (md);
+  return checkval;
+}
+
+
+/* Return the status word to be stored in a keybox for the cached
+ * verification result of SIG.  FPR,FPRLEN is the fingerprint of the
+ * primary key of the keyblock.  Returns 0 if no result is cached.  */
+u32
+sig_cache_to_status (const byte *fpr, size_t fprlen, PKT_signature *sig)
+{
+  if (!sig->flags.checked)
+    return 0;
+  return ((sig->flags.valid? SIGSTATUS_GOOD : SIGSTATUS_BAD)
+          | sigstatus_checkval (fpr, fprlen, sig));
+}
+
+
+/* Set the cached verification result of SIG from the keybox status
+ * word STATUS.  FPR,FPRLEN is the fingerprint of the primary key of
+ * the keyblock.  A result already cached in SIG takes precedence and
+ * STATUS is ignored if it does not belong to SIG.  */
+void
+sig_cache_from_status (const byte *fpr, size_t fprlen, PKT_signature *sig,
+                       u32 status)
+{
+  if (sig->flags.checked)
+    return;
+  if ((status & ~SIGSTATUS_MASK) != SIGSTATUS_GOOD
+      && (status & ~SIGSTATUS_MASK) != SIGSTATUS_BAD)
+    return;
+  if ((status & SIGSTATUS_MASK) != sigstatus_checkval (fpr, fprlen, sig))
+    return;
+
+  sig->flags.checked = 1;
+  sig->flags.valid = !!(status & SIGSTATUS_GOOD);
+}
+
+
 /* SIG is a key revocation signature.  Check if this signature was
  * generated by any of the public key PK's designated revokers.
  *
@@ -0,0 +1,156 @@
+/* t-keydb-compress.c - Check that keybox updates do not pile up.
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "test.c"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "keydb.h"
+
+#define KBXNAME "t-keydb-compress.kbx"
+
+/* The number of updates.  Without a compress run each update adds
+   another copy of the keyblock to the file.  */
+#define NUPDATES 300
+
+/* The limit on the growth of the file.  keybox_compress kicks in
+   once 16k and half of the file are taken up by deleted blobs.  */
+#define MAXGROWTH (2*16384)
+
+
+/* Copy the file SRC to DST.  */
+static void
+copy_file (const char *src, const char *dst)
+{
+  FILE *in, *out;
+  char buffer[4096];
+  size_t n;
+
+  in = fopen (src, "rb");
+  if (!in)
+    ABORT (src);
+  out = fopen (dst, "wb");
+  if (!out)
+    ABORT (dst);
+  while ((n = fread (buffer, 1, sizeof buffer, in)))
+    if (fwrite (buffer, n, 1, out) != 1)
+      ABORT (dst);
+  if (ferror (in))
+    ABORT (src);
+  fclose (in);
+  if (fclose (out))
+    ABORT (dst);
+}
+
+
+/* Return the size of the file FNAME.  */
+static off_t
+file_size (const char *fname)
+{
+  struct stat st;
+
+  if (stat (fname, &st))
+    ABORT (fname);
+  return st.st_size;
+}
+
+
+static void
+remove_files (void)
+{
+  gnupg_remove (KBXNAME ".idx");
+  gnupg_remove (KBXNAME ".jnl");
+  gnupg_remove (KBXNAME ".lock");
+  gnupg_remove (KBXNAME "~");
+  gnupg_remove (KBXNAME);
+}
+
+
+static void
+do_test (int argc, char *argv[])
+{
+  int rc;
+  int i, nkeys, ncompress;
+  KEYDB_HANDLE hd;
+  KEYDB_SEARCH_DESC desc;
+  kbnode_t kb;
+  char *fname;
+  off_t initial, size, prevsize, maxsize;
+
+  (void) argc;
+  (void) argv;
+
+  remove_files ();
+  fname = prepend_srcdir ("t-keydb-photo.kbx");
+  copy_file (fname, KBXNAME);
+  test_free (fname);
+  initial = file_size (KBXNAME);
+
+  rc = keydb_add_resource ("." DIRSEP_S KBXNAME, 0);
+  if (rc)
+    ABORT ("Failed to open keyring.");
+
+  hd = keydb_new ();
+  if (!hd)
+    ABORT ("");
+
+  rc = classify_user_id ("94B5 E29A 9326 B036 C121  DA02 700B 1688 A962 1622",
+                         &desc, 0);
+  if (rc)
+    ABORT ("Failed to convert fingerprint for A9621622");
+
+  /* Update the same key over and over again.  Each update appends a
+     new blob and flags the old one as deleted.  */
+  maxsize = initial;
+  ncompress = 0;
+  for (i=0; i < NUPDATES; i++)
+    {
+      keydb_search_reset (hd);
+      rc = keydb_search (hd, &desc, 1, NULL);
+      if (rc)
+        ABORT ("Failed to lookup key associated with A9621622");
+      rc = keydb_get_keyblock (hd, &kb);
+      if (rc)
+        ABORT ("Failed to get keyblock for A9621622");
+      rc = keydb_update_keyblock (NULL, hd, kb);
+      release_kbnode (kb);
+      if (rc)
+        ABORT ("Failed to update keyblock for A9621622");
+
+      size = file_size (KBXNAME);
+      if (size > maxsize)
+        maxsize = size;
+      else if (i && size < prevsize)
+        ncompress++;
+      prevsize = size;
+    }
+
+  TEST_P ("that the keybox size is bounded", maxsize <= initial + MAXGROWTH);
+  TEST_P ("that the keybox has been compressed", ncompress > 0);
+
+  /* The key must still be there exactly once.  */
+  keydb_search_reset (hd);
+  for (nkeys=0; !keydb_search (hd, &desc, 1, NULL); nkeys++)
+    ;
+  TEST ("the number of keys after the updates", nkeys, 1);
+
+  keydb_release (hd);
+  remove_files ();
+}
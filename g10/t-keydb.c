@@ -21,13 +21,49 @@
 
 #include "keydb.h"
 
+
+/* Return true if the keyblocks A and B carry the same packets.  With
+   WITH_FLAGS set the flags of the nodes must match as well.  */
+static int
+same_keyblock_p (kbnode_t a, kbnode_t b, int with_flags)
+{
+  for (; a && b; a = a->next, b = b->next)
+    {
+      if (a->pkt->pkttype != b->pkt->pkttype
+          || (with_flags && a->flag != b->flag))
+        return 0;
+      switch (a->pkt->pkttype)
+        {
+        case PKT_PUBLIC_KEY:
+        case PKT_PUBLIC_SUBKEY:
+          if (cmp_public_keys (a->pkt->pkt.public_key,
+                               b->pkt->pkt.public_key))
+            return 0;
+          break;
+        case PKT_USER_ID:
+        case PKT_ATTRIBUTE:
+          if (cmp_user_ids (a->pkt->pkt.user_id, b->pkt->pkt.user_id))
+            return 0;
+          break;
+        case PKT_SIGNATURE:
+          if (cmp_signatures (a->pkt->pkt.signature, b->pkt->pkt.signature))
+            return 0;
+          break;
+        default:
+          break;
+        }
+    }
+  return !a && !b;
+}
+
+
 static void
 do_test (int argc, char *argv[])
 {
   int rc;
   KEYDB_HANDLE hd1, hd2;
-  KEYDB_SEARCH_DESC desc1, desc2;
-  KBNODE kb1, kb2, p;
+  KEYDB_SEARCH_DESC desc1, desc2, desc3;
+  KBNODE kb1, kb2, kb3, kb4, p, q;
   char *uid1;
   char *uid2;
   char *fname;
@@ -41,6 +77,13 @@ do_test (int argc, char *argv[])
   if (rc)
     ABORT ("Failed to open keyring.");
 
+  /* This keybox holds a key with a photo ID.  */
+  fname = prepend_srcdir ("t-keydb-photo.kbx");
+  rc = keydb_add_resource (fname, 0);
+  test_free (fname);
+  if (rc)
+    ABORT ("Failed to open keyring.");
+
   hd1 = keydb_new ();
   if (!hd1)
     ABORT ("");
@@ -97,6 +140,61 @@ do_test (int argc, char *argv[])
 
   TEST_P ("cache consistency", strcmp (uid1, uid2) != 0);
 
+  /* The second request for the same keyblock is served from the
+     keyblock cache and must yield an identical copy.  */
+  rc = keydb_get_keyblock (hd1, &kb3);
+  if (rc)
+    ABORT ("Failed to get cached keyblock for DBFC6AD9");
+  TEST_P ("cached keyblock", same_keyblock_p (kb1, kb3, 1));
+  release_kbnode (kb3);
+
+  /* A keyblock with an attribute packet is cached as well; this
+     requires that it can be copied.  The parser stores attribute
+     packets as user ids with ATTRIB_DATA set.  */
+  rc = classify_user_id ("94B5 E29A 9326 B036 C121  DA02 700B 1688 A962 1622",
+                         &desc3, 0);
+  if (rc)
+    ABORT ("Failed to convert fingerprint for A9621622");
+
+  rc = keydb_search (hd1, &desc3, 1, NULL);
+  if (rc)
+    ABORT ("Failed to lookup key associated with A9621622");
+
+  rc = keydb_get_keyblock (hd1, &kb3);
+  if (rc)
+    ABORT ("Failed to get keyblock for A9621622");
+
+  p = kb3;
+  while (p && !(p->pkt->pkttype == PKT_USER_ID
+                && p->pkt->pkt.user_id->attrib_data))
+    p = p->next;
+  if (! p)
+    ABORT ("A9621622 has no attribute packet");
+
+  kb4 = copy_keyblock (kb3);
+  TEST_P ("copy of keyblock with attribute",
+          kb4 && same_keyblock_p (kb3, kb4, 0));
+  for (p = kb3, q = kb4; p && q; p = p->next, q = q->next)
+    if (p->pkt->pkttype == PKT_USER_ID && p->pkt->pkt.user_id->attrib_data)
+      {
+        PKT_user_id *a = p->pkt->pkt.user_id;
+        PKT_user_id *b = q->pkt->pkt.user_id;
+
+        TEST_P ("deep copy of attribute",
+                a != b && a->attrib_data != b->attrib_data
+                && a->numattribs == b->numattribs && b->numattribs
+                && (b->attribs[0].data - b->attrib_data
+                    == a->attribs[0].data - a->attrib_data));
+      }
+  release_kbnode (kb4);
+
+  rc = keydb_get_keyblock (hd1, &kb4);
+  if (rc)
+    ABORT ("Failed to get cached keyblock for A9621622");
+  TEST_P ("cached keyblock with attribute", same_keyblock_p (kb3, kb4, 1));
+  release_kbnode (kb4);
+  release_kbnode (kb3);
+
   release_kbnode (kb1);
   release_kbnode (kb2);
   keydb_release (hd1);
@@ -57,32 +57,48 @@
 #endif
 
 /*
- * Yes, this is a very simple implementation. We should really
- * use a page aligned buffer and read complete pages.
- * To implement a simple trannsaction system, this is sufficient.
+ * The record cache.  The trustdb is cached in pages of
+ * RECORDS_PER_PAGE records, which are found by means of a hash table
+ * and kept in LRU order.  A page is read from the file as a whole
+ * when one of its records is requested; records written by us are
+ * marked dirty and written back by tdbio_sync or when the page is
+ * evicted.  Records of a page which are not (yet) in the file, for
+ * example because the page was read before the file was extended, are
+ * not marked valid and are read individually on demand.
  */
-typedef struct cache_ctrl_struct *CACHE_CTRL;
-struct cache_ctrl_struct
+#define RECORDS_PER_PAGE  (4096 / TRUST_RECORD_LEN)
+#define PAGE_LEN          (RECORDS_PER_PAGE * TRUST_RECORD_LEN)
+
+/* Flags for the records in a cache page.  */
+#define CACHE_REC_VALID   1  /* The record has been read or written.  */
+#define CACHE_REC_DIRTY   2  /* The record needs to be written.  */
+
+typedef struct cache_page_s *CACHE_PAGE;
+struct cache_page_s
 {
-  CACHE_CTRL next;
-  struct {
-    unsigned used:1;
-    unsigned dirty:1;
-  } flags;
-  ulong recno;
-  char data[TRUST_RECORD_LEN];
+  CACHE_PAGE hash_next;     /* Next page in the same hash bucket.  */
+  CACHE_PAGE lru_prev;      /* Next more recently used page.  */
+  CACHE_PAGE lru_next;      /* Next less recently used page.  */
+  ulong pageno;
+  int ndirty;               /* Number of dirty records.  */
+  byte flags[RECORDS_PER_PAGE];
+  char data[PAGE_LEN];
 };
 
-/* Size of the cache.  The SOFT value is the general one.  While in a
-   transaction this may not be sufficient and thus we may increase it
-   then up to the HARD limit.  */
-#define MAX_CACHE_ENTRIES_SOFT	200
-#define MAX_CACHE_ENTRIES_HARD	10000
+/* The default size of the cache in KiB; see --trustdb-cache-size.
+   While in a transaction the cache may grow by up to
+   CACHE_PAGES_EXTRA pages.  */
+#define DEFAULT_CACHE_SIZE  1024
+#define CACHE_PAGES_EXTRA   100
 
 
 /* The cache is controlled by these variables.  */
-static CACHE_CTRL cache_list;
-static int cache_entries;
+static CACHE_PAGE *cache_buckets;
+static unsigned int cache_nbuckets;  /* A power of 2.  */
+static CACHE_PAGE cache_lru_head;    /* The most recently used page.  */
+static CACHE_PAGE cache_lru_tail;    /* The least recently used page.  */
+static unsigned int cache_pages;
+static unsigned int cache_max_pages;
 static int cache_is_dirty;
 
 
@@ -169,233 +185,317 @@ release_write_lock (void)
  ************* record cache **********
  *************************************/
 
-/*
- * Get the data from the record cache and return a pointer into that
- * cache.  Caller should copy the returned data.  NULL is returned on
- * a cache miss.
- */
-static const char *
-get_record_from_cache (ulong recno)
+/* Set up the hash table of the cache.  */
+static void
+init_cache (void)
 {
-  CACHE_CTRL r;
+  unsigned int size;
+
+  size = opt.trustdb_cache_size? opt.trustdb_cache_size : DEFAULT_CACHE_SIZE;
+  cache_max_pages = size * 1024 / PAGE_LEN;
+  if (cache_max_pages < 4)
+    cache_max_pages = 4;
+  for (cache_nbuckets = 16; cache_nbuckets < cache_max_pages; )
+    cache_nbuckets *= 2;
+  cache_buckets = xcalloc (cache_nbuckets, sizeof *cache_buckets);
+}
 
-  for (r = cache_list; r; r = r->next)
-    {
-      if (r->flags.used && r->recno == recno)
-        return r->data;
-    }
+
+/* Return the bucket of the cache's hash table for page PAGENO.  */
+static CACHE_PAGE *
+cache_bucket (ulong pageno)
+{
+  return cache_buckets + (pageno & (cache_nbuckets - 1));
+}
+
+
+/* Remove page R from the LRU list.  */
+static void
+lru_unlink (CACHE_PAGE r)
+{
+  if (r->lru_prev)
+    r->lru_prev->lru_next = r->lru_next;
+  else
+    cache_lru_head = r->lru_next;
+  if (r->lru_next)
+    r->lru_next->lru_prev = r->lru_prev;
+  else
+    cache_lru_tail = r->lru_prev;
+  r->lru_prev = r->lru_next = NULL;
+}
+
+
+/* Insert page R at the head of the LRU list.  */
+static void
+lru_push (CACHE_PAGE r)
+{
+  r->lru_prev = NULL;
+  r->lru_next = cache_lru_head;
+  if (cache_lru_head)
+    cache_lru_head->lru_prev = r;
+  else
+    cache_lru_tail = r;
+  cache_lru_head = r;
+}
+
+
+/* Return the cached page PAGENO or NULL.  The page is moved to the
+ * head of the LRU list.  */
+static CACHE_PAGE
+find_cache_page (ulong pageno)
+{
+  CACHE_PAGE r;
+
+  if (!cache_buckets)
+    return NULL;
+
+  for (r = *cache_bucket (pageno); r; r = r->hash_next)
+    if (r->pageno == pageno)
+      {
+        if (r != cache_lru_head)
+          {
+            lru_unlink (r);
+            lru_push (r);
+          }
+        return r;
+      }
   return NULL;
 }
 
 
 /*
- * Write a cached item back to the trustdb file.
+ * Write the dirty records of the cached page R back to the trustdb
+ * file.  Consecutive records are written with one call.
  *
  * Returns: 0 on success or an error code.
  */
 static int
-write_cache_item (CACHE_CTRL r)
+write_cache_page (CACHE_PAGE r)
 {
   gpg_error_t err;
-  int n;
+  ulong recno;
+  int i, n, count;
 
-  if (lseek (db_fd, r->recno * TRUST_RECORD_LEN, SEEK_SET) == -1)
-    {
-      err = gpg_error_from_syserror ();
-      log_error (_("trustdb rec %lu: lseek failed: %s\n"),
-                 r->recno, strerror (errno));
-      return err;
-    }
-  n = write (db_fd, r->data, TRUST_RECORD_LEN);
-  if (n != TRUST_RECORD_LEN)
+  for (i=0; i < RECORDS_PER_PAGE && r->ndirty; i++)
     {
-      err = gpg_error_from_syserror ();
-      log_error (_("trustdb rec %lu: write failed (n=%d): %s\n"),
-                 r->recno, n, strerror (errno) );
-      return err;
+      if (!(r->flags[i] & CACHE_REC_DIRTY))
+        continue;
+      for (count=1; i + count < RECORDS_PER_PAGE; count++)
+        if (!(r->flags[i + count] & CACHE_REC_DIRTY))
+          break;
+
+      recno = r->pageno * RECORDS_PER_PAGE + i;
+      if (lseek (db_fd, recno * TRUST_RECORD_LEN, SEEK_SET) == -1)
+        {
+          err = gpg_error_from_syserror ();
+          log_error (_("trustdb rec %lu: lseek failed: %s\n"),
+                     recno, strerror (errno));
+          return err;
+        }
+      n = write (db_fd, r->data + i * TRUST_RECORD_LEN,
+                 count * TRUST_RECORD_LEN);
+      if (n != count * TRUST_RECORD_LEN)
+        {
+          err = gpg_error_from_syserror ();
+          log_error (_("trustdb rec %lu: write failed (n=%d): %s\n"),
+                     recno, n, strerror (errno) );
+          return err;
+        }
+      for (n=0; n < count; n++, i++)
+        r->flags[i] &= ~CACHE_REC_DIRTY;
+      r->ndirty -= count;
     }
-  r->flags.dirty = 0;
   return 0;
 }
 
 
+/* Remove page R from the cache and release it.  */
+static void
+drop_cache_page (CACHE_PAGE r)
+{
+  CACHE_PAGE *rp;
+
+  for (rp = cache_bucket (r->pageno); *rp != r; rp = &(*rp)->hash_next)
+    ;
+  *rp = r->hash_next;
+  lru_unlink (r);
+  cache_pages--;
+  xfree (r);
+}
+
+
 /*
- * Put data into the cache.  This function may flush
- * some cache entries if the cache is filled up.
+ * Make room for a new page by evicting the least recently used page.
+ * Dirty pages are written back unless a transaction is active.
  *
  * Returns: 0 on success or an error code.
  */
 static int
-put_record_into_cache (ulong recno, const char *data)
+evict_cache_page (void)
 {
-  CACHE_CTRL r, unused;
-  int dirty_count = 0;
-  int clean_count = 0;
+  CACHE_PAGE r;
+  int did_lock = 0;
+  int rc;
 
-  /* See whether we already cached this one.  */
-  for (unused = NULL, r = cache_list; r; r = r->next)
+  for (r = cache_lru_tail; r; r = r->lru_prev)
+    if (!r->ndirty)
+      {
+        drop_cache_page (r);
+        return 0;
+      }
+
+  /* No clean pages: We have to flush a dirty page.  */
+  if (in_transaction)
     {
-      if (!r->flags.used)
-        {
-          if (!unused)
-            unused = r;
-	}
-      else if (r->recno == recno)
+      /* But we can't do this while in a transaction.  Thus we
+       * increase the cache size instead.  */
+      if (cache_pages < cache_max_pages + CACHE_PAGES_EXTRA)
         {
-          if (!r->flags.dirty)
-            {
-              /* Hmmm: should we use a copy and compare? */
-              if (memcmp (r->data, data, TRUST_RECORD_LEN))
-                {
-                  r->flags.dirty = 1;
-                  cache_is_dirty = 1;
-		}
-	    }
-          memcpy (r->data, data, TRUST_RECORD_LEN);
+          if (opt.debug && !(cache_pages % 10))
+            log_debug ("increasing tdbio cache size\n");
           return 0;
-	}
-      if (r->flags.used)
-        {
-          if (r->flags.dirty)
-            dirty_count++;
-          else
-            clean_count++;
-	}
+        }
+      /* Hard limit for the cache size reached.  */
+      log_info (_("trustdb transaction too large\n"));
+      return GPG_ERR_RESOURCE_LIMIT;
     }
 
-  /* Not in the cache: add a new entry. */
-  if (unused)
+  r = cache_lru_tail;
+  if (!take_write_lock ())
+    did_lock = 1;
+  rc = write_cache_page (r);
+  if (did_lock)
+    release_write_lock ();
+  if (rc)
+    return rc;
+  drop_cache_page (r);
+  return 0;
+}
+
+
+/*
+ * Return the cached page PAGENO.  If it is not cached, a new page is
+ * added to the cache; if READ_PAGE is set the records of that page
+ * are read from the trustdb file.
+ *
+ * Returns: 0 on success or an error code.
+ */
+static int
+get_cache_page (ulong pageno, int read_page, CACHE_PAGE *r_page)
+{
+  CACHE_PAGE r, *bucket;
+  int i, n, rc;
+
+  *r_page = NULL;
+  if (!cache_buckets)
+    init_cache ();
+
+  r = find_cache_page (pageno);
+  if (r)
     {
-      /* Reuse this entry. */
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
+      *r_page = r;
       return 0;
     }
 
-  /* See whether we reached the limit. */
-  if (cache_entries < MAX_CACHE_ENTRIES_SOFT)
+  if (cache_pages >= cache_max_pages)
     {
-      /* No: Put into cache.  */
-      r = xmalloc (sizeof *r);
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      r->next = cache_list;
-      cache_list = r;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
+      rc = evict_cache_page ();
+      if (rc)
+        return rc;
     }
 
-  /* Cache is full: discard some clean entries.  */
-  if (clean_count)
+  r = xmalloc (sizeof *r);
+  r->pageno = pageno;
+  r->ndirty = 0;
+  memset (r->flags, 0, sizeof r->flags);
+  if (read_page
+      && lseek (db_fd, pageno * PAGE_LEN, SEEK_SET) != -1)
     {
-      int n;
+      /* Errors and short reads are not fatal here; the records which
+       * could not be read will be read again by tdbio_read_record.  */
+      n = read (db_fd, r->data, PAGE_LEN);
+      for (i=0; n > 0 && i < n / TRUST_RECORD_LEN; i++)
+        r->flags[i] = CACHE_REC_VALID;
+    }
+  bucket = cache_bucket (pageno);
+  r->hash_next = *bucket;
+  *bucket = r;
+  lru_push (r);
+  cache_pages++;
 
-      /* We discard a third of the clean entries.  */
-      n = clean_count / 3;
-      if (!n)
-        n = 1;
+  *r_page = r;
+  return 0;
+}
 
-      for (unused = NULL, r = cache_list; r; r = r->next)
-        {
-          if (r->flags.used && !r->flags.dirty)
-            {
-              if (!unused)
-                unused = r;
-              r->flags.used = 0;
-              cache_entries--;
-              if (!--n)
-                break;
-	    }
-	}
 
-      /* Now put into the cache.  */
-      log_assert (unused);
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
-    }
+/*
+ * Get the data from the record cache and return a pointer into that
+ * cache.  Caller should copy the returned data.  The page of the
+ * record is read into the cache if needed.  NULL is returned if the
+ * record is not available in the cache.
+ */
+static const char *
+get_record_from_cache (ulong recno)
+{
+  CACHE_PAGE r;
+  int idx = recno % RECORDS_PER_PAGE;
+
+  if (get_cache_page (recno / RECORDS_PER_PAGE, 1, &r))
+    return NULL;
+  if (!(r->flags[idx] & CACHE_REC_VALID))
+    return NULL;
+  return r->data + idx * TRUST_RECORD_LEN;
+}
 
-  /* No clean entries: We have to flush some dirty entries.  */
-  if (in_transaction)
+
+/*
+ * Store the record RECNO read from the trustdb file in the cache if
+ * its page is cached.
+ */
+static void
+update_record_in_cache (ulong recno, const char *data)
+{
+  CACHE_PAGE r;
+  int idx = recno % RECORDS_PER_PAGE;
+
+  r = find_cache_page (recno / RECORDS_PER_PAGE);
+  if (r && !(r->flags[idx] & CACHE_REC_VALID))
     {
-      /* But we can't do this while in a transaction.  Thus we
-       * increase the cache size instead.  */
-      if (cache_entries < MAX_CACHE_ENTRIES_HARD)
-        {
-          if (opt.debug && !(cache_entries % 100))
-            log_debug ("increasing tdbio cache size\n");
-          r = xmalloc (sizeof *r);
-          r->flags.used = 1;
-          r->recno = recno;
-          memcpy (r->data, data, TRUST_RECORD_LEN);
-          r->flags.dirty = 1;
-          r->next = cache_list;
-          cache_list = r;
-          cache_is_dirty = 1;
-          cache_entries++;
-          return 0;
-	}
-      /* Hard limit for the cache size reached.  */
-      log_info (_("trustdb transaction too large\n"));
-      return GPG_ERR_RESOURCE_LIMIT;
+      memcpy (r->data + idx * TRUST_RECORD_LEN, data, TRUST_RECORD_LEN);
+      r->flags[idx] = CACHE_REC_VALID;
     }
+}
 
-  if (dirty_count)
-    {
-      int n;
 
-      /* Discard some dirty entries. */
-      n = dirty_count / 5;
-      if (!n)
-        n = 1;
+/*
+ * Put data into the cache.  This function may flush
+ * some cache entries if the cache is filled up.
+ *
+ * Returns: 0 on success or an error code.
+ */
+static int
+put_record_into_cache (ulong recno, const char *data)
+{
+  CACHE_PAGE r;
+  char *p;
+  int idx = recno % RECORDS_PER_PAGE;
+  int rc;
 
-      take_write_lock ();
-      for (unused = NULL, r = cache_list; r; r = r->next)
-        {
-          if (r->flags.used && r->flags.dirty)
-            {
-              int rc;
+  rc = get_cache_page (recno / RECORDS_PER_PAGE, 0, &r);
+  if (rc)
+    return rc;
 
-              rc = write_cache_item (r);
-              if (rc)
-                return rc;
-              if (!unused)
-                unused = r;
-              r->flags.used = 0;
-              cache_entries--;
-              if (!--n)
-                break;
-	    }
-	}
-      release_write_lock ();
-
-      /* Now put into the cache.  */
-      log_assert (unused);
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
-      return 0;
-    }
+  p = r->data + idx * TRUST_RECORD_LEN;
+  if ((r->flags[idx] & CACHE_REC_VALID)
+      && !memcmp (p, data, TRUST_RECORD_LEN))
+    return 0;  /* Unchanged.  */
 
-  /* We should never reach this.  */
-  BUG();
+  memcpy (p, data, TRUST_RECORD_LEN);
+  if (!(r->flags[idx] & CACHE_REC_DIRTY))
+    r->ndirty++;
+  r->flags[idx] = CACHE_REC_VALID | CACHE_REC_DIRTY;
+  cache_is_dirty = 1;
+  return 0;
 }
 
 
@@ -407,14 +507,27 @@ tdbio_is_dirty()
 }
 
 
+static int
+cmp_cache_page (const void *a, const void *b)
+{
+  ulong pa = (*(const CACHE_PAGE *)a)->pageno;
+  ulong pb = (*(const CACHE_PAGE *)b)->pageno;
+
+  return pa < pb? -1 : pa > pb? 1 : 0;
+}
+
+
 /*
- * Flush the cache.  This cannot be used while in a transaction.
+ * Flush the cache.  This cannot be used while in a transaction.  The
+ * dirty pages are written in file order.
  */
 int
 tdbio_sync()
 {
-    CACHE_CTRL r;
+    CACHE_PAGE r, *dirty;
+    unsigned int i, n;
     int did_lock = 0;
+    int rc = 0;
 
     if( db_fd == -1 )
 	open_db();
@@ -424,16 +537,21 @@ tdbio_sync()
     if( !cache_is_dirty )
 	return 0;
 
+    dirty = xmalloc (cache_pages * sizeof *dirty);
+    for (n = 0, r = cache_lru_head; r; r = r->lru_next)
+      if (r->ndirty)
+        dirty[n++] = r;
+    qsort (dirty, n, sizeof *dirty, cmp_cache_page);
+
     if (!take_write_lock ())
         did_lock = 1;
 
-    for( r = cache_list; r; r = r->next ) {
-	if( r->flags.used && r->flags.dirty ) {
-	    int rc = write_cache_item( r );
-	    if( rc )
-		return rc;
-	}
-    }
+    for (i = 0; i < n && !rc; i++)
+      rc = write_cache_page (dirty[i]);
+    xfree (dirty);
+    if( rc )
+      return rc;
+
     cache_is_dirty = 0;
     if (did_lock)
         release_write_lock ();
@@ -485,7 +603,8 @@ tdbio_end_transaction ()  /* Not yet used.  */
 int
 tdbio_cancel_transaction () /* Not yet used.  */
 {
-  CACHE_CTRL r;
+  CACHE_PAGE r;
+  int i;
 
   if (!in_transaction)
     log_bug ("tdbio: no active transaction\n");
@@ -494,13 +613,14 @@ tdbio_cancel_transaction () /* Not yet used.  */
    * read back the next time.  */
   if (cache_is_dirty)
     {
-      for (r = cache_list; r; r = r->next)
+      for (r = cache_lru_head; r; r = r->lru_next)
         {
-          if (r->flags.used && r->flags.dirty)
-            {
-              r->flags.used = 0;
-              cache_entries--;
-	    }
+          for (i=0; i < RECORDS_PER_PAGE && r->ndirty; i++)
+            if ((r->flags[i] & CACHE_REC_DIRTY))
+              {
+                r->flags[i] = 0;
+                r->ndirty--;
+              }
 	}
       cache_is_dirty = 0;
     }
@@ -914,8 +1034,9 @@ tdbio_read_nextcheck ()
 
 
 /*
- * Write the STAMP nextstamp timestamp to the trustdb.  On a read or
- * write problem the process is terminated.
+ * Write the STAMP nextstamp timestamp to the trustdb.  This also
+ * cancels a pending incremental check.  On a read or write problem
+ * the process is terminated.
  *
  * Return: True if the stamp actually changed.
  */
@@ -930,10 +1051,51 @@ tdbio_write_nextcheck (ctrl_t ctrl, ulong stamp)
     log_fatal (_("%s: error reading version record: %s\n"),
                db_name, gpg_strerror (rc));
 
-  if (vr.r.ver.nextcheck == stamp)
+  if (vr.r.ver.nextcheck == stamp
+      && !(vr.r.ver.flags & TDB_VERFLAG_INCREMENTAL))
     return 0;
 
   vr.r.ver.nextcheck = stamp;
+  vr.r.ver.flags &= ~TDB_VERFLAG_INCREMENTAL;
+  vr.r.ver.schedcheck = 0;
+  rc = tdbio_write_record (ctrl, &vr);
+  if (rc)
+    log_fatal (_("%s: error writing version record: %s\n"),
+               db_name, gpg_strerror (rc));
+  return 1;
+}
+
+
+/*
+ * Schedule an incremental check of the trustdb.  This is the
+ * counterpart of tdbio_write_nextcheck (ctrl, 1) for the case that
+ * only the keys flagged with TDB_TRUSTFLAG_DIRTY need to be
+ * revalidated.  The currently scheduled check is saved so that it can
+ * be restored if the incremental check finds nothing to do.  On a
+ * read or write problem the process is terminated.
+ *
+ * Return: False if a full check is already pending; the caller does
+ *         not need to flag any key in this case.
+ */
+int
+tdbio_mark_incremental (ctrl_t ctrl)
+{
+  TRUSTREC vr;
+  int rc;
+
+  rc = tdbio_read_record (0, &vr, RECTYPE_VER);
+  if (rc)
+    log_fatal (_("%s: error reading version record: %s\n"),
+               db_name, gpg_strerror (rc));
+
+  if ((vr.r.ver.flags & TDB_VERFLAG_INCREMENTAL))
+    return 1;
+  if (vr.r.ver.nextcheck == 1)
+    return 0;
+
+  vr.r.ver.schedcheck = vr.r.ver.nextcheck;
+  vr.r.ver.nextcheck = 1;
+  vr.r.ver.flags |= TDB_VERFLAG_INCREMENTAL;
   rc = tdbio_write_record (ctrl, &vr);
   if (rc)
     log_fatal (_("%s: error writing version record: %s\n"),
@@ -942,6 +1104,27 @@ tdbio_write_nextcheck (ctrl_t ctrl, ulong stamp)
 }
 
 
+/*
+ * Return true if the pending trustdb check is an incremental one.  In
+ * this case the check which was scheduled before is stored at
+ * R_SCHEDCHECK.  On a read problem the process is terminated.
+ */
+int
+tdbio_read_incremental (ulong *r_schedcheck)
+{
+  TRUSTREC vr;
+  int rc;
+
+  rc = tdbio_read_record (0, &vr, RECTYPE_VER);
+  if (rc)
+    log_fatal (_("%s: error reading version record: %s\n"),
+               db_name, gpg_strerror (rc));
+
+  *r_schedcheck = vr.r.ver.schedcheck;
+  return !!(vr.r.ver.flags & TDB_VERFLAG_INCREMENTAL);
+}
+
+
 
 /*
  * Return the record number of the trusthash table or create one if it
@@ -1382,7 +1565,8 @@ tdbio_dump_record (TRUSTREC *rec, estream_t fp)
 
     case RECTYPE_VER:
       es_fprintf (fp,
-         "version, td=%lu, f=%lu, m/c/d=%d/%d/%d tm=%d mcl=%d nc=%lu (%s)\n",
+         "version, td=%lu, f=%lu, m/c/d=%d/%d/%d tm=%d mcl=%d nc=%lu (%s)"
+         " fl=%d\n",
                   rec->r.ver.trusthashtbl,
                   rec->r.ver.firstfree,
                   rec->r.ver.marginals,
@@ -1391,7 +1575,8 @@ tdbio_dump_record (TRUSTREC *rec, estream_t fp)
                   rec->r.ver.trust_model,
                   rec->r.ver.min_cert_level,
                   rec->r.ver.nextcheck,
-                  strtimestamp(rec->r.ver.nextcheck)
+                  strtimestamp(rec->r.ver.nextcheck),
+                  rec->r.ver.flags
                   );
       break;
 
@@ -1417,8 +1602,9 @@ tdbio_dump_record (TRUSTREC *rec, estream_t fp)
       es_fprintf (fp, "trust ");
       for (i=0; i < 20; i++)
         es_fprintf (fp, "%02X", rec->r.trust.fingerprint[i]);
-      es_fprintf (fp, ", ot=%d, d=%d, vl=%lu\n", rec->r.trust.ownertrust,
-                  rec->r.trust.depth, rec->r.trust.validlist);
+      es_fprintf (fp, ", ot=%d, d=%d, vl=%lu, fl=%d\n",
+                  rec->r.trust.ownertrust, rec->r.trust.depth,
+                  rec->r.trust.validlist, rec->r.trust.flags);
       break;
 
     case RECTYPE_VALID:
@@ -1475,6 +1661,7 @@ tdbio_read_record (ulong recnum, TRUSTREC *rec, int expected)
                      n, strerror(errno));
           return err;
 	}
+      update_record_in_cache (recnum, readbuf);
       buf = readbuf;
     }
   rec->recnum = recnum;
@@ -1508,11 +1695,13 @@ tdbio_read_record (ulong recnum, TRUSTREC *rec, int expected)
           rec->r.ver.cert_depth = *p++;
           rec->r.ver.trust_model = *p++;
           rec->r.ver.min_cert_level = *p++;
-          p += 2;
+          rec->r.ver.flags = *p++;
+          p++;
           rec->r.ver.created  = buf32_to_ulong(p);
           p += 4;
           rec->r.ver.nextcheck = buf32_to_ulong(p);
           p += 4;
+          rec->r.ver.schedcheck = buf32_to_ulong(p);
           p += 4;
           p += 4;
           rec->r.ver.firstfree = buf32_to_ulong(p);
@@ -1562,7 +1751,7 @@ tdbio_read_record (ulong recnum, TRUSTREC *rec, int expected)
       rec->r.trust.ownertrust = *p++;
       rec->r.trust.depth = *p++;
       rec->r.trust.min_ownertrust = *p++;
-      p++;
+      rec->r.trust.flags = *p++;
       rec->r.trust.validlist = buf32_to_ulong(p);
       break;
 
@@ -1623,10 +1812,11 @@ tdbio_write_record (ctrl_t ctrl, TRUSTREC *rec)
       *p++ = rec->r.ver.cert_depth;
       *p++ = rec->r.ver.trust_model;
       *p++ = rec->r.ver.min_cert_level;
-      p += 2;
+      *p++ = rec->r.ver.flags;
+      p++;
       ulongtobuf(p, rec->r.ver.created); p += 4;
       ulongtobuf(p, rec->r.ver.nextcheck); p += 4;
-      p += 4;
+      ulongtobuf(p, rec->r.ver.schedcheck); p += 4;
       p += 4;
       ulongtobuf(p, rec->r.ver.firstfree ); p += 4;
       p += 4;
@@ -1657,7 +1847,7 @@ tdbio_write_record (ctrl_t ctrl, TRUSTREC *rec)
       *p++ = rec->r.trust.ownertrust;
       *p++ = rec->r.trust.depth;
       *p++ = rec->r.trust.min_ownertrust;
-      p++;
+      *p++ = rec->r.trust.flags;
       ulongtobuf( p, rec->r.trust.validlist); p += 4;
       break;
 
@@ -40,6 +40,12 @@
 #define RECTYPE_VALID 13
 #define RECTYPE_FREE 254
 
+/* Flags of the version record.  */
+#define TDB_VERFLAG_INCREMENTAL 1  /* Only keys flagged dirty need a check. */
+
+/* Flags of the trust record.  */
+#define TDB_TRUSTFLAG_DIRTY     1  /* Certifications or ownertrust changed. */
+
 
 struct trust_record {
     int  rectype;
@@ -55,9 +61,10 @@ struct trust_record {
 	    byte  cert_depth;
 	    byte  trust_model;
 	    byte  min_cert_level;
+	    byte  flags;     /* TDB_VERFLAG_* */
 	    ulong created;   /* timestamp of trustdb creation  */
 	    ulong nextcheck; /* timestamp of next scheduled check */
-	    ulong reserved;
+	    ulong schedcheck; /* nextcheck saved by tdbio_mark_incremental */
 	    ulong reserved2;
 	    ulong firstfree;
 	    ulong reserved3;
@@ -79,6 +86,7 @@ struct trust_record {
         byte depth;
         ulong validlist;
 	byte min_ownertrust;
+	byte flags;             /* TDB_TRUSTFLAG_* */
       } trust;
       struct {
         byte namehash[20];
@@ -103,6 +111,8 @@ int tdbio_db_matches_options(void);
 byte tdbio_read_model(void);
 ulong tdbio_read_nextcheck (void);
 int tdbio_write_nextcheck (ctrl_t ctrl, ulong stamp);
+int tdbio_mark_incremental (ctrl_t ctrl);
+int tdbio_read_incremental (ulong *r_schedcheck);
 int tdbio_is_dirty(void);
 int tdbio_sync(void);
 int tdbio_begin_transaction(void);
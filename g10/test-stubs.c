@@ -124,6 +124,19 @@ get_validity (ctrl_t ctrl, kbnode_t kb, PKT_public_key *pk, PKT_user_id *uid,
   return 0;
 }
 
+kbnode_t
+verify_get_pubkeyblock (ctrl_t ctrl, u32 *keyid)
+{
+  return get_pubkeyblock (ctrl, keyid);
+}
+
+unsigned int
+verify_get_validity (ctrl_t ctrl, kbnode_t kb, PKT_public_key *pk,
+                     PKT_user_id *uid, PKT_signature *sig, int may_ask)
+{
+  return get_validity (ctrl, kb, pk, uid, sig, may_ask);
+}
+
 const char *
 trust_value_to_string (unsigned int value)
 {
@@ -386,7 +399,10 @@ agent_scd_getattr (const char *name, struct agent_card_info_s *info)
 }
 #endif /* ENABLE_CARD_SUPPORT */
 
-/* We do not do any locking, so use these stubs here */
+/* We do not do any locking, so use these stubs here.  A dummy handle
+   is returned so that the tests are able to update a keybox.  */
+static int dummy_dotlock;
+
 void
 dotlock_disable (void)
 {
@@ -397,7 +413,7 @@ dotlock_create (const char *file_to_lock, unsigned int flags)
 {
   (void)file_to_lock;
   (void)flags;
-  return NULL;
+  return (dotlock_t)&dummy_dotlock;
 }
 
 void
@@ -527,6 +543,14 @@ tofu_end_batch_update (ctrl_t ctrl)
   (void)ctrl;
 }
 
+gpg_error_t
+tofu_preload_bindings (ctrl_t ctrl)
+{
+  (void)ctrl;
+
+  return 0;
+}
+
 gpg_error_t
 tofu_notice_key_changed (ctrl_t ctrl, kbnode_t kb)
 {
@@ -88,12 +88,47 @@ struct tofu_dbs_s
   int in_batch_transaction;
   int in_transaction;
   time_t batch_update_started;
+
+  /* A cache of the bindings table; see find_cached_binding.  */
+  struct binding_cache_item_s **binding_cache;
+  unsigned int binding_cache_size;   /* Number of buckets (a power of 2).  */
+  unsigned int binding_cache_count;  /* Number of cached bindings.  */
+  int binding_cache_complete;        /* All bindings are cached.  */
+
+  /* The statistics queue; see flush_stats_queue.  */
+  unsigned int stats_queued;         /* Rows queued since the last flush.  */
+  time_t stats_queued_since;         /* Time the first row was queued.  */
+
+  /* Link to the next open DB and back to the owning session; used by
+   * tofu_flush_on_exit.  */
+  tofu_dbs_t next;
+  ctrl_t ctrl;
+};
+
+
+/* A cached row of the bindings table.  The items are hashed by the
+ * fingerprint only so that all bindings of a key are found in the
+ * same bucket.  */
+struct binding_cache_item_s
+{
+  struct binding_cache_item_s *next;
+  char *fingerprint;
+  char *email;
+  enum tofu_policy policy;
+  enum tofu_policy effective_policy;
+  char *conflict;                    /* NULL if there is no conflict.  */
 };
+typedef struct binding_cache_item_s *binding_cache_item_t;
 
 
 #define STRINGIFY(s) STRINGIFY2(s)
 #define STRINGIFY2(s) #s
 
+/* The number of queued statistics rows and the age of the oldest
+ * queued row in seconds at which the queue is written to the DB.  */
+#define STATS_QUEUE_MAX 256
+#define STATS_QUEUE_MAX_AGE 5
+
 /* The grouping parameters when collecting signature statistics.  */
 
 /* If a message is signed a couple of hours in the future, just assume
@@ -109,6 +144,9 @@ struct tofu_dbs_s
 #define TIME_AGO_UNIT_LARGE (365 * 24 * 60 * 60)
 #define TIME_AGO_LARGE_THRESHOLD (2 * TIME_AGO_UNIT_LARGE)
 
+/* List of all open DBs.  */
+static tofu_dbs_t open_dbs;
+
 /* Local prototypes.  */
 static gpg_error_t end_transaction (ctrl_t ctrl, int only_batch);
 static char *email_from_user_id (const char *user_id);
@@ -117,6 +155,171 @@ static int show_statistics (tofu_dbs_t dbs,
                             enum tofu_policy policy,
                             estream_t outfp, int only_status_fd, time_t now);
 
+
+
+/* The binding cache.  The policy of each binding <fingerprint, email>
+ * read from or written to the DB is cached to avoid further queries
+ * for it.  To keep the cache coherent with other processes it is only
+ * used while we hold the batch transaction; it is flushed when the
+ * batch transaction is committed and when a transaction is rolled
+ * back.  All updates of the bindings table must be reflected in the
+ * cache.  */
+
+/* Remove all bindings from the cache of DBS.  */
+static void
+flush_binding_cache (tofu_dbs_t dbs)
+{
+  binding_cache_item_t item, next;
+  unsigned int i;
+
+  for (i = 0; i < dbs->binding_cache_size; i++)
+    for (item = dbs->binding_cache[i]; item; item = next)
+      {
+        next = item->next;
+        xfree (item->fingerprint);
+        xfree (item->email);
+        xfree (item->conflict);
+        xfree (item);
+      }
+  xfree (dbs->binding_cache);
+  dbs->binding_cache = NULL;
+  dbs->binding_cache_size = 0;
+  dbs->binding_cache_count = 0;
+  dbs->binding_cache_complete = 0;
+}
+
+
+/* Return the bucket for FINGERPRINT in the binding cache.  */
+static binding_cache_item_t *
+binding_cache_bucket (tofu_dbs_t dbs, const char *fingerprint)
+{
+  unsigned int hash = 0;
+
+  for (; *fingerprint; fingerprint++)
+    hash = hash * 33 + *(const unsigned char *)fingerprint;
+  return dbs->binding_cache + (hash & (dbs->binding_cache_size - 1));
+}
+
+
+/* Return the cached binding <FINGERPRINT, EMAIL> or NULL.  */
+static binding_cache_item_t
+find_cached_binding (tofu_dbs_t dbs, const char *fingerprint,
+                     const char *email)
+{
+  binding_cache_item_t item;
+
+  if (!dbs->binding_cache || !dbs->in_batch_transaction)
+    return NULL;
+
+  for (item = *binding_cache_bucket (dbs, fingerprint); item;
+       item = item->next)
+    if (!strcmp (item->fingerprint, fingerprint)
+        && !strcmp (item->email, email))
+      return item;
+  return NULL;
+}
+
+
+/* Store the binding <FINGERPRINT, EMAIL> with POLICY,
+ * EFFECTIVE_POLICY and CONFLICT (NULL or the empty string for none)
+ * in the cache.  If SET_CONFLICT is false the cached conflict is not
+ * changed.  Nothing is cached if we don't hold the batch
+ * transaction.  */
+static void
+cache_binding (tofu_dbs_t dbs, const char *fingerprint, const char *email,
+               enum tofu_policy policy, enum tofu_policy effective_policy,
+               const char *conflict, int set_conflict)
+{
+  binding_cache_item_t item, next, *bucket;
+  binding_cache_item_t *old;
+  unsigned int i, oldsize;
+
+  if (!dbs->in_batch_transaction)
+    return;
+
+  item = find_cached_binding (dbs, fingerprint, email);
+  if (!item)
+    {
+      if (!set_conflict)
+        {
+          /* A new row inherits no conflict; for an existing row we
+           * don't know the conflict.  */
+          if (!dbs->binding_cache_complete)
+            return;
+          conflict = NULL;
+        }
+
+      if (dbs->binding_cache_count >= 2 * dbs->binding_cache_size)
+        {
+          /* Grow the hash table.  */
+          old = dbs->binding_cache;
+          oldsize = dbs->binding_cache_size;
+          dbs->binding_cache_size = oldsize? 2 * oldsize : 256;
+          dbs->binding_cache = xcalloc (dbs->binding_cache_size,
+                                        sizeof *dbs->binding_cache);
+          for (i = 0; i < oldsize; i++)
+            for (item = old[i]; item; item = next)
+              {
+                next = item->next;
+                bucket = binding_cache_bucket (dbs, item->fingerprint);
+                item->next = *bucket;
+                *bucket = item;
+              }
+          xfree (old);
+        }
+
+      item = xcalloc (1, sizeof *item);
+      item->fingerprint = xstrdup (fingerprint);
+      item->email = xstrdup (email);
+      bucket = binding_cache_bucket (dbs, fingerprint);
+      item->next = *bucket;
+      *bucket = item;
+      dbs->binding_cache_count++;
+      set_conflict = 1;
+    }
+
+  item->policy = policy;
+  item->effective_policy = effective_policy;
+  if (set_conflict)
+    {
+      xfree (item->conflict);
+      item->conflict = conflict && *conflict? xstrdup (conflict) : NULL;
+    }
+}
+
+
+/* Look up the binding <FINGERPRINT, EMAIL> in the cache.  On a hit
+ * the cached values are stored at R_POLICY, R_EFFECTIVE_POLICY and
+ * R_CONFLICT (a malloced string or NULL) and true is returned.  If
+ * all bindings are cached, a binding not in the cache is reported as
+ * a hit with TOFU_POLICY_NONE.  */
+static int
+lookup_cached_binding (tofu_dbs_t dbs, const char *fingerprint,
+                       const char *email, enum tofu_policy *r_policy,
+                       enum tofu_policy *r_effective_policy,
+                       char **r_conflict)
+{
+  binding_cache_item_t item;
+
+  item = find_cached_binding (dbs, fingerprint, email);
+  if (item)
+    {
+      *r_policy = item->policy;
+      *r_effective_policy = item->effective_policy;
+      *r_conflict = item->conflict? xstrdup (item->conflict) : NULL;
+      return 1;
+    }
+  if (dbs->binding_cache_complete && dbs->in_batch_transaction)
+    {
+      *r_policy = TOFU_POLICY_NONE;
+      *r_effective_policy = TOFU_POLICY_NONE;
+      *r_conflict = NULL;
+      return 1;
+    }
+  return 0;
+}
+
+
 const char *
 tofu_policy_str (enum tofu_policy policy)
 {
@@ -293,6 +496,7 @@ end_transaction (ctrl_t ctrl, int only_batch)
            * batch mode.  */
           dbs->in_batch_transaction = 0;
           dbs->in_transaction = 0;
+          flush_binding_cache (dbs);
 
           rc = gpgsql_stepx (dbs->db, &dbs->s.savepoint_batch_commit,
                              NULL, NULL, &err,
@@ -349,6 +553,7 @@ rollback_transaction (ctrl_t ctrl)
                            dbs->in_transaction);
 
   dbs->in_transaction --;
+  flush_binding_cache (dbs);
 
   if (rc)
     {
@@ -396,6 +601,98 @@ tofu_resume_batch_transaction (ctrl_t ctrl)
 }
 
 
+
+/* The statistics queue.  Rows for the signatures and encryptions
+ * tables are not directly inserted into these tables but into the
+ * temporary tables signatures_queue and encryptions_queue, which are
+ * private to our connection and never written to disk.  This function
+ * moves the queued rows to the real tables in one transaction.  It is
+ * called when too many rows have been queued or the oldest row is too
+ * old (see maybe_flush_stats_queue), before showing the statistics in
+ * a conflict dialog and when the DB is closed.  Because the queues
+ * are part of the transactions, rolling back a transaction also
+ * removes the rows it queued.  Readers of the statistics need to
+ * include the queues.  */
+static gpg_error_t
+flush_stats_queue (ctrl_t ctrl)
+{
+  tofu_dbs_t dbs = ctrl->tofu.dbs;
+  gpg_error_t rc;
+  char *err = NULL;
+
+  if (!dbs || !dbs->stats_queued)
+    return 0;
+
+  rc = begin_transaction (ctrl, 0);
+  if (rc)
+    return rc;
+
+  /* Another process may have recorded the same signature since we
+     queued it.  Skip those rows explicitly; any other constraint
+     violation is still reported as an error.  */
+  rc = gpgsql_exec_printf
+    (dbs->db, NULL, NULL, &err,
+     "insert into main.signatures\n"
+     " (binding, sig_digest, origin, sig_time, time)\n"
+     " select binding, sig_digest, origin, sig_time, time\n"
+     "  from temp.signatures_queue as q\n"
+     "  where not exists\n"
+     "   (select 1 from main.signatures as s\n"
+     "     where s.binding = q.binding and s.sig_digest is q.sig_digest\n"
+     "     and s.origin is q.origin);\n"
+     "insert into main.encryptions (binding, time)\n"
+     " select binding, time from temp.encryptions_queue;\n"
+     "delete from temp.signatures_queue;\n"
+     "delete from temp.encryptions_queue;");
+  if (rc)
+    {
+      log_error (_("error updating TOFU database: %s\n"), err);
+      print_further_info ("flushing the statistics queue");
+      sqlite3_free (err);
+      rollback_transaction (ctrl);
+      return gpg_error (GPG_ERR_GENERAL);
+    }
+
+  rc = end_transaction (ctrl, 0);
+  if (rc)
+    return rc;
+
+  if (DBG_TRUST)
+    log_debug ("TOFU: flushed %u queued statistics rows\n",
+               dbs->stats_queued);
+  dbs->stats_queued = 0;
+  return 0;
+}
+
+
+/* Account for a row queued in the statistics queue.  */
+static void
+note_stats_queued (tofu_dbs_t dbs, time_t now)
+{
+  if (!dbs->stats_queued++)
+    dbs->stats_queued_since = now;
+}
+
+
+/* Flush the statistics queue if it is full or the oldest row has
+ * been waiting too long.  Does nothing in a transaction; a rollback
+ * of the transaction would also undo the flush.  */
+static gpg_error_t
+maybe_flush_stats_queue (ctrl_t ctrl, time_t now)
+{
+  tofu_dbs_t dbs = ctrl->tofu.dbs;
+
+  if (!dbs || !dbs->stats_queued || dbs->in_transaction)
+    return 0;
+
+  if (dbs->stats_queued >= STATS_QUEUE_MAX
+      || now - dbs->stats_queued_since >= STATS_QUEUE_MAX_AGE
+      || now < dbs->stats_queued_since)
+    return flush_stats_queue (ctrl);
+  return 0;
+}
+
+
 
 /* Wrapper around strtol which prints a warning in case of a
  * conversion error.  On success the converted value is stored at
@@ -936,6 +1233,37 @@ busy_handler (void *cookie, int call_count)
   return 1;
 }
 
+/* Create the temporary tables for the statistics queue (see
+   flush_stats_queue) on DB.  Returns 0 on success and 1 otherwise.  */
+static int
+init_stats_queue (sqlite3 *db)
+{
+  char *err = NULL;
+  int rc;
+
+  rc = sqlite3_exec (db,
+                     "create temp table signatures_queue"
+                     " (binding INTEGER NOT NULL, sig_digest TEXT,"
+                     "  origin TEXT, sig_time INTEGER, time INTEGER);\n"
+                     "create index temp.signatures_queue_binding"
+                     " on signatures_queue (binding);\n"
+                     "create temp table encryptions_queue"
+                     " (binding INTEGER NOT NULL, time INTEGER);\n"
+                     "create index temp.encryptions_queue_binding"
+                     " on encryptions_queue (binding);\n",
+                     NULL, NULL, &err);
+  if (rc)
+    {
+      log_error (_("error initializing TOFU database: %s\n"), err);
+      print_further_info ("create statistics queue");
+      sqlite3_free (err);
+      return 1;
+    }
+
+  return 0;
+}
+
+
 /* Create a new DB handle.  Returns NULL on error.  */
 /* FIXME: Change to return an error code for better reporting by the
    caller.  */
@@ -968,7 +1296,7 @@ opendbs (ctrl_t ctrl)
           sqlite3_busy_handler (db, busy_handler, ctrl);
         }
 
-      if (db && initdb (db))
+      if (db && (initdb (db) || init_stats_queue (db)))
         {
           sqlite3_close (db);
           db = NULL;
@@ -979,6 +1307,9 @@ opendbs (ctrl_t ctrl)
           ctrl->tofu.dbs = xmalloc_clear (sizeof *ctrl->tofu.dbs);
           ctrl->tofu.dbs->db = db;
           ctrl->tofu.dbs->want_lock_file = xasprintf ("%s-want-lock", filename);
+          ctrl->tofu.dbs->ctrl = ctrl;
+          ctrl->tofu.dbs->next = open_dbs;
+          open_dbs = ctrl->tofu.dbs;
         }
 
       xfree (filename);
@@ -994,7 +1325,7 @@ opendbs (ctrl_t ctrl)
 void
 tofu_closedbs (ctrl_t ctrl)
 {
-  tofu_dbs_t dbs;
+  tofu_dbs_t dbs, *dbsp;
   sqlite3_stmt **statements;
 
   dbs = ctrl->tofu.dbs;
@@ -1003,8 +1334,16 @@ tofu_closedbs (ctrl_t ctrl)
 
   log_assert (dbs->in_transaction == 0);
 
+  flush_stats_queue (ctrl);
   end_transaction (ctrl, 2);
 
+  for (dbsp = &open_dbs; *dbsp; dbsp = &(*dbsp)->next)
+    if (*dbsp == dbs)
+      {
+        *dbsp = dbs->next;
+        break;
+      }
+
   /* Arghh, that is a surprising use of the struct.  */
   for (statements = (void *) &dbs->s;
        (void *) statements < (void *) &(&dbs->s)[1];
@@ -1012,12 +1351,31 @@ tofu_closedbs (ctrl_t ctrl)
     sqlite3_finalize (*statements);
 
   sqlite3_close (dbs->db);
+  flush_binding_cache (dbs);
   xfree (dbs->want_lock_file);
   xfree (dbs);
   ctrl->tofu.dbs = NULL;
 }
 
 
+/* Write the queued statistics of all open DBs and commit their batch
+ * transactions.  This is called when the process exits without
+ * releasing its sessions.  DBs in the middle of a transaction are
+ * skipped; SQLite rolls back that transaction anyway.  */
+void
+tofu_flush_on_exit (void)
+{
+  tofu_dbs_t dbs;
+
+  for (dbs = open_dbs; dbs; dbs = dbs->next)
+    if (!dbs->in_transaction)
+      {
+        flush_stats_queue (dbs->ctrl);
+        end_transaction (dbs->ctrl, 2);
+      }
+}
+
+
 /* Collect results of a select min (foo) ...; style query.  Aborts if
    the argument is not a valid integer (or real of the form X.0).  */
 static int
@@ -1153,6 +1511,9 @@ record_binding (tofu_dbs_t dbs, const char *fingerprint, const char *email,
       goto leave;
     }
 
+  cache_binding (dbs, fingerprint, email, policy, effective_policy,
+                 conflict, set_conflict);
+
  leave:
   xfree (fingerprint_pp);
   return rc;
@@ -1579,6 +1940,9 @@ ask_about_binding (ctrl_t ctrl,
   log_assert (dbs);
   log_assert (dbs->in_transaction == 0);
 
+  /* The statistics below are only read from the tables.  */
+  flush_stats_queue (ctrl);
+
   fp = es_fopenmem (0, "rw,samethread");
   if (!fp)
     log_fatal ("error creating memory stream: %s\n",
@@ -2337,6 +2701,10 @@ get_policy (ctrl_t ctrl, tofu_dbs_t dbs, PKT_public_key *pk,
   strlist_t conflict_set = NULL;
   int conflict_set_count;
 
+  if (lookup_cached_binding (dbs, fingerprint, email,
+                             &policy, &effective_policy, &conflict))
+    goto have_binding;
+
   /* Check if the <FINGERPRINT, EMAIL> binding is known
      (TOFU_POLICY_NONE cannot appear in the DB.  Thus, if POLICY is
      still TOFU_POLICY_NONE after executing the query, then the
@@ -2428,6 +2796,10 @@ get_policy (ctrl_t ctrl, tofu_dbs_t dbs, PKT_public_key *pk,
       goto out;
     }
 
+  cache_binding (dbs, fingerprint, email, policy, effective_policy,
+                 conflict, 1);
+
+ have_binding:
   /* Save the effective policy and conflict so we know if we changed
    * them.  */
   effective_policy_orig = effective_policy;
@@ -2831,9 +3203,18 @@ get_trust (ctrl_t ctrl, PKT_public_key *pk,
           sqerr = NULL;
           rc = gpg_error (GPG_ERR_GENERAL);
         }
-      else if (DBG_TRUST)
-        log_debug ("Set %s to conflict with %s\n",
-                   iter->d, fingerprint);
+      else
+        {
+          binding_cache_item_t item;
+
+          item = find_cached_binding (dbs, iter->d, email);
+          if (item && item->effective_policy != TOFU_POLICY_ASK)
+            cache_binding (dbs, iter->d, email, item->policy,
+                           TOFU_POLICY_NONE, fingerprint, 1);
+          if (DBG_TRUST)
+            log_debug ("Set %s to conflict with %s\n",
+                       iter->d, fingerprint);
+        }
     }
 
  out:
@@ -2986,6 +3367,7 @@ show_statistics (tofu_dbs_t dbs,
 		 estream_t outfp, int only_status_fd, time_t now)
 {
   char *fingerprint_pp;
+  char *binding = NULL;
   int rc;
   strlist_t strlist = NULL;
   char *err = NULL;
@@ -3006,15 +3388,29 @@ show_statistics (tofu_dbs_t dbs,
 
   fingerprint_pp = format_hexfingerprint (fingerprint, NULL, 0);
 
+  /* The statistics are taken from the tables and the queues (see
+   * flush_stats_queue).  */
+  binding = sqlite3_mprintf ("(select oid from bindings"
+                             " where fingerprint = %Q and email = %Q)",
+                             fingerprint, email);
+  if (!binding)
+    {
+      log_error (_("error reading TOFU database: %s\n"),
+                 gpg_strerror (gpg_error (GPG_ERR_ENOMEM)));
+      print_further_info ("getting signature statistics");
+      goto out;
+    }
+
   /* Get the signature stats.  */
   rc = gpgsql_exec_printf
     (dbs->db, strings_collect_cb, &strlist, &err,
-     "select count (*), coalesce (min (signatures.time), 0),\n"
-     "  coalesce (max (signatures.time), 0)\n"
-     " from signatures\n"
-     " left join bindings on signatures.binding = bindings.oid\n"
-     " where fingerprint = %Q and email = %Q;",
-     fingerprint, email);
+     "select count (*), coalesce (min (time), 0),\n"
+     "  coalesce (max (time), 0)\n"
+     " from\n"
+     "  (select time from signatures where binding = %s\n"
+     "   union all\n"
+     "   select time from temp.signatures_queue where binding = %s);",
+     binding, binding);
   if (rc)
     {
       log_error (_("error reading TOFU database: %s\n"), err);
@@ -3026,12 +3422,13 @@ show_statistics (tofu_dbs_t dbs,
   rc = gpgsql_exec_printf
     (dbs->db, strings_collect_cb, &strlist, &err,
      "select count (*) from\n"
-     "  (select round(signatures.time / (24 * 60 * 60)) day\n"
-     "    from signatures\n"
-     "    left join bindings on signatures.binding = bindings.oid\n"
-     "    where fingerprint = %Q and email = %Q\n"
+     "  (select round(time / (24 * 60 * 60)) day\n"
+     "    from\n"
+     "     (select time from signatures where binding = %s\n"
+     "      union all\n"
+     "      select time from temp.signatures_queue where binding = %s)\n"
      "    group by day);",
-     fingerprint, email);
+     binding, binding);
   if (rc)
     {
       log_error (_("error reading TOFU database: %s\n"), err);
@@ -3063,12 +3460,13 @@ show_statistics (tofu_dbs_t dbs,
   /* Get the encryption stats.  */
   rc = gpgsql_exec_printf
     (dbs->db, strings_collect_cb, &strlist, &err,
-     "select count (*), coalesce (min (encryptions.time), 0),\n"
-     "  coalesce (max (encryptions.time), 0)\n"
-     " from encryptions\n"
-     " left join bindings on encryptions.binding = bindings.oid\n"
-     " where fingerprint = %Q and email = %Q;",
-     fingerprint, email);
+     "select count (*), coalesce (min (time), 0),\n"
+     "  coalesce (max (time), 0)\n"
+     " from\n"
+     "  (select time from encryptions where binding = %s\n"
+     "   union all\n"
+     "   select time from temp.encryptions_queue where binding = %s);",
+     binding, binding);
   if (rc)
     {
       log_error (_("error reading TOFU database: %s\n"), err);
@@ -3080,12 +3478,13 @@ show_statistics (tofu_dbs_t dbs,
   rc = gpgsql_exec_printf
     (dbs->db, strings_collect_cb, &strlist, &err,
      "select count (*) from\n"
-     "  (select round(encryptions.time / (24 * 60 * 60)) day\n"
-     "    from encryptions\n"
-     "    left join bindings on encryptions.binding = bindings.oid\n"
-     "    where fingerprint = %Q and email = %Q\n"
+     "  (select round(time / (24 * 60 * 60)) day\n"
+     "    from\n"
+     "     (select time from encryptions where binding = %s\n"
+     "      union all\n"
+     "      select time from temp.encryptions_queue where binding = %s)\n"
      "    group by day);",
-     fingerprint, email);
+     binding, binding);
   if (rc)
     {
       log_error (_("error reading TOFU database: %s\n"), err);
@@ -3240,6 +3639,7 @@ show_statistics (tofu_dbs_t dbs,
     }
 
  out:
+  sqlite3_free (binding);
   xfree (fingerprint_pp);
 
   return show_warning;
@@ -3387,11 +3787,18 @@ tofu_register_signature (ctrl_t ctrl,
       rc = gpgsql_stepx
         (dbs->db, &dbs->s.register_already_seen,
          get_single_unsigned_long_cb2, &c, &err,
-         "select count (*)\n"
-         " from signatures left join bindings\n"
-         "  on signatures.binding = bindings.oid\n"
-         " where fingerprint = ? and email = ? and sig_time = ?\n"
-         "  and sig_digest = ?",
+         "select\n"
+         "  (select count (*) from signatures\n"
+         "    where binding =\n"
+         "     (select oid from bindings where fingerprint = ? and email = ?)\n"
+         "    and sig_time = ? and sig_digest = ?)\n"
+         "  + (select count (*) from temp.signatures_queue\n"
+         "      where binding =\n"
+         "       (select oid from bindings where fingerprint = ? and email = ?)\n"
+         "      and sig_time = ? and sig_digest = ?)",
+         GPGSQL_ARG_STRING, fingerprint, GPGSQL_ARG_STRING, email,
+         GPGSQL_ARG_LONG_LONG, (long long) sig_time,
+         GPGSQL_ARG_STRING, sig_digest,
          GPGSQL_ARG_STRING, fingerprint, GPGSQL_ARG_STRING, email,
          GPGSQL_ARG_LONG_LONG, (long long) sig_time,
          GPGSQL_ARG_STRING, sig_digest,
@@ -3439,7 +3846,7 @@ tofu_register_signature (ctrl_t ctrl,
 
           rc = gpgsql_stepx
             (dbs->db, &dbs->s.register_signature, NULL, NULL, &err,
-             "insert into signatures\n"
+             "insert into temp.signatures_queue\n"
              " (binding, sig_digest, origin, sig_time, time)\n"
              " values\n"
              " ((select oid from bindings\n"
@@ -3457,6 +3864,8 @@ tofu_register_signature (ctrl_t ctrl,
               sqlite3_free (err);
               rc = gpg_error (GPG_ERR_GENERAL);
             }
+          else
+            note_stats_queued (dbs, now);
         }
 
       xfree (email);
@@ -3470,6 +3879,9 @@ tofu_register_signature (ctrl_t ctrl,
   else
     rc = end_transaction (ctrl, 0);
 
+  if (!rc)
+    rc = maybe_flush_stats_queue (ctrl, now);
+
   xfree (fingerprint);
   xfree (sig_digest);
 
@@ -3579,7 +3991,7 @@ tofu_register_encryption (ctrl_t ctrl,
 
       rc = gpgsql_stepx
         (dbs->db, &dbs->s.register_encryption, NULL, NULL, &err,
-         "insert into encryptions\n"
+         "insert into temp.encryptions_queue\n"
          " (binding, time)\n"
          " values\n"
          " ((select oid from bindings\n"
@@ -3595,6 +4007,8 @@ tofu_register_encryption (ctrl_t ctrl,
           sqlite3_free (err);
           rc = gpg_error (GPG_ERR_GENERAL);
         }
+      else
+        note_stats_queued (dbs, now);
 
       xfree (email);
     }
@@ -3602,6 +4016,9 @@ tofu_register_encryption (ctrl_t ctrl,
  die:
   tofu_end_batch_update (ctrl);
 
+  if (!rc)
+    rc = maybe_flush_stats_queue (ctrl, now);
+
   if (kb)
     release_kbnode (kb);
 
@@ -3973,6 +4390,102 @@ tofu_get_policy (ctrl_t ctrl, PKT_public_key *pk, PKT_user_id *user_id,
   return 0;
 }
 
+/* Helper for tofu_preload_bindings.  */
+struct preload_bindings_parm_s
+{
+  tofu_dbs_t dbs;
+  int skipped;    /* Number of rows which could not be parsed.  */
+};
+
+static int
+preload_bindings_cb (void *cookie, int argc, char **argv, char **azColName)
+{
+  struct preload_bindings_parm_s *parm = cookie;
+  long policy, effective_policy;
+
+  (void)azColName;
+
+  if (argc != 5 || !argv[0] || !argv[1] || !argv[2]
+      || string_to_long (&policy, argv[2], 0, __LINE__)
+      || string_to_long (&effective_policy, argv[4]? argv[4] : "",
+                         0, __LINE__)
+      || ! (policy == TOFU_POLICY_AUTO
+            || policy == TOFU_POLICY_GOOD
+            || policy == TOFU_POLICY_UNKNOWN
+            || policy == TOFU_POLICY_BAD
+            || policy == TOFU_POLICY_ASK)
+      || ! (effective_policy == TOFU_POLICY_NONE
+            || effective_policy == TOFU_POLICY_AUTO
+            || effective_policy == TOFU_POLICY_GOOD
+            || effective_policy == TOFU_POLICY_UNKNOWN
+            || effective_policy == TOFU_POLICY_BAD
+            || effective_policy == TOFU_POLICY_ASK))
+    {
+      /* Leave it to get_policy to report the error.  */
+      parm->skipped++;
+      return 0;
+    }
+
+  cache_binding (parm->dbs, argv[0], argv[1], policy, effective_policy,
+                 argv[3], 1);
+  return 0;
+}
+
+
+/* Read the policies of all bindings with one query into the cache.
+ * This is useful before looking up the validity of many keys, for
+ * example to list all keys.  The cache is kept until the batch
+ * update started by the caller using tofu_begin_batch_update ends.
+ * Without a batch update this function does nothing.  */
+gpg_error_t
+tofu_preload_bindings (ctrl_t ctrl)
+{
+  struct preload_bindings_parm_s parm;
+  tofu_dbs_t dbs;
+  char *sqlerr = NULL;
+  int rc;
+
+  if (!ctrl->tofu.batch_updated_wanted)
+    return 0;
+
+  dbs = opendbs (ctrl);
+  if (! dbs)
+    {
+      log_error (_("error opening TOFU database: %s\n"),
+                 gpg_strerror (GPG_ERR_GENERAL));
+      return gpg_error (GPG_ERR_GENERAL);
+    }
+
+  tofu_resume_batch_transaction (ctrl);
+  if (!dbs->in_batch_transaction)
+    return gpg_error (GPG_ERR_GENERAL);
+  if (dbs->binding_cache_complete)
+    return 0;
+
+  memset (&parm, 0, sizeof parm);
+  parm.dbs = dbs;
+  rc = gpgsql_exec_printf
+    (dbs->db, preload_bindings_cb, &parm, &sqlerr,
+     "select fingerprint, email, policy, conflict, effective_policy"
+     " from bindings;");
+  if (rc)
+    {
+      log_error (_("error reading TOFU database: %s\n"), sqlerr);
+      print_further_info ("preloading the bindings");
+      sqlite3_free (sqlerr);
+      flush_binding_cache (dbs);
+      return gpg_error (GPG_ERR_GENERAL);
+    }
+
+  if (!parm.skipped)
+    dbs->binding_cache_complete = 1;
+  if (DBG_TRUST)
+    log_debug ("TOFU: preloaded %u bindings (%d skipped)\n",
+               dbs->binding_cache_count, parm.skipped);
+  return 0;
+}
+
+
 gpg_error_t
 tofu_notice_key_changed (ctrl_t ctrl, kbnode_t kb)
 {
@@ -4003,6 +4516,15 @@ tofu_notice_key_changed (ctrl_t ctrl, kbnode_t kb)
                      GPGSQL_ARG_INT, (int) TOFU_POLICY_NONE,
                      GPGSQL_ARG_STRING, fingerprint,
                      GPGSQL_ARG_END);
+  if (!rc && dbs->binding_cache)
+    {
+      binding_cache_item_t item;
+
+      for (item = *binding_cache_bucket (dbs, fingerprint); item;
+           item = item->next)
+        if (!strcmp (item->fingerprint, fingerprint))
+          item->effective_policy = TOFU_POLICY_NONE;
+    }
   xfree (fingerprint);
 
   if (rc == _tofu_GET_POLICY_ERROR)
@@ -131,9 +131,16 @@ gpg_error_t tofu_get_policy (ctrl_t ctrl,
 void tofu_begin_batch_update (ctrl_t ctrl);
 void tofu_end_batch_update (ctrl_t ctrl);
 
+/* Load all bindings into a cache which is valid until the batch
+ * update ends.  Speeds up looking up the policies of many keys.  */
+gpg_error_t tofu_preload_bindings (ctrl_t ctrl);
+
 /* Release all of the resources associated with a DB meta-handle.  */
 void tofu_closedbs (ctrl_t ctrl);
 
+/* Write out pending data of all open DBs; called at process exit.  */
+void tofu_flush_on_exit (void);
+
 /* Whenever a key is modified (e.g., a user id is added or revoked, a
  * new signature, etc.), this function should be called to cause TOFU
  * to update its world view.  */
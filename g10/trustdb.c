@@ -27,6 +27,7 @@
 #include <sys/types.h>
 #include <regex.h>
 #endif /* !DISABLE_REGEX */
+#include <npth.h>
 
 #include "gpg.h"
 #include "../common/status.h"
@@ -56,6 +57,99 @@ struct key_array
 };
 
 
+/*
+ * The certification graph of the keyring.  There is one node for
+ * each keyblock and one edge for each certifier and certified key.
+ * The edges are sorted by the key ID of the certifier so that all
+ * keys certified by a given key can be found with a binary search.
+ * This allows validate_keys to look only at the keys signed by the
+ * current key list instead of scanning the entire keyring for each
+ * level of the web of trust.
+ */
+struct cert_node
+{
+  u32 kid[2];
+  byte fpr[MAX_FINGERPRINT_LEN];
+  unsigned int dirty:1;      /* The key has been flagged in the trustdb.  */
+  unsigned int affected:1;   /* The key's validity may have changed.  */
+  unsigned int reachable:1;  /* The key is within the web of trust.  */
+};
+
+struct cert_edge
+{
+  u32 signer[2];
+  size_t idx;                /* Index of the certified key's node.  */
+};
+
+struct cert_graph
+{
+  struct cert_node *nodes;
+  size_t nnodes;
+  struct cert_edge *edges;
+  size_t nedges;
+};
+
+
+/* A trust record flagged with TDB_TRUSTFLAG_DIRTY.  */
+struct dirty_key
+{
+  byte fpr[MAX_FINGERPRINT_LEN];
+  ulong recnum;
+};
+
+
+/* A set of record numbers used by validate_keys to track the records
+ * which have been set during the current run.  */
+struct record_set
+{
+  byte *bits;
+  ulong size;   /* Allocated size of BITS in bytes.  */
+};
+
+
+/*
+ * The certification check pool.  validate_key_list loads the
+ * keyblocks of a level in batches and hands the certifications made
+ * by keys of the current key list to a set of worker threads.  The
+ * main thread takes part in the checks and waits until the batch is
+ * done; the results are then stored in the signature cache flags in
+ * the order of the batch.  Thus validate_one_keyblock finds all
+ * results cached and the outcome does not depend on the scheduling
+ * of the threads.  All pool operations are done with the nPth global
+ * lock held; the checks themselves run unprotected.
+ */
+#define CERT_CHECK_BATCH 64
+
+struct cert_check
+{
+  PKT_public_key *signer;
+  PKT_signature *sig;
+  kbnode_t keyblock;
+  PACKET *uidpkt;
+  gpg_error_t err;
+};
+
+struct cert_signer
+{
+  u32 kid[2];
+  PKT_public_key *pk;        /* NULL if not yet looked up.  */
+  int failed;                /* The key could not be looked up.  */
+};
+
+struct cert_check_pool
+{
+  npth_mutex_t lock;
+  npth_cond_t cond;          /* Signaled on state changes.  */
+  int stop;                  /* Request the workers to terminate.  */
+  int nthreads;              /* Number of running workers.  */
+  npth_t *threads;           /* The workers.  */
+  struct cert_check *jobs;   /* The current batch.  */
+  size_t njobs;              /* Number of jobs in the batch.  */
+  size_t next;               /* Index of the next job to take.  */
+  size_t ndone;              /* Number of finished jobs.  */
+};
+
+
 /* Control information for the trust DB.  */
 static struct
 {
@@ -72,6 +166,7 @@ static struct key_item *utk_list;      /* all ultimately trusted keys */
 static int pending_check_trustdb;
 
 static int validate_keys (ctrl_t ctrl, int interactive);
+static int read_trust_record (ctrl_t ctrl, PKT_public_key *pk, TRUSTREC *rec);
 
 
 /**********************************************
@@ -181,6 +276,68 @@ release_key_array ( struct key_array *keys )
 }
 
 
+static void
+add_record_set (struct record_set *set, ulong recnum)
+{
+  if (recnum / 8 >= set->size)
+    {
+      ulong newsize = set->size? set->size : 1024;
+
+      while (recnum / 8 >= newsize)
+        newsize *= 2;
+      set->bits = xrealloc (set->bits, newsize);
+      memset (set->bits + set->size, 0, newsize - set->size);
+      set->size = newsize;
+    }
+  set->bits[recnum / 8] |= 1 << (recnum % 8);
+}
+
+static int
+test_record_set (struct record_set *set, ulong recnum)
+{
+  return (recnum / 8 < set->size
+          && (set->bits[recnum / 8] & (1 << (recnum % 8))));
+}
+
+
+static void
+release_cert_graph (struct cert_graph *graph)
+{
+  xfree (graph->nodes);
+  xfree (graph->edges);
+  memset (graph, 0, sizeof *graph);
+}
+
+/*
+ * Return the index of the first edge in GRAPH for a key certified by
+ * the key with key ID KID.  All edges for KID are at consecutive
+ * indices; if KID did not certify any key, the edge at the returned
+ * index (if any) is for another key.
+ */
+static size_t
+cert_graph_first_edge (struct cert_graph *graph, u32 *kid)
+{
+  size_t lo = 0;
+  size_t hi = graph->nedges;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      u32 *signer = graph->edges[mid].signer;
+
+      if (signer[0] < kid[0] || (signer[0] == kid[0] && signer[1] < kid[1]))
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+#define cert_edge_signer_p(e,kid) \
+  ((e)->signer[0] == (kid)[0] && (e)->signer[1] == (kid)[1])
+
+
+
 /*********************************************
  **********  Initialization  *****************
  *********************************************/
@@ -589,6 +746,51 @@ tdb_revalidation_mark (ctrl_t ctrl)
   pending_check_trustdb = 1;
 }
 
+/*
+ * Like tdb_revalidation_mark but for the case that only the
+ * certifications on the key PK or its ownertrust changed.  The key is
+ * flagged in the trustdb so that the next check can skip the work if
+ * the change does not affect the web of trust.
+ */
+void
+tdb_revalidation_mark_key (ctrl_t ctrl, PKT_public_key *pk)
+{
+  TRUSTREC rec;
+  gpg_error_t err;
+
+  init_trustdb (ctrl, 0);
+  if (trustdb_args.no_trustdb && opt.trust_model == TM_ALWAYS)
+    return;
+
+  pending_check_trustdb = 1;
+  if (!tdbio_mark_incremental (ctrl))
+    return; /* A full check is pending anyway.  */
+
+  err = read_trust_record (ctrl, pk, &rec);
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    {
+      /* No record yet - create a new one.  */
+      size_t dummy;
+
+      memset (&rec, 0, sizeof rec);
+      rec.recnum = tdbio_new_recnum (ctrl);
+      rec.rectype = RECTYPE_TRUST;
+      fingerprint_from_pk (pk, rec.r.trust.fingerprint, &dummy);
+    }
+  else if (err)
+    {
+      tdbio_invalid ();
+      return;
+    }
+
+  if (!(rec.r.trust.flags & TDB_TRUSTFLAG_DIRTY))
+    {
+      rec.r.trust.flags |= TDB_TRUSTFLAG_DIRTY;
+      write_record (ctrl, &rec);
+    }
+  do_sync ();
+}
+
 int
 trustdb_pending_check(void)
 {
@@ -753,9 +955,18 @@ tdb_update_ownertrust (ctrl_t ctrl, PKT_public_key *pk, unsigned int new_trust )
                    (unsigned int)rec.r.trust.ownertrust, new_trust );
       if (rec.r.trust.ownertrust != new_trust)
         {
+          /* A change of the set of ultimately trusted keys requires a
+             full check.  */
+          int ultimate = ((rec.r.trust.ownertrust & TRUST_MASK)
+                          == TRUST_ULTIMATE
+                          || (new_trust & TRUST_MASK) == TRUST_ULTIMATE);
+
           rec.r.trust.ownertrust = new_trust;
           write_record (ctrl, &rec);
-          tdb_revalidation_mark (ctrl);
+          if (ultimate)
+            tdb_revalidation_mark (ctrl);
+          else
+            tdb_revalidation_mark_key (ctrl, pk);
           do_sync ();
         }
     }
@@ -772,7 +983,10 @@ tdb_update_ownertrust (ctrl_t ctrl, PKT_public_key *pk, unsigned int new_trust )
       fingerprint_from_pk (pk, rec.r.trust.fingerprint, &dummy);
       rec.r.trust.ownertrust = new_trust;
       write_record (ctrl, &rec);
-      tdb_revalidation_mark (ctrl);
+      if ((new_trust & TRUST_MASK) == TRUST_ULTIMATE)
+        tdb_revalidation_mark (ctrl);
+      else
+        tdb_revalidation_mark_key (ctrl, pk);
       do_sync ();
     }
   else
@@ -781,8 +995,13 @@ tdb_update_ownertrust (ctrl_t ctrl, PKT_public_key *pk, unsigned int new_trust )
     }
 }
 
+/*
+ * Set the min_ownertrust value of the key with KID and record the
+ * trust record in TOUCHED.
+ */
 static void
-update_min_ownertrust (ctrl_t ctrl, u32 *kid, unsigned int new_trust)
+update_min_ownertrust (ctrl_t ctrl, u32 *kid, unsigned int new_trust,
+                       struct record_set *touched)
 {
   PKT_public_key *pk;
   TRUSTREC rec;
@@ -815,6 +1034,7 @@ update_min_ownertrust (ctrl_t ctrl, u32 *kid, unsigned int new_trust)
           tdb_revalidation_mark (ctrl);
           do_sync ();
         }
+      add_record_set (touched, rec.recnum);
     }
   else if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
     { /* no record yet - create a new one */
@@ -831,6 +1051,7 @@ update_min_ownertrust (ctrl_t ctrl, u32 *kid, unsigned int new_trust)
       write_record (ctrl, &rec);
       tdb_revalidation_mark (ctrl);
       do_sync ();
+      add_record_set (touched, rec.recnum);
     }
   else
     {
@@ -883,15 +1104,18 @@ tdb_clear_ownertrusts (ctrl_t ctrl, PKT_public_key *pk)
 }
 
 /*
+ * Set the validity of UID of PK and record the validity record in
+ * TOUCHED.  Records are only written if their values change.
  * Note: Caller has to do a sync
  */
 static void
 update_validity (ctrl_t ctrl, PKT_public_key *pk, PKT_user_id *uid,
-                 int depth, int validity)
+                 int depth, int validity, struct record_set *touched)
 {
   TRUSTREC trec, vrec;
   gpg_error_t err;
   ulong recno;
+  int trec_changed = 0;
 
   namehash_from_uid(uid);
 
@@ -911,6 +1135,7 @@ update_validity (ctrl_t ctrl, PKT_public_key *pk, PKT_user_id *uid,
       trec.rectype = RECTYPE_TRUST;
       fingerprint_from_pk (pk, trec.r.trust.fingerprint, &dummy);
       trec.r.trust.ownertrust = 0;
+      trec_changed = 1;
       }
 
   /* locate an existing one */
@@ -931,13 +1156,26 @@ update_validity (ctrl_t ctrl, PKT_public_key *pk, PKT_user_id *uid,
       memcpy (vrec.r.valid.namehash, uid->namehash, 20);
       vrec.r.valid.next = trec.r.trust.validlist;
       trec.r.trust.validlist = vrec.recnum;
+      trec_changed = 1;
+    }
+  if (!recno
+      || vrec.r.valid.validity != validity
+      || vrec.r.valid.full_count != uid->help_full_count
+      || vrec.r.valid.marginal_count != uid->help_marginal_count)
+    {
+      vrec.r.valid.validity = validity;
+      vrec.r.valid.full_count = uid->help_full_count;
+      vrec.r.valid.marginal_count = uid->help_marginal_count;
+      write_record (ctrl, &vrec);
+    }
+  add_record_set (touched, vrec.recnum);
+  if (trec.r.trust.depth != depth)
+    {
+      trec.r.trust.depth = depth;
+      trec_changed = 1;
     }
-  vrec.r.valid.validity = validity;
-  vrec.r.valid.full_count = uid->help_full_count;
-  vrec.r.valid.marginal_count = uid->help_marginal_count;
-  write_record (ctrl, &vrec);
-  trec.r.trust.depth = depth;
-  write_record (ctrl, &trec);
+  if (trec_changed)
+    write_record (ctrl, &trec);
 }
 
 
@@ -1277,8 +1515,13 @@ tdb_get_validity_core (ctrl_t ctrl,
 }
 
 
+/*
+ * Initialize the validity counts of UID of PK from the values stored
+ * by the current run of validate_keys as listed in TOUCHED.
+ */
 static void
-get_validity_counts (ctrl_t ctrl, PKT_public_key *pk, PKT_user_id *uid)
+get_validity_counts (ctrl_t ctrl, PKT_public_key *pk, PKT_user_id *uid,
+                     struct record_set *touched)
 {
   TRUSTREC trec, vrec;
   ulong recno;
@@ -1303,6 +1546,8 @@ get_validity_counts (ctrl_t ctrl, PKT_public_key *pk, PKT_user_id *uid)
 
       if(memcmp(vrec.r.valid.namehash,uid->namehash,20)==0)
 	{
+	  if (!test_record_set (touched, recno))
+	    break; /* Left over from the last run.  */
 	  uid->help_marginal_count=vrec.r.valid.marginal_count;
 	  uid->help_full_count=vrec.r.valid.full_count;
 	  /*  es_printf("Fetched marginal %d, full %d\n",uid->help_marginal_count,uid->help_full_count); */
@@ -1462,7 +1707,8 @@ dump_key_array (int depth, struct key_array *keys)
 
 static void
 store_validation_status (ctrl_t ctrl, int depth,
-                         kbnode_t keyblock, KeyHashTable stored)
+                         kbnode_t keyblock, KeyHashTable stored,
+                         struct record_set *touched)
 {
   KBNODE node;
   int status;
@@ -1485,7 +1731,7 @@ store_validation_status (ctrl_t ctrl, int depth,
           if (status)
             {
               update_validity (ctrl, keyblock->pkt->pkt.public_key,
-			       uid, depth, status);
+			       uid, depth, status, touched);
 
 	      mark_keyblock_seen(stored,keyblock);
 
@@ -1622,7 +1868,8 @@ check_regexp(const char *expr,const char *string)
  */
 static int
 validate_one_keyblock (ctrl_t ctrl, kbnode_t kb, struct key_item *klist,
-                       u32 curtime, u32 *next_expire)
+                       u32 curtime, u32 *next_expire,
+                       struct record_set *touched)
 {
   struct key_item *kr;
   KBNODE node, uidnode=NULL;
@@ -1668,7 +1915,7 @@ validate_one_keyblock (ctrl_t ctrl, kbnode_t kb, struct key_item *klist,
 	    *next_expire = uid->expiredate;
 
           issigned = 0;
-	  get_validity_counts (ctrl, pk, uid);
+	  get_validity_counts (ctrl, pk, uid, touched);
           mark_usable_uid_certs (ctrl, kb, uidnode, main_kid, klist,
                                  curtime, next_expire);
         }
@@ -1786,139 +2033,875 @@ validate_one_keyblock (ctrl_t ctrl, kbnode_t kb, struct key_item *klist,
 
 
 static int
-search_skipfnc (void *opaque, u32 *kid, int dummy_uid_no)
+cmp_dirty_key (const void *a, const void *b)
+{
+  const struct dirty_key *da = a;
+  const struct dirty_key *db = b;
+
+  return memcmp (da->fpr, db->fpr, MAX_FINGERPRINT_LEN);
+}
+
+
+static int
+cmp_cert_edge (const void *a, const void *b)
 {
-  (void)dummy_uid_no;
-  return test_key_hash_table ((KeyHashTable)opaque, kid);
+  const struct cert_edge *ea = a;
+  const struct cert_edge *eb = b;
+
+  if (ea->signer[0] != eb->signer[0])
+    return ea->signer[0] < eb->signer[0]? -1 : 1;
+  if (ea->signer[1] != eb->signer[1])
+    return ea->signer[1] < eb->signer[1]? -1 : 1;
+  if (ea->idx != eb->idx)
+    return ea->idx < eb->idx? -1 : 1;
+  return 0;
+}
+
+
+static int
+cmp_node_index (const void *a, const void *b)
+{
+  size_t ia = *(const size_t *)a;
+  size_t ib = *(const size_t *)b;
+
+  return ia < ib? -1 : ia > ib? 1 : 0;
 }
 
 
 /*
- * Scan all keys and return a key_array of all suitable keys from
- * kllist.  The caller has to pass keydb handle so that we don't use
- * to create our own.  Returns either a key_array or NULL in case of
- * an error.  No results found are indicated by an empty array.
- * Caller hast to release the returned array.
+ * Return an array with all trust records flagged with
+ * TDB_TRUSTFLAG_DIRTY sorted by fingerprint and store the number of
+ * items at R_NDIRTY.  Returns NULL if no record is flagged.
  */
-static struct key_array *
-validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
-                   struct key_item *klist, u32 curtime, u32 *next_expire)
+static struct dirty_key *
+collect_dirty_keys (size_t *r_ndirty)
 {
-  KBNODE keyblock = NULL;
-  struct key_array *keys = NULL;
-  size_t nkeys, maxkeys;
-  int rc;
+  struct dirty_key *dirty = NULL;
+  size_t ndirty = 0;
+  size_t maxdirty = 0;
+  TRUSTREC rec;
+  ulong recnum;
+
+  for (recnum=1; !tdbio_read_record (recnum, &rec, 0); recnum++)
+    {
+      if (rec.rectype != RECTYPE_TRUST
+          || !(rec.r.trust.flags & TDB_TRUSTFLAG_DIRTY))
+        continue;
+
+      if (ndirty == maxdirty)
+        {
+          maxdirty += 256;
+          dirty = xrealloc (dirty, maxdirty * sizeof *dirty);
+        }
+      memcpy (dirty[ndirty].fpr, rec.r.trust.fingerprint,
+              MAX_FINGERPRINT_LEN);
+      dirty[ndirty].recnum = recnum;
+      ndirty++;
+    }
+
+  if (ndirty)
+    qsort (dirty, ndirty, sizeof *dirty, cmp_dirty_key);
+  *r_ndirty = ndirty;
+  return dirty;
+}
+
+
+/* Clear the flag of the NDIRTY trust records in DIRTY.  Caller must
+ * sync. */
+static void
+clear_dirty_keys (ctrl_t ctrl, struct dirty_key *dirty, size_t ndirty)
+{
+  TRUSTREC rec;
+  size_t i;
+
+  for (i=0; i < ndirty; i++)
+    {
+      read_record (dirty[i].recnum, &rec, RECTYPE_TRUST);
+      if ((rec.r.trust.flags & TDB_TRUSTFLAG_DIRTY))
+        {
+          rec.r.trust.flags &= ~TDB_TRUSTFLAG_DIRTY;
+          write_record (ctrl, &rec);
+        }
+    }
+}
+
+
+/*
+ * Scan all keys and build the certification graph GRAPH.  Only the
+ * issuer of a certification is taken into account; the signatures
+ * are not verified here.  The keys listed in the sorted array DIRTY
+ * with NDIRTY items are flagged as dirty and affected.  The caller
+ * has to pass keydb handle so that we don't use to create our own.
+ */
+static gpg_error_t
+build_cert_graph (KEYDB_HANDLE hd, struct cert_graph *graph,
+                  struct dirty_key *dirty, size_t ndirty)
+{
+  gpg_error_t err;
   KEYDB_SEARCH_DESC desc;
+  KBNODE keyblock = NULL;
+  KBNODE node;
+  size_t maxnodes = 0;
+  size_t maxedges = 0;
+  size_t i, n;
 
-  maxkeys = 1000;
-  keys = xmalloc ((maxkeys+1) * sizeof *keys);
-  nkeys = 0;
+  memset (graph, 0, sizeof *graph);
 
-  rc = keydb_search_reset (hd);
-  if (rc)
+  err = keydb_search_reset (hd);
+  if (err)
     {
-      log_error ("keydb_search_reset failed: %s\n", gpg_strerror (rc));
-      xfree (keys);
-      return NULL;
+      log_error ("keydb_search_reset failed: %s\n", gpg_strerror (err));
+      return err;
     }
 
   memset (&desc, 0, sizeof desc);
   desc.mode = KEYDB_SEARCH_MODE_FIRST;
-  desc.skipfnc = search_skipfnc;
-  desc.skipfncvalue = full_trust;
-  rc = keydb_search (hd, &desc, 1, NULL);
-  if (gpg_err_code (rc) == GPG_ERR_NOT_FOUND)
+  while (!(err = keydb_search (hd, &desc, 1, NULL)))
     {
-      keys[nkeys].keyblock = NULL;
-      return keys;
+      struct cert_node *cn;
+      struct dirty_key dk;
+      PKT_public_key *pk;
+      size_t dummy;
+
+      desc.mode = KEYDB_SEARCH_MODE_NEXT;
+      err = keydb_get_keyblock (hd, &keyblock);
+      if (err)
+        {
+          log_error ("keydb_get_keyblock failed: %s\n", gpg_strerror (err));
+          goto leave;
+        }
+      if (keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
+        {
+          release_kbnode (keyblock);
+          keyblock = NULL;
+          continue;
+        }
+
+      if (graph->nnodes == maxnodes)
+        {
+          maxnodes = maxnodes? 2 * maxnodes : 1024;
+          graph->nodes = xrealloc (graph->nodes,
+                                   maxnodes * sizeof *graph->nodes);
+        }
+      cn = graph->nodes + graph->nnodes;
+      memset (cn, 0, sizeof *cn);
+      pk = keyblock->pkt->pkt.public_key;
+      keyid_from_pk (pk, cn->kid);
+      fingerprint_from_pk (pk, cn->fpr, &dummy);
+      if (ndirty)
+        {
+          memcpy (dk.fpr, cn->fpr, MAX_FINGERPRINT_LEN);
+          if (bsearch (&dk, dirty, ndirty, sizeof *dirty, cmp_dirty_key))
+            cn->dirty = cn->affected = 1;
+        }
+
+      /* Note that we do not care about the position of the
+         signature; any extra edge merely makes validate_key_list
+         look at a key which it will then not consider as signed.  */
+      for (node = keyblock->next; node; node = node->next)
+        {
+          PKT_signature *sig;
+
+          if (node->pkt->pkttype != PKT_SIGNATURE)
+            continue;
+          sig = node->pkt->pkt.signature;
+          if (!IS_UID_SIG (sig)
+              || (sig->keyid[0] == cn->kid[0] && sig->keyid[1] == cn->kid[1]))
+            continue;
+
+          if (graph->nedges == maxedges)
+            {
+              maxedges = maxedges? 2 * maxedges : 4096;
+              graph->edges = xrealloc (graph->edges,
+                                       maxedges * sizeof *graph->edges);
+            }
+          graph->edges[graph->nedges].signer[0] = sig->keyid[0];
+          graph->edges[graph->nedges].signer[1] = sig->keyid[1];
+          graph->edges[graph->nedges].idx = graph->nnodes;
+          graph->nedges++;
+        }
+
+      graph->nnodes++;
+      release_kbnode (keyblock);
+      keyblock = NULL;
     }
-  if (rc)
+  if (gpg_err_code (err) != GPG_ERR_NOT_FOUND)
+    {
+      log_error ("keydb_search_next failed: %s\n", gpg_strerror (err));
+      goto leave;
+    }
+  err = 0;
+
+  /* Sort the edges by certifier and remove the duplicates due to
+     several certified user IDs.  */
+  if (graph->nedges)
+    qsort (graph->edges, graph->nedges, sizeof *graph->edges, cmp_cert_edge);
+  for (i = n = 0; i < graph->nedges; i++)
+    if (!n || cmp_cert_edge (graph->edges + n - 1, graph->edges + i))
+      graph->edges[n++] = graph->edges[i];
+  graph->nedges = n;
+
+ leave:
+  release_kbnode (keyblock);
+  if (err)
+    release_cert_graph (graph);
+  return err;
+}
+
+
+/*
+ * Flag all keys in GRAPH certified by the keys in QUEUE, and in turn
+ * the keys certified by those, up to MAXDEPTH levels.  If REACHABLE
+ * is set the reachable flag is set, otherwise the affected flag.  The
+ * NQUEUE nodes in QUEUE must already be flagged and QUEUE must have
+ * space for all nodes of GRAPH.
+ */
+static void
+propagate_cert_graph (struct cert_graph *graph, size_t *queue, size_t nqueue,
+                      int maxdepth, int reachable)
+{
+  size_t head = 0;
+  size_t end, i;
+  int depth;
+
+  for (depth=0; depth < maxdepth && head < nqueue; depth++)
+    for (end = nqueue; head < end; head++)
+      {
+        u32 *kid = graph->nodes[queue[head]].kid;
+
+        for (i = cert_graph_first_edge (graph, kid);
+             i < graph->nedges && cert_edge_signer_p (graph->edges + i, kid);
+             i++)
+          {
+            struct cert_node *cn = graph->nodes + graph->edges[i].idx;
+
+            if (reachable? cn->reachable : cn->affected)
+              continue;
+            if (reachable)
+              cn->reachable = 1;
+            else
+              cn->affected = 1;
+            queue[nqueue++] = graph->edges[i].idx;
+          }
+      }
+}
+
+
+/*
+ * Return true if the changes to the keys flagged as dirty in GRAPH
+ * may change the validity of any key.  A key which is not certified,
+ * directly or indirectly, by a dirty key keeps its validity.  The
+ * other keys can only change if they are within the web of trust or
+ * had a validity before.
+ */
+static int
+dirty_keys_affect_wot (struct cert_graph *graph)
+{
+  size_t *queue;
+  size_t nqueue, i;
+  struct key_item *k;
+  TRUSTREC trec, vrec;
+  ulong recno;
+  int result = 0;
+
+  queue = xmalloc ((graph->nnodes + 1) * sizeof *queue);
+
+  /* Flag the keys within max_cert_depth of an ultimately trusted
+     key.  */
+  nqueue = 0;
+  for (k = utk_list; k; k = k->next)
+    for (i = cert_graph_first_edge (graph, k->kid);
+         i < graph->nedges && cert_edge_signer_p (graph->edges + i, k->kid);
+         i++)
+      if (!graph->nodes[graph->edges[i].idx].reachable)
+        {
+          graph->nodes[graph->edges[i].idx].reachable = 1;
+          queue[nqueue++] = graph->edges[i].idx;
+        }
+  propagate_cert_graph (graph, queue, nqueue, opt.max_cert_depth - 1, 1);
+
+  /* Flag the keys certified by a dirty key.  */
+  nqueue = 0;
+  for (i=0; i < graph->nnodes; i++)
+    if (graph->nodes[i].dirty)
+      queue[nqueue++] = i;
+  propagate_cert_graph (graph, queue, nqueue, opt.max_cert_depth, 0);
+
+  for (i=0; i < graph->nnodes && !result; i++)
     {
-      log_error ("keydb_search(first) failed: %s\n", gpg_strerror (rc));
-      goto die;
+      if (!graph->nodes[i].affected)
+        continue;
+      if (graph->nodes[i].reachable)
+        result = 1;
+      else if (!tdbio_search_trust_byfpr (graph->nodes[i].fpr, &trec))
+        {
+          for (recno = trec.r.trust.validlist; recno && !result;
+               recno = vrec.r.valid.next)
+            {
+              read_record (recno, &vrec, RECTYPE_VALID);
+              if ((vrec.r.valid.validity & TRUST_MASK)
+                  || vrec.r.valid.full_count || vrec.r.valid.marginal_count)
+                result = 1;
+            }
+        }
     }
 
-  desc.mode = KEYDB_SEARCH_MODE_NEXT; /* change mode */
-  do
+  if (DBG_TRUST)
     {
-      PKT_public_key *pk;
+      size_t ndirty, naffected, nreachable;
 
-      rc = keydb_get_keyblock (hd, &keyblock);
-      if (rc)
+      ndirty = naffected = nreachable = 0;
+      for (i=0; i < graph->nnodes; i++)
         {
-          log_error ("keydb_get_keyblock failed: %s\n", gpg_strerror (rc));
-	  goto die;
+          ndirty += graph->nodes[i].dirty;
+          naffected += graph->nodes[i].affected;
+          nreachable += graph->nodes[i].reachable;
         }
+      log_debug ("trustdb: %zu keys dirty, %zu affected, %zu in the WoT%s\n",
+                 ndirty, naffected, nreachable,
+                 result? "" : " - nothing to do");
+    }
+
+  xfree (queue);
+  return result;
+}
+
+
+/* The thread function of the certification check workers.  */
+static void *
+cert_check_worker_thread (void *arg)
+{
+  struct cert_check_pool *pool = arg;
+  struct cert_check *job;
+
+  npth_mutex_lock (&pool->lock);
+  for (;;)
+    {
+      while (!pool->stop && pool->next >= pool->njobs)
+        npth_cond_wait (&pool->cond, &pool->lock);
+      if (pool->stop)
+        break;
+
+      job = pool->jobs + pool->next++;
+      npth_mutex_unlock (&pool->lock);
+
+      npth_unprotect ();
+      job->err = check_signature_over_key_or_uid (NULL, job->signer, job->sig,
+                                                  job->keyblock, job->uidpkt,
+                                                  NULL, NULL);
+      npth_protect ();
+
+      npth_mutex_lock (&pool->lock);
+      if (++pool->ndone == pool->njobs)
+        npth_cond_broadcast (&pool->cond);
+    }
+  npth_mutex_unlock (&pool->lock);
+
+  return NULL;
+}
+
+
+/* Release the certification check pool POOL.  This must be called
+ * by the main thread.  */
+static void
+release_cert_check_pool (struct cert_check_pool *pool)
+{
+  int i;
+
+  if (!pool)
+    return;
+
+  npth_main_enter ();
+  npth_mutex_lock (&pool->lock);
+  pool->stop = 1;
+  npth_cond_broadcast (&pool->cond);
+  npth_mutex_unlock (&pool->lock);
+  for (i=0; i < pool->nthreads; i++)
+    npth_join (pool->threads[i], NULL);
+  npth_cond_destroy (&pool->cond);
+  npth_mutex_destroy (&pool->lock);
+  npth_main_leave (-1);
+  xfree (pool->threads);
+  xfree (pool);
+}
+
+
+/* Create a new certification check pool with NTHREADS workers.  On
+ * success the main thread runs unprotected until
+ * release_cert_check_pool is called.  Returns NULL on error.  */
+static struct cert_check_pool *
+new_cert_check_pool (int nthreads)
+{
+  gpg_error_t err;
+  struct cert_check_pool *pool;
+  npth_attr_t tattr;
+  int i;
+
+  pool = xtrycalloc (1, sizeof *pool);
+  if (!pool)
+    return NULL;
+  pool->threads = xtrycalloc (nthreads, sizeof *pool->threads);
+  if (!pool->threads || npth_main_enter ())
+    {
+      xfree (pool->threads);
+      xfree (pool);
+      return NULL;
+    }
+  npth_mutex_init (&pool->lock, NULL);
+  npth_cond_init (&pool->cond, NULL);
 
-      if ( keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  for (i=0; i < nthreads; i++)
+    {
+      err = gpg_error_from_errno (npth_create (&pool->threads[i], &tattr,
+                                               cert_check_worker_thread,
+                                               pool));
+      if (err)
         {
-          log_debug ("ooops: invalid pkttype %d encountered\n",
-                     keyblock->pkt->pkttype);
-          dump_kbnode (keyblock);
-          release_kbnode(keyblock);
-          continue;
+          log_info ("error spawning trustdb worker: %s\n",
+                    gpg_strerror (err));
+          break;
         }
+      pool->nthreads++;
+    }
+  npth_attr_destroy (&tattr);
 
-      /* prepare the keyblock for further processing */
-      merge_keys_and_selfsig (ctrl, keyblock);
-      clear_kbnode_flags (keyblock);
-      pk = keyblock->pkt->pkt.public_key;
-      if (pk->has_expired || pk->flags.revoked)
+  if (opt.verbose)
+    log_info (_("using %d threads to check certifications\n"),
+              pool->nthreads);
+
+  npth_main_leave (1);
+  return pool;
+}
+
+
+/* Check the NJOBS certifications in JOBS using the pool POOL and
+ * store the results in the signature cache flags.  */
+static void
+run_cert_checks (struct cert_check_pool *pool,
+                 struct cert_check *jobs, size_t njobs)
+{
+  struct cert_check *job;
+  size_t i;
+
+  if (!njobs)
+    return;
+
+  npth_main_enter ();
+  npth_mutex_lock (&pool->lock);
+  pool->jobs = jobs;
+  pool->njobs = njobs;
+  pool->next = pool->ndone = 0;
+  npth_cond_broadcast (&pool->cond);
+  while (pool->next < pool->njobs)
+    {
+      /* Do not idle while the workers are busy.  */
+      job = pool->jobs + pool->next++;
+      npth_mutex_unlock (&pool->lock);
+      npth_main_leave (0);
+      job->err = check_signature_over_key_or_uid (NULL, job->signer, job->sig,
+                                                  job->keyblock, job->uidpkt,
+                                                  NULL, NULL);
+      npth_main_enter ();
+      npth_mutex_lock (&pool->lock);
+      pool->ndone++;
+    }
+  while (pool->ndone < pool->njobs)
+    npth_cond_wait (&pool->cond, &pool->lock);
+  pool->jobs = NULL;
+  pool->njobs = pool->next = pool->ndone = 0;
+  npth_mutex_unlock (&pool->lock);
+  npth_main_leave (0);
+
+  /* Merge the results in the order of the batch.  Other errors than a
+   * bad signature are left to check_key_signature to report.  */
+  for (i=0; i < njobs; i++)
+    {
+      if (!jobs[i].err)
         {
-          /* it does not make sense to look further at those keys */
-          mark_keyblock_seen (full_trust, keyblock);
+          jobs[i].sig->flags.checked = 1;
+          jobs[i].sig->flags.valid = 1;
         }
-      else if (validate_one_keyblock (ctrl, keyblock, klist,
-                                      curtime, next_expire))
+      else if (gpg_err_code (jobs[i].err) == GPG_ERR_BAD_SIGNATURE)
         {
-	  KBNODE node;
+          jobs[i].sig->flags.checked = 1;
+          jobs[i].sig->flags.valid = 0;
+        }
+    }
+}
 
-          if (pk->expiredate && pk->expiredate >= curtime
-              && pk->expiredate < *next_expire)
-            *next_expire = pk->expiredate;
 
-          if (nkeys == maxkeys) {
-            maxkeys += 1000;
-            keys = xrealloc (keys, (maxkeys+1) * sizeof *keys);
-          }
-          keys[nkeys++].keyblock = keyblock;
+static int
+cmp_cert_signer (const void *a, const void *b)
+{
+  const struct cert_signer *sa = a;
+  const struct cert_signer *sb = b;
+
+  if (sa->kid[0] != sb->kid[0])
+    return sa->kid[0] < sb->kid[0]? -1 : 1;
+  if (sa->kid[1] != sb->kid[1])
+    return sa->kid[1] < sb->kid[1]? -1 : 1;
+  return 0;
+}
+
 
-	  /* Optimization - if all uids are fully trusted, then we
-	     never need to consider this key as a candidate again. */
+/* Return an array with the keys in KLIST sorted by key ID and store
+ * the number of items at R_NSIGNERS.  The public keys are looked up
+ * on demand by find_cert_signer.  */
+static struct cert_signer *
+new_cert_signers (struct key_item *klist, size_t *r_nsigners)
+{
+  struct cert_signer *signers;
+  struct key_item *k;
+  size_t n;
 
-	  for (node=keyblock; node; node = node->next)
-	    if (node->pkt->pkttype == PKT_USER_ID && !(node->flag & 4))
-	      break;
+  for (n=0, k=klist; k; k = k->next)
+    n++;
+  signers = xcalloc (n? n : 1, sizeof *signers);
+  for (n=0, k=klist; k; k = k->next, n++)
+    {
+      signers[n].kid[0] = k->kid[0];
+      signers[n].kid[1] = k->kid[1];
+    }
+  qsort (signers, n, sizeof *signers, cmp_cert_signer);
+  *r_nsigners = n;
+  return signers;
+}
 
-	  if(node==NULL)
-	    mark_keyblock_seen (full_trust, keyblock);
 
-          keyblock = NULL;
+static void
+release_cert_signers (struct cert_signer *signers, size_t nsigners)
+{
+  size_t n;
+
+  for (n=0; n < nsigners; n++)
+    free_public_key (signers[n].pk);
+  xfree (signers);
+}
+
+
+/* Return the public key with the key ID KID from SIGNERS or NULL if
+ * the key is not in SIGNERS or can't be found.  */
+static PKT_public_key *
+find_cert_signer (ctrl_t ctrl, struct cert_signer *signers, size_t nsigners,
+                  u32 *kid)
+{
+  struct cert_signer key, *signer;
+
+  key.kid[0] = kid[0];
+  key.kid[1] = kid[1];
+  signer = bsearch (&key, signers, nsigners, sizeof *signers,
+                    cmp_cert_signer);
+  if (!signer || signer->failed)
+    return NULL;
+  if (!signer->pk)
+    {
+      signer->pk = xmalloc_clear (sizeof *signer->pk);
+      if (get_pubkey (ctrl, signer->pk, kid))
+        {
+          free_public_key (signer->pk);
+          signer->pk = NULL;
+          signer->failed = 1;
         }
+    }
+  return signer->pk;
+}
 
-      release_kbnode (keyblock);
-      keyblock = NULL;
+
+/* Append the certifications on KEYBLOCK which are not yet checked
+ * and would be checked by mark_usable_uid_certs with a key list
+ * matching SIGNERS to the array *R_JOBS.  */
+static void
+collect_cert_checks (ctrl_t ctrl, kbnode_t keyblock,
+                     struct cert_signer *signers, size_t nsigners,
+                     struct cert_check **r_jobs, size_t *r_njobs,
+                     size_t *r_maxjobs)
+{
+  PKT_public_key *pk = keyblock->pkt->pkt.public_key;
+  PKT_public_key *signer;
+  PKT_signature *sig;
+  const struct weakhash *weak;
+  struct cert_check *job;
+  kbnode_t node, uidnode = NULL;
+  u32 main_kid[2];
+
+  keyid_from_pk (pk, main_kid);
+  for (node=keyblock->next; node; node = node->next)
+    {
+      if (node->pkt->pkttype == PKT_USER_ID)
+        {
+          if (node->pkt->pkt.user_id->flags.revoked
+              || node->pkt->pkt.user_id->flags.expired)
+            uidnode = NULL;
+          else
+            uidnode = node;
+          continue;
+        }
+      if (node->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+        break;
+      if (!uidnode || node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+
+      sig = node->pkt->pkt.signature;
+      if (sig->flags.checked || sig->flags.unknown_critical)
+        continue;
+      if (sig->keyid[0] == main_kid[0] && sig->keyid[1] == main_kid[1])
+        continue;
+      if (!IS_UID_SIG (sig) && !IS_UID_REV (sig))
+        continue;
+      if (sig->sig_class >= 0x11 && sig->sig_class <= 0x13
+          && sig->sig_class - 0x10 < opt.min_cert_level)
+        continue;
+
+      /* A weak digest algorithm shall be reported only once.  */
+      if (!opt.flags.allow_weak_digest_algos)
+        {
+          for (weak = opt.weak_digests; weak; weak = weak->next)
+            if (sig->digest_algo == weak->algo)
+              break;
+          if (weak)
+            continue;
+        }
+
+      signer = find_cert_signer (ctrl, signers, nsigners, sig->keyid);
+      if (!signer)
+        continue;
+
+      if (*r_njobs == *r_maxjobs)
+        {
+          *r_maxjobs += 256;
+          *r_jobs = xrealloc (*r_jobs, *r_maxjobs * sizeof **r_jobs);
+        }
+      job = *r_jobs + (*r_njobs)++;
+      job->signer = signer;
+      job->sig = sig;
+      job->keyblock = keyblock;
+      job->uidpkt = uidnode->pkt;
+      job->err = 0;
     }
-  while (!(rc = keydb_search (hd, &desc, 1, NULL)));
+}
+
+
+/*
+ * Return a key_array of all keys signed by a key in KLIST.  The keys
+ * are located using the certification graph GRAPH; keys in
+ * FULL_TRUST are skipped.  TOUCHED lists the validity records set so
+ * far by this run.  If POOL is not NULL the keyblocks are loaded in
+ * batches and their certifications are checked in parallel before
+ * they are validated in keyring order.  If STORE_SIGS is set, the
+ * results of the certification checks are stored with the keyblocks;
+ * this is only done by --update-trustdb.  The caller has to pass keydb
+ * handle so that we don't use to create our own.  Returns either a
+ * key_array or NULL in case of an error.  No results found are
+ * indicated by an empty array.  Caller hast to release the returned
+ * array.
+ */
+static struct key_array *
+validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, struct cert_graph *graph,
+                   struct cert_check_pool *pool,
+                   KeyHashTable full_trust, struct key_item *klist,
+                   u32 curtime, u32 *next_expire,
+                   struct record_set *touched, int store_sigs)
+{
+  KBNODE keyblock = NULL;
+  struct key_array *keys = NULL;
+  size_t nkeys, maxkeys;
+  size_t *cand = NULL;
+  size_t ncand, maxcand, i;
+  struct key_item *k;
+  kbnode_t batch[CERT_CHECK_BATCH];
+  size_t batchidx[CERT_CHECK_BATCH];
+  size_t nbatch, batchsize, j;
+  struct cert_signer *signers = NULL;
+  size_t nsigners = 0;
+  struct cert_check *jobs = NULL;
+  size_t njobs, maxjobs = 0;
+  int rc;
+
+  /* Collect the candidates and process them in keyring order.  */
+  ncand = maxcand = 0;
+  for (k = klist; k; k = k->next)
+    for (i = cert_graph_first_edge (graph, k->kid);
+         i < graph->nedges && cert_edge_signer_p (graph->edges + i, k->kid);
+         i++)
+      {
+        if (ncand == maxcand)
+          {
+            maxcand += 1000;
+            cand = xrealloc (cand, maxcand * sizeof *cand);
+          }
+        cand[ncand++] = graph->edges[i].idx;
+      }
+  if (ncand)
+    qsort (cand, ncand, sizeof *cand, cmp_node_index);
 
-  if (rc && gpg_err_code (rc) != GPG_ERR_NOT_FOUND)
+  maxkeys = 1000;
+  keys = xmalloc ((maxkeys+1) * sizeof *keys);
+  nkeys = 0;
+
+  if (pool)
     {
-      log_error ("keydb_search_next failed: %s\n", gpg_strerror (rc));
-      goto die;
+      signers = new_cert_signers (klist, &nsigners);
+      batchsize = CERT_CHECK_BATCH;
     }
+  else
+    batchsize = 1;
+
+  nbatch = 0;
+  for (i=0; i < ncand; )
+    {
+      /* Load the next batch of keyblocks.  */
+      for (nbatch = 0; i < ncand && nbatch < batchsize; i++)
+        {
+          struct cert_node *cn = graph->nodes + cand[i];
+
+          if (i && cand[i] == cand[i-1])
+            continue; /* Signed by several keys in KLIST.  */
+          if (test_key_hash_table (full_trust, cn->kid))
+            continue;
+
+          rc = keydb_search_reset (hd);
+          if (!rc)
+            rc = keydb_search_fpr (hd, cn->fpr);
+          if (gpg_err_code (rc) == GPG_ERR_NOT_FOUND)
+            continue; /* Deleted in the meantime.  */
+          if (rc)
+            {
+              log_error ("keydb_search_fpr failed: %s\n", gpg_strerror (rc));
+              goto die;
+            }
+
+          rc = keydb_get_keyblock (hd, &keyblock);
+          if (rc)
+            {
+              log_error ("keydb_get_keyblock failed: %s\n",
+                         gpg_strerror (rc));
+              goto die;
+            }
+
+          if ( keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
+            {
+              log_debug ("ooops: invalid pkttype %d encountered\n",
+                         keyblock->pkt->pkttype);
+              dump_kbnode (keyblock);
+              release_kbnode(keyblock);
+              keyblock = NULL;
+              continue;
+            }
+
+          /* prepare the keyblock for further processing */
+          merge_keys_and_selfsig (ctrl, keyblock);
+          clear_kbnode_flags (keyblock);
+          batchidx[nbatch] = cand[i];
+          batch[nbatch++] = keyblock;
+          keyblock = NULL;
+        }
+
+      if (pool)
+        {
+          njobs = 0;
+          for (j=0; j < nbatch; j++)
+            {
+              PKT_public_key *pk = batch[j]->pkt->pkt.public_key;
 
+              if (!pk->has_expired && !pk->flags.revoked)
+                collect_cert_checks (ctrl, batch[j], signers, nsigners,
+                                     &jobs, &njobs, &maxjobs);
+            }
+          run_cert_checks (pool, jobs, njobs);
+        }
+
+      for (j=0; j < nbatch; j++)
+        {
+          PKT_public_key *pk;
+
+          keyblock = batch[j];
+          batch[j] = NULL;
+          pk = keyblock->pkt->pkt.public_key;
+          if (pk->has_expired || pk->flags.revoked)
+            {
+              /* it does not make sense to look further at those keys */
+              mark_keyblock_seen (full_trust, keyblock);
+            }
+          else if (validate_one_keyblock (ctrl, keyblock, klist,
+                                          curtime, next_expire, touched))
+            {
+              KBNODE node;
+
+              /* Remember the checked certifications.  The handle is
+                 still positioned on the keyblock unless it was
+                 loaded as part of a batch.  */
+              if (store_sigs)
+                {
+                  rc = 0;
+                  if (batchsize > 1)
+                    {
+                      rc = keydb_search_reset (hd);
+                      if (!rc)
+                        rc = keydb_search_fpr (hd,
+                                               graph->nodes[batchidx[j]].fpr);
+                    }
+                  if (!rc)
+                    keydb_update_sig_cache (hd, keyblock);
+                }
+
+              if (pk->expiredate && pk->expiredate >= curtime
+                  && pk->expiredate < *next_expire)
+                *next_expire = pk->expiredate;
+
+              if (nkeys == maxkeys) {
+                maxkeys += 1000;
+                keys = xrealloc (keys, (maxkeys+1) * sizeof *keys);
+              }
+              keys[nkeys++].keyblock = keyblock;
+
+              /* Optimization - if all uids are fully trusted, then we
+                 never need to consider this key as a candidate again. */
+
+              for (node=keyblock; node; node = node->next)
+                if (node->pkt->pkttype == PKT_USER_ID && !(node->flag & 4))
+                  break;
+
+              if(node==NULL)
+                mark_keyblock_seen (full_trust, keyblock);
+
+              keyblock = NULL;
+            }
+
+          release_kbnode (keyblock);
+          keyblock = NULL;
+        }
+      nbatch = 0;
+    }
+
+  xfree (jobs);
+  if (signers)
+    release_cert_signers (signers, nsigners);
+  xfree (cand);
   keys[nkeys].keyblock = NULL;
   return keys;
 
  die:
+  for (j=0; j < nbatch; j++)
+    release_kbnode (batch[j]);
+  xfree (jobs);
+  if (signers)
+    release_cert_signers (signers, nsigners);
+  xfree (cand);
   keys[nkeys].keyblock = NULL;
   release_key_array (keys);
   return NULL;
 }
 
-/* Caller must sync */
+/*
+ * Clear the validity and min_ownertrust values which have not been
+ * set by the current run of validate_keys as listed in TOUCHED, and
+ * the dirty flags.  Only records which actually change are written.
+ * Caller must sync.
+ */
 static void
-reset_trust_records (ctrl_t ctrl)
+clear_stale_trust_records (ctrl_t ctrl, struct record_set *touched)
 {
   TRUSTREC rec;
   ulong recnum;
@@ -1928,15 +2911,25 @@ reset_trust_records (ctrl_t ctrl)
     {
       if(rec.rectype==RECTYPE_TRUST)
 	{
+	  int changed = 0;
+
 	  count++;
-	  if(rec.r.trust.min_ownertrust)
+	  if(rec.r.trust.min_ownertrust
+	     && !test_record_set (touched, recnum))
 	    {
 	      rec.r.trust.min_ownertrust=0;
-	      write_record (ctrl, &rec);
+	      changed = 1;
 	    }
-
+	  if ((rec.r.trust.flags & TDB_TRUSTFLAG_DIRTY))
+	    {
+	      rec.r.trust.flags &= ~TDB_TRUSTFLAG_DIRTY;
+	      changed = 1;
+	    }
+	  if (changed)
+	    write_record (ctrl, &rec);
 	}
       else if(rec.rectype==RECTYPE_VALID
+	      && !test_record_set (touched, recnum)
 	      && ((rec.r.valid.validity&TRUST_MASK)
 		  || rec.r.valid.marginal_count
 		  || rec.r.valid.full_count))
@@ -1969,7 +2962,8 @@ reset_trust_records (ctrl_t ctrl)
  * Step 2: loop max_cert_times
  * Step 3:   if OWNERTRUST of any key in klist is undefined
  *             ask user to assign ownertrust
- * Step 4:   Loop over all keys in the keyDB which are not marked seen
+ * Step 4:   Loop over all keys signed by a key in klist (as told by
+ *           the certification graph) which are not marked seen
  * Step 5:     if key is revoked or expired
  *                mark key as seen
  *                continue loop at Step 4
@@ -1981,8 +2975,16 @@ reset_trust_records (ctrl_t ctrl)
  *             End Loop
  * Step 8:   Build a new klist from all fully trusted keys from step 6
  *           End Loop
+ * Step 9: Clear the validity of all keys not set in step 6.
  *         Ready
  *
+ * If only the certifications on some keys or their ownertrust
+ * changed (see tdb_revalidation_mark_key), the keyring caches are not
+ * rebuilt and Steps 2 to 9 are skipped if none of the changed keys
+ * can affect the web of trust.
+ *
+ * With --trustdb-threads the signatures checked in Step 6 are checked
+ * in advance by a pool of threads for batches of keys of Step 4.
  */
 static int
 validate_keys (ctrl_t ctrl, int interactive)
@@ -1999,26 +3001,46 @@ validate_keys (ctrl_t ctrl, int interactive)
   int ot_unknown, ot_undefined, ot_never, ot_marginal, ot_full, ot_ultimate;
   KeyHashTable stored,used,full_trust;
   u32 start_time, next_expire;
+  struct cert_graph graph;
+  struct cert_check_pool *pool = NULL;
+  struct record_set touched;
+  struct dirty_key *dirty = NULL;
+  size_t ndirty = 0;
+  ulong schedcheck = 0;
+  int incremental;
+  int unaffected = 0;
+
+  start_time = make_timestamp ();
+
+  /* An incremental check is sufficient if since the last check only
+     keys have been flagged and the check scheduled by then is not yet
+     due.  */
+  incremental = (!interactive
+                 && tdbio_read_incremental (&schedcheck)
+                 && tdbio_db_matches_options ()
+                 && !(schedcheck && schedcheck <= start_time));
 
   /* Make sure we have all sigs cached.  TODO: This is going to
      require some architectural re-thinking, as it is agonizingly slow.
-     Perhaps combine this with reset_trust_records(), or only check
-     the caches on keys that are actually involved in the web of
-     trust. */
-  keydb_rebuild_caches (ctrl, 0);
+     Perhaps only check the caches on keys that are actually involved
+     in the web of trust. */
+  if (!incremental)
+    keydb_rebuild_caches (ctrl, 0);
 
   kdb = keydb_new ();
   if (!kdb)
     return gpg_error_from_syserror ();
 
-  start_time = make_timestamp ();
+  memset (&graph, 0, sizeof graph);
+  memset (&touched, 0, sizeof touched);
+  if (incremental)
+    dirty = collect_dirty_keys (&ndirty);
+
   next_expire = 0xffffffff; /* set next expire to the year 2106 */
   stored = new_key_hash_table ();
   used = new_key_hash_table ();
   full_trust = new_key_hash_table ();
 
-  reset_trust_records (ctrl);
-
   /* Fixme: Instead of always building a UTK list, we could just build it
    * here when needed */
   if (!utk_list)
@@ -2050,7 +3072,7 @@ validate_keys (ctrl_t ctrl, int interactive)
         {
           if (node->pkt->pkttype == PKT_USER_ID)
 	    update_validity (ctrl, pk, node->pkt->pkt.user_id,
-                             0, TRUST_ULTIMATE);
+                             0, TRUST_ULTIMATE, &touched);
         }
       if ( pk->expiredate && pk->expiredate >= start_time
            && pk->expiredate < next_expire)
@@ -2065,6 +3087,27 @@ validate_keys (ctrl_t ctrl, int interactive)
        trusted keys.  */
     goto leave;
 
+  rc = build_cert_graph (kdb, &graph, dirty, ndirty);
+  if (rc)
+    {
+      log_error ("building the certification graph failed: %s\n",
+                 gpg_strerror (rc));
+      goto leave;
+    }
+
+  if (incremental && !dirty_keys_affect_wot (&graph))
+    {
+      if (!opt.quiet)
+        log_info (_("no need for a trustdb check\n"));
+      unaffected = 1;
+      goto leave;
+    }
+
+  /* The certification checks are passed to validate_one_keyblock via
+     the signature cache; thus the pool is useless without it.  */
+  if (opt.trustdb_threads > 0 && !opt.no_sig_cache)
+    pool = new_cert_check_pool (opt.trustdb_threads);
+
   klist = utk_list;
 
   if (!opt.quiet)
@@ -2089,8 +3132,8 @@ validate_keys (ctrl_t ctrl, int interactive)
 	  else if(k->trust_value>=60)
 	    min=TRUST_MARGINAL;
 
-	  if(min!=k->min_ownertrust)
-	    update_min_ownertrust (ctrl, k->kid,min);
+	  if(min || min!=k->min_ownertrust)
+	    update_min_ownertrust (ctrl, k->kid, min, &touched);
 
           if (interactive && k->ownertrust == TRUST_UNKNOWN)
 	    {
@@ -2136,8 +3179,9 @@ validate_keys (ctrl_t ctrl, int interactive)
         }
 
       /* Find all keys which are signed by a key in kdlist */
-      keys = validate_key_list (ctrl, kdb, full_trust, klist,
-				start_time, &next_expire);
+      keys = validate_key_list (ctrl, kdb, &graph, pool, full_trust, klist,
+				start_time, &next_expire, &touched,
+				interactive);
       if (!keys)
         {
           log_error ("validate_key_list failed\n");
@@ -2153,7 +3197,7 @@ validate_keys (ctrl_t ctrl, int interactive)
         dump_key_array (depth, keys);
 
       for (kar=keys; kar->keyblock; kar++)
-        store_validation_status (ctrl, depth, kar->keyblock, stored);
+        store_validation_status (ctrl, depth, kar->keyblock, stored, &touched);
 
       if (!opt.quiet)
         log_info (_("depth: %d  valid: %3d  signed: %3d"
@@ -2213,6 +3257,7 @@ validate_keys (ctrl_t ctrl, int interactive)
     }
 
  leave:
+  release_cert_check_pool (pool);
   keydb_release (kdb);
   release_key_array (keys);
   if (klist != utk_list)
@@ -2220,18 +3265,29 @@ validate_keys (ctrl_t ctrl, int interactive)
   release_key_hash_table (full_trust);
   release_key_hash_table (used);
   release_key_hash_table (stored);
+  release_cert_graph (&graph);
   if (!rc && !quit) /* mark trustDB as checked */
     {
       int rc2;
 
-      if (next_expire == 0xffffffff || next_expire < start_time )
-        tdbio_write_nextcheck (ctrl, 0);
+      if (unaffected)
+        {
+          /* Nothing to do; keep the check scheduled before.  */
+          clear_dirty_keys (ctrl, dirty, ndirty);
+          tdbio_write_nextcheck (ctrl, schedcheck);
+        }
       else
         {
-          tdbio_write_nextcheck (ctrl, next_expire);
-          if (!opt.quiet)
-            log_info (_("next trustdb check due at %s\n"),
-                      strtimestamp (next_expire));
+          clear_stale_trust_records (ctrl, &touched);
+          if (next_expire == 0xffffffff || next_expire < start_time )
+            tdbio_write_nextcheck (ctrl, 0);
+          else
+            {
+              tdbio_write_nextcheck (ctrl, next_expire);
+              if (!opt.quiet)
+                log_info (_("next trustdb check due at %s\n"),
+                          strtimestamp (next_expire));
+            }
         }
 
       rc2 = tdbio_update_version_record (ctrl);
@@ -2245,6 +3301,8 @@ validate_keys (ctrl_t ctrl, int interactive)
       do_sync ();
       pending_check_trustdb = 0;
     }
+  xfree (dirty);
+  xfree (touched.bits);
 
   return rc;
 }
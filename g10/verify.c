@@ -32,6 +32,8 @@
 #include "keydb.h"
 #include "../common/util.h"
 #include "main.h"
+#include "trustdb.h"
+#include "tofu.h"
 #include "filter.h"
 #include "../common/ttyio.h"
 #include "../common/i18n.h"
@@ -137,6 +139,189 @@ print_file_status( int status, const char *name, int what )
 }
 
 
+/* The cache used by verify_files to resolve the keys of the signers
+ * only once for a batch of files.  It maps the key ID of a signature
+ * to the merged keyblock of the signer and remembers the validity of
+ * the signers' keys and user ids.  Entries are refreshed after
+ * VERIFY_CACHE_TTL seconds so that a long running batch notices
+ * expired keys.  */
+#define VERIFY_CACHE_TTL      300
+#define VERIFY_CACHE_MAX_KEYS 1024
+#define VERIFY_CACHE_MAX_VALIDITIES 4096
+
+struct verify_cache_key_s
+{
+  struct verify_cache_key_s *next;
+  u32 keyid[2];         /* The key ID used for the lookup.  */
+  u32 created;          /* The time the entry was created.  */
+  kbnode_t keyblock;    /* The merged keyblock.  */
+};
+
+struct verify_cache_validity_s
+{
+  struct verify_cache_validity_s *next;
+  u32 keyid[2];         /* The key ID of the (sub)key.  */
+  u32 created;          /* The time the entry was created.  */
+  int has_uid;          /* NAMEHASH is valid.  */
+  byte namehash[20];    /* The namehash of the user id.  */
+  unsigned int validity;
+};
+
+struct verify_cache_s
+{
+  struct verify_cache_key_s *keys;
+  unsigned int nkeys;
+  struct verify_cache_validity_s *validities;
+  unsigned int nvalidities;
+  unsigned int hits;    /* Number of lookups served by the cache.  */
+  unsigned int misses;  /* Number of lookups not served by the cache.  */
+};
+
+
+static void
+release_verify_cache (struct verify_cache_s *cache)
+{
+  struct verify_cache_key_s *k;
+  struct verify_cache_validity_s *v;
+
+  if (!cache)
+    return;
+  while ((k = cache->keys))
+    {
+      cache->keys = k->next;
+      release_kbnode (k->keyblock);
+      xfree (k);
+    }
+  while ((v = cache->validities))
+    {
+      cache->validities = v->next;
+      xfree (v);
+    }
+  xfree (cache);
+}
+
+
+/* Return the keyblock of the key with KEYID like get_pubkeyblock
+ * does.  While verify_files is running the keyblock is taken from a
+ * cache.  The caller must release the keyblock.  */
+kbnode_t
+verify_get_pubkeyblock (ctrl_t ctrl, u32 *keyid)
+{
+  struct verify_cache_s *cache = ctrl->verify_cache;
+  struct verify_cache_key_s *k, **kp;
+  kbnode_t keyblock;
+  u32 now;
+
+  if (!cache)
+    return get_pubkeyblock (ctrl, keyid);
+
+  now = make_timestamp ();
+  for (kp = &cache->keys; (k = *kp); kp = &k->next)
+    if (k->keyid[0] == keyid[0] && k->keyid[1] == keyid[1])
+      {
+        if (k->created + VERIFY_CACHE_TTL > now
+            && (keyblock = copy_keyblock (k->keyblock)))
+          {
+            cache->hits++;
+            return keyblock;
+          }
+        /* Expired - remove it.  */
+        *kp = k->next;
+        release_kbnode (k->keyblock);
+        xfree (k);
+        cache->nkeys--;
+        break;
+      }
+
+  cache->misses++;
+  keyblock = get_pubkeyblock (ctrl, keyid);
+  if (keyblock && cache->nkeys < VERIFY_CACHE_MAX_KEYS)
+    {
+      k = xtrycalloc (1, sizeof *k);
+      if (k && (k->keyblock = copy_keyblock (keyblock)))
+        {
+          k->keyid[0] = keyid[0];
+          k->keyid[1] = keyid[1];
+          k->created = now;
+          k->next = cache->keys;
+          cache->keys = k;
+          cache->nkeys++;
+        }
+      else
+        xfree (k);
+    }
+  return keyblock;
+}
+
+
+/* Return the validity like get_validity does.  While verify_files is
+ * running the result is taken from a cache.  The TOFU trust models
+ * are not cached because there the validity depends on the
+ * signatures seen so far.  */
+unsigned int
+verify_get_validity (ctrl_t ctrl, kbnode_t kb, PKT_public_key *pk,
+                     PKT_user_id *uid, PKT_signature *sig, int may_ask)
+{
+  struct verify_cache_s *cache = ctrl->verify_cache;
+  struct verify_cache_validity_s *v, **vp;
+  unsigned int validity;
+  u32 kid[2];
+  u32 now;
+
+  if (!cache || opt.trust_model == TM_TOFU || opt.trust_model == TM_TOFU_PGP
+      || opt.trust_model == TM_AUTO)
+    return get_validity (ctrl, kb, pk, uid, sig, may_ask);
+
+  if (!pk)
+    pk = kb->pkt->pkt.public_key;
+  keyid_from_pk (pk, kid);
+  if (uid)
+    namehash_from_uid (uid);
+
+  now = make_timestamp ();
+  for (vp = &cache->validities; (v = *vp); vp = &v->next)
+    if (v->keyid[0] == kid[0] && v->keyid[1] == kid[1]
+        && v->has_uid == !!uid
+        && (!uid || !memcmp (v->namehash, uid->namehash, 20)))
+      {
+        if (v->created + VERIFY_CACHE_TTL > now)
+          return v->validity;
+        *vp = v->next;
+        xfree (v);
+        cache->nvalidities--;
+        break;
+      }
+
+  validity = get_validity (ctrl, kb, pk, uid, sig, may_ask);
+
+  /* Don't cache if the validity was computed while the trustdb is
+   * still pending a check or if get_validity switched the trust
+   * model from auto to TOFU.  */
+  if ((validity & TRUST_FLAG_PENDING_CHECK)
+      || opt.trust_model == TM_TOFU || opt.trust_model == TM_TOFU_PGP
+      || cache->nvalidities >= VERIFY_CACHE_MAX_VALIDITIES)
+    return validity;
+
+  v = xtrycalloc (1, sizeof *v);
+  if (v)
+    {
+      v->keyid[0] = kid[0];
+      v->keyid[1] = kid[1];
+      v->created = now;
+      if (uid)
+        {
+          v->has_uid = 1;
+          memcpy (v->namehash, uid->namehash, 20);
+        }
+      v->validity = validity;
+      v->next = cache->validities;
+      cache->validities = v;
+      cache->nvalidities++;
+    }
+  return validity;
+}
+
+
 static int
 verify_one_file (ctrl_t ctrl, const char *name )
 {
@@ -192,6 +377,18 @@ int
 verify_files (ctrl_t ctrl, int nfiles, char **files )
 {
     int i;
+    int rc = 0;
+
+    /* Usually all files are signed by a few keys; thus we resolve
+     * each signer only once for the whole batch.  */
+    log_assert (!ctrl->verify_cache);
+    ctrl->verify_cache = xtrycalloc (1, sizeof *ctrl->verify_cache);
+
+#ifdef USE_TOFU
+    tofu_begin_batch_update (ctrl);
+    if (opt.trust_model == TM_TOFU || opt.trust_model == TM_TOFU_PGP)
+      tofu_preload_bindings (ctrl);
+#endif
 
     if( !nfiles ) { /* read the filenames from stdin */
 	char line[2048];
@@ -201,7 +398,8 @@ verify_files (ctrl_t ctrl, int nfiles, char **files )
 	    lno++;
 	    if( !*line || line[strlen(line)-1] != '\n' ) {
 		log_error(_("input line %u too long or missing LF\n"), lno );
-		return GPG_ERR_GENERAL;
+		rc = GPG_ERR_GENERAL;
+                goto leave;
 	    }
 	    /* This code does not work on MSDOS but how cares there are
 	     * also no script languages available.  We don't strip any
@@ -215,7 +413,18 @@ verify_files (ctrl_t ctrl, int nfiles, char **files )
 	for(i=0; i < nfiles; i++ )
             verify_one_file (ctrl, files[i] );
     }
-    return 0;
+
+ leave:
+    if (DBG_CACHE && ctrl->verify_cache)
+      log_debug ("verify_files: signer cache: keys=%u hits=%u misses=%u\n",
+                 ctrl->verify_cache->nkeys, ctrl->verify_cache->hits,
+                 ctrl->verify_cache->misses);
+#ifdef USE_TOFU
+    tofu_end_batch_update (ctrl);
+#endif
+    release_verify_cache (ctrl->verify_cache);
+    ctrl->verify_cache = NULL;
+    return rc;
 }
 
 
@@ -49,7 +49,10 @@
    - u32  RFU
    - u32  file_created_at
    - u32  last_maintenance_run
-   - u32  RFU
+   - u32  Number of bytes in blobs flagged as deleted since the last
+          maintenance run.  This is only used to schedule a compress
+          run and may be too large if the file has been compressed by
+          an older version.
    - u32  RFU
 
 ** The OpenPGP and X.509 blobs
@@ -109,6 +112,14 @@
              - 0x00000002 = bad signature
              - 0x10000000 = valid and expires at some date in 1978.
              - 0xffffffff = valid and does not expire
+             For OpenPGP this is now a cache of the signature check
+             result which gpg updates in place:
+             - 0x00000000 = not checked
+             - 0x40000000 | CHECK = good signature
+             - 0x80000000 | CHECK = bad signature
+             The 30 bit CHECK value is derived from the signature
+             and the fingerprints of the key and the issuer; values
+             with a wrong CHECK are ignored.  See ../g10/sig-check.c.
    - u8	Assigned ownertrust [X509: not used]
    - u8	All_Validity
         OpenPGP: See ../g10/trustdb/TRUST_* [not yet used]
@@ -127,6 +138,8 @@
    - bN   RFU.  This is the remaining space after keyblock and before
           the checksum.  It is not covered by the checksum.
    - b20  SHA-1 checksum (useful for KS syncronisation?)
+          Note that the signature info may be updated in place; the
+          checksum is then updated along with it.
           Note, that KBX versions before GnuPG 2.1 used an MD5
           checksum.  However it was only created but never checked.
           Thus we do not expect problems if we switch to SHA-1.  If
@@ -208,6 +221,7 @@ struct keyboxblob {
   byte *blob;
   size_t bloblen;
   off_t fileoffset;
+  KEYBOX_MAP map;  /* If not NULL BLOB points into this mapping.  */
 
   /* stuff used only by keybox_create_blob */
   unsigned char *serialbuf;
@@ -1000,6 +1014,40 @@ _keybox_new_blob (KEYBOXBLOB *r_blob,
 }
 
 
+/* Turn *R_BLOB into a view of the IMAGELEN bytes at offset OFF of
+   MAP.  If *R_BLOB is NULL a new blob object is allocated; otherwise
+   *R_BLOB must be a view returned by an earlier call and is re-used.
+   This allows to walk over all blobs of a mapped file without
+   allocating or copying anything.  */
+gpg_error_t
+_keybox_set_blob_view (KEYBOXBLOB *r_blob, KEYBOX_MAP map,
+                       size_t off, size_t imagelen)
+{
+  KEYBOXBLOB blob = *r_blob;
+
+  if (!blob)
+    {
+      blob = xtrycalloc (1, sizeof *blob);
+      if (!blob)
+        return gpg_error_from_syserror ();
+      *r_blob = blob;
+    }
+  else
+    assert (blob->map);
+
+  if (blob->map != map)
+    {
+      map->refcount++;
+      _keybox_unref_map (blob->map);
+      blob->map = map;
+    }
+  blob->blob = map->image + off;
+  blob->bloblen = imagelen;
+  blob->fileoffset = off;
+  return 0;
+}
+
+
 void
 _keybox_release_blob (KEYBOXBLOB blob)
 {
@@ -1017,7 +1065,10 @@ _keybox_release_blob (KEYBOXBLOB blob)
     xfree (blob->uids[i].name);
   xfree (blob->uids );
   xfree (blob->sigs );
-  xfree (blob->blob );
+  if (blob->map)
+    _keybox_unref_map (blob->map);
+  else
+    xfree (blob->blob );
   xfree (blob );
 }
 
@@ -1051,6 +1102,9 @@ _keybox_update_header_blob (KEYBOXBLOB blob, int for_openpgp)
       blob->blob[20+2] = (val >>  8);
       blob->blob[20+3] = (val      );
 
+      /* The deleted blobs are gone.  */
+      memset (blob->blob+24, 0, 4);
+
       if (for_openpgp)
         blob->blob[7] |= 0x02;  /* OpenPGP data may be available.  */
     }
@@ -32,6 +32,7 @@
         map_assuan_err_with_source (GPG_ERR_SOURCE_DEFAULT, (a))
 
 #include <sys/types.h> /* off_t */
+#include <time.h>
 
 /* We include the type definitions from jnlib instead of defining our
    owns here.  This will not allow us build KBX in a standalone way
@@ -47,6 +48,7 @@
 
 
 typedef struct keyboxblob *KEYBOXBLOB;
+typedef struct keybox_map_s *KEYBOX_MAP;
 
 
 typedef struct keybox_name *KB_NAME;
@@ -79,6 +81,29 @@ struct keybox_name
 };
 
 
+/* The size, modification time and inode of a keybox file.  This is
+   used to detect whether the index matches the keybox file.  */
+struct keybox_stamp_s
+{
+  off_t size;
+  time_t mtime;
+  unsigned long mtime_nsec;  /* Sub-second part of MTIME or 0.  */
+  unsigned long inode;       /* Low 32 bits of the inode number.  */
+};
+
+
+/* A read-only memory mapping of a keybox file.  Blobs read from a
+   mapping point into IMAGE and hold a reference to the mapping, so
+   that it is only unmapped after the last of them has been
+   released.  */
+struct keybox_map_s
+{
+  unsigned int refcount;
+  unsigned char *image;
+  size_t length;
+};
+
+
 struct keybox_found_s
 {
   KEYBOXBLOB blob;
@@ -90,6 +115,8 @@ struct keybox_handle {
   KB_NAME kb;
   int secret;             /* this is for a secret keybox */
   FILE *fp;
+  KEYBOX_MAP map;         /* The mapped FP or NULL.  */
+  off_t mappos;           /* The read position if MAP is used.  */
   int eof;
   int error;
   int ephemeral;
@@ -100,6 +127,17 @@ struct keybox_handle {
     char *name;
     char *pattern;
   } word_match;
+  struct {
+    FILE *fp;             /* The opened index file or NULL.  */
+    unsigned int flags;   /* The flags from the index header.  */
+    size_t nrecs;         /* The number of records in the index.  */
+    size_t bloomlen;      /* The length of the bloom filter or 0.  */
+    struct keybox_stamp_s stamp;  /* The stamp from the index header.  */
+    unsigned char *adds;  /* The sorted records added by the delta log.  */
+    size_t nadds;         /* The number of these records.  */
+    off_t *removed;       /* The sorted offsets removed by the delta log.  */
+    size_t nremoved;      /* The number of these offsets.  */
+  } index;
 };
 
 
@@ -164,6 +202,8 @@ int _keybox_create_x509_blob (KEYBOXBLOB *r_blob, ksba_cert_t cert,
 int  _keybox_new_blob (KEYBOXBLOB *r_blob,
                        unsigned char *image, size_t imagelen,
                        off_t off);
+gpg_error_t _keybox_set_blob_view (KEYBOXBLOB *r_blob, KEYBOX_MAP map,
+                                   size_t off, size_t imagelen);
 void _keybox_release_blob (KEYBOXBLOB blob);
 const unsigned char *_keybox_get_blob_image (KEYBOXBLOB blob, size_t *n);
 off_t _keybox_get_blob_fileoffset (KEYBOXBLOB blob);
@@ -178,13 +218,39 @@ void _keybox_destroy_openpgp_info (keybox_openpgp_info_t info);
 
 /*-- keybox-file.c --*/
 int _keybox_read_blob (KEYBOXBLOB *r_blob, FILE *fp, int *skipped_deleted);
+int _keybox_read_blob_from_map (KEYBOXBLOB *r_blob, KEYBOX_MAP map,
+                                off_t *r_pos, int *skipped_deleted);
 int _keybox_write_blob (KEYBOXBLOB blob, FILE *fp);
+gpg_error_t _keybox_map_file (FILE *fp, KEYBOX_MAP *r_map);
+void _keybox_unref_map (KEYBOX_MAP map);
+
+/*-- keybox-index.c --*/
+int _keybox_get_off (const unsigned char *buffer, off_t *r_value);
+void _keybox_put_off (unsigned char *buffer, off_t value);
+void _keybox_get_stamp (const char *fname, struct keybox_stamp_s *r_stamp);
+gpg_error_t _keybox_index_rebuild (KB_NAME kb);
+void _keybox_index_refresh (KEYBOX_HANDLE hd);
+void _keybox_index_update (KB_NAME kb, const struct keybox_stamp_s *before,
+                           off_t remove_off, off_t add_off, off_t delta,
+                           KEYBOXBLOB blob);
+void _keybox_index_close (KEYBOX_HANDLE hd);
+int _keybox_index_usable (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc,
+                          size_t ndesc);
+gpg_error_t _keybox_index_next (KEYBOX_HANDLE hd,
+                                KEYBOX_SEARCH_DESC *desc, size_t ndesc,
+                                off_t *r_off);
 
 /*-- keybox-search.c --*/
 gpg_err_code_t _keybox_get_flag_location (const unsigned char *buffer,
                                           size_t length,
                                           int what,
                                           size_t *flag_off, size_t *flag_size);
+int _keybox_get_mailbox (const unsigned char *buffer, size_t off, size_t len,
+                         int x509, size_t *r_off, size_t *r_len);
+#ifdef KEYBOX_WITH_X509
+int _keybox_get_x509_keygrip (const unsigned char *buffer, size_t length,
+                              unsigned char *grip);
+#endif /*KEYBOX_WITH_X509*/
 
 static inline int
 blob_get_type (KEYBOXBLOB blob)
@@ -23,6 +23,11 @@
 #include <string.h>
 #include <errno.h>
 #include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
 
 #include "keybox-defs.h"
 
@@ -116,7 +121,12 @@ _keybox_read_blob (KEYBOXBLOB *r_blob, FILE *fp, int *skipped_deleted)
   image[0] = c1; image[1] = c2; image[2] = c3; image[3] = c4; image[4] = type;
   if (fread (image+5, imagelen-5, 1, fp) != 1)
     {
-      gpg_error_t tmperr = gpg_error_from_syserror ();
+      gpg_error_t tmperr;
+
+      if (feof (fp) && !ferror (fp))
+        tmperr = gpg_error (GPG_ERR_TOO_SHORT);
+      else
+        tmperr = gpg_error_from_syserror ();
       xfree (image);
       return tmperr;
     }
@@ -128,6 +138,145 @@ _keybox_read_blob (KEYBOXBLOB *r_blob, FILE *fp, int *skipped_deleted)
 }
 
 
+/* Map the keybox file opened as FP into memory and store the mapping
+   at R_MAP.  If R_MAP already holds a mapping of FP with the current
+   size of the file it is kept; otherwise it is released and replaced
+   by a new one.  On error *R_MAP is set to NULL and the caller needs
+   to fall back to _keybox_read_blob.  */
+gpg_error_t
+_keybox_map_file (FILE *fp, KEYBOX_MAP *r_map)
+{
+#ifdef HAVE_MMAP
+  gpg_error_t err;
+  struct stat st;
+  KEYBOX_MAP map;
+  void *image;
+  size_t length;
+
+  if (fstat (fileno (fp), &st))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  length = (size_t)st.st_size;
+  if (*r_map && (off_t)(*r_map)->length == st.st_size)
+    return 0;  /* Still valid.  */
+
+  if ((off_t)length != st.st_size || !length)
+    {
+      /* Too large for our address space or empty.  */
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+
+  map = xtrycalloc (1, sizeof *map);
+  if (!map)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  image = mmap (NULL, length, PROT_READ, MAP_SHARED, fileno (fp), 0);
+  if (image == MAP_FAILED)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (map);
+      goto leave;
+    }
+  map->refcount = 1;
+  map->image = image;
+  map->length = length;
+
+  _keybox_unref_map (*r_map);
+  *r_map = map;
+  return 0;
+
+ leave:
+  _keybox_unref_map (*r_map);
+  *r_map = NULL;
+  return err;
+
+#else /*!HAVE_MMAP*/
+  (void)fp;
+  _keybox_unref_map (*r_map);
+  *r_map = NULL;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#endif /*!HAVE_MMAP*/
+}
+
+
+/* Drop a reference to MAP and unmap it if it is not anymore used.
+   MAP may be NULL.  */
+void
+_keybox_unref_map (KEYBOX_MAP map)
+{
+  if (!map)
+    return;
+  if (--map->refcount)
+    return;
+#ifdef HAVE_MMAP
+  munmap (map->image, map->length);
+#endif
+  xfree (map);
+}
+
+
+/* Read the blob at *R_POS of the mapped file MAP and advance *R_POS
+   to the next blob.  This is the counterpart of _keybox_read_blob
+   but instead of allocating and copying the blob, *R_BLOB is turned
+   into a view of the mapping (see _keybox_set_blob_view).  Thus
+   *R_BLOB must be NULL or a blob from a previous call.  */
+int
+_keybox_read_blob_from_map (KEYBOXBLOB *r_blob, KEYBOX_MAP map,
+                            off_t *r_pos, int *skipped_deleted)
+{
+  const unsigned char *p;
+  size_t imagelen, pos;
+  int type;
+
+  if (skipped_deleted)
+    *skipped_deleted = 0;
+  if (*r_pos < 0)
+    return gpg_error (GPG_ERR_INV_VALUE);
+ again:
+  if ((off_t)map->length <= *r_pos)
+    return -1; /* eof */
+  pos = (size_t)*r_pos;
+  if (map->length - pos < 5)
+    {
+      /* A truncated blob at the end; see _keybox_read_blob.  */
+      *r_pos = map->length;
+      return gpg_error (GPG_ERR_TOO_SHORT);
+    }
+
+  p = map->image + pos;
+  imagelen = ((size_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8 ) | p[3];
+  type = p[4];
+  if (imagelen < 5)
+    return gpg_error (GPG_ERR_TOO_SHORT);
+  if (imagelen > map->length - pos)
+    {
+      /* A truncated blob at the end; see _keybox_read_blob.  */
+      *r_pos = map->length;
+      return gpg_error (GPG_ERR_TOO_SHORT);
+    }
+  *r_pos += imagelen;
+
+  if (!type)
+    {
+      /* Special treatment for empty blobs. */
+      if (skipped_deleted)
+        *skipped_deleted = 1;
+      goto again;
+    }
+
+  if (imagelen > IMAGELEN_LIMIT) /* Sanity check. */
+    return gpg_error (GPG_ERR_TOO_LARGE);
+
+  return _keybox_set_blob_view (r_blob, map, pos, imagelen);
+}
+
+
 /* Write the block to the current file position */
 int
 _keybox_write_blob (KEYBOXBLOB blob, FILE *fp)
@@ -0,0 +1,1291 @@
+/* keybox-index.c - Sidecar index for keybox files
+ * Copyright (C) 2017 Free Software Foundation, Inc.
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+* The keybox index format
+
+   To avoid a linear scan over all blobs for the most common lookups
+   (by key ID, fingerprint, keygrip or mail address) a keybox file
+   FOO.kbx may be accompanied by an index file FOO.kbx.idx.  The index
+   is a mere accelerator: It is never required, it may be deleted at
+   any time and it is ignored if it does not match the keybox file.
+   All integers are stored in network byte order.
+
+   The index starts with a header of 48 bytes:
+
+   - b4   Magic 'KBXi'
+   - byte Version number (2)
+   - byte Flags
+          bit 0 - Keygrips of X.509 blobs are included
+   - u16  RFU
+   - u32  High part of the size of the keybox file.
+   - u32  Low part of the size of the keybox file.
+   - u32  High part of the mtime of the keybox file.
+   - u32  Low part of the mtime of the keybox file.
+   - u32  Nanoseconds part of the mtime or 0 if not known.
+   - u32  Low 32 bits of the inode number of the keybox file.
+   - u32  [NREC] Number of records
+   - u32  [NBLOOM] Length of the bloom filter in bytes or 0
+   - u32  [NDELTA] Number of records in the delta log
+   - u32  RFU
+
+   The size, mtime and inode are those of the keybox file at the
+   time the index was last updated.  If they do not match the
+   current values of the keybox file, the index is stale and won't be
+   used.  A keybox replaced by a new file gets a new inode and an in
+   place change is caught by the sub-second mtime; thus a change by a
+   process not maintaining the index is detected even if it does not
+   change the size and happens within the same second.  Indices of
+   version 1, which lacked the last two stamp fields, are rebuilt.
+
+   This is followed by NREC records of 32 bytes each:
+
+   - byte Record type
+          1 = Fingerprint
+          2 = Long key ID
+          3 = Keygrip
+          4 = Mail address
+   - b3   RFU (zero)
+   - b20  The key.  Fingerprints and keygrips are stored as is, key
+          IDs are stored as their 8 bytes left aligned and padded
+          with zeroes, for mail addresses the SHA-1 hash of the
+          lower-cased addr-spec is used.
+   - u32  High part of the blob's offset in the keybox file.
+   - u32  Low part of the blob's offset in the keybox file.
+
+   The records are sorted using memcmp over the entire 32 bytes which
+   due to the big-endian offset also sorts all records with the same
+   key by ascending file offset.  A lookup is thus a binary search for
+   the first record with the requested key and an offset not lower
+   than the current file position.  A record may point to a blob
+   which does not match the search (for example after a hash
+   collision or if a blob has been marked as deleted); thus any blob
+   found via the index needs to be checked by the regular search
+   code.
+
+   The records are followed by NBLOOM bytes of a bloom filter over the
+   long key IDs of all key ID records.  NBLOOM is a power of two.  A
+   key ID is hashed using its high and low words H and L as the bit
+   indices (L + i * (H|1)) mod (8*NBLOOM) for i = 0 .. 5; bit N is
+   stored in byte N/8 with bit 0 being the LSB.  If any of these bits
+   is not set, there is no record for this key ID and the binary
+   search can be skipped.  This makes lookups for unknown keys, as
+   done for each signature while checking a key, very cheap.
+
+   The bloom filter is followed by the delta log with NDELTA records
+   in the order the changes were made.  They have the same layout as
+   the above records but are not sorted.  A record with bit 7 of the
+   type set removes all records with its offset which precede it in
+   the delta log or are in the sorted part; its key is zero.  All
+   other records are added to the index.  Thus an update of the
+   keybox only appends a few records and rewrites the header instead
+   of copying the entire index.  Readers load the delta log into
+   memory.  If the delta log grows too large or the offsets of blobs
+   change, the index is rebuilt and the delta log is empty again.
+   Note that records appended after NDELTA, for example by an
+   interrupted update, are ignored; the header still has the old
+   stamp in this case and thus the index is stale anyway.
+
+   The keygrip of an X.509 blob can only be computed with X.509
+   support, which gpg lacks.  When gpg rebuilds the index of a keybox
+   shared with gpgsm it thus takes the keygrip records from the old
+   index, matching the blobs by their fingerprint.  Flag bit 0 is
+   only cleared if there is an X.509 blob without a known keygrip.
+
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "keybox-defs.h"
+#include <gcrypt.h>
+#include "../common/sysutils.h"
+#include "../common/host2net.h"
+
+#define INDEX_VERSION 2
+#define INDEX_HDRLEN 48
+#define INDEX_RECLEN 32
+#define INDEX_KEYLEN 24  /* Type, RFU and key part of a record.  */
+
+#define INDEX_FLAG_X509_GRIPS 1
+
+#define INDEX_REC_FPR   1
+#define INDEX_REC_KID   2
+#define INDEX_REC_GRIP  3
+#define INDEX_REC_MAIL  4
+#define INDEX_REC_REMOVE 0x80  /* Flag for a removal in the delta log.  */
+
+/* The maximum number of records in the delta log for an index with
+   NRECS sorted records.  If more are required the index is rebuilt.  */
+#define INDEX_MAX_DELTA(nrecs) ((nrecs) / 8 > 1024? (nrecs) / 8 : 1024)
+
+#define INDEX_BLOOM_PROBES 6
+
+#define get32(a) buf32_to_ulong ((a))
+#define get16(a) buf16_to_ulong ((a))
+
+/* A growable array of index records.  */
+struct reclist_s
+{
+  unsigned char *recs;
+  size_t nrecs;
+  size_t size;
+  unsigned int flags;   /* The header flags valid for this list.  */
+#ifndef KEYBOX_WITH_X509
+  /* Pairs of fingerprint and keygrip of X.509 blobs taken from the
+     previous index, sorted by fingerprint.  */
+  unsigned char *oldgrips;
+  size_t noldgrips;
+#endif
+};
+
+
+#if !defined(HAVE_FSEEKO) && !defined(fseeko)
+# define fseeko(a,b,c) fseek ((a), (long)(b), (c))
+#endif
+
+
+/* Store the 64 bit value composed of the 32 bit values at BUFFER and
+   BUFFER+4 at R_VALUE.  Returns false if the value does not fit into
+   an off_t.  */
+int
+_keybox_get_off (const unsigned char *buffer, off_t *r_value)
+{
+  unsigned long hi = get32 (buffer);
+  unsigned long lo = get32 (buffer + 4);
+
+  if (sizeof (off_t) <= 4 && hi)
+    return 0;
+  *r_value = (((off_t)hi << 16) << 16) | (off_t)lo;
+  return 1;
+}
+
+
+/* Store VALUE as two 32 bit values at BUFFER.  */
+void
+_keybox_put_off (unsigned char *buffer, off_t value)
+{
+  unsigned long hi, lo;
+
+  hi = sizeof (off_t) > 4? (unsigned long)((value >> 16) >> 16) : 0;
+  lo = (unsigned long)(value & 0xffffffff);
+  ulongtobuf (buffer, hi);
+  ulongtobuf (buffer+4, lo);
+}
+
+
+/* Return a malloced string with the name of the index file for the
+   keybox FNAME.  */
+static char *
+index_fname (const char *fname)
+{
+  char *name;
+
+  name = xtrymalloc (strlen (fname) + 5);
+  if (name)
+    strcpy (stpcpy (name, fname), EXTSEP_S "idx");
+  return name;
+}
+
+
+/* Store the stamp for the file described by ST at R_STAMP.  */
+static void
+stamp_from_stat (const struct stat *st, struct keybox_stamp_s *r_stamp)
+{
+  r_stamp->size = st->st_size;
+  r_stamp->mtime = st->st_mtime;
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+  r_stamp->mtime_nsec = (unsigned long)st->st_mtim.tv_nsec;
+#else
+  r_stamp->mtime_nsec = 0;
+#endif
+  r_stamp->inode = (unsigned long)st->st_ino & 0xffffffff;
+}
+
+
+/* Store the stamp of the keybox file FNAME at R_STAMP.  On error the
+   size is set to -1.  */
+void
+_keybox_get_stamp (const char *fname, struct keybox_stamp_s *r_stamp)
+{
+  struct stat st;
+
+  if (stat (fname, &st))
+    {
+      memset (r_stamp, 0, sizeof *r_stamp);
+      r_stamp->size = (off_t)(-1);
+    }
+  else
+    stamp_from_stat (&st, r_stamp);
+}
+
+
+/* Return true if the two stamps A and B describe the same file.  */
+static int
+same_stamp_p (const struct keybox_stamp_s *a, const struct keybox_stamp_s *b)
+{
+  return (a->size != (off_t)(-1)
+          && a->size == b->size && a->mtime == b->mtime
+          && a->mtime_nsec == b->mtime_nsec && a->inode == b->inode);
+}
+
+
+/* Read the index header from FP and store the stamp at R_STAMP, the
+   flags at R_FLAGS, the number of records at R_NRECS, the length of
+   the bloom filter at R_BLOOMLEN and the number of records in the
+   delta log at R_NDELTA.  */
+static gpg_error_t
+read_index_header (FILE *fp, struct keybox_stamp_s *r_stamp,
+                   unsigned int *r_flags, size_t *r_nrecs,
+                   size_t *r_bloomlen, size_t *r_ndelta)
+{
+  unsigned char hdr[INDEX_HDRLEN];
+  off_t mtime;
+
+  if (fseeko (fp, 0, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (fread (hdr, INDEX_HDRLEN, 1, fp) != 1)
+    return ferror (fp)? gpg_error_from_syserror ()
+                      : gpg_error (GPG_ERR_TOO_SHORT);
+  if (memcmp (hdr, "KBXi", 4))
+    return gpg_error (GPG_ERR_INV_OBJ);
+  if (hdr[4] != INDEX_VERSION)
+    return gpg_error (GPG_ERR_UNKNOWN_VERSION);
+  if (!_keybox_get_off (hdr+8, &r_stamp->size) || !_keybox_get_off (hdr+16, &mtime))
+    return gpg_error (GPG_ERR_TOO_LARGE);
+  r_stamp->mtime = (time_t)mtime;
+  r_stamp->mtime_nsec = get32 (hdr+24);
+  r_stamp->inode = get32 (hdr+28);
+  *r_flags = hdr[5];
+  *r_nrecs = get32 (hdr+32);
+  *r_bloomlen = get32 (hdr+36);
+  if ((*r_bloomlen & (*r_bloomlen - 1)))
+    return gpg_error (GPG_ERR_INV_OBJ);  /* Not a power of two.  */
+  *r_ndelta = get32 (hdr+40);
+  return 0;
+}
+
+
+/* Write an index header to FP.  */
+static gpg_error_t
+write_index_header (FILE *fp, const struct keybox_stamp_s *stamp,
+                    unsigned int flags, size_t nrecs, size_t bloomlen,
+                    size_t ndelta)
+{
+  unsigned char hdr[INDEX_HDRLEN];
+
+  memset (hdr, 0, sizeof hdr);
+  memcpy (hdr, "KBXi", 4);
+  hdr[4] = INDEX_VERSION;
+  hdr[5] = flags;
+  _keybox_put_off (hdr+8, stamp->size);
+  _keybox_put_off (hdr+16, (off_t)stamp->mtime);
+  ulongtobuf (hdr+24, stamp->mtime_nsec);
+  ulongtobuf (hdr+28, stamp->inode);
+  ulongtobuf (hdr+32, (unsigned long)nrecs);
+  ulongtobuf (hdr+36, (unsigned long)bloomlen);
+  ulongtobuf (hdr+40, (unsigned long)ndelta);
+
+  if (fseeko (fp, 0, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (fwrite (hdr, INDEX_HDRLEN, 1, fp) != 1)
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Append a record of TYPE with KEY,KEYLEN for the blob at OFF to
+   LIST.  KEY may be NULL for a zero key.  */
+static gpg_error_t
+add_record (struct reclist_s *list, int type,
+            const unsigned char *key, size_t keylen, off_t off)
+{
+  unsigned char *rec;
+
+  if (list->nrecs == list->size)
+    {
+      size_t newsize = list->size? 2 * list->size : 64;
+      unsigned char *tmp;
+
+      tmp = xtryrealloc (list->recs, newsize * INDEX_RECLEN);
+      if (!tmp)
+        return gpg_error_from_syserror ();
+      list->recs = tmp;
+      list->size = newsize;
+    }
+
+  rec = list->recs + list->nrecs * INDEX_RECLEN;
+  memset (rec, 0, INDEX_RECLEN);
+  rec[0] = type;
+  if (key)
+    memcpy (rec+4, key, keylen > 20? 20 : keylen);
+  _keybox_put_off (rec+INDEX_KEYLEN, off);
+  list->nrecs++;
+  return 0;
+}
+
+
+/* Compute the key for a mail address record from the addr-spec
+   NAME,NAMELEN and store it at KEY which must be 20 bytes.  */
+static void
+mail_key (unsigned char *key, const char *name, size_t namelen)
+{
+  gcry_md_hd_t md;
+  size_t n;
+
+  if (gcry_md_open (&md, GCRY_MD_SHA1, 0))
+    {
+      memset (key, 0, 20);
+      return;
+    }
+  for (n=0; n < namelen; n++)
+    gcry_md_putc (md, ascii_tolower (name[n]));
+  memcpy (key, gcry_md_read (md, GCRY_MD_SHA1), 20);
+  gcry_md_close (md);
+}
+
+
+#ifndef KEYBOX_WITH_X509
+/* Compare the fingerprints at A and B.  */
+static int
+compare_fpr (const void *a, const void *b)
+{
+  return memcmp (a, b, 20);
+}
+
+
+/* Compare the records A and B by their offset and then by type.  */
+static int
+compare_offset_type (const void *a, const void *b)
+{
+  const unsigned char *x = a;
+  const unsigned char *y = b;
+  int cmp;
+
+  cmp = memcmp (x + INDEX_KEYLEN, y + INDEX_KEYLEN, 8);
+  return cmp? cmp : (int)x[0] - (int)y[0];
+}
+
+
+/* Take the keygrips of X.509 blobs from the index IDXNAME and store
+   them along with the fingerprints at LIST.  A missing or corrupt
+   index is not an error; there are then no keygrips to take.  */
+static gpg_error_t
+read_old_grips (const char *idxname, struct reclist_s *list)
+{
+  gpg_error_t err = 0;
+  FILE *fp;
+  struct keybox_stamp_s stamp;
+  struct reclist_s recs;
+  unsigned char rec[INDEX_RECLEN];
+  unsigned int flags;
+  size_t nrecs, bloomlen, ndelta, n, i, j, nfpr, ngrip;
+  const unsigned char *fpr, *grip;
+  off_t off, recoff;
+
+  memset (&recs, 0, sizeof recs);
+  fp = fopen (idxname, "rb");
+  if (!fp)
+    return 0;
+  if (read_index_header (fp, &stamp, &flags, &nrecs, &bloomlen, &ndelta))
+    goto leave;
+
+  /* Collect the fingerprint and keygrip records which are still
+     valid after applying the delta log.  */
+  for (n=0; n < nrecs + ndelta; n++)
+    {
+      if (n == nrecs
+          && fseeko (fp, (INDEX_HDRLEN + (off_t)nrecs * INDEX_RECLEN
+                          + (off_t)bloomlen), SEEK_SET))
+        goto leave;
+      if (fread (rec, INDEX_RECLEN, 1, fp) != 1
+          || !_keybox_get_off (rec+INDEX_KEYLEN, &off))
+        goto leave;
+      if ((rec[0] & INDEX_REC_REMOVE))
+        {
+          for (i=j=0; i < recs.nrecs; i++)
+            {
+              _keybox_get_off (recs.recs + i*INDEX_RECLEN + INDEX_KEYLEN,
+                               &recoff);
+              if (recoff == off)
+                continue;
+              if (i != j)
+                memcpy (recs.recs + j*INDEX_RECLEN,
+                        recs.recs + i*INDEX_RECLEN, INDEX_RECLEN);
+              j++;
+            }
+          recs.nrecs = j;
+        }
+      else if (rec[0] == INDEX_REC_FPR || rec[0] == INDEX_REC_GRIP)
+        {
+          err = add_record (&recs, rec[0], rec+4, 20, off);
+          if (err)
+            goto leave;
+        }
+    }
+
+  /* Only X.509 blobs have a keygrip record; they have exactly one
+     fingerprint.  */
+  qsort (recs.recs, recs.nrecs, INDEX_RECLEN, compare_offset_type);
+  for (i=0; i < recs.nrecs; i = j)
+    {
+      fpr = grip = NULL;
+      nfpr = ngrip = 0;
+      for (j=i; (j < recs.nrecs
+                 && !memcmp (recs.recs + j*INDEX_RECLEN + INDEX_KEYLEN,
+                             recs.recs + i*INDEX_RECLEN + INDEX_KEYLEN, 8));
+           j++)
+        {
+          const unsigned char *r = recs.recs + j*INDEX_RECLEN;
+
+          if (r[0] == INDEX_REC_FPR)
+            {
+              fpr = r + 4;
+              nfpr++;
+            }
+          else
+            {
+              grip = r + 4;
+              ngrip++;
+            }
+        }
+      if (nfpr != 1 || ngrip != 1)
+        continue;
+
+      if (!(list->noldgrips % 64))
+        {
+          unsigned char *tmp;
+
+          tmp = xtryrealloc (list->oldgrips, (list->noldgrips + 64) * 40);
+          if (!tmp)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+          list->oldgrips = tmp;
+        }
+      memcpy (list->oldgrips + list->noldgrips * 40, fpr, 20);
+      memcpy (list->oldgrips + list->noldgrips * 40 + 20, grip, 20);
+      list->noldgrips++;
+    }
+  qsort (list->oldgrips, list->noldgrips, 40, compare_fpr);
+
+ leave:
+  fclose (fp);
+  xfree (recs.recs);
+  return err;
+}
+#endif /*!KEYBOX_WITH_X509*/
+
+
+/* Add all index records for BLOB at file offset OFF to LIST.  */
+static gpg_error_t
+add_blob_records (struct reclist_s *list, KEYBOXBLOB blob, off_t off)
+{
+  gpg_error_t err;
+  const unsigned char *buffer;
+  size_t length;
+  size_t pos, uidoff, uidlen, mboxoff, mboxlen;
+  size_t nkeys, keyinfolen;
+  size_t nuids, uidinfolen;
+  size_t nserial;
+  size_t idx;
+  int btype, x509;
+  unsigned char key[20];
+
+  buffer = _keybox_get_blob_image (blob, &length);
+  if (length < 40)
+    return 0; /* Blob too short - nothing to index.  */
+  btype = buffer[4];
+  if (btype != KEYBOX_BLOBTYPE_PGP && btype != KEYBOX_BLOBTYPE_X509)
+    return 0;
+  x509 = (btype == KEYBOX_BLOBTYPE_X509);
+
+  /* Keys.  */
+  nkeys = get16 (buffer + 16);
+  keyinfolen = get16 (buffer + 18);
+  if (keyinfolen < 28)
+    return 0; /* Invalid blob.  */
+  pos = 20;
+  if (pos + keyinfolen*nkeys > length)
+    return 0; /* Out of bounds.  */
+  for (idx=0; idx < nkeys; idx++)
+    {
+      const unsigned char *fpr = buffer + pos + idx*keyinfolen;
+
+      err = add_record (list, INDEX_REC_FPR, fpr, 20, off);
+      if (!err)
+        err = add_record (list, INDEX_REC_KID, fpr+12, 8, off);
+      if (err)
+        return err;
+    }
+
+  if (x509)
+    {
+#ifdef KEYBOX_WITH_X509
+      if (_keybox_get_x509_keygrip (buffer, length, key))
+        {
+          err = add_record (list, INDEX_REC_GRIP, key, 20, off);
+          if (err)
+            return err;
+        }
+#else
+      const unsigned char *pair = NULL;
+
+      /* We can't compute the keygrip; use the one from the previous
+         index or mark the index as incomplete for keygrip
+         searches.  */
+      if (nkeys == 1 && list->noldgrips)
+        pair = bsearch (buffer + pos, list->oldgrips, list->noldgrips,
+                        40, compare_fpr);
+      if (pair)
+        {
+          err = add_record (list, INDEX_REC_GRIP, pair + 20, 20, off);
+          if (err)
+            return err;
+        }
+      else
+        list->flags &= ~INDEX_FLAG_X509_GRIPS;
+#endif
+    }
+
+  /* Serial number.  */
+  pos += keyinfolen*nkeys;
+  if (pos+2 > length)
+    return 0;
+  nserial = get16 (buffer+pos);
+  pos += 2 + nserial;
+  if (pos+4 > length)
+    return 0;
+
+  /* User IDs.  Note that for X.509 index 0 is the issuer.  */
+  nuids = get16 (buffer + pos);  pos += 2;
+  uidinfolen = get16 (buffer + pos);  pos += 2;
+  if (uidinfolen < 12 || pos + uidinfolen*nuids > length)
+    return 0;
+  for (idx = x509; idx < nuids; idx++)
+    {
+      uidoff = get32 (buffer + pos + idx*uidinfolen);
+      uidlen = get32 (buffer + pos + idx*uidinfolen + 4);
+      if (uidoff + uidlen > length)
+        break;
+      if (!_keybox_get_mailbox (buffer, uidoff, uidlen, x509,
+                                &mboxoff, &mboxlen))
+        continue;
+      mail_key (key, (const char*)buffer + mboxoff, mboxlen);
+      err = add_record (list, INDEX_REC_MAIL, key, 20, off);
+      if (err)
+        return err;
+    }
+
+  return 0;
+}
+
+
+static int
+compare_records (const void *a, const void *b)
+{
+  return memcmp (a, b, INDEX_RECLEN);
+}
+
+
+/* Return the bit number of the I-th probe for the key ID KEY (8
+   bytes) in a bloom filter of NBITS bits.  */
+static size_t
+bloom_bit (const unsigned char *key, int i, size_t nbits)
+{
+  u32 h1 = buf32_to_u32 (key+4);
+  u32 h2 = buf32_to_u32 (key) | 1;
+
+  return (size_t)(u32)(h1 + (u32)i * h2) & (nbits - 1);
+}
+
+
+/* Write the index file IDXNAME with the sorted records from LIST
+   using a temporary file which is then renamed.  STAMP is the stamp
+   of the keybox to record.  */
+static gpg_error_t
+write_index (const char *idxname, struct reclist_s *list,
+             const struct keybox_stamp_s *stamp)
+{
+  gpg_error_t err;
+  char *tmpname;
+  FILE *fp;
+  const unsigned char *rec;
+  unsigned char *bloom = NULL;
+  size_t bloomlen, nbits, n;
+  int i;
+
+  tmpname = xtrymalloc (strlen (idxname) + 5);
+  if (!tmpname)
+    return gpg_error_from_syserror ();
+  strcpy (stpcpy (tmpname, idxname), EXTSEP_S "tmp");
+
+  fp = fopen (tmpname, "wb");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (tmpname);
+      return err;
+    }
+
+  /* Size the bloom filter for about 8 bits per record which, given
+   that there are several records per key, amounts to well over 16
+   bits per key ID.  Without memory we simply write no filter.  */
+  for (nbits = 64; nbits < 8 * list->nrecs; nbits <<= 1)
+    ;
+  bloomlen = nbits / 8;
+  if (bloomlen > 0x40000000)
+    bloomlen = 0;
+  else
+    bloom = xtrycalloc (1, bloomlen);
+  if (!bloom)
+    bloomlen = 0;
+
+  err = write_index_header (fp, stamp, list->flags, list->nrecs, bloomlen, 0);
+  if (err)
+    goto leave;
+
+  if (list->nrecs
+      && fwrite (list->recs, INDEX_RECLEN, list->nrecs, fp) != list->nrecs)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  for (n=0; bloom && n < list->nrecs; n++)
+    {
+      rec = list->recs + n * INDEX_RECLEN;
+      if (*rec == INDEX_REC_KID)
+        for (i=0; i < INDEX_BLOOM_PROBES; i++)
+          {
+            size_t bit = bloom_bit (rec+4, i, nbits);
+            bloom[bit / 8] |= 1 << (bit % 8);
+          }
+    }
+
+  if (bloom && fwrite (bloom, bloomlen, 1, fp) != 1)
+    err = gpg_error_from_syserror ();
+
+ leave:
+  if (fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  if (!err)
+    err = gnupg_rename_file (tmpname, idxname, NULL);
+  if (err)
+    gnupg_remove (tmpname);
+  xfree (tmpname);
+  xfree (bloom);
+  return err;
+}
+
+
+/* Build the index for the keybox KB from scratch.  This should be run
+   with the keybox locked.  */
+gpg_error_t
+_keybox_index_rebuild (KB_NAME kb)
+{
+  gpg_error_t err;
+  FILE *fp;
+  KEYBOXBLOB blob = NULL;
+  struct reclist_s list;
+  struct keybox_stamp_s stamp;
+  char *idxname;
+  int rc;
+
+  memset (&list, 0, sizeof list);
+  list.flags = INDEX_FLAG_X509_GRIPS;
+
+  idxname = index_fname (kb->fname);
+  if (!idxname)
+    return gpg_error_from_syserror ();
+
+#ifndef KEYBOX_WITH_X509
+  err = read_old_grips (idxname, &list);
+  if (err)
+    goto leave;
+#endif
+
+  fp = fopen (kb->fname, "rb");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  _keybox_get_stamp (kb->fname, &stamp);
+
+  err = 0;
+  while (!(rc = _keybox_read_blob (&blob, fp, NULL))
+         || (gpg_err_code (rc) == GPG_ERR_TOO_LARGE
+             && gpg_err_source (rc) == GPG_ERR_SOURCE_KEYBOX))
+    {
+      if (!rc)
+        {
+          err = add_blob_records (&list, blob,
+                                  _keybox_get_blob_fileoffset (blob));
+          _keybox_release_blob (blob);
+          blob = NULL;
+          if (err)
+            break;
+        }
+    }
+  if (!err && rc != -1)
+    err = rc;
+  fclose (fp);
+  if (err)
+    goto leave;
+
+  qsort (list.recs, list.nrecs, INDEX_RECLEN, compare_records);
+  err = write_index (idxname, &list, &stamp);
+
+ leave:
+  if (err)
+    log_info ("error building index for '%s': %s\n",
+              kb->fname, gpg_strerror (err));
+  xfree (list.recs);
+#ifndef KEYBOX_WITH_X509
+  xfree (list.oldgrips);
+#endif
+  xfree (idxname);
+  return err;
+}
+
+
+/* Check whether the index of the keybox used by HD is current and
+   rebuild it if not.  This should be run with the keybox locked.  */
+void
+_keybox_index_refresh (KEYBOX_HANDLE hd)
+{
+  FILE *fp;
+  char *idxname;
+  struct keybox_stamp_s stamp, idxstamp;
+  unsigned int flags;
+  size_t nrecs, bloomlen, ndelta;
+  int current = 0;
+
+  if (!keybox_is_writable (hd->kb))
+    return;
+
+  idxname = index_fname (hd->kb->fname);
+  if (!idxname)
+    return;
+
+  fp = fopen (idxname, "rb");
+  if (fp)
+    {
+      _keybox_get_stamp (hd->kb->fname, &stamp);
+      if (!read_index_header (fp, &idxstamp, &flags, &nrecs,
+                              &bloomlen, &ndelta)
+          && same_stamp_p (&stamp, &idxstamp))
+        {
+          current = 1;
+#ifdef KEYBOX_WITH_X509
+          /* The index has been built by a version without X.509
+             support - rebuild so that keygrip searches can use it.  */
+          if (!(flags & INDEX_FLAG_X509_GRIPS))
+            current = 0;
+#endif
+        }
+      fclose (fp);
+    }
+  xfree (idxname);
+
+  if (!current)
+    _keybox_index_rebuild (hd->kb);
+}
+
+
+/* Update the index of the keybox KB after a change of the keybox.
+   BEFORE is the stamp of the keybox taken before the change; if the
+   index does not match BEFORE it is left alone.  All records of the
+   blob at REMOVE_OFF are removed and the offsets of all blobs after
+   REMOVE_OFF are shifted by DELTA.  Then the records for BLOB are
+   added at offset ADD_OFF.  REMOVE_OFF may be -1 to not remove
+   anything and BLOB may be NULL to not add anything; with both the
+   stamp in the header is updated (e.g. after an in-place change of
+   the flags).  This should be run with the keybox locked.  */
+void
+_keybox_index_update (KB_NAME kb, const struct keybox_stamp_s *before,
+                      off_t remove_off, off_t add_off, off_t delta,
+                      KEYBOXBLOB blob)
+{
+  gpg_error_t err = 0;
+  char *idxname;
+  FILE *fp;
+  struct keybox_stamp_s idxstamp, after;
+  struct reclist_s list;
+  size_t nrecs, bloomlen, ndelta;
+  int rebuild = 0;
+
+  memset (&list, 0, sizeof list);
+
+  idxname = index_fname (kb->fname);
+  if (!idxname)
+    return;
+
+  fp = fopen (idxname, "r+b");
+  if (!fp)
+    goto leave;  /* No index - nothing to update.  */
+  if (read_index_header (fp, &idxstamp, &list.flags, &nrecs,
+                         &bloomlen, &ndelta)
+      || !same_stamp_p (before, &idxstamp))
+    goto leave;  /* The index is stale anyway.  */
+
+  /* Shifted offsets can't be expressed by the delta log.  */
+  if (remove_off != (off_t)(-1) && delta)
+    {
+      rebuild = 1;
+      goto leave;
+    }
+
+  if (remove_off != (off_t)(-1))
+    err = add_record (&list, INDEX_REC_REMOVE, NULL, 0, remove_off);
+  if (!err && blob)
+    err = add_blob_records (&list, blob, add_off);
+  if (err)
+    goto leave;
+  if (ndelta + list.nrecs > INDEX_MAX_DELTA (nrecs))
+    {
+      rebuild = 1;
+      goto leave;
+    }
+
+  /* Append the records to the delta log.  Only then the header with
+     the new stamp and count is written; thus an interrupted update
+     leaves a stale index.  */
+  if (list.nrecs
+      && (fseeko (fp, (INDEX_HDRLEN + (off_t)nrecs * INDEX_RECLEN
+                       + (off_t)bloomlen + (off_t)ndelta * INDEX_RECLEN),
+                  SEEK_SET)
+          || fwrite (list.recs, INDEX_RECLEN, list.nrecs, fp) != list.nrecs
+          || fflush (fp)))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  _keybox_get_stamp (kb->fname, &after);
+  err = write_index_header (fp, &after, list.flags, nrecs, bloomlen,
+                            ndelta + list.nrecs);
+
+ leave:
+  if (fp && fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  if (err)
+    log_info ("error updating index for '%s': %s\n",
+              kb->fname, gpg_strerror (err));
+  else if (rebuild)
+    _keybox_index_rebuild (kb);
+  xfree (list.recs);
+  xfree (idxname);
+}
+
+
+/* Close the index file of HD.  */
+void
+_keybox_index_close (KEYBOX_HANDLE hd)
+{
+  if (hd->index.fp)
+    {
+      fclose (hd->index.fp);
+      hd->index.fp = NULL;
+    }
+  xfree (hd->index.adds);
+  hd->index.adds = NULL;
+  hd->index.nadds = 0;
+  xfree (hd->index.removed);
+  hd->index.removed = NULL;
+  hd->index.nremoved = 0;
+}
+
+
+static int
+compare_offs (const void *a, const void *b)
+{
+  off_t x = *(const off_t *)a;
+  off_t y = *(const off_t *)b;
+
+  return x < y? -1 : x > y;
+}
+
+
+/* Load the delta log with NDELTA records of the index opened for HD
+   into memory.  */
+static gpg_error_t
+load_delta (KEYBOX_HANDLE hd, size_t ndelta)
+{
+  gpg_error_t err;
+  struct reclist_s adds;
+  unsigned char rec[INDEX_RECLEN];
+  off_t off, *removed = NULL;
+  size_t nremoved = 0;
+  size_t n, i, j;
+
+  memset (&adds, 0, sizeof adds);
+  if (!ndelta)
+    return 0;
+
+  if (fseeko (hd->index.fp, (INDEX_HDRLEN
+                             + (off_t)hd->index.nrecs * INDEX_RECLEN
+                             + (off_t)hd->index.bloomlen), SEEK_SET))
+    return gpg_error_from_syserror ();
+
+  for (n=0; n < ndelta; n++)
+    {
+      if (fread (rec, INDEX_RECLEN, 1, hd->index.fp) != 1)
+        {
+          err = ferror (hd->index.fp)? gpg_error_from_syserror ()
+                                     : gpg_error (GPG_ERR_TOO_SHORT);
+          goto leave;
+        }
+      if (!_keybox_get_off (rec+INDEX_KEYLEN, &off))
+        {
+          err = gpg_error (GPG_ERR_TOO_LARGE);
+          goto leave;
+        }
+      if ((rec[0] & INDEX_REC_REMOVE))
+        {
+          /* The removal applies to the sorted records and to the
+             preceding records of the delta log.  */
+          if (!(nremoved % 64))
+            {
+              off_t *tmp = xtryrealloc (removed,
+                                        (nremoved + 64) * sizeof *removed);
+              if (!tmp)
+                {
+                  err = gpg_error_from_syserror ();
+                  goto leave;
+                }
+              removed = tmp;
+            }
+          removed[nremoved++] = off;
+          for (i=j=0; i < adds.nrecs; i++)
+            {
+              off_t addoff;
+
+              _keybox_get_off (adds.recs + i*INDEX_RECLEN + INDEX_KEYLEN,
+                               &addoff);
+              if (addoff == off)
+                continue;
+              if (i != j)
+                memcpy (adds.recs + j*INDEX_RECLEN,
+                        adds.recs + i*INDEX_RECLEN, INDEX_RECLEN);
+              j++;
+            }
+          adds.nrecs = j;
+        }
+      else
+        {
+          err = add_record (&adds, rec[0], rec+4, 20, off);
+          if (err)
+            goto leave;
+        }
+    }
+
+  qsort (adds.recs, adds.nrecs, INDEX_RECLEN, compare_records);
+  qsort (removed, nremoved, sizeof *removed, compare_offs);
+  hd->index.adds = adds.recs;
+  hd->index.nadds = adds.nrecs;
+  hd->index.removed = removed;
+  hd->index.nremoved = nremoved;
+  return 0;
+
+ leave:
+  xfree (adds.recs);
+  xfree (removed);
+  return err;
+}
+
+
+/* Return true if the delta log of HD removed the blob at OFF.  */
+static int
+removed_p (KEYBOX_HANDLE hd, off_t off)
+{
+  return (hd->index.nremoved
+          && bsearch (&off, hd->index.removed, hd->index.nremoved,
+                      sizeof *hd->index.removed, compare_offs));
+}
+
+
+/* Return true if a search for DESC,NDESC on HD can be done using the
+   index.  The keybox file must already be open.  */
+int
+_keybox_index_usable (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc,
+                      size_t ndesc)
+{
+  struct stat st;
+  struct keybox_stamp_s stamp;
+  size_t n;
+
+  if (!ndesc || !hd->fp)
+    return 0;
+
+  for (n=0; n < ndesc; n++)
+    {
+      switch (desc[n].mode)
+        {
+        case KEYDB_SEARCH_MODE_LONG_KID:
+        case KEYDB_SEARCH_MODE_FPR:
+        case KEYDB_SEARCH_MODE_FPR20:
+        case KEYDB_SEARCH_MODE_MAIL:
+        case KEYDB_SEARCH_MODE_KEYGRIP:
+          break;
+        default:
+          return 0;
+        }
+    }
+
+  if (!hd->index.fp)
+    {
+      char *idxname = index_fname (hd->kb->fname);
+      size_t ndelta;
+
+      if (idxname)
+        hd->index.fp = fopen (idxname, "rb");
+      xfree (idxname);
+      if (!hd->index.fp
+          || read_index_header (hd->index.fp, &hd->index.stamp,
+                                &hd->index.flags, &hd->index.nrecs,
+                                &hd->index.bloomlen, &ndelta)
+          || load_delta (hd, ndelta))
+        {
+          _keybox_index_close (hd);
+          return 0;
+        }
+    }
+
+  /* Compare with the file we actually read and not with the file
+     name which might have been replaced in the meantime.  */
+  if (fstat (fileno (hd->fp), &st))
+    return 0;
+  stamp_from_stat (&st, &stamp);
+  if (!same_stamp_p (&stamp, &hd->index.stamp))
+    {
+      /* Close so that we will try a possibly rebuilt index the next
+         time.  */
+      _keybox_index_close (hd);
+      return 0;
+    }
+
+  for (n=0; n < ndesc; n++)
+    if (desc[n].mode == KEYDB_SEARCH_MODE_KEYGRIP
+        && !(hd->index.flags & INDEX_FLAG_X509_GRIPS))
+      return 0;
+
+  return 1;
+}
+
+
+/* Find the first record in the index of HD with the key TYPE,KEY and
+   an offset not lower than START.  The sorted part of the index is
+   only searched if WITH_SORTED is set.  On success the offset of that
+   record is stored at R_OFF; if there is no such record -1 is
+   returned.  */
+static gpg_error_t
+lookup_record (KEYBOX_HANDLE hd, int type, const unsigned char *key,
+               off_t start, int with_sorted, off_t *r_off)
+{
+  unsigned char probe[INDEX_RECLEN];
+  unsigned char rec[INDEX_RECLEN];
+  const unsigned char *p;
+  size_t lo, hi, mid;
+  off_t off, best = (off_t)(-1);
+
+  memset (probe, 0, sizeof probe);
+  probe[0] = type;
+  memcpy (probe+4, key, 20);
+  _keybox_put_off (probe+INDEX_KEYLEN, start);
+
+  /* Binary search for the first record not less than PROBE.  */
+  lo = 0;
+  hi = with_sorted? hd->index.nrecs : 0;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (fseeko (hd->index.fp, INDEX_HDRLEN + (off_t)mid * INDEX_RECLEN,
+                  SEEK_SET))
+        return gpg_error_from_syserror ();
+      if (fread (rec, INDEX_RECLEN, 1, hd->index.fp) != 1)
+        return ferror (hd->index.fp)? gpg_error_from_syserror ()
+                                    : gpg_error (GPG_ERR_TOO_SHORT);
+      if (compare_records (rec, probe) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  /* Skip the records of blobs removed by the delta log.  */
+  if (with_sorted && lo < hd->index.nrecs)
+    {
+      if (fseeko (hd->index.fp, INDEX_HDRLEN + (off_t)lo * INDEX_RECLEN,
+                  SEEK_SET))
+        return gpg_error_from_syserror ();
+      for (; lo < hd->index.nrecs; lo++)
+        {
+          if (fread (rec, INDEX_RECLEN, 1, hd->index.fp) != 1)
+            return ferror (hd->index.fp)? gpg_error_from_syserror ()
+                                        : gpg_error (GPG_ERR_TOO_SHORT);
+          if (memcmp (rec, probe, INDEX_KEYLEN))
+            break;
+          if (!_keybox_get_off (rec+INDEX_KEYLEN, &off))
+            return gpg_error (GPG_ERR_TOO_LARGE);
+          if (!removed_p (hd, off))
+            {
+              best = off;
+              break;
+            }
+        }
+    }
+
+  /* Search the records added by the delta log.  */
+  lo = 0;
+  hi = hd->index.nadds;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (compare_records (hd->index.adds + mid * INDEX_RECLEN, probe) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  if (lo < hd->index.nadds)
+    {
+      p = hd->index.adds + lo * INDEX_RECLEN;
+      if (!memcmp (p, probe, INDEX_KEYLEN)
+          && _keybox_get_off (p+INDEX_KEYLEN, &off)
+          && (best == (off_t)(-1) || off < best))
+        best = off;
+    }
+
+  if (best == (off_t)(-1))
+    return -1;
+  *r_off = best;
+  return 0;
+}
+
+
+/* Return false if the bloom filter of the index of HD tells that
+   there is no record for the key ID KEY.  */
+static int
+bloom_maybe_p (KEYBOX_HANDLE hd, const unsigned char *key)
+{
+  off_t start = INDEX_HDRLEN + (off_t)hd->index.nrecs * INDEX_RECLEN;
+  size_t nbits = hd->index.bloomlen * 8;
+  size_t bit;
+  int i, c;
+
+  if (!nbits)
+    return 1;
+
+  for (i=0; i < INDEX_BLOOM_PROBES; i++)
+    {
+      bit = bloom_bit (key, i, nbits);
+      if (fseeko (hd->index.fp, start + (off_t)(bit / 8), SEEK_SET)
+          || (c = getc (hd->index.fp)) == EOF)
+        return 1;  /* On error let the binary search decide.  */
+      if (!(c & (1 << (bit % 8))))
+        return 0;
+    }
+  return 1;
+}
+
+
+/* Find the next blob listed in the index of HD as matching one of
+   DESC,NDESC.  On entry R_OFF has the current read position in the
+   keybox file; on success it is updated to the offset of the blob to
+   read next.  Returns -1 if there is no more candidate.  The caller
+   must check that the blob really matches.  */
+gpg_error_t
+_keybox_index_next (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
+                    off_t *r_off)
+{
+  gpg_error_t err;
+  off_t start, off, best;
+  unsigned char key[20];
+  const char *name;
+  size_t n, namelen;
+  int type, with_sorted;
+
+  start = *r_off;
+  if (start == (off_t)(-1))
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  best = (off_t)(-1);
+  for (n=0; n < ndesc; n++)
+    {
+      memset (key, 0, sizeof key);
+      with_sorted = 1;
+      switch (desc[n].mode)
+        {
+        case KEYDB_SEARCH_MODE_LONG_KID:
+          type = INDEX_REC_KID;
+          ulongtobuf (key, desc[n].u.kid[0]);
+          ulongtobuf (key+4, desc[n].u.kid[1]);
+          /* The bloom filter does not cover the delta log.  */
+          with_sorted = bloom_maybe_p (hd, key);
+          if (!with_sorted && !hd->index.nadds)
+            continue;
+          break;
+        case KEYDB_SEARCH_MODE_FPR:
+        case KEYDB_SEARCH_MODE_FPR20:
+          type = INDEX_REC_FPR;
+          memcpy (key, desc[n].u.fpr, 20);
+          break;
+        case KEYDB_SEARCH_MODE_KEYGRIP:
+          type = INDEX_REC_GRIP;
+          memcpy (key, desc[n].u.grip, 20);
+          break;
+        case KEYDB_SEARCH_MODE_MAIL:
+          /* Normalize the same way has_mail does.  */
+          type = INDEX_REC_MAIL;
+          name = desc[n].u.name;
+          if (!name)
+            continue;
+          if (*name == '<')
+            name++;
+          namelen = strlen (name);
+          if (namelen && name[namelen-1] == '>')
+            namelen--;
+          if (!namelen)
+            continue;
+          mail_key (key, name, namelen);
+          break;
+        default:
+          return gpg_error (GPG_ERR_INV_VALUE);
+        }
+
+      err = lookup_record (hd, type, key, start, with_sorted, &off);
+      if (err == -1)
+        continue;
+      if (err)
+        return err;
+      if (best == (off_t)(-1) || off < best)
+        best = off;
+    }
+
+  if (best == (off_t)(-1))
+    return -1;
+
+  *r_off = best;
+  return 0;
+}
@@ -177,11 +177,14 @@ keybox_release (KEYBOX_HANDLE hd)
     }
   _keybox_release_blob (hd->found.blob);
   _keybox_release_blob (hd->saved_found.blob);
+  _keybox_unref_map (hd->map);
+  hd->map = NULL;
   if (hd->fp)
     {
       fclose (hd->fp);
       hd->fp = NULL;
     }
+  _keybox_index_close (hd);
   xfree (hd->word_match.name);
   xfree (hd->word_match.pattern);
   xfree (hd);
@@ -250,21 +253,28 @@ _keybox_close_file (KEYBOX_HANDLE hd)
   for (idx=0; idx < hd->kb->handle_table_size; idx++)
     if ((roverhd = hd->kb->handle_table[idx]))
       {
+        _keybox_unref_map (roverhd->map);
+        roverhd->map = NULL;
         if (roverhd->fp)
           {
             fclose (roverhd->fp);
             roverhd->fp = NULL;
           }
+        _keybox_index_close (roverhd);
       }
   assert (!hd->fp);
 }
 
 
 /*
- * Lock the keybox at handle HD, or unlock if YES is false.
+ * Lock the keybox at handle HD, or unlock if YES is false.  TIMEOUT
+ * is the value used for dotlock_take.  In general -1 should be used
+ * when taking a lock; use 0 when releasing a lock.  Taking the lock
+ * also brings the index up to date if another process changed the
+ * keybox without maintaining the index.
  */
 gpg_error_t
-keybox_lock (KEYBOX_HANDLE hd, int yes)
+keybox_lock (KEYBOX_HANDLE hd, int yes, long timeout)
 {
   gpg_error_t err = 0;
   KB_NAME kb = hd->kb;
@@ -302,13 +312,19 @@ keybox_lock (KEYBOX_HANDLE hd, int yes)
               hd->fp = NULL;
             }
 #endif /*HAVE_W32_SYSTEM*/
-          if (dotlock_take (kb->lockhd, -1))
+          if (dotlock_take (kb->lockhd, timeout))
             {
               err = gpg_error_from_syserror ();
-              log_info ("can't lock '%s'\n", kb->fname );
+              if (!timeout && gpg_err_code (err) == GPG_ERR_EACCES)
+                ; /* No diagnostic if we only tried to lock.  */
+              else
+                log_info ("can't lock '%s'\n", kb->fname );
             }
           else
-            kb->is_locked = 1;
+            {
+              kb->is_locked = 1;
+              _keybox_index_refresh (hd);
+            }
         }
     }
   else /* Release the lock.  */
@@ -383,6 +383,62 @@ blob_cmp_name (KEYBOXBLOB blob, int idx,
 }
 
 
+/* Locate the mailbox in the user ID at OFF,LEN of the blob BUFFER.
+   On success true is returned and the offset and length of the
+   mailbox (without the angle brackets) are stored at R_OFF and R_LEN.
+   The X509 flag indicates whether this is an X.509 blob.  */
+int
+_keybox_get_mailbox (const unsigned char *buffer, size_t off, size_t len,
+                     int x509, size_t *r_off, size_t *r_len)
+{
+  size_t mypos, mylen;
+
+  if (x509)
+    {
+      if (len < 2 || buffer[off] != '<')
+        return 0; /* empty name or trailing 0 not stored */
+      len--; /* one back */
+      if ( len < 3 || buffer[off+len] != '>')
+        return 0; /* not a proper email address */
+      off++;
+      len--;
+    }
+  else /* OpenPGP.  */
+    {
+      /* We need to forward to the mailbox part.  */
+      mypos = off;
+      mylen = len;
+      for ( ; len && buffer[off] != '<'; len--, off++)
+        ;
+      if (len < 2 || buffer[off] != '<')
+        {
+          /* Mailbox not explicitly given or too short.  Restore
+             OFF and LEN and check whether the entire string
+             resembles a mailbox without the angle brackets.  */
+          off = mypos;
+          len = mylen;
+          if (!is_valid_mailbox_mem (buffer+off, len))
+            return 0; /* Not a mail address. */
+        }
+      else /* Seems to be standard user id with mail address.  */
+        {
+          off++; /* Point to first char of the mail address.  */
+          len--;
+          /* Search closing '>'.  */
+          for (mypos=off; len && buffer[mypos] != '>'; len--, mypos++)
+            ;
+          if (!len || buffer[mypos] != '>' || off == mypos)
+            return 0; /* Not a proper mail address.  */
+          len = mypos - off;
+        }
+    }
+
+  *r_off = off;
+  *r_len = len;
+  return 1;
+}
+
+
 /* Compare all email addresses of the subject.  With SUBSTR given as
    True a substring search is done in the mail address.  The X509 flag
    indicated whether the search is done on an X.509 blob.  */
@@ -434,53 +490,14 @@ blob_cmp_mail (KEYBOXBLOB blob, const char *name, size_t namelen, int substr,
   for (idx=!!x509 ;idx < nuids; idx++)
     {
       size_t mypos = pos;
-      size_t mylen;
 
       mypos += idx*uidinfolen;
       off = get32 (buffer+mypos);
       len = get32 (buffer+mypos+4);
       if (off+len > length)
         return 0; /* error: better stop here - out of bounds */
-      if (x509)
-        {
-          if (len < 2 || buffer[off] != '<')
-            continue; /* empty name or trailing 0 not stored */
-          len--; /* one back */
-          if ( len < 3 || buffer[off+len] != '>')
-            continue; /* not a proper email address */
-          off++;
-          len--;
-        }
-      else /* OpenPGP.  */
-        {
-          /* We need to forward to the mailbox part.  */
-          mypos = off;
-          mylen = len;
-          for ( ; len && buffer[off] != '<'; len--, off++)
-            ;
-          if (len < 2 || buffer[off] != '<')
-            {
-              /* Mailbox not explicitly given or too short.  Restore
-                 OFF and LEN and check whether the entire string
-                 resembles a mailbox without the angle brackets.  */
-              off = mypos;
-              len = mylen;
-              if (!is_valid_mailbox_mem (buffer+off, len))
-                continue; /* Not a mail address. */
-            }
-          else /* Seems to be standard user id with mail address.  */
-            {
-              off++; /* Point to first char of the mail address.  */
-              len--;
-              /* Search closing '>'.  */
-              for (mypos=off; len && buffer[mypos] != '>'; len--, mypos++)
-                ;
-              if (!len || buffer[mypos] != '>' || off == mypos)
-                continue; /* Not a proper mail address.  */
-              len = mypos - off;
-            }
-
-        }
+      if (!_keybox_get_mailbox (buffer, off, len, x509, &off, &len))
+        continue;
 
       if (substr)
         {
@@ -498,26 +515,24 @@ blob_cmp_mail (KEYBOXBLOB blob, const char *name, size_t namelen, int substr,
 
 
 #ifdef KEYBOX_WITH_X509
-/* Return true if the key in BLOB matches the 20 bytes keygrip GRIP.
-   We don't have the keygrips as meta data, thus we need to parse the
-   certificate. Fixme: We might want to return proper error codes
-   instead of failing a search for invalid certificates etc.  */
-static int
-blob_x509_has_grip (KEYBOXBLOB blob, const unsigned char *grip)
+/* Compute the 20 byte keygrip of the certificate in the X.509 blob
+   BUFFER,LENGTH and store it at GRIP.  We don't have the keygrips as
+   meta data, thus we need to parse the certificate.  Returns true on
+   success.  Fixme: We might want to return proper error codes instead
+   of failing for invalid certificates etc.  */
+int
+_keybox_get_x509_keygrip (const unsigned char *buffer, size_t length,
+                          unsigned char *grip)
 {
   int rc;
-  const unsigned char *buffer;
-  size_t length;
   size_t cert_off, cert_len;
   ksba_reader_t reader = NULL;
   ksba_cert_t cert = NULL;
   ksba_sexp_t p = NULL;
   gcry_sexp_t s_pkey;
-  unsigned char array[20];
   unsigned char *rcp;
   size_t n;
 
-  buffer = _keybox_get_blob_image (blob, &length);
   if (length < 40)
     return 0; /* Too short. */
   cert_off = get32 (buffer+8);
@@ -549,7 +564,7 @@ blob_x509_has_grip (KEYBOXBLOB blob, const unsigned char *grip)
       gcry_sexp_release (s_pkey);
       goto failed;
     }
-  rcp = gcry_pk_get_keygrip (s_pkey, array);
+  rcp = gcry_pk_get_keygrip (s_pkey, grip);
   gcry_sexp_release (s_pkey);
   if (!rcp)
     goto failed; /* Can't calculate keygrip. */
@@ -557,13 +572,28 @@ blob_x509_has_grip (KEYBOXBLOB blob, const unsigned char *grip)
   xfree (p);
   ksba_cert_release (cert);
   ksba_reader_release (reader);
-  return !memcmp (array, grip, 20);
+  return 1;
  failed:
   xfree (p);
   ksba_cert_release (cert);
   ksba_reader_release (reader);
   return 0;
 }
+
+
+/* Return true if the key in BLOB matches the 20 bytes keygrip GRIP.  */
+static int
+blob_x509_has_grip (KEYBOXBLOB blob, const unsigned char *grip)
+{
+  const unsigned char *buffer;
+  size_t length;
+  unsigned char array[20];
+
+  buffer = _keybox_get_blob_image (blob, &length);
+  if (!_keybox_get_x509_keygrip (buffer, length, array))
+    return 0;
+  return !memcmp (array, grip, 20);
+}
 #endif /*KEYBOX_WITH_X509*/
 
 
@@ -763,10 +793,13 @@ keybox_search_reset (KEYBOX_HANDLE hd)
 
   if (hd->fp)
     {
+      hd->mappos = 0;
       if (fseeko (hd->fp, 0, SEEK_SET))
         {
           /* Ooops.  Seek did not work.  Close so that the search will
            * open the file again.  */
+          _keybox_unref_map (hd->map);
+          hd->map = NULL;
           fclose (hd->fp);
           hd->fp = NULL;
         }
@@ -777,6 +810,40 @@ keybox_search_reset (KEYBOX_HANDLE hd)
 }
 
 
+/* Map the keybox file of HD or update an existing mapping if the
+   file has grown.  While HD->MAP is set, HD->MAPPOS and not the
+   position of HD->FP is used as the read position.  If the file can't
+   be mapped we silently fall back to reading via stdio.  */
+static gpg_error_t
+update_map (KEYBOX_HANDLE hd)
+{
+  int was_mapped = !!hd->map;
+
+  if (!_keybox_map_file (hd->fp, &hd->map))
+    {
+      if (!was_mapped)
+        {
+          hd->mappos = ftello (hd->fp);
+          if (hd->mappos == (off_t)(-1))
+            {
+              gpg_error_t err = gpg_error_from_syserror ();
+              _keybox_unref_map (hd->map);
+              hd->map = NULL;
+              return err;
+            }
+        }
+    }
+  else if (was_mapped)
+    {
+      /* Continue with stdio where the mapped reads stopped.  */
+      if (fseeko (hd->fp, hd->mappos, SEEK_SET))
+        return gpg_error_from_syserror ();
+    }
+
+  return 0;
+}
+
+
 /* Note: When in ephemeral mode the search function does visit all
    blobs but in standard mode, blobs flagged as ephemeral are ignored.
    If WANT_BLOBTYPE is not 0 only blobs of this type are considered.
@@ -789,7 +856,7 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
 {
   gpg_error_t rc;
   size_t n;
-  int need_words, any_skip;
+  int need_words, any_skip, use_index;
   KEYBOXBLOB blob = NULL;
   struct sn_array_s *sn_array = NULL;
   int pk_no, uid_no;
@@ -847,6 +914,13 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
         }
     }
 
+  rc = update_map (hd);
+  if (rc)
+    {
+      xfree (sn_array);
+      return (hd->error = rc);
+    }
+
   /* Kludge: We need to convert an SN given as hexstring to its binary
      representation - in some cases we are not able to store it in the
      search descriptor, because due to the way we use it, it is not
@@ -908,14 +982,62 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
     }
 
 
+  /* If all descriptors can be served by the index we use it to skip
+     right to the candidate blobs instead of scanning the whole
+     file.  */
+  use_index = _keybox_index_usable (hd, desc, ndesc);
+
   pk_no = uid_no = 0;
   for (;;)
     {
       unsigned int blobflags;
       int blobtype;
 
-      _keybox_release_blob (blob); blob = NULL;
-      rc = _keybox_read_blob (&blob, hd->fp, NULL);
+      if (!hd->map)
+        {
+          _keybox_release_blob (blob);
+          blob = NULL;
+        }
+      if (use_index)
+        {
+          off_t off = hd->map? hd->mappos : ftello (hd->fp);
+
+          rc = _keybox_index_next (hd, desc, ndesc, &off);
+          if (rc == -1)
+            {
+              /* Leave the file at EOF just like a linear scan would do.  */
+              if (hd->map)
+                hd->mappos = hd->map->length;
+              else if (fseeko (hd->fp, 0, SEEK_END))
+                rc = gpg_error_from_syserror ();
+              break;
+            }
+          if (rc)
+            use_index = 0; /* Index is corrupt - fallback to a scan.  */
+          else if (hd->map)
+            hd->mappos = off;
+          else if (fseeko (hd->fp, off, SEEK_SET))
+            {
+              rc = gpg_error_from_syserror ();
+              break;
+            }
+        }
+      /* With a mapped file BLOB is re-used as a view into the mapping;
+         thus there is no allocation or copying for each blob.  */
+      if (hd->map)
+        rc = _keybox_read_blob_from_map (&blob, hd->map, &hd->mappos, NULL);
+      else
+        rc = _keybox_read_blob (&blob, hd->fp, NULL);
+      if (gpg_err_code (rc) == GPG_ERR_TOO_SHORT
+          && (hd->map? hd->mappos == hd->map->length : feof (hd->fp)))
+        {
+          /* A blob truncated at the end of the file is being
+             appended by another process (or the append has been
+             interrupted and will be rolled back by the next update);
+             for a search this is the end of the file.  */
+          rc = -1;
+          break;
+        }
       if (gpg_err_code (rc) == GPG_ERR_TOO_LARGE
           && gpg_err_source (rc) == GPG_ERR_SOURCE_KEYBOX)
         {
@@ -1112,6 +1234,45 @@ keybox_get_keyblock (KEYBOX_HANDLE hd, iobuf_t *r_iobuf,
 }
 
 
+/* Store the checksum of the last found keyblock at R_CHECKSUM, which
+ * must provide space for 20 bytes.  R_PK_NO and R_UID_NO are set as
+ * with keybox_get_keyblock.  The checksum identifies the keyblock
+ * without the need to copy it and may thus be used by the caller to
+ * look up the parsed keyblock in a cache.  Returns GPG_ERR_NO_DATA
+ * if the blob has no checksum.  */
+gpg_error_t
+keybox_get_keyblock_checksum (KEYBOX_HANDLE hd, unsigned char *r_checksum,
+                              int *r_pk_no, int *r_uid_no)
+{
+  const unsigned char *buffer;
+  size_t length;
+  int i;
+
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  if (!hd->found.blob)
+    return gpg_error (GPG_ERR_NOTHING_FOUND);
+
+  if (blob_get_type (hd->found.blob) != KEYBOX_BLOBTYPE_PGP)
+    return gpg_error (GPG_ERR_WRONG_BLOB_TYPE);
+
+  buffer = _keybox_get_blob_image (hd->found.blob, &length);
+  if (length < 40)
+    return gpg_error (GPG_ERR_TOO_SHORT);
+
+  buffer += length - 20;
+  for (i=0; i < 20 && !buffer[i]; i++)
+    ;
+  if (i == 20)
+    return gpg_error (GPG_ERR_NO_DATA);
+
+  memcpy (r_checksum, buffer, 20);
+  *r_pk_no  = hd->found.pk_no;
+  *r_uid_no = hd->found.uid_no;
+  return 0;
+}
+
+
 #ifdef KEYBOX_WITH_X509
 /*
   Return the last found cert.  Caller must free it.
@@ -1197,11 +1358,60 @@ keybox_get_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int *value)
   return ec? gpg_error (ec):0;
 }
 
+
+/* Return the signature status words of the last found OpenPGP blob.
+ * On success a new array is stored at R_SIGSTATUS with the number of
+ * signatures in its first element, followed by the status of each
+ * signature in the order of the keyblock.  NULL is stored if the
+ * blob has no signatures.  The caller must xfree the array.  */
+gpg_error_t
+keybox_get_sigstatus (KEYBOX_HANDLE hd, u32 **r_sigstatus)
+{
+  const unsigned char *buffer;
+  size_t length;
+  size_t siginfo_off, siginfo_size, siginfo_len, nsigs, n;
+  gpg_err_code_t ec;
+  u32 *sigstatus;
+
+  *r_sigstatus = NULL;
+
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  if (!hd->found.blob)
+    return gpg_error (GPG_ERR_NOTHING_FOUND);
+
+  if (blob_get_type (hd->found.blob) != KEYBOX_BLOBTYPE_PGP)
+    return gpg_error (GPG_ERR_WRONG_BLOB_TYPE);
+
+  buffer = _keybox_get_blob_image (hd->found.blob, &length);
+  ec = _keybox_get_flag_location (buffer, length, KEYBOX_FLAG_SIG_INFO,
+                                  &siginfo_off, &siginfo_size);
+  if (ec)
+    return gpg_error (ec);
+  nsigs = get16 (buffer + siginfo_off);
+  siginfo_len = get16 (buffer + siginfo_off + 2);
+  if (!nsigs)
+    return 0;
+
+  sigstatus = xtrymalloc ((1+nsigs) * sizeof *sigstatus);
+  if (!sigstatus)
+    return gpg_error_from_syserror ();
+  sigstatus[0] = nsigs;
+  siginfo_off += 4;
+  for (n=1; n <= nsigs; n++, siginfo_off += siginfo_len)
+    sigstatus[n] = get32 (buffer + siginfo_off);
+
+  *r_sigstatus = sigstatus;
+  return 0;
+}
+
 off_t
 keybox_offset (KEYBOX_HANDLE hd)
 {
   if (!hd->fp)
     return 0;
+  if (hd->map)
+    return hd->mappos;
   return ftello (hd->fp);
 }
 
@@ -1227,6 +1437,8 @@ keybox_seek (KEYBOX_HANDLE hd, off_t offset)
         return err;
     }
 
+  if (hd->map)
+    hd->mappos = offset;
   err = fseeko (hd->fp, offset, SEEK_SET);
   hd->error = gpg_error_from_errno (err);
 
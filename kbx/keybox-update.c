@@ -25,8 +25,11 @@
 #include <time.h>
 #include <unistd.h>
 #include <assert.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "keybox-defs.h"
+#include <gcrypt.h>
 #include "../common/sysutils.h"
 #include "../common/host2net.h"
 #include "../common/utilproto.h"
@@ -37,6 +40,15 @@
 #define FILECOPY_DELETE 2
 #define FILECOPY_UPDATE 3
 
+/* The length and magic of the journal record.  */
+#define JOURNAL_RECLEN 64
+#define JOURNAL_MAGIC  "KBXj"
+
+/* keybox_compress does not wait for the next scheduled maintenance
+   run if at least this many bytes and half of the file are taken up
+   by deleted blobs.  */
+#define COMPRESS_MIN_DELETED 16384
+
 
 #if !defined(HAVE_FSEEKO) && !defined(fseeko)
 
@@ -154,6 +166,454 @@ rename_tmp_file (const char *bakfname, const char *tmpfname,
 
 
 
+/* In-place updates.
+
+   Instead of copying the entire keybox for each change, new blobs
+   are appended to the file and superseded blobs are only flagged as
+   deleted; keybox_compress later reclaims the space.  The header blob
+   keeps a count of the deleted bytes so that keybox_compress can tell
+   when that is due.  To make this
+   crash safe a journal file (FNAME.jnl) is used which holds a single
+   record describing the change in progress:
+
+     byte[4]  magic "KBXj"
+     byte     version (1)
+     byte[3]  reserved
+     u32      low 32 bits of the keybox's inode number or 0
+     u32      reserved
+     u32[2]   size of the keybox before the change
+     u32[2]   offset of the blob to be flagged as deleted or 0
+     u32      length of the appended blob
+     byte[20] SHA-1 of the appended blob
+     byte[8]  reserved
+
+   An empty journal file indicates that no change is in progress.
+   The record is synced to disk before the keybox is touched.  If a
+   journal record is found by the next writer, the change is either
+   completed (the appended blob is intact) or rolled back by turning
+   the partly written blob into an empty blob.  The keybox is never
+   shrunk in place because readers may have mapped it; only
+   keybox_compress gets rid of empty blobs by writing a new file.  The
+   journal is only accessed with the keybox locked.  */
+
+/* Return the name of the journal file for the keybox FNAME.  */
+static char *
+journal_fname (const char *fname)
+{
+  char *name;
+
+  name = xtrymalloc (strlen (fname) + 5);
+  if (name)
+    strcpy (stpcpy (name, fname), EXTSEP_S "jnl");
+  return name;
+}
+
+
+/* Flush FP and sync it to the disk.  */
+static gpg_error_t
+sync_file (FILE *fp)
+{
+  if (fflush (fp))
+    return gpg_error_from_syserror ();
+#ifdef HAVE_FSYNC
+  if (fsync (fileno (fp)))
+    return gpg_error_from_syserror ();
+#endif
+  return 0;
+}
+
+
+/* Sync the directory holding FNAME so that a new directory entry
+   for FNAME is persistent.  */
+static void
+sync_dir (const char *fname)
+{
+#if defined(HAVE_FSYNC) && !defined(HAVE_W32_SYSTEM)
+  char *dname;
+  int fd;
+
+  dname = make_dirname (fname);
+  fd = open (dname, O_RDONLY);
+  if (fd != -1)
+    {
+      fsync (fd);
+      close (fd);
+    }
+  xfree (dname);
+#else
+  (void)fname;
+#endif
+}
+
+
+/* Return the low 32 bits of the inode number of the file open as
+   FP or 0.  */
+static u32
+file_inode (FILE *fp)
+{
+#ifndef HAVE_W32_SYSTEM
+  struct stat st;
+
+  if (!fstat (fileno (fp), &st))
+    return (u32)st.st_ino;
+#else
+  (void)fp;
+#endif
+  return 0;
+}
+
+
+/* Add N to the count of deleted bytes kept in the header blob of the
+   keybox open as FP.  This count is only used to schedule a compress
+   run; thus a missing header blob is not an error.  */
+static gpg_error_t
+add_deleted_bytes (FILE *fp, size_t n)
+{
+  unsigned char header[32];
+  u32 val;
+
+  if (fseeko (fp, 0, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (fread (header, sizeof header, 1, fp) != 1
+      || buf32_to_size_t (header) < sizeof header
+      || header[4] != KEYBOX_BLOBTYPE_HEADER
+      || memcmp (header+8, "KBXf", 4))
+    return 0;
+
+  val = buf32_to_u32 (header+24);
+  val = (n > 0xffffffff - val)? 0xffffffff : val + n;
+  ulongtobuf (header+24, val);
+  if (fseeko (fp, 24, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (fwrite (header+24, 4, 1, fp) != 1)
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Flag the blob at OFF of the keybox open as FP as deleted.  */
+static gpg_error_t
+mark_blob_deleted (FILE *fp, off_t off)
+{
+  unsigned char buf[5];
+
+  if (fseeko (fp, off, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (fread (buf, sizeof buf, 1, fp) != 1)
+    return ferror (fp)? gpg_error_from_syserror ()
+                      : gpg_error (GPG_ERR_TOO_SHORT);
+  if (!buf[4])
+    return 0;  /* Already flagged.  */
+
+  if (fseeko (fp, off + 4, SEEK_SET))
+    return gpg_error_from_syserror ();
+  if (putc (0, fp) == EOF)
+    return gpg_error_from_syserror ();
+  return add_deleted_bytes (fp, buf32_to_size_t (buf));
+}
+
+
+/* Complete or roll back the change described by the journal JFP for
+   the keybox FNAME and clear the journal.  */
+static gpg_error_t
+replay_journal (const char *fname, FILE *jfp)
+{
+  gpg_error_t err = 0;
+  unsigned char rec[JOURNAL_RECLEN];
+  unsigned char digest[20];
+  unsigned char *image = NULL;
+  u32 inode;
+  off_t size, old_off, cursize;
+  size_t bloblen;
+  FILE *fp = NULL;
+
+  rewind (jfp);
+  if (fread (rec, JOURNAL_RECLEN, 1, jfp) != 1)
+    goto clear;  /* Empty or incomplete - nothing has been changed.  */
+  if (memcmp (rec, JOURNAL_MAGIC, 4) || rec[4] != 1)
+    {
+      log_info ("%s: invalid journal - ignored\n", fname);
+      goto clear;
+    }
+  inode   = buf32_to_u32 (rec+8);
+  bloblen = buf32_to_size_t (rec+32);
+  if (!_keybox_get_off (rec+16, &size) || !_keybox_get_off (rec+24, &old_off)
+      || old_off < 0 || old_off >= size)
+    {
+      log_info ("%s: invalid journal - ignored\n", fname);
+      goto clear;
+    }
+
+  fp = fopen (fname, "r+b");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      if (gpg_err_code (err) == GPG_ERR_ENOENT)
+        err = 0;
+      goto clear;
+    }
+  if (inode && file_inode (fp) && inode != file_inode (fp))
+    goto clear;  /* The keybox has been replaced in the meantime.  */
+  if (fseeko (fp, 0, SEEK_END) || (cursize = ftello (fp)) == (off_t)-1)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  if (cursize < size)
+    goto clear;  /* Not our file anymore.  */
+
+  if (cursize >= size + (off_t)bloblen)
+    {
+      /* Check whether the blob has completely been written.  */
+      image = xtrymalloc (bloblen? bloblen : 1);
+      if (!image)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      if (fseeko (fp, size, SEEK_SET)
+          || fread (image, bloblen, 1, fp) != 1)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      gcry_md_hash_buffer (GCRY_MD_SHA1, digest, image, bloblen);
+      if (memcmp (digest, rec+36, 20))
+        {
+          /* Something else has been written - better leave it
+             alone.  */
+          log_info ("%s: journal does not match - ignored\n", fname);
+          goto clear;
+        }
+
+      /* Complete the change.  */
+      if (old_off)
+        {
+          err = mark_blob_deleted (fp, old_off);
+          if (!err)
+            err = sync_file (fp);
+          if (err)
+            goto leave;
+        }
+      log_info ("%s: interrupted update completed\n", fname);
+    }
+  else if (cursize > size)
+    {
+      /* The blob has only partly been written - roll back.  We can't
+         truncate the file because readers may have mapped it (see
+         _keybox_map_file) and would get a SIGBUS.  Instead the
+         partial blob is turned into an empty blob; if it is shorter
+         than the minimal blob the file is extended.  */
+      unsigned char pad[5];
+
+      bloblen = (size_t)(cursize - size);
+      if (bloblen < sizeof pad)
+        bloblen = sizeof pad;
+      ulongtobuf (pad, bloblen);
+      pad[4] = 0;
+      if (fseeko (fp, size, SEEK_SET)
+          || fwrite (pad, sizeof pad, 1, fp) != 1)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      err = add_deleted_bytes (fp, bloblen);
+      if (!err)
+        err = sync_file (fp);
+      if (err)
+        goto leave;
+      log_info ("%s: interrupted update rolled back\n", fname);
+    }
+
+ clear:
+#ifdef HAVE_FTRUNCATE
+  if (!err)
+    {
+      if (fflush (jfp) || ftruncate (fileno (jfp), 0))
+        err = gpg_error_from_syserror ();
+      else
+        err = sync_file (jfp);
+    }
+#endif
+
+ leave:
+  if (fp && fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  xfree (image);
+  if (err)
+    log_error ("%s: error replaying the journal: %s\n",
+               fname, gpg_strerror (err));
+  return err;
+}
+
+
+/* Open the journal of the keybox FNAME and complete a change which
+   has been interrupted.  If R_JFP is not NULL the journal is created
+   if needed and the open journal is stored there; with R_JFP NULL
+   only an existing journal is replayed.  */
+static gpg_error_t
+open_journal (const char *fname, FILE **r_jfp)
+{
+  gpg_error_t err;
+  char *jname;
+  FILE *jfp;
+
+  if (r_jfp)
+    *r_jfp = NULL;
+
+  jname = journal_fname (fname);
+  if (!jname)
+    return gpg_error_from_syserror ();
+
+  jfp = fopen (jname, "r+b");
+  if (!jfp && errno == ENOENT && r_jfp)
+    {
+      jfp = fopen (jname, "w+b");
+      if (jfp)
+        sync_dir (jname);
+    }
+  if (!jfp)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (jname);
+      if (!r_jfp && gpg_err_code (err) == GPG_ERR_ENOENT)
+        return 0;  /* No journal - nothing to do.  */
+      return err;
+    }
+  xfree (jname);
+
+  err = replay_journal (fname, jfp);
+  if (err || !r_jfp)
+    fclose (jfp);
+  else
+    *r_jfp = jfp;
+  return err;
+}
+
+
+/* Append BLOB to the keybox FNAME and if OLD_OFF is not 0 flag the
+   blob at OLD_OFF as deleted; the journal makes sure that either both
+   or no changes survive a crash.  FOR_OPENPGP indicates that this is
+   called due to an OpenPGP keyblock change.  The offset of the new
+   blob is stored at R_OFF.  Returns GPG_ERR_NOT_SUPPORTED if the
+   change can't be done in place; the caller shall then fall back to
+   blob_filecopy.  */
+static gpg_error_t
+blob_append (const char *fname, KEYBOXBLOB blob, int for_openpgp,
+             off_t old_off, off_t *r_off)
+{
+#ifdef HAVE_FTRUNCATE
+  gpg_error_t err;
+  FILE *fp = NULL;
+  FILE *jfp = NULL;
+  const unsigned char *image;
+  size_t imagelen;
+  unsigned char rec[JOURNAL_RECLEN];
+  unsigned char header[8];
+  off_t size;
+
+  if (access (fname, W_OK))
+    {
+      err = gpg_error_from_syserror ();
+      if (gpg_err_code (err) == GPG_ERR_ENOENT)
+        err = gpg_error (GPG_ERR_NOT_SUPPORTED);  /* Create it.  */
+      return err;
+    }
+
+  err = open_journal (fname, &jfp);
+  if (err)
+    return err;
+
+  fp = fopen (fname, "r+b");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  /* We need a valid header blob.  */
+  if (fread (header, sizeof header, 1, fp) != 1
+      || header[4] != KEYBOX_BLOBTYPE_HEADER)
+    {
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+  if (fseeko (fp, 0, SEEK_END) || (size = ftello (fp)) == (off_t)-1)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  /* Write the journal record.  */
+  image = _keybox_get_blob_image (blob, &imagelen);
+  memset (rec, 0, sizeof rec);
+  memcpy (rec, JOURNAL_MAGIC, 4);
+  rec[4] = 1;
+  ulongtobuf (rec+8, file_inode (fp));
+  _keybox_put_off (rec+16, size);
+  _keybox_put_off (rec+24, old_off);
+  ulongtobuf (rec+32, imagelen);
+  gcry_md_hash_buffer (GCRY_MD_SHA1, rec+36, image, imagelen);
+  rewind (jfp);
+  if (fwrite (rec, sizeof rec, 1, jfp) != 1)
+    err = gpg_error_from_syserror ();
+  else
+    err = sync_file (jfp);
+  if (err)
+    goto leave;
+
+  /* Append the blob and make sure it is on the disk before we flag
+     the old one as deleted.  */
+  err = _keybox_write_blob (blob, fp);
+  if (!err)
+    err = sync_file (fp);
+  if (!err && old_off)
+    err = mark_blob_deleted (fp, old_off);
+  if (!err && for_openpgp && !(header[7] & 0x02))
+    {
+      /* Set the flag that OpenPGP data may be available.  */
+      if (fseeko (fp, 7, SEEK_SET) || putc (header[7] | 0x02, fp) == EOF)
+        err = gpg_error_from_syserror ();
+    }
+  if (!err)
+    err = sync_file (fp);
+  if (fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  fp = NULL;
+
+  /* Clear the journal or on error roll back.  */
+  if (!err)
+    {
+      if (fflush (jfp) || ftruncate (fileno (jfp), 0))
+        err = gpg_error_from_syserror ();
+      else
+        err = sync_file (jfp);
+    }
+  else
+    replay_journal (fname, jfp);
+
+  if (!err)
+    *r_off = size;
+
+ leave:
+  if (fp)
+    fclose (fp);
+  if (jfp)
+    fclose (jfp);
+  return err;
+#else /*!HAVE_FTRUNCATE*/
+  /* Without ftruncate we can't roll back.  */
+  (void)fname;
+  (void)blob;
+  (void)for_openpgp;
+  (void)old_off;
+  (void)r_off;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#endif /*!HAVE_FTRUNCATE*/
+}
+
+
+
 /* Perform insert/delete/update operation.  MODE is one of
    FILECOPY_INSERT, FILECOPY_DELETE, FILECOPY_UPDATE.  FOR_OPENPGP
    indicates that this is called due to an OpenPGP keyblock change.  */
@@ -362,6 +822,8 @@ keybox_insert_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
   KEYBOXBLOB blob;
   size_t nparsed;
   struct _keybox_openpgp_info info;
+  struct keybox_stamp_s stamp;
+  off_t off;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_HANDLE);
@@ -386,12 +848,18 @@ keybox_insert_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
   _keybox_destroy_openpgp_info (&info);
   if (!err)
     {
-      err = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 1, 0);
+      /* The new blob is appended; thus its offset is the current
+         size of the file.  */
+      _keybox_get_stamp (fname, &stamp);
+      err = blob_append (fname, blob, 1, 0, &off);
+      if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+        {
+          err = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 1, 0);
+          off = stamp.size;
+        }
+      if (!err)
+        _keybox_index_update (hd->kb, &stamp, (off_t)(-1), off, 0, blob);
       _keybox_release_blob (blob);
-      /*    if (!rc && !hd->secret && kb_offtbl) */
-      /*      { */
-      /*        update_offset_hash_table_from_kb (kb_offtbl, kb, 0); */
-      /*      } */
     }
   return err;
 }
@@ -404,10 +872,12 @@ keybox_update_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
 {
   gpg_error_t err;
   const char *fname;
-  off_t off;
+  off_t off, newoff;
   KEYBOXBLOB blob;
   size_t nparsed;
   struct _keybox_openpgp_info info;
+  struct keybox_stamp_s stamp;
+  size_t oldlen, newlen;
 
   if (!hd || !image || !imagelen)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -422,6 +892,7 @@ keybox_update_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
   off = _keybox_get_blob_fileoffset (hd->found.blob);
   if (off == (off_t)-1)
     return gpg_error (GPG_ERR_GENERAL);
+  _keybox_get_blob_image (hd->found.blob, &oldlen);
 
   /* Close this the file so that we do no mess up the position for a
      next search.  */
@@ -436,10 +907,25 @@ keybox_update_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
                                      hd->ephemeral);
   _keybox_destroy_openpgp_info (&info);
 
-  /* Update the keyblock.  */
+  /* Update the keyblock.  The new blob is appended and the old one
+     flagged as deleted.  */
   if (!err)
     {
-      err = blob_filecopy (FILECOPY_UPDATE, fname, blob, hd->secret, 1, off);
+      _keybox_get_stamp (fname, &stamp);
+      err = blob_append (fname, blob, 1, off, &newoff);
+      if (!err)
+        _keybox_index_update (hd->kb, &stamp, off, newoff, 0, blob);
+      else if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+        {
+          err = blob_filecopy (FILECOPY_UPDATE, fname, blob, hd->secret, 1,
+                               off);
+          if (!err)
+            {
+              _keybox_get_blob_image (blob, &newlen);
+              _keybox_index_update (hd->kb, &stamp, off, off,
+                                    (off_t)newlen - (off_t)oldlen, blob);
+            }
+        }
       _keybox_release_blob (blob);
     }
   return err;
@@ -455,6 +941,8 @@ keybox_insert_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
   int rc;
   const char *fname;
   KEYBOXBLOB blob;
+  struct keybox_stamp_s stamp;
+  off_t off;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_HANDLE);
@@ -472,12 +960,16 @@ keybox_insert_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
   rc = _keybox_create_x509_blob (&blob, cert, sha1_digest, hd->ephemeral);
   if (!rc)
     {
-      rc = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 0, 0);
+      _keybox_get_stamp (fname, &stamp);
+      rc = blob_append (fname, blob, 0, 0, &off);
+      if (gpg_err_code (rc) == GPG_ERR_NOT_SUPPORTED)
+        {
+          rc = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 0, 0);
+          off = stamp.size;
+        }
+      if (!rc)
+        _keybox_index_update (hd->kb, &stamp, (off_t)(-1), off, 0, blob);
       _keybox_release_blob (blob);
-      /*    if (!rc && !hd->secret && kb_offtbl) */
-      /*      { */
-      /*        update_offset_hash_table_from_kb (kb_offtbl, kb, 0); */
-      /*      } */
     }
   return rc;
 }
@@ -508,6 +1000,7 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
   size_t flag_pos, flag_size;
   const unsigned char *buffer;
   size_t length;
+  struct keybox_stamp_s stamp;
 
   (void)idx;  /* Not yet used.  */
 
@@ -535,6 +1028,10 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
   off += flag_pos;
 
   _keybox_close_file (hd);
+  ec = gpg_err_code (open_journal (fname, NULL));
+  if (ec)
+    return gpg_error (ec);
+  _keybox_get_stamp (fname, &stamp);
   fp = fopen (hd->kb->fname, "r+b");
   if (!fp)
     return gpg_error_from_syserror ();
@@ -571,10 +1068,144 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
         ec = gpg_err_code_from_syserror ();
     }
 
+  /* The flags are not indexed; we only need to update the stamp.  */
+  if (!ec)
+    _keybox_index_update (hd->kb, &stamp, (off_t)(-1), (off_t)(-1), 0, NULL);
+
   return gpg_error (ec);
 }
 
 
+/* Update the signature status words of the last found OpenPGP blob
+ * in place.  SIGSTATUS has the number of signatures in its first
+ * element as returned by keybox_get_sigstatus.  Unlike the other
+ * update functions this does not wait for the lock: if the keybox is
+ * not yet locked we only try to take the lock and return
+ * GPG_ERR_EACCES if that is not possible.  If the blob has been
+ * changed in the file since it was found, GPG_ERR_CONFLICT is
+ * returned.  The SHA-1 checksum of the blob covers the status words
+ * and is thus updated as well; if R_CHECKSUM is not NULL the new
+ * checksum is stored there, which must provide space for 20 bytes.
+ * Note that the found blob of HD still has the old checksum.  */
+gpg_error_t
+keybox_set_sigstatus (KEYBOX_HANDLE hd, const u32 *sigstatus,
+                      unsigned char *r_checksum)
+{
+  gpg_error_t err;
+  const char *fname;
+  const unsigned char *buffer;
+  unsigned char *image = NULL;
+  size_t length, siginfo_off, siginfo_size, siginfo_len, nsigs, n, pos;
+  off_t off;
+  off_t readpos;
+  FILE *fp = NULL;
+  struct keybox_stamp_s stamp;
+  int locked = 0;
+
+  if (!hd || !sigstatus)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  if (!hd->found.blob)
+    return gpg_error (GPG_ERR_NOTHING_FOUND);
+  if (!hd->kb)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+  fname = hd->kb->fname;
+  if (!fname)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+  if (!keybox_is_writable (hd->kb))
+    return gpg_error (GPG_ERR_EACCES);
+  if (blob_get_type (hd->found.blob) != KEYBOX_BLOBTYPE_PGP)
+    return gpg_error (GPG_ERR_WRONG_BLOB_TYPE);
+
+  off = _keybox_get_blob_fileoffset (hd->found.blob);
+  if (off == (off_t)-1)
+    return gpg_error (GPG_ERR_GENERAL);
+
+  buffer = _keybox_get_blob_image (hd->found.blob, &length);
+  err = gpg_error (_keybox_get_flag_location (buffer, length,
+                                              KEYBOX_FLAG_SIG_INFO,
+                                              &siginfo_off, &siginfo_size));
+  if (err)
+    return err;
+  nsigs = buf16_to_ulong (buffer + siginfo_off);
+  siginfo_len = buf16_to_ulong (buffer + siginfo_off + 2);
+  if (nsigs != sigstatus[0])
+    return gpg_error (GPG_ERR_INV_VALUE);
+  if (length < siginfo_off + 4 + siginfo_size + 20)
+    return gpg_error (GPG_ERR_TOO_SHORT);
+
+  image = xtrymalloc (length);
+  if (!image)
+    return gpg_error_from_syserror ();
+
+  /* The blobs do not move; thus, unlike the other update functions,
+   * we leave the files of all handles open so that their searches can
+   * continue.  Only keybox_lock may close the file of HD and we
+   * restore its read position in this case.  */
+  readpos = keybox_offset (hd);
+  if (!hd->kb->is_locked)
+    {
+      err = keybox_lock (hd, 1, 0);
+      if (err)
+        goto leave;
+      locked = 1;
+    }
+
+  err = open_journal (fname, NULL);
+  if (err)
+    goto leave;
+  _keybox_get_stamp (fname, &stamp);
+  fp = fopen (fname, "r+b");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  /* Make sure that nobody changed the blob since we found it.  */
+  if (fseeko (fp, off, SEEK_SET))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (fread (image, length, 1, fp) != 1 || memcmp (image, buffer, length))
+    {
+      err = gpg_error (GPG_ERR_CONFLICT);
+      goto leave;
+    }
+
+  /* Update the status words and the checksum as done by
+   * _keybox_create_openpgp_blob.  */
+  pos = siginfo_off + 4;
+  for (n=1; n <= nsigs; n++, pos += siginfo_len)
+    ulongtobuf (image + pos, sigstatus[n]);
+  gcry_md_hash_buffer (GCRY_MD_SHA1, image + length - 20, image, length - 20);
+  if (fseeko (fp, off + siginfo_off + 4, SEEK_SET)
+      || fwrite (image + siginfo_off + 4, siginfo_size, 1, fp) != 1
+      || fseeko (fp, off + length - 20, SEEK_SET)
+      || fwrite (image + length - 20, 20, 1, fp) != 1)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (r_checksum)
+    memcpy (r_checksum, image + length - 20, 20);
+
+ leave:
+  if (fp && fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  /* The signature info is not indexed; we only need to update the
+     stamp.  */
+  if (!err)
+    _keybox_index_update (hd->kb, &stamp, (off_t)(-1), (off_t)(-1), 0, NULL);
+  if (locked)
+    keybox_lock (hd, 0, 0);
+  if (!hd->fp && readpos)
+    keybox_seek (hd, readpos);
+  xfree (image);
+  return err;
+}
+
+
 
 int
 keybox_delete (KEYBOX_HANDLE hd)
@@ -583,6 +1214,7 @@ keybox_delete (KEYBOX_HANDLE hd)
   const char *fname;
   FILE *fp;
   int rc;
+  struct keybox_stamp_s stamp;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -597,19 +1229,17 @@ keybox_delete (KEYBOX_HANDLE hd)
   off = _keybox_get_blob_fileoffset (hd->found.blob);
   if (off == (off_t)-1)
     return gpg_error (GPG_ERR_GENERAL);
-  off += 4;
 
   _keybox_close_file (hd);
+  rc = open_journal (fname, NULL);
+  if (rc)
+    return rc;
+  _keybox_get_stamp (fname, &stamp);
   fp = fopen (hd->kb->fname, "r+b");
   if (!fp)
     return gpg_error_from_syserror ();
 
-  if (fseeko (fp, off, SEEK_SET))
-    rc = gpg_error_from_syserror ();
-  else if (putc (0, fp) == EOF)
-    rc = gpg_error_from_syserror ();
-  else
-    rc = 0;
+  rc = mark_blob_deleted (fp, off);
 
   if (fclose (fp))
     {
@@ -617,12 +1247,19 @@ keybox_delete (KEYBOX_HANDLE hd)
         rc = gpg_error_from_syserror ();
     }
 
+  /* The blob has only been flagged as deleted; thus the offsets of
+     the other blobs did not change.  */
+  if (!rc)
+    _keybox_index_update (hd->kb, &stamp, off, (off_t)(-1), 0, NULL);
+
   return rc;
 }
 
 
-/* Compress the keybox file.  This should be run with the file
-   locked. */
+/* Compress the keybox file if needed.  This should be run with the
+   file locked.  gpg calls this after each update and deletion so that
+   the blobs flagged as deleted by the in-place updates do not pile
+   up.  */
 int
 keybox_compress (KEYBOX_HANDLE hd)
 {
@@ -654,6 +1291,11 @@ keybox_compress (KEYBOX_HANDLE hd)
   if (access (fname, W_OK))
     return gpg_error_from_syserror ();
 
+  /* Complete an interrupted in-place update before we copy.  */
+  rc = open_journal (fname, NULL);
+  if (rc)
+    return rc;
+
   fp = fopen (fname, "rb");
   if (!fp && errno == ENOENT)
     return 0; /* Ready. File has been deleted right after the access above. */
@@ -664,7 +1306,8 @@ keybox_compress (KEYBOX_HANDLE hd)
     }
 
   /* A quick test to see if we need to compress the file at all.  We
-     schedule a compress run after 3 hours. */
+     schedule a compress run after 3 hours or as soon as deleted blobs
+     make up half of the file. */
   if ( !_keybox_read_blob (&blob, fp, NULL) )
     {
       const unsigned char *buffer;
@@ -674,12 +1317,23 @@ keybox_compress (KEYBOX_HANDLE hd)
       if (length > 4 && buffer[4] == KEYBOX_BLOBTYPE_HEADER)
         {
           u32 last_maint = buf32_to_u32 (buffer+20);
-
-          if ( (last_maint + 3*3600) > time (NULL) )
+          u32 deleted = length >= 32? buf32_to_u32 (buffer+24) : 0;
+          struct stat st;
+
+          /* Don't wait if most of the file is taken up by blobs
+             flagged as deleted; see mark_blob_deleted.  */
+          if (deleted >= COMPRESS_MIN_DELETED
+              && !fstat (fileno (fp), &st)
+              && (off_t)deleted >= st.st_size / 2)
+            ;
+          else if ( (last_maint + 3*3600) > time (NULL) )
             {
               fclose (fp);
               _keybox_release_blob (blob);
-              return 0; /* Compress run not yet needed. */
+              /* Compress run not yet needed but make sure that the
+                 index is up to date.  */
+              _keybox_index_refresh (hd);
+              return 0;
             }
         }
       _keybox_release_blob (blob);
@@ -791,6 +1445,11 @@ keybox_compress (KEYBOX_HANDLE hd)
   else
     rc = rename_tmp_file (bakfname, tmpfname, fname, hd->secret);
 
+  /* The offsets may have changed; thus we need to rebuild the index.
+     Without changes this only checks that the index is current.  */
+  if (!rc)
+    _keybox_index_refresh (hd);
+
   xfree(bakfname);
   xfree(tmpfname);
   return rc;
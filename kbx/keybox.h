@@ -76,7 +76,7 @@ void keybox_pop_found_state (KEYBOX_HANDLE hd);
 const char *keybox_get_resource_name (KEYBOX_HANDLE hd);
 int keybox_set_ephemeral (KEYBOX_HANDLE hd, int yes);
 
-gpg_error_t keybox_lock (KEYBOX_HANDLE hd, int yes);
+gpg_error_t keybox_lock (KEYBOX_HANDLE hd, int yes, long timeout);
 
 /*-- keybox-file.c --*/
 /* Fixme: This function does not belong here: Provide a better
@@ -86,10 +86,14 @@ int _keybox_write_header_blob (FILE *fp, int openpgp_flag);
 /*-- keybox-search.c --*/
 gpg_error_t keybox_get_keyblock (KEYBOX_HANDLE hd, iobuf_t *r_iobuf,
                                  int *r_uid_no, int *r_pk_no);
+gpg_error_t keybox_get_keyblock_checksum (KEYBOX_HANDLE hd,
+                                          unsigned char *r_checksum,
+                                          int *r_pk_no, int *r_uid_no);
 #ifdef KEYBOX_WITH_X509
 int keybox_get_cert (KEYBOX_HANDLE hd, ksba_cert_t *ret_cert);
 #endif /*KEYBOX_WITH_X509*/
 int keybox_get_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int *value);
+gpg_error_t keybox_get_sigstatus (KEYBOX_HANDLE hd, u32 **r_sigstatus);
 
 gpg_error_t keybox_search_reset (KEYBOX_HANDLE hd);
 gpg_error_t keybox_search (KEYBOX_HANDLE hd,
@@ -113,6 +117,8 @@ int keybox_update_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
                         unsigned char *sha1_digest);
 #endif /*KEYBOX_WITH_X509*/
 int keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value);
+gpg_error_t keybox_set_sigstatus (KEYBOX_HANDLE hd, const u32 *sigstatus,
+                                  unsigned char *r_checksum);
 
 int keybox_delete (KEYBOX_HANDLE hd);
 int keybox_compress (KEYBOX_HANDLE hd);
@@ -0,0 +1,501 @@
+/* t-keybox-index.c - Module test for keybox-index.c
+ * Copyright (C) 2017 Free Software Foundation, Inc.
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "keybox-defs.h"
+#include <gcrypt.h>
+#include "../common/sysutils.h"
+#include "../common/host2net.h"
+
+#define pass()  do { ; } while(0)
+#define fail(a,e)  do { fprintf (stderr, "%s:%d: test '%s' failed: %s\n", \
+                                 __FILE__,__LINE__, (a), (e));          \
+                        exit (1);                                       \
+                      } while(0)
+
+#define KBXNAME "t-keybox-index.kbx"
+#define IDXNAME KBXNAME ".idx"
+#define SAVNAME KBXNAME ".idx-saved"
+#define MAXHITS 16
+
+static int verbose;
+static void *token;
+
+
+/* Copy the file SRC to DST.  */
+static void
+copy_file (const char *src, const char *dst)
+{
+  FILE *in, *out;
+  char buffer[4096];
+  size_t n;
+
+  in = fopen (src, "rb");
+  if (!in)
+    fail (src, strerror (errno));
+  out = fopen (dst, "wb");
+  if (!out)
+    fail (dst, strerror (errno));
+  while ((n = fread (buffer, 1, sizeof buffer, in)))
+    if (fwrite (buffer, n, 1, out) != 1)
+      fail (dst, strerror (errno));
+  if (ferror (in))
+    fail (src, strerror (errno));
+  fclose (in);
+  if (fclose (out))
+    fail (dst, strerror (errno));
+}
+
+
+/* Run a search for DESC and store the offsets of up to MAXHITS
+   matching blobs at OFFS.  Returns the number of hits.  If R_INDEX is
+   not NULL a flag telling whether the index was used is stored
+   there.  */
+static int
+search_offsets (const char *what, KEYBOX_SEARCH_DESC *desc,
+                off_t *offs, int *r_index)
+{
+  KEYBOX_HANDLE hd;
+  gpg_error_t err;
+  unsigned long skipped;
+  int n = 0;
+
+  hd = keybox_new_openpgp (token, 0);
+  if (!hd)
+    fail (what, "keybox_new_openpgp");
+  while (!(err = keybox_search (hd, desc, 1, 0, NULL, &skipped)))
+    {
+      if (n == MAXHITS)
+        fail (what, "too many hits");
+      offs[n++] = _keybox_get_blob_fileoffset (hd->found.blob);
+    }
+  if (err != -1)
+    fail (what, gpg_strerror (err));
+  if (r_index)
+    *r_index = !!hd->index.fp;
+  keybox_release (hd);
+  return n;
+}
+
+
+/* Search for DESC with and without the index and check that the
+   results are the same.  If EXPECT_INDEX is set the index must have
+   been used for the first search.  Returns the number of hits.  */
+static int
+check_search (const char *what, KEYBOX_SEARCH_DESC *desc, int expect_index)
+{
+  off_t offs1[MAXHITS], offs2[MAXHITS];
+  int n1, n2, used;
+
+  n1 = search_offsets (what, desc, offs1, &used);
+  if (used != expect_index)
+    fail (what, used? "index used" : "index not used");
+
+  /* Hide the index for the reference search.  */
+  if (rename (IDXNAME, SAVNAME) && errno != ENOENT)
+    fail (what, strerror (errno));
+  n2 = search_offsets (what, desc, offs2, NULL);
+  if (rename (SAVNAME, IDXNAME) && errno != ENOENT)
+    fail (what, strerror (errno));
+
+  if (n1 != n2 || memcmp (offs1, offs2, n1 * sizeof *offs1))
+    fail (what, "result differs from a full scan");
+  return n1;
+}
+
+
+/* Look up all keys of all blobs by fingerprint and long key ID, a
+   few mail addresses and some random key IDs.  Returns the number of
+   keys found.  */
+static int
+check_all (const char *what, int expect_index)
+{
+  static const char *mails[] =
+    { "<wk@gnupg.org>", "WK@G10CODE.com", "werner@eifzilla.de",
+      "nobody@example.org", NULL };
+  KEYBOX_HANDLE hd;
+  KEYBOX_SEARCH_DESC desc, q;
+  gpg_error_t err;
+  unsigned long skipped;
+  const unsigned char *buffer, *fpr;
+  size_t length, nkeys, keyinfolen, k;
+  int i, nfound = 0;
+
+  hd = keybox_new_openpgp (token, 0);
+  if (!hd)
+    fail (what, "keybox_new_openpgp");
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FIRST;
+  while (!(err = keybox_search (hd, &desc, 1, 0, NULL, &skipped)))
+    {
+      desc.mode = KEYDB_SEARCH_MODE_NEXT;
+      buffer = _keybox_get_blob_image (hd->found.blob, &length);
+      nkeys = buf16_to_uint (buffer + 16);
+      keyinfolen = buf16_to_uint (buffer + 18);
+      for (k=0; k < nkeys; k++)
+        {
+          fpr = buffer + 20 + k * keyinfolen;
+
+          memset (&q, 0, sizeof q);
+          q.mode = KEYDB_SEARCH_MODE_FPR;
+          memcpy (q.u.fpr, fpr, 20);
+          if (!check_search (what, &q, expect_index))
+            fail (what, "fingerprint not found");
+
+          memset (&q, 0, sizeof q);
+          q.mode = KEYDB_SEARCH_MODE_LONG_KID;
+          q.u.kid[0] = buf32_to_u32 (fpr + 12);
+          q.u.kid[1] = buf32_to_u32 (fpr + 16);
+          if (!check_search (what, &q, expect_index))
+            fail (what, "key ID not found");
+          nfound++;
+        }
+    }
+  if (err != -1)
+    fail (what, gpg_strerror (err));
+  keybox_release (hd);
+
+  for (i=0; mails[i]; i++)
+    {
+      memset (&q, 0, sizeof q);
+      q.mode = KEYDB_SEARCH_MODE_MAIL;
+      q.u.name = mails[i];
+      check_search (what, &q, expect_index);
+    }
+
+  for (i=0; i < 100; i++)
+    {
+      memset (&q, 0, sizeof q);
+      q.mode = KEYDB_SEARCH_MODE_LONG_KID;
+      gcry_create_nonce (q.u.kid, sizeof q.u.kid);
+      if (check_search (what, &q, expect_index))
+        fail (what, "random key ID found");
+    }
+
+  if (verbose)
+    printf ("%s: %d keys checked\n", what, nfound);
+  return nfound;
+}
+
+
+/* Lock and unlock the keybox which brings the index up to date.  */
+static void
+lock_unlock (const char *what)
+{
+  KEYBOX_HANDLE hd;
+  gpg_error_t err;
+
+  hd = keybox_new_openpgp (token, 0);
+  if (!hd)
+    fail (what, "keybox_new_openpgp");
+  err = keybox_lock (hd, 1, -1);
+  if (!err)
+    err = keybox_lock (hd, 0, 0);
+  if (err)
+    fail (what, gpg_strerror (err));
+  keybox_release (hd);
+}
+
+
+/* Return the number of records in the delta log of the index.  */
+static unsigned long
+index_ndelta (const char *what)
+{
+  FILE *fp;
+  unsigned char hdr[48];
+
+  fp = fopen (IDXNAME, "rb");
+  if (!fp || fread (hdr, sizeof hdr, 1, fp) != 1)
+    fail (what, "error reading the index header");
+  fclose (fp);
+  return buf32_to_ulong (hdr+40);
+}
+
+
+/* Return a handle with the N-th blob (counting from 0) found.  */
+static KEYBOX_HANDLE
+find_blob (const char *what, int n)
+{
+  KEYBOX_HANDLE hd;
+  KEYBOX_SEARCH_DESC desc;
+  gpg_error_t err;
+  unsigned long skipped;
+
+  hd = keybox_new_openpgp (token, 0);
+  if (!hd)
+    fail (what, "keybox_new_openpgp");
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FIRST;
+  do
+    {
+      err = keybox_search (hd, &desc, 1, 0, NULL, &skipped);
+      if (err)
+        fail (what, err == -1? "not enough blobs" : gpg_strerror (err));
+      desc.mode = KEYDB_SEARCH_MODE_NEXT;
+    }
+  while (n--);
+  return hd;
+}
+
+
+static void
+run_test (void)
+{
+  KEYBOX_HANDLE hd;
+  KEYBOXBLOB blob;
+  gpg_error_t err;
+  const unsigned char *buffer;
+  unsigned char *image;
+  size_t length, imagelen;
+  int nkeys, c, i, rebuilt;
+  unsigned long ndelta;
+  ino_t inode;
+  FILE *fp;
+  struct stat st, st2;
+  unsigned char rec[64];
+  unsigned char checksum[20], digest[20];
+  u32 *sigstatus, status;
+
+  /* Without an index all searches are done by a scan.  */
+  nkeys = check_all ("no index", 0);
+  if (!nkeys)
+    fail ("no index", "no keys");
+
+  /* Taking the lock builds the index.  */
+  lock_unlock ("build");
+  if (stat (IDXNAME, &st))
+    fail ("build", "no index created");
+  check_all ("build", 1);
+
+  /* Insert a copy of the first keyblock.  */
+  hd = find_blob ("insert", 0);
+  buffer = _keybox_get_blob_image (hd->found.blob, &length);
+  imagelen = buf32_to_uint (buffer + 12);
+  image = xtrymalloc (imagelen);
+  if (!image)
+    fail ("insert", strerror (errno));
+  memcpy (image, buffer + buf32_to_uint (buffer + 8), imagelen);
+  err = keybox_insert_keyblock (hd, image, imagelen);
+  if (err)
+    fail ("insert", gpg_strerror (err));
+  keybox_release (hd);
+  if (check_all ("insert", 1) <= nkeys)
+    fail ("insert", "inserted keys not found");
+
+  /* Replace the second keyblock by the first one which changes the
+     length of the blob.  */
+  hd = find_blob ("update", 1);
+  err = keybox_update_keyblock (hd, image, imagelen);
+  if (err)
+    fail ("update", gpg_strerror (err));
+  keybox_release (hd);
+  check_all ("update", 1);
+
+  /* Delete the first keyblock.  */
+  hd = find_blob ("delete", 0);
+  err = keybox_delete (hd);
+  if (err)
+    fail ("delete", gpg_strerror (err));
+  keybox_release (hd);
+  check_all ("delete", 1);
+
+  /* Storing the signature status words also updates the checksum.  */
+  hd = find_blob ("sigstatus", 0);
+  err = keybox_get_sigstatus (hd, &sigstatus);
+  if (err || !sigstatus || !sigstatus[0])
+    fail ("sigstatus", err? gpg_strerror (err) : "no signatures");
+  sigstatus[1] ^= 0x01020304;
+  status = sigstatus[1];
+  err = keybox_set_sigstatus (hd, sigstatus, checksum);
+  if (err)
+    fail ("sigstatus", gpg_strerror (err));
+  xfree (sigstatus);
+  keybox_release (hd);
+  hd = find_blob ("sigstatus", 0);
+  buffer = _keybox_get_blob_image (hd->found.blob, &length);
+  gcry_md_hash_buffer (GCRY_MD_SHA1, digest, buffer, length - 20);
+  if (memcmp (buffer + length - 20, digest, 20)
+      || memcmp (checksum, digest, 20))
+    fail ("sigstatus", "checksum not updated");
+  err = keybox_get_sigstatus (hd, &sigstatus);
+  if (err || !sigstatus || sigstatus[1] != status)
+    fail ("sigstatus", "status not stored");
+  xfree (sigstatus);
+  keybox_release (hd);
+  check_all ("sigstatus", 1);
+
+  /* Updates are appended to the delta log without replacing the index
+     file until the log is full and the index is rebuilt.  */
+  if (stat (IDXNAME, &st))
+    fail ("delta", strerror (errno));
+  inode = st.st_ino;
+  ndelta = index_ndelta ("delta");
+  for (i=0, rebuilt=0; i < 200; i++)
+    {
+      hd = find_blob ("delta", 0);
+      err = keybox_update_keyblock (hd, image, imagelen);
+      if (err)
+        fail ("delta", gpg_strerror (err));
+      keybox_release (hd);
+      if (stat (IDXNAME, &st))
+        fail ("delta", strerror (errno));
+      if (index_ndelta ("delta") > ndelta)
+        {
+          if (st.st_ino != inode)
+            fail ("delta", "index replaced");
+        }
+      else
+        rebuilt++;
+      ndelta = index_ndelta ("delta");
+      inode = st.st_ino;
+      if (i == 5 || i == 150)
+        check_all ("delta", 1);
+    }
+  if (!rebuilt)
+    fail ("delta", "delta log not compacted");
+  check_all ("delta", 1);
+
+  /* Replace the keybox by a copy behind our back.  This does not
+     change the size and is likely done within the same second but the
+     index must nevertheless be detected as stale.  */
+  copy_file (KBXNAME, KBXNAME ".tmp");
+  if (gnupg_rename_file (KBXNAME ".tmp", KBXNAME, NULL))
+    fail ("replace", "rename failed");
+  check_all ("replace", 0);
+  lock_unlock ("replace");
+  check_all ("replace", 1);
+
+  /* Rewrite the last byte in place; again without changing the
+     size.  */
+  fp = fopen (KBXNAME, "r+b");
+  if (!fp || fseek (fp, -1, SEEK_END) || (c = getc (fp)) == EOF
+      || fseek (fp, -1, SEEK_END) || putc (c, fp) == EOF || fclose (fp))
+    fail ("in place", strerror (errno));
+  check_all ("in place", 0);
+  lock_unlock ("in place");
+  check_all ("in place", 1);
+
+  /* A corrupt index is ignored.  */
+  fp = fopen (IDXNAME, "r+b");
+  if (!fp || fseek (fp, 4, SEEK_SET)
+      || putc (0x7f, fp) == EOF || fclose (fp))
+    fail ("corrupt", strerror (errno));
+  check_all ("corrupt", 0);
+  lock_unlock ("corrupt");
+  check_all ("corrupt", 1);
+
+  /* A blob truncated at the end of the file, as seen while another
+     process appends a blob, ends a search but is an error when
+     reading the entire keybox.  */
+  fp = fopen (KBXNAME, "ab");
+  if (!fp || fwrite ("\x00\x00\x00\x40\x02", 5, 1, fp) != 1 || fclose (fp))
+    fail ("truncated", strerror (errno));
+  check_all ("truncated", 0);
+  fp = fopen (KBXNAME, "rb");
+  if (!fp)
+    fail ("truncated", strerror (errno));
+  while (!(err = _keybox_read_blob (&blob, fp, NULL)))
+    _keybox_release_blob (blob);
+  fclose (fp);
+  if (gpg_err_code (err) != GPG_ERR_TOO_SHORT)
+    fail ("truncated", "truncated blob not detected");
+
+  /* Let the journal claim that this blob is the remains of an
+     interrupted append.  The next update must roll it back without
+     shrinking the file, which could crash readers having it mapped.  */
+  if (stat (KBXNAME, &st))
+    fail ("rollback", strerror (errno));
+  memset (rec, 0, sizeof rec);
+  memcpy (rec, "KBXj", 4);
+  rec[4] = 1;
+  _keybox_put_off (rec+16, st.st_size - 5);
+  ulongtobuf (rec+32, 0x40);
+  fp = fopen (KBXNAME ".jnl", "wb");
+  if (!fp || fwrite (rec, sizeof rec, 1, fp) != 1 || fclose (fp))
+    fail ("rollback", strerror (errno));
+  hd = find_blob ("rollback", 0);
+  err = keybox_insert_keyblock (hd, image, imagelen);
+  if (err)
+    fail ("rollback", gpg_strerror (err));
+  keybox_release (hd);
+  xfree (image);
+  if (stat (KBXNAME, &st2))
+    fail ("rollback", strerror (errno));
+  if (st2.st_size <= st.st_size)
+    fail ("rollback", "file shrunk");
+  lock_unlock ("rollback");
+  check_all ("rollback", 1);
+  fp = fopen (KBXNAME, "rb");
+  if (!fp || fseek (fp, st.st_size - 5, SEEK_SET)
+      || fread (rec, 5, 1, fp) != 1)
+    fail ("rollback", strerror (errno));
+  if (memcmp (rec, "\x00\x00\x00\x05\x00", 5))
+    fail ("rollback", "partial blob not turned into an empty blob");
+  rewind (fp);
+  while (!(err = _keybox_read_blob (&blob, fp, NULL)))
+    _keybox_release_blob (blob);
+  fclose (fp);
+  if (err != -1)
+    fail ("rollback", gpg_strerror (err));
+}
+
+
+int
+main (int argc, char **argv)
+{
+  const char *srcdir;
+  char *fname;
+  gpg_error_t err;
+
+  if (argc)
+    { argc--; argv++; }
+  if (argc && !strcmp (argv[0], "--verbose"))
+    verbose = 1;
+
+  gcry_control (GCRYCTL_DISABLE_SECMEM, 0);
+  gcry_control (GCRYCTL_INITIALIZATION_FINISHED, 0);
+
+  srcdir = getenv ("abs_top_srcdir");
+  if (!srcdir)
+    srcdir = "..";
+  fname = xstrconcat (srcdir, "/g10/t-keydb-keyring.kbx", NULL);
+  gnupg_remove (IDXNAME);
+  gnupg_remove (KBXNAME ".jnl");
+  copy_file (fname, KBXNAME);
+  xfree (fname);
+
+  err = keybox_register_file (KBXNAME, 0, &token);
+  if (err)
+    fail ("register", gpg_strerror (err));
+
+  run_test ();
+
+  gnupg_remove (IDXNAME);
+  gnupg_remove (KBXNAME ".jnl");
+  gnupg_remove (KBXNAME ".lock");
+  gnupg_remove (KBXNAME);
+  return 0;
+}
@@ -82,6 +82,12 @@ struct run_command_parm_s {
   assuan_context_t ctx;
 };
 
+struct prefetch_ocsp_parm_s {
+  ctrl_t ctrl;
+  assuan_context_t ctx;
+  certlist_t certs;
+};
+
 
 
 static gpg_error_t get_cached_cert (assuan_context_t ctx,
@@ -620,6 +626,112 @@ gpgsm_dirmngr_isvalid (ctrl_t ctrl,
 }
 
 
+
+/* Handle the TARGETCERT inquiry of CHECKOCSP_BATCH.  */
+static gpg_error_t
+inq_prefetch_cert (void *opaque, const char *line)
+{
+  struct prefetch_ocsp_parm_s *parm = opaque;
+  const char *s;
+  unsigned char fpr[20], fpr2[20];
+  certlist_t cl;
+  const unsigned char *der;
+  size_t derlen;
+
+  s = has_leading_keyword (line, "TARGETCERT");
+  if (!s || !unhexify_fpr (s, fpr))
+    {
+      log_error ("unsupported inquiry '%s'\n", line);
+      return gpg_error (GPG_ERR_ASS_UNKNOWN_INQUIRE);
+    }
+
+  for (cl = parm->certs; cl; cl = cl->next)
+    if (!memcmp (gpgsm_get_fingerprint (cl->cert, GCRY_MD_SHA1, fpr2, NULL),
+                 fpr, 20))
+      break;
+  if (!cl)
+    return assuan_send_data (parm->ctx, NULL, 0);
+
+  der = ksba_cert_get_image (cl->cert, &derlen);
+  if (!der)
+    return gpg_error (GPG_ERR_INV_CERT_OBJ);
+  return assuan_send_data (parm->ctx, der, derlen);
+}
+
+
+static gpg_error_t
+prefetch_ocsp_status_cb (void *opaque, const char *line)
+{
+  struct prefetch_ocsp_parm_s *parm = opaque;
+  const char *s;
+
+  if ((s = has_leading_keyword (line, "OCSP_STATUS")))
+    {
+      if (opt.verbose > 1)
+        log_info ("OCSP status from dirmngr: %s\n", s);
+    }
+  else if ((s = has_leading_keyword (line, "PROGRESS")))
+    {
+      if (gpgsm_status (parm->ctrl, STATUS_PROGRESS, s))
+        return gpg_error (GPG_ERR_ASS_CANCELED);
+    }
+  return 0;
+}
+
+
+/* Ask the dirmngr to run the OCSP checks for all certificates in
+   CERTS at once.  Dirmngr groups them by responder and caches the
+   responses; thus the checks done later by gpgsm_validate_chain for
+   each certificate won't need another round trip to the responder.
+   Errors are not returned because the real checks are done later
+   anyway.  */
+void
+gpgsm_dirmngr_prefetch_ocsp (ctrl_t ctrl, certlist_t certs)
+{
+  struct prefetch_ocsp_parm_s parm;
+  char line[ASSUAN_LINELENGTH];
+  certlist_t cl;
+  unsigned char fpr[20];
+  size_t n;
+  int rc;
+
+  if (!certs || start_dirmngr (ctrl))
+    return;
+
+  parm.ctrl = ctrl;
+  parm.ctx = dirmngr_ctx;
+  parm.certs = certs;
+
+  while (certs)
+    {
+      /* Put as many fingerprints into one command as fit.  */
+      strcpy (line, "CHECKOCSP_BATCH");
+      n = strlen (line);
+      for (cl = certs; cl && n + 41 < DIM (line); cl = cl->next)
+        {
+          line[n++] = ' ';
+          gpgsm_get_fingerprint (cl->cert, GCRY_MD_SHA1, fpr, NULL);
+          bin2hex (fpr, 20, line + n);
+          n += 40;
+        }
+      certs = cl;
+
+      rc = assuan_transact (dirmngr_ctx, line, NULL, NULL,
+                            inq_prefetch_cert, &parm,
+                            prefetch_ocsp_status_cb, &parm);
+      if (rc)
+        {
+          if (opt.verbose)
+            log_info ("prefetching OCSP status failed: %s\n",
+                      gpg_strerror (rc));
+          break;
+        }
+    }
+
+  release_dirmngr (ctrl);
+}
+
+
 
 /* Lookup helpers*/
 static gpg_error_t
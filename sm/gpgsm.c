@@ -748,6 +748,27 @@ set_cmd (enum cmd_and_opt_values *ret_cmd, enum cmd_and_opt_values new_cmd)
 }
 
 
+/* Helper to ask the dirmngr for the OCSP status of the certificates
+   given by NAMES in one go.  */
+static void
+prefetch_ocsp (ctrl_t ctrl, strlist_t names)
+{
+  strlist_t sl;
+  certlist_t certs = NULL;
+  ksba_cert_t cert;
+
+  for (sl = names; sl; sl = sl->next)
+    if (!gpgsm_find_cert (ctrl, sl->d, NULL, &cert))
+      {
+        gpgsm_add_cert_to_certlist (ctrl, cert, &certs, 0);
+        ksba_cert_release (cert);
+      }
+  if (certs && certs->next)
+    gpgsm_dirmngr_prefetch_ocsp (ctrl, certs);
+  gpgsm_release_certlist (certs);
+}
+
+
 /* Helper to add recipients to a list. */
 static void
 do_add_recipient (ctrl_t ctrl, const char *name,
@@ -1677,6 +1698,12 @@ main ( int argc, char **argv)
             }
         }
 
+      /* With OCSP checks enabled, ask the dirmngr for the status of
+         all recipients at once; their validation below will then be
+         answered from the dirmngr's cache.  */
+      if (ctrl.use_ocsp && !ctrl.offline && remusr && remusr->next)
+        prefetch_ocsp (&ctrl, remusr);
+
       /* Build the recipient list.  We first add the regular ones and then
          the encrypt-to ones because the underlying function will silently
          ignore duplicates and we can't allow keeping a duplicate which is
@@ -193,6 +193,202 @@ nW1ff9rt1YcTH9LiiE4EGBECAAYFAjnKLe0AEgkQ3uyMCd5BWw4HZUdQRwABAZeBAKDsa7tc
  (pipe:echo armored_key_8192)
  (pipe:gpg '(--import)))
 
+;; The same check for the 64 KiB buffers used for files: A key of
+;; exactly 65536 bytes made up of the above key and an attribute
+;; packet filled with zeros.  The radix64 of the zeros is a long run
+;; of 'A's which is constructed here instead of being spelled out.
+(define armored_key_65536_head "-----BEGIN PGP PUBLIC KEY BLOCK-----
+
+mQGiBDnKLQkRBACVlYh6HivoRjHzGedNpnYPISxImK3eFgt+qs/DD9rqhBOSUTYv
+mKfa1u7MW4XDc23YEoq3MyhtC35IL2RH6rmeIPz7ZVK5rUKWMqzf94n58gIkgdDZ
+gCcaDWImtZFSjji4TGhepaIz75iIbymvtnjr9d++fH/lFkz0HDjbOkXCfwCg9GeO
+jiWw1yBK8cO11acAjk+QpW8D/i8ftC1hV0iuh9mswYeG05pBbeeaOW4I2Ps4Icec
+pXhSyPaP1YiXKRqg9GX2brNgXwc3MEiqWn4UU407RzjrUNF4/d20Q7N2g2MDUDzB
+tmMytfT2LLKlj53Cq+p510yXESA7UHjiOpRrHPN9R69wHmHPsLPkdkB/jRTSM1gz
+QNtXA/96bRpfGMtCssfB449gBA/kYF14iXUM5KTF6YPSFhCCxPGNMoP1uxTk0NHv
+cYZe4zW2O6b/f9x5Lh15RI1ozWXakX6u3xEV3OqsvVTtXupe4MljHQlXYwMDI3MU
+zFtnHR+He1Bw5lkBVWtkV7rX2kX749J1EgADwlNEP1KFRdjqi7QhU3VzdW11IE9T
+QVdBIDxzdXN1bXVvQGRlYmlhbi5vcmc+iEYEEBECAAYFAjvNYPUACgkQU+WZW1FV
+MwrlTACfRigokAWd1OqYtcOt3v829fhNqYEAnR9uUslZr6B6RaW0z8/BZZuhGuLV
+iEYEEBECAAYFAjzGevgACgkQfGUzr9MtPXGWyACg066aP5SSkBHWqqYGGLZv9sVR
+MNIAoIEHBI1gq4rPJatYDdauNi6DUTkGiEYEEBECAAYFAjzGfBAACgkQ9D5yZjzI
+jAlTqACeJmtp9kpfljkARhfa3QTc2Q56WKkAoJmUchp+fAceVeFncpFeo6leM1Yh
+iEYEEBECAAYFAjzGftIACgkQ2QCnNZ2xmQQCegCgrdTsTWzaZk6gF+mtvIDwKsUx
+8gwAnRUbdDfOP0qL+83Bbz2r/IzPxjCEiEYEEBECAAYFAj2TRd0ACgkQFwU5DuZs
+m7BfXQCeNVG09VZ2VnuuWTRbgoANXGIyRb0AoI/giUU4DcIpAPbcoNV7PzCIreyv
+iEYEExECAAYFAj2508wACgkQ0pu//EQuY8KiUwCdHijK7Wkim2FUPU6i6KxwRH/k
+kFwAn1sOAWVOrLfRBfrNNQBANpbr5ufniEYEExECAAYFAj27vpsACgkQKb5dImj9
+VJ9m2wCcDeL9IkWpytXLPFhKCH9U9XhzPA4AnRjiY3y6AdNhbUgG/eS8Dumch0dn
+iEYEExECAAYFAj5qMCcACgkQO/YJxouvzb2O5QCghtxYfrIcbfTcBwvz9vG1sBHk
+QSkAnj3PMjN9dk1x1e4rUD9dS00JOoI0iFYEExECABYFAjnKLQkECwoEAwMVAwID
+FgIBAheAAAoJEN7sjAneQVsOUfcAoNgNxaeqMn5EWO2MkwVvVrLjWI2FAKDLnp19
+rJsU69OK7qHqfMeGWFXsQYheBBMRAgAWBQI5yi0JBAsKBAMDFQMCAxYCAQIXgAAS
+CRDe7IwJ3kFbDgdlR1BHAAEBUfcAoNgNxaeqMn5EWO2MkwVvVrLjWI2FAKDLnp19
+rJsU69OK7qHqfMeGWFXsQYiVAwUQOcrkWi2pLp/VI9wNAQE5mAP/WW9gshqGqWN/
+rWevpVKlzwqGSqMUq6E2K34dHrFdqd/WnY8ng5zAd66Ey3OLS5x9/+KI6W9MU5OI
+WmxOfrp7PxwqLrQH/BruPTHe9mZbkSyjWIS/V+W8/lYtzIUYTd0584+1x7cK6jah
+3mAdFu5t8fr1k3NyVXFH66dLrLF0bBu0JFN1c3VtdSBPU0FXQSA8c3VzdW11LW9A
+ZGViaWFuLm9yLmpwPohGBBARAgAGBQI7zWD4AAoJEFPlmVtRVTMKpEEAn0Oxl1tc
+dFf6LxiG2URD7kmHNm+iAJ9luLXjsYvo0OXlG1HlaFkFduhgp4hGBBARAgAGBQI8
+xnr7AAoJEHxlM6/TLT1xZlEAnjSeGhDQmbidMrjv4nOaWWDePjN7AKDXoHEhZbpU
+IJLJBgS4jZfuGtT3VYhGBBARAgAGBQI8xnwTAAoJEPQ+cmY8yIwJTjEAnAllI6IP
+XWJlHjtwqlHHwprrZG4eAJwMTl5Rbqu1lf+Lmz3N8QBrcTjnzYhGBBARAgAGBQI8
+xn7VAAoJENkApzWdsZkE6M4AoIpVj26AQLU6dtiJuLNMio8jKx/AAJ9n8VzpA4GF
+EL3Rg2eqNvuQC0bJp4hGBBARAgAGBQI9k0XgAAoJEBcFOQ7mbJuwsaUAnRIT1q2W
+kEgui423U/TVWLvSp2/aAKDG6xkJ+tdAmBnO5CcQcNswRmK4NIhGBBMRAgAGBQI9
+u76dAAoJECm+XSJo/VSfDJQAn0pZLQJhXUWzasjG2s2L8egRvvkmAJ4yTxKBoZbv
+truTf//8HwNLRs9Wv4hGBBMRAgAGBQI+ajAuAAoJEDv2CcaLr829bTYAoJzZa95z
+3Ty/rVS8Q5viOnicJwtOAKCGRKoaw3UZfpm6RLHZ4aHlYxCA0YhXBBMRAgAXBQI6
+aHxFBQsHCgMEAxUDAgMWAgECF4AACgkQ3uyMCd5BWw4I+ACfQhdkd2tu9qqWuWW7
+O1GsLpb359oAoLleotCCH4La5L5ZE/cPIde9+p8oiF8EExECABcFAjpofEUFCwcK
+AwQDFQMCAxYCAQIXgAASCRDe7IwJ3kFbDgdlR1BHAAEBCPgAn0IXZHdrbvaqlrll
+uztRrC6W9+faAKC5XqLQgh+C2uS+WRP3DyHXvfqfKLQlU3VzdW11IE9TQVdBIDxz
+dXN1bXUtb0Bnb2ZvcndhcmQub3JnPohGBBARAgAGBQI7zWD4AAoJEFPlmVtRVTMK
+aY0An0oI4Fwko9YsVWS+0M3/Tpc8FB2eAJ4oALojFgFkOWYT97dh8rTQW8BhyohG
+BBARAgAGBQI8xnr7AAoJEHxlM6/TLT1xsXcAoJV/9zoudxvWy+LwktkGyCB7aTx4
+AJ0Z8GWmx2/C4W2MtSyaUscY3X19uYhGBBARAgAGBQI8xnwTAAoJEPQ+cmY8yIwJ
+pxQAn3efnPpctMJFDQomRDbo7Q8rg6r4AKCq7LZmOaXvyrBF/JcYjOCLtYMPIIhG
+BBARAgAGBQI8xn7VAAoJENkApzWdsZkEiB0AnRQs0XjhpGOpR1lyEOuZkm2xxHPz
+AJ9Is3sG9UMOr+YS5V1GXXiFM29S3YhGBBARAgAGBQI9k0XgAAoJEBcFOQ7mbJuw
+jiAAn2wcQP9HreVLCSQruB1wnX/s79ZcAKCRcecLF+wiRo59JJvwtnxp2W24EYhG
+BBMRAgAGBQI9u76dAAoJECm+XSJo/VSftKUAoJQ/cYKqkyOLSOelU8eMplFiFJlP
+AJwK7B0HrN+tDmR7r8Hc0GrRrbAuvYhGBBMRAgAGBQI+ajAuAAoJEDv2CcaLr829
+PX0An2kfEs+3iR5qV35EQlCdL5ITZCSNAKCf8HErpT620TUhU6hI7vW5R3LNgohX
+BBMRAgAXBQI6aHxeBQsHCgMEAxUDAgMWAgECF4AACgkQ3uyMCd5BWw5HzwCdF8w3
+WjnwTvktko3ZB7IMmFLKvSQAn3GbioDBdV+j6xuhSI90osLMu1jgiF8EExECABcF
+AjpofF4FCwcKAwQDFQMCAxYCAQIXgAASCRDe7IwJ3kFbDgdlR1BHAAEBR88AnRfM
+N1o58E75LZKN2QeyDJhSyr0kAJ9xm4qAwXVfo+sboUiPdKLCzLtY4IkBIgQQAQIA
+DAUCQpGGggUDABJ1AAAKCRCXELibyletfJEKCACwYf5qY4J3RtHnC56HmGiW4GXa
+ahJpBQ1JcWmfx7CkTqJPQveg+KQ4pfLuJvZ8v4YqPZCxPOeK/ZhIO48UB4obcD8B
+ZdSkRA4QBamRp8iqcgrCot/LA5xQu9tivIhUJP/1dT6PmDy4DAV3FlgtHgED5niV
+ESDPfz3Gjff5iWWIs6dM3bycxoTcFWLz++578aOasoq9T8Tfua9H8UrouVz3+6TK
+xG0rGeb2jOQOQcbLCn3soU/Z60H3SvJYHzgxlS5bqIybrjo3sAnuus/kisrmNjeF
+fQBdl9v+GnK65D1tmBa1+6a95uHb+OG4eHzIXmvnDI4A1RhRKiZ/kpVsT7RViQEi
+BBABAgAMBQJCo1H8BQMAEnUAAAoJEJcQuJvKV618bJgIAMb9Xiv8ps3quJ9ByHhb
+IQtBOymH0fFiodsutPrcR2Af1lc/eh3Ik20Z9Ba3g5V6eUW+3sjpDsjKtI1CXuRq
+0Zgmze3hrUTMRmyrLoaHPocrqfj2G9mWy2OomLHMDurcJFQkSUJioI4Kxo+1NBZm
+ylPKUEeIEoP8UBJbKxf78dVh00ZUecwZcn9lLiZATycRQ0WTT1Yv1fI+tBmvSrpM
+Se+0k+JS+QigvINN5vUxaV1cN6mkREPYVm7oHzPCQ2C9NX1qcI/Wkc38ieZw1Sv9
+vyPCCL6MYd/2t1209a/ZKADaw5l+mhyWUqIT6SXPLxMDy0NvPhTKdDr17S5LOcKh
+wPqJASIEEAECAAwFAkK2pukFAwASdQAACgkQlxC4m8pXrXxvUQgAlfw6doD0JHtY
+iN9uCp2M1orLKS/zm66e9eiYPJwbim96KiwP98Ti5J+QO5hZdT3dhW2Avw5JPFiQ
+ukSc/rjT1YHRyuhZfXKhQhsjom5JmyFSdeIzjnz0PIM2qZaK4OfFihleQfQ8Y94w
+kPwYtkEXxpBQSClgXk6QJEql34sQexIDM7VsREwv/eIQ73RMquat4RZP1L3h4nj1
+UJu/X7ey3HVVo61gH0RIAR+Aadv59AAp//TkKUNIRCHOsIpFCXHjJsJxRvJKhiz3
+T6FhqFEQNF2tDJKHFV1FcLAIEZheuGOVfKNXgmvVATPHrJsg5HsZACg/aRFq9NL9
+FYskFyGcB4kBIgQQAQIADAUCQrdR0QUDABJ1AAAKCRCXELibyletfMNMB/49u9oQ
+zbmTtmHaoKuvou7OA6zmrfeu5X9vV1efZgItF78J7G19fVt8K3e6kn0KGYVL+FTb
+PdEbvrYTb+jfMkzrHooxQYSr0j8Baqfh2bMuZzuw2pVtgBUTYHoihNjQlv6GPtF7
+Y3CVWLUYXZ25yqY3Hzh9YneoH8bUVFZWxRFitqGB+noFpvm0YXrCJZ19BDNTQlx7
+5quAl4KTNOAxapsKaBrz/4PrnNbuwZBkzP5EEuEyjTM+6UBhxibXfdWKnZw6ky7k
+6tuUsc68qfQJBK6KBmVLflZ5nrd2N90Ueb0m3xfzdncBAZb43THGhi6XyZ4jvbMj
+vjm3MCGuUosYYbT6iQEiBBABAgAMBQJCyQLdBQMAEnUAAAoJEJcQuJvKV618Jz0I
+AKstm2VX39p4Lt4k55ZdOqXGCqHCFT5YYOVcnptx8dKTpHWQXpI2lUJBAcWz0IAX
+XFhyUbGpvS1E9T/pYF97RSSsQyTncQllmLbzy3fESVkGT9xpEvF7ZaK+61BKuWFp
+bKRdpy5wWakk0GRyF0156vxm7vQh4XI91TwXj7DAv6KYWdjnHcEB8O9jLw6RlD4Y
+6dKjb/v7vTY6dGmYYyOQVK+Bmr/8vVcNDf+tevExsytTu4FZtL9yp+yHODfHP5LZ
+k3mC7UGR/mUKFDYhuEzzIU5ozc6qUfC5ViGt2Hjg45i2T79WeSV0UHSE8c3JOgE3
+e7A71bQEUJygPC9S+RTuc8aJASIEEAECAAwFAkLMT3oFAwASdQAACgkQlxC4m8pX
+rXwoBgf+MEjA/hx7UMl6LHwheZ9qzH/4P1d4CU46SzoC/XEPqWGs9sJw0dKxEAnR
+ZgrG1WMPMl127bOHby5WWDa/xGi0siYM64F386SG0W42FD67vPK9mMPnCDIQ4xn5
+gGoqUUl8ZzFG0eNvXRg0bmMVmoZFvaUyf0uah/0dYCYplgAjJtmC3cmNuJ98PoYE
+VHMKKGtPW4fVf+TcN90HVjXUkr0GnAvRegb3ZXnte3GrOe3jOfXjfjZMyEM6a16F
+FuKHmykgfyX/I4tS9GqoxPZ6s0KARKn0YLZUuxxFL7i1VaGJR/9duyUc8T0BLc9O
+4TxNuvd1vd5UKVVmTL04fe0q1Bfu4okBIgQQAQIADAUCQtGX8QUDABJ1AAAKCRCX
+ELibyletfNEoCACtKtfWhAfkxLqPihQMbvwXTuSszG61XNYba41gTOpjADF2jQAQ
+2y8oilVyr5RgSvug8knik3EitSpBOOg0o5Y9NHF3e+85r27m8T5cP3g5GHAeugRF
+DqMXXioiAw9WoyvG9ruMY4caD3gAuogM4hB/3EMEHSlMylMrXLUtbGkQKqkLVJQn
+7V/3SVG8zfUyGb0lSFaGtHFa6LaIIuvJwkQYGMT/SiK7ISqPKOPD7kKRWhxjgcfz
+VthqGORnuQGi+316fdA+JzEYOI/gGdcZsbN/KrMSNQ0DOdSRIeiATy9M0fd+8QtU
+POCtaDKLYISSrm72xgnKbussJRxAPjxo66dPiQEiBBABAgAMBQJC42DIBQMAEnUA
+AAoJEJcQuJvKV6181SUIAL/PgZhrwepyFUhr+nlYvxeflrxgR9Yl1aNtTngcOYlF
+U273cs3XnkczIpkg4fVikY5s56Y42G8FNvqRu0M0eL5kJvYi50NNMQnf39GkZZp2
+LrL9bZ9n7ysWU5tiOJsxCBnaOiAg/p6vCUVN3NV+t8vRP1fHwPsd5tYEBqA/g4g1
+U0xJAG+JqJftSDRDLxfTZ16hBdHzlQ3opqMMmW5Mv005p4o+buh4HzQLmBHDE98B
+eZ7CpjYeXY23bu8oi0tvkcTjCEeBWrXWfA3pKSX5HH63nmG3ryKuP0tr1A2gTgs9
+JtLXnGFJUdVYULiQbU781wR6+9o/0h6NuCJDPmJMNmmJASIEEAECAAwFAkLmBFIF
+AwASdQAACgkQlxC4m8pXrXxYZwf/ah4IaTK3CbtqF1+4uz7VVRKemSaNg3jMKLey
+2simqAQs1JwqkLuwEgrwF7XiejfLAvX0/yFqJZkdtDFqeK0VrwOq3WIpfj7+g5B9
+YSW0CkasD0HUci/loXQiT9CN7PAe1vM5X4X3cqlXfC9tmU7fH7kc0kULxYHAfn96
+nZQklZS9aVecJ0H+pqMlPoDtxtxweNa7UJWAanO9kbPZ/xEdSlkuqzk1CK6ThURe
+dc2lCE+qobPpUZri1FEvMBjyXoQ9MyD6AFWfax9eNn1ZSRq9t2WpPyFSQmCvyGET
+HyvM2BBiFR6UAQUKdr+d4ZE09cR0wXpEtoqaNeJ8AidTEGkuLYkBIgQQAQIADAUC
+QuydlwUDABJ1AAAKCRCXELibyletfLsbB/0X/Jafv+v43U26W3HD5XdmHaNdxm7u
+thGzGGzATGcTAUd3/t8fyVFk2XgmUYxtz0wHUdM8GiyK0tpKBu6wqcbOnGkBlvC1
+m6Blxy+PvpJxQ2sK4ycN8ToEEn/7HCCJesS2fvDudXkvdvskXkxZprPWe7JTHNxj
+fvESUAbLLmSpNGflZnMAOfuQP0hFBQr4D5FEA+zMf7FtrwkBanXt6W65xxEIJ/23
+9ctCsRe8jIQ4LesYQN7hyX6x9bP9h3tEw6+OtvjYbMH+2B/3muNVac/9bYqi9rnu
+Gew9eAjmdmm0u8T57Iboy5mUDH2wjpRo6MGU1cHe4oZscW0f9TPE+6XbiQEiBBAB
+AgAMBQJC7UXaBQMAEnUAAAoJEJcQuJvKV618zbcH/RlUtrZSBcUafmhY29s9BYyc
+wWx/UoeJRIJmi852TguSGsoPuAYEGeaWWxCdSru2ibn7GPBXowM5u+4MqYqaRB69
+5sg/Ajxho2Djys3lV0TPeSIbyZ7cXbjoSDnSVw/NeWGKJLwbFVZPjjC7mcGIMhE1
+NGGxyRO5H1Z6GA8dEP3zR0rIivklN8KEngfyLRVvB5WYPBs+buaNF5HflsBXl2bO
+P5ueThcal1PSE4HNoQXz79t0Cw7kpsWy3FyFUVVRHPyvwVpJSdYjz8UrL4cD3Dj9
+SOPwa4AvM7WX+JXbPEIFxi+NA4R0TVxIZXJ/HX8AZj87RFxGYlTfP3GFFw+52QaJ
+ASIEEAECAAwFAkMHCEAFAwASdQAACgkQlxC4m8pXrXxGXQgAwFY5RYFHKcYkL9nD
+fblQDjXWIctj1rlP2yPsy8dKX579ejhdd8o0TGJf8AzYRaDEpffPf/ZvyfRltqKd
+979GzdAE3smkrGeDkPuUY2rEF6Eon549Tn7omGYNueDuO27QQ4zIs0k9h4m+pE6P
+xPTgC5BsEVF8Hrz647/XSTf2G0Wo11y/KBWGJ9BYvZ1YSxwmk5zicGF4sYNktO1Y
+l6CGS1ugP9zitCuwSiUm+gJrMCZ3am/D+Of+80Ui7e/V9yOOeyC7/gqQq4okPZbd
+VzJ3hiG2Y3eip19ewHYlYSiLoBW3rr3M3mKBTcbx+nLfVOTUHp8HdqxIyI782SaZ
+lpg0mYkBIgQQAQIADAUCQwhbTQUDABJ1AAAKCRCXELibyletfD7WB/9ydWuVT1De
+eL3UBqqeRRN+mt5DChdFeCjJhWcAjds8R6Z8Q9c+kpKEk+MeSevKaOAfiiM2JBtr
+uIxt1sfh/vVEFgjHP/M0sF1il6TwZEKqVn5c3ikMYCMXy75xheslCJoX7fi4jZut
+TO8+JqjVN+z+SYzeRrvQFcjJoIOLRnshh2XgUiXVf/xo/My+fM9rKnMHxF/75PaF
+VVz8cXz1X3jsuUOVLxnUZHsOaP9r1h3bq8uHJxkxPElVPbCuKLdCWrNOHHX6/+TA
+H9xohUvrBm6HXqbvO/aVGqf+Bip6oWSB6rSIe9+0GmXLRe4Ph3ekBvyGUJM/nFhN
+4hQHX69xZS7yiQEiBBABAgAMBQJDEOyRBQMAEnUAAAoJEJcQuJvKV618IlwIAIPb
+Wp20TBCnU0D3kE6JFqRaVKqNAFaJbmRn48qxX10NmHnBAluU1iJiUsVL2kOpvf2e
+yFUsX+sQfVJPzmWkUU2gED/+WZNkcmxPZ72FtJCshW30BcJnLjcRo8wv/6nhdEZ2
+JYNiBIFHxNQ6iiB7BzVpYsMp1l5tI6mIhbxYxMNETTMrb+hKNNAhxjrqiWxPNlrz
+w6TaKnBOE0Au/Asjz9n37hsPV5Q9xY3zXbff3yDirVkBC4l0Vc+U6drXXiFBjQj7
+7yt6AjTYUzBZY7UuGQ0W6o/6QF3KfiC3WAoFJL7SLujIaALkALs+lFzsu3CA9KoB
+X8Ca4hA7kzOP1H76VZKJASIEEAECAAwFAkMSPXoFAwASdQAACgkQlxC4m8pXrXx3
+cQf9GBPOXIrdbvUWIKTofiwftiy6j3MhKOszHkzR9quCu6aLu/aVvIA/avTZHjfj
+0EvYaQaSNMWplMiXi2UhkPHe4cgJYkbjmXEz16GtXYPZXGP1FubQ/RwQ7yQKaVtX
+SCgz+ZdR5tKhU5kruxAsVjlyKcQvST95wlqxLuvXzSCjPdWj4qBvkuEt6QADx8EY
+CafraIiHPRkKtAAiK0sXJSkLevXn3zAN6X6ngvZZiNQFvfWLFV8Rodz1vI4S6Af2
+MTSlVV9Vw0voJGprcsNDlB8k5B/Kl9LigeKdkFa8JVfwOQppAtU+Nq3pHjquEafZ
+rPVF9HWY0G0Szh5tOFEpVMF6g4kBIgQQAQIADAUCQxQ7iwUDABJ1AAAKCRCXELib
+yletfBVfB/9ydVsiBrNWLt0RwbAdMvHRceHz1twh+YeSnpr9Equ7aDMGqou4ppl/
+nTbnZIizdWn3dnRKt+vKY/puuPIT9kEVF7DlfBOcWBdLBvJz34eBt29BCFgvsfOS
+fwESMNKgquZmrraGpEvj4cSTOmW3DJPevB+6ajsN87BC5Qp2MjDGVkwT/Nj6R60p
+z/vmeSwl0BmzgthrBd+NfHSA116HEAF1V21/2UhA1hbkPKe40jWp6HK+GcXDC3+P
+ucTJeS8nX4LLQnWZJCr1QUbkaW6jHCw7i/pgCLfqBBdIh7xJE7d+6mut1AKtq2qU
+SpEM4qTvrR89DLz3OtNiMnr9hq7s5SyduQINBDnKLe0QCACUXlS4TkpEZZP06rJ2
+IVWZ2v7ZSPkLXjDRcC8h6ESQeZdBOSbddciiWYiHtGq2kyx+eoltwooP7EgJ9m35
+wn0FGV+5hpKbhSwz2Up9oYsSbexjx/hlopUYGCL4kgezCUWQsKypsitJChjV8MHg
+ePDQcF3ho+qK+0ZJeevbYKSZ9bLyzt/i3/b3Jnt0f8tsFP3Pdjel4N76DyQiTyuo
+OxzZJUJDKx1zr745PUMGcur79oAxuahUfPcRpuwcHFOB0yO7SwEY8fe268U5/AZr
+GwX+UAZhN7y2MMkU/xK/4BIDY5/W4NY3EX2APAYMRanI+mFW3idui8EEzpzKZ1K1
+8RODAAMFCACOAfgCjg7cgjZe58k0lAV0SANrJbMqgAT1M7v4f5mOf5e3B4si9z8M
+k1hx5cRXI3dDz/W4LPh8eONmMPjov42NOz8z84PksQBbnjlfZ5UCotPS2fZ2actJ
+PhYCho+a4iXwRm8BaXQ3DFa1CsWdXvkGsNIouuSkGoGh6+sEgAdP6JXanM9YGTQI
+Ny9Xsg9YOj1UWInSwRqUmJnjaNQhxJfj8j5W0uXixzkbKB+Is92mfo8Km3TAi9u0
+Ge/Acb5Cz0c5sqs+oWqcouaTS3o8/1n6CZVmvcHyGI0APiALwU84z7YT9srpXHrj
+iHo2oS3M4sLxl0nuSFqD6uiIFrg7yF+HiEYEGBECAAYFAjnKLe0ACgkQ3uyMCd5B
+Ww6XgQCg7Gu7XOzqnEcnCYR7v6rub5d0zwwAoOsQ9TNDYmVlnW1ff9rt1YcTH9Li
+iE4EGBECAAYFAjnKLe0AEgkQ3uyMCd5BWw4HZUdQRwABAZeBAKDsa7tc7OqcRycJ
+hHu/qu5vl3TPDACg6xD1M0NiZWWdbV9/2u3VhxMf0uLR/wAA3/r/AADf9WQA
+")
+
+(define armored_key_65536
+  (let ((body (make-string (* 1194 65) #\A)))
+    (let loop ((i 64))
+      (if (< i (string-length body))
+	  (begin
+	    (string-set! body i #\newline)
+	    (loop (+ i 65)))))
+    (string-append armored_key_65536_head body
+		   (make-string 24 #\A) "AA==\n"
+		   "=AKPy\n"
+		   "-----END PGP PUBLIC KEY BLOCK-----\n")))
+
+(info "Checking armored_key_65536")
+(pipe:do
+ (pipe:echo armored_key_65536)
+ (pipe:gpg '(--import)))
+
 (define nopad_armored_msg "-----BEGIN PGP MESSAGE-----
 Version: GnuPG v1.4.11-svn5139 (GNU/Linux)
 
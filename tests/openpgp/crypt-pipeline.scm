@@ -0,0 +1,82 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2026 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+(load (in-srcdir "tests" "openpgp" "defs.scm"))
+(setup-legacy-environment)
+
+;; Each message is encrypted and decrypted with and without
+;; --crypt-pipeline so that the output of the threaded code is also
+;; checked against the code running in a single thread.
+(define pipeline-options '(() (--crypt-pipeline)))
+
+;; With a 64 bit cipher a message without MDC is accepted.
+(define mdc-options '((--force-mdc) (--disable-mdc --cipher-algo 3DES)))
+
+(define (for-each-combination proc)
+  (for-each
+   (lambda (mdc)
+     (for-each
+      (lambda (enc)
+	(for-each
+	 (lambda (dec)
+	   (proc `(,@mdc ,@enc) dec))
+	 pipeline-options))
+      pipeline-options))
+   mdc-options))
+
+;; Without compression the length of a file is known in advance and
+;; thus packets with a fixed length are created.
+(for-each-p
+ "Checking --crypt-pipeline with fixed length packets"
+ (lambda (source)
+   (for-each-combination
+    (lambda (enc dec)
+      (tr:do
+       (tr:open source)
+       (tr:gpg "" `(--yes -z "0" --encrypt --recipient ,usrname2 ,@enc))
+       (tr:gpg "" `(--yes --decrypt ,@dec))
+       (tr:assert-identity source)))))
+ (append plain-files data-files))
+
+;; The length of data read from a pipe is not known and thus partial
+;; length packets are created.
+(for-each-p
+ "Checking --crypt-pipeline with partial length packets"
+ (lambda (source)
+   (for-each-combination
+    (lambda (enc dec)
+      (tr:do
+       (tr:open source)
+       (tr:pipe-do
+	(pipe:gpg `(--yes --encrypt --recipient ,usrname2 ,@enc))
+	(pipe:gpg `(--yes --decrypt ,@dec)))
+       (tr:assert-identity source)))))
+ (append plain-files data-files))
+
+(for-each-p
+ "Checking --crypt-pipeline with armored messages"
+ (lambda (source)
+   (for-each-combination
+    (lambda (enc dec)
+      (tr:do
+       (tr:open source)
+       (tr:gpg "" `(--yes --armor --encrypt --recipient ,usrname2 ,@enc))
+       (tr:gpg "" `(--yes --decrypt ,@dec))
+       (tr:assert-identity source)))))
+ (append plain-files data-files))
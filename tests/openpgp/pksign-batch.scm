@@ -0,0 +1,111 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2026 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+(load (in-srcdir "tests" "openpgp" "defs.scm"))
+(setup-environment)
+
+;; Run the gpg-connect-agent COMMANDS and return the output.
+(define (connect-agent . commands)
+  (call-popen `(,(tool 'gpg-connect-agent))
+	      (apply string-append
+		     (map (lambda (command) (string-append command "\n"))
+			  commands))))
+
+(define (assert-no-error response)
+  (if (string-contains? response "ERR")
+      (fail "Unexpected error from the agent:" response)))
+
+;; Ed25519 signatures are deterministic and thus a signature created
+;; by PKSIGN_BATCH is the same as one created by PKSIGN.
+(define uid "Batch <batch@invalid.example.net>")
+(info "Creating an unprotected Ed25519 key...")
+(call-check `(,@GPG --passphrase "" --pinentry-mode loopback
+		    --quick-generate-key ,uid future-default sign never))
+(define keygrip
+  (:fpr (assoc "grp" (gpg-with-colons `(--with-keygrip -K ,uid)))))
+
+;; Three SHA-256 sized hash values and their hex encodings.
+(define hashes (map (lambda (c) (make-string 32 c)) '(#\a #\b #\c)))
+(define (hexify hash)
+  (apply string-append
+	 (map (lambda (c) (number->string (char->integer c) 16))
+	      (string->list hash))))
+
+(define (write-hashes name hashes)
+  (call-with-binary-output-file
+   name
+   (lambda (port)
+     (for-each (lambda (hash) (display hash port)) hashes))))
+
+(write-hashes "hashvals" hashes)
+(write-hashes "hashval" (list (car hashes)))
+
+(info "Checking that PKSIGN_BATCH creates the same signatures as PKSIGN...")
+(assert-no-error
+ (apply connect-agent
+	`(,(string-append "SIGKEY " keygrip)
+	  "/datafile batch.sig"
+	  "/definqfile HASHVALS hashvals"
+	  "PKSIGN_BATCH --hash=sha256"
+	  "/datafile single.sig"
+	  ,@(apply append
+		   (map (lambda (hash)
+			  (list (string-append "SETHASH --hash=sha256 "
+					       (hexify hash))
+				"PKSIGN"))
+			hashes))
+	  "/datafile"
+	  "/bye")))
+(unless (file=? "batch.sig" "single.sig")
+	(fail "PKSIGN_BATCH and PKSIGN created different signatures"))
+(unless (string-contains? (call-with-input-file "batch.sig" read-all)
+			  "(7:sig-val")
+	(fail "PKSIGN_BATCH did not create signatures"))
+
+(info "Checking PKSIGN_BATCH with a single hash value...")
+(assert-no-error
+ (connect-agent (string-append "SIGKEY " keygrip)
+		"/definqfile HASHVALS hashval"
+		"PKSIGN_BATCH --hash=sha256"
+		"/bye"))
+
+(info "Checking that PKSIGN_BATCH rejects a bad list of hash values...")
+(unless (string-contains?
+	 (connect-agent (string-append "SIGKEY " keygrip)
+			"/definqfile HASHVALS hashvals"
+			"PKSIGN_BATCH --hash=sha1"
+			"/bye")
+	 "ERR")
+	(fail "PKSIGN_BATCH accepted hash values of the wrong length"))
+
+(info "Checking that PKSIGN_BATCH honors use-cache-for-signing...")
+(unless (string-contains?
+	 (connect-agent "OPTION use-cache-for-signing=0"
+			(string-append "SIGKEY " keygrip)
+			"/definqfile HASHVALS hashvals"
+			"PKSIGN_BATCH --hash=sha256"
+			"/bye")
+	 "ERR")
+	(fail "PKSIGN_BATCH signed several hashes without using the cache"))
+(assert-no-error
+ (connect-agent "OPTION use-cache-for-signing=0"
+		(string-append "SIGKEY " keygrip)
+		"/definqfile HASHVALS hashval"
+		"PKSIGN_BATCH --hash=sha256"
+		"/bye"))
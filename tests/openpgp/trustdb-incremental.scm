@@ -0,0 +1,177 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2026 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+;; Changes to a single key only schedule that key for revalidation
+;; and --check-trustdb then walks the part of the web of trust
+;; reachable from it.  After each change the validities computed this
+;; way are compared with those of a full check done from scratch in a
+;; fresh home directory.
+
+(load (in-srcdir "tests" "openpgp" "defs.scm"))
+(load (with-path "time.scm"))
+(setup-environment)
+
+(define GPGTIME 1480943782)
+
+;; The faked time offset and the marginals needed for all following
+;; commands.
+(define now 0)
+(define marginals "2")
+
+;; Build a gpg command line using the PGP trust model and the current
+;; settings.  HOMEDIR may be #f to use the test environment.
+(define (gpg-command homedir)
+  `(,(tool 'gpg) --no-permission-warning --batch
+    ,@(if homedir `(--homedir ,homedir) '())
+    --trust-model=pgp --marginals-needed ,marginals --completes-needed "1"
+    ,(string-append "--faked-system-time="
+		    (number->string (+ GPGTIME now)))))
+
+(define (gpg . args)
+  (call-check `(,@(gpg-command #f) ,@args)))
+
+(setenv "PINENTRY_USER_DATA" "test" #t)
+
+(define (make-key name)
+  (gpg '--quick-generate-key name 'future-default 'default 'never)
+  (:fpr (assoc "fpr" (map (lambda (line) (string-split line #\:))
+			  (string-split-newlines
+			   (call-popen `(,@(gpg-command #f) --with-colons
+					 -k ,(string-append "=" name)) ""))))))
+
+(info "Creating keys...")
+(define owner (make-key "Owner <owner@invalid.example.net>"))
+(define alice (make-key "Alice <alice@invalid.example.net>"))
+(define bob (make-key "Bob <bob@invalid.example.net>"))
+(define carol (make-key "Carol <carol@invalid.example.net>"))
+(define dave (make-key "Dave <dave@invalid.example.net>"))
+(define all-keys (list owner alice bob carol dave))
+
+;; Set the ownertrust of KEY using the key edit menu, which only
+;; schedules KEY for revalidation.  VALUE is the menu choice: 1 = don't
+;; know, 2 = never, 3 = marginal, 4 = full.
+(define (set-ownertrust key value)
+  (call-popen `(,@(gpg-command #f) --command-fd "0" --edit-key ,key trust quit)
+	      (string-append value "\n")))
+
+(define (certify signer key)
+  (gpg '-u signer '--quick-sign-key key))
+
+;; Revoke the certification on KEY made by the Nth signature prompted
+;; for by the revsig command, counting the self-signature.
+(define (revoke-certification key n count)
+  (call-popen `(,@(gpg-command #f) --command-fd "0" --edit-key ,key revsig save)
+	      (let loop ((i 0) (acc ""))
+		(if (= i count)
+		    (string-append acc "y\n0\n\ny\n")
+		    (loop (+ i 1)
+			  (string-append acc (if (= i n) "y\n" "n\n")))))))
+
+;; Return the validities of the keys and user ids as listed in
+;; HOMEDIR without updating the trustdb.
+(define (validities homedir)
+  (map (lambda (key)
+	 (cons key
+	       (map (lambda (x) (list (car x) (cadr x)))
+		    (filter (lambda (x) (member (car x) '("pub" "uid")))
+			    (map (lambda (line) (string-split line #\:))
+				 (string-split-newlines
+				  (call-popen `(,@(gpg-command homedir)
+						--no-auto-check-trustdb
+						--with-colons -k ,key) "")))))))
+       all-keys))
+
+(define (validity key)
+  (cadr (cadr (assoc key (validities #f)))))
+
+;; Validate the web of trust incrementally and compare the result with
+;; a full check of the same keys and ownertrust values.
+(define (check-against-full-check what)
+  (info "Checking" what)
+  (gpg '--yes '--check-trustdb)
+  (let ((incremental (validities #f))
+	(home (mkdtemp)))
+    (finally (unlink-recursively home)
+      (let ((keys (path-join home "keys"))
+	    (ownertrust (call-popen `(,@(gpg-command #f) --export-ownertrust)
+				    "")))
+	(call-check `(,@(gpg-command #f) --output ,keys --export ,@all-keys))
+	(call-check `(,@(gpg-command home) --import ,keys))
+	(call-popen `(,@(gpg-command home) --import-ownertrust) ownertrust)
+	(call-check `(,@(gpg-command home) --yes --check-trustdb))
+	(let ((full (validities home)))
+	  (unless (equal? incremental full)
+		  (fail what ": incremental check yields" incremental
+			"but a full check yields" full)))))))
+
+;; Owner is ultimately trusted and introduces Alice and Dave.  Both are
+;; marginally trusted and together introduce Carol.  Alice alone
+;; introduces Bob.
+(for-each (lambda (key) (set-ownertrust key "3")) (list alice dave))
+(for-each (lambda (key) (set-ownertrust key "1")) (list bob carol))
+(certify owner alice)
+(certify owner dave)
+(certify alice carol)
+(certify dave carol)
+(certify alice bob)
+(check-against-full-check "the initial web of trust")
+(assert (string=? "f" (validity carol)))
+(assert (string=? "m" (validity bob)))
+
+(certify owner bob)
+(check-against-full-check "an added certification")
+(assert (string=? "f" (validity bob)))
+
+;; Prompted for are the self-signature, Alice's and Owner's
+;; certification.  A revocation needs to be newer than the signature
+;; it revokes.
+(set! now (minutes->seconds 1))
+(revoke-certification bob 2 3)
+(check-against-full-check "a revoked certification")
+(assert (string=? "m" (validity bob)))
+
+(set-ownertrust alice "4")
+(check-against-full-check "a raised ownertrust")
+(assert (string=? "f" (validity bob)))
+
+(set-ownertrust alice "2")
+(check-against-full-check "a lowered ownertrust")
+(assert (string=? "q" (validity bob)))
+(assert (string=? "m" (validity carol)))
+
+(set-ownertrust alice "3")
+(check-against-full-check "a restored ownertrust")
+(assert (string=? "f" (validity carol)))
+
+(set! marginals "3")
+(check-against-full-check "a higher number of marginals needed")
+(assert (string=? "m" (validity carol)))
+
+(set! marginals "2")
+(check-against-full-check "a lower number of marginals needed")
+(assert (string=? "f" (validity carol)))
+
+(gpg '--quick-set-expire dave "1d")
+(check-against-full-check "a new expiration date")
+(assert (string=? "f" (validity carol)))
+
+(set! now (days->seconds 2))
+(check-against-full-check "an expired key")
+(assert (string=? "e" (validity dave)))
+(assert (string=? "m" (validity carol)))